@@ -1,25 +1,21 @@
 #include <stdio.h>
 #include <ctype.h>
+#include <errno.h>
 #include <string.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 #include <signal.h>
 #include <pwd.h>
+#include <sys/select.h>
+#include <sys/signalfd.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include "../src/lab.h"
 
-static void explain_waitpid(int status)
-{
-    if (WIFSIGNALED(status)) {
-        fprintf(stderr, "Process terminated by signal %d\n", WTERMSIG(status));
-    } else if (WIFEXITED(status)) {
-        fprintf(stderr, "Process exited normally with status %d\n", WEXITSTATUS(status));
-    }
-}
 
 // Handles Ctrl+C signal to prevent exiting the shell
 void handle_signal(int signo) {
@@ -31,86 +27,232 @@ void handle_signal(int signo) {
     }
 }
 
+// readline's callback interface gives the line handler no user data
+static struct shell sh;
+static bool done;
+
+// Render the prompt template for the next line
+static void update_prompt(void)
+{
+    free(sh.prompt);
+    sh.prompt = prompt_render(&sh.prompt_template, &sh);
+    rl_set_prompt(sh.prompt);
+}
+
+// Runs one line the user entered, called by readline when a line is ready
+static void handle_line(char *raw)
+{
+    if (!raw) {
+        // EOF (Ctrl+D) ends the shell
+        done = true;
+        return;
+    }
+
+    // History gets the line the way the user typed it
+    char *line = trim_white(raw);
+    if (*line) {
+        add_history(line);
+        if (hist_add(&sh.history, line) == -1) perror("history");
+        hist_index_update(&sh.history);
+        sh_exec_line(&sh, line);
+    }
+    free(raw);
+    update_prompt();
+}
+
+// Entries readline gets from the history file at startup
+#define HIST_LOAD 1000
+
+static void load_history_line(const char *line, void *arg)
+{
+    UNUSED(arg);
+    add_history(line);
+}
+
+// Ctrl-R: replace the line with the newest entry containing what was
+// typed. Pressing it again steps to the next older match.
+static int search_history(int count, int key)
+{
+    UNUSED(count);
+    UNUSED(key);
+    static char *query;
+    static size_t before;
+    if (rl_last_func != search_history) {
+        free(query);
+        query = strdup(rl_line_buffer);
+        before = SIZE_MAX;
+    }
+    ssize_t id = query ? hist_search(&sh.history, query, before) : -1;
+    if (id < 0) {
+        rl_ding();
+        return 0;
+    }
+    before = id;
+    rl_replace_line(hist_entry(&sh.history, id, NULL), 0);
+    rl_point = rl_end;
+    return 0;
+}
+
+// Completions gathered for readline, slot 0 is left for the common prefix
+struct matches {
+    char **v;
+    size_t n;
+    size_t cap;
+};
+
+static void add_match(const char *name, void *arg)
+{
+    struct matches *m = arg;
+    if (m->n + 2 >= m->cap) {
+        size_t cap = m->cap ? m->cap * 2 : 16;
+        char **v = realloc(m->v, cap * sizeof(*v));
+        if (!v) return;
+        m->v = v;
+        m->cap = cap;
+    }
+    char *copy = strdup(name);
+    if (copy) m->v[++m->n] = copy;
+}
+
+// Tab on the command word of a line or pipeline stage completes from the
+// executables on PATH. Anything else is left to filename completion.
+static char **complete_command(const char *text, int start, int end)
+{
+    UNUSED(end);
+    int i = start;
+    while (i > 0 && (rl_line_buffer[i - 1] == ' ' || rl_line_buffer[i - 1] == '\t')) i--;
+    if ((i > 0 && rl_line_buffer[i - 1] != '|') || strchr(text, '/')) return NULL;
+    const struct cmd_index *x = cmd_hash_index(&sh.hash);
+    if (!x) return NULL;
+
+    struct matches m = {0};
+    cmd_index_complete(x, text, add_match, &m);
+    rl_attempted_completion_over = 1;
+    if (!m.n) {
+        free(m.v);
+        return NULL;
+    }
+    // The names come sorted, so the first and last bound the common prefix
+    size_t common = 0;
+    while (m.v[1][common] && m.v[1][common] == m.v[m.n][common]) common++;
+    m.v[0] = strndup(m.v[1], common);
+    m.v[m.n + 1] = NULL;
+    return m.v;
+}
+
+// Reap children after a SIGCHLD and report finished background jobs
+// without disturbing the line being edited
+static void handle_sigchld(int sfd)
+{
+    struct signalfd_siginfo info;
+    while (read(sfd, &info, sizeof(info)) == sizeof(info))
+        ;
+    job_reap(&sh.jobs);
+    if (job_has_news(&sh.jobs)) {
+        rl_clear_visible_line();
+        fflush(rl_outstream);
+        job_notify(&sh.jobs, stderr);
+        rl_forced_update_display();
+    }
+}
+
 int main(int argc, char *argv[])
 {
-    parse_args(argc, argv);
-    struct shell sh = {0};  
+    parse_args(&sh, argc, argv);
     sh_init(&sh);
 
+    // Batch mode: no readline, history or prompt
+    if (!sh.shell_is_interactive) {
+        if (sh.command) {
+            char *cmd = strdup(sh.command);
+            script_run_buffer(&sh, cmd, strlen(cmd));
+            free(cmd);
+        } else if (sh.script) {
+            sh.last_status = script_run_file(&sh, sh.script);
+        } else {
+            script_run_fd(&sh, STDIN_FILENO);
+        }
+        int status = sh.last_status;
+        sh_destroy(&sh);
+        return status;
+    }
+
     // Ignore signals in the shell process to prevent accidental termination
+    // SIGTTOU is ignored so the shell can take the terminal back
     struct sigaction sa;
     sa.sa_handler = SIG_IGN;
     sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
     sigaction(SIGINT, &sa, NULL);
     sigaction(SIGQUIT, &sa, NULL);
     sigaction(SIGTSTP, &sa, NULL);
+    sigaction(SIGTTIN, &sa, NULL);
+    sigaction(SIGTTOU, &sa, NULL);
+
+    // SIGCHLD is only ever consumed through the signalfd
+    sigset_t chld;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, NULL);
+    int sfd = signalfd(-1, &chld, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sfd == -1) {
+        perror("signalfd");
+        exit(EXIT_FAILURE);
+    }
 
-    char *line;
     using_history();
+    // Only the newest entries are read, the rest of the file stays on disk
+    char *histfile = hist_default_path();
+    if (histfile) {
+        if (hist_open(&sh.history, histfile) == -1) {
+            fprintf(stderr, "%s: %s, history will not be saved\n", histfile, strerror(errno));
+        } else {
+            hist_recent(&sh.history, HIST_LOAD, load_history_line, NULL);
+            // Search the whole file rather than what readline holds
+            rl_bind_keyseq("\\C-r", search_history);
+        }
+        free(histfile);
+    }
+    char *jumpfile = jump_default_path();
+    if (jumpfile) {
+        if (jump_open(&sh.jumps, jumpfile) == -1) {
+            fprintf(stderr, "%s: %s, directories will not be recorded\n", jumpfile, strerror(errno));
+        }
+        free(jumpfile);
+    }
+    rl_attempted_completion_function = complete_command;
+    free(sh.prompt);
+    sh.prompt = prompt_render(&sh.prompt_template, &sh);
+    rl_callback_handler_install(sh.prompt, handle_line);
 
-    while ((line = readline(sh.prompt))) {
-        // do nothing on blank lines don't save history or attempt to exec
-        line = trim_white(line);
-        if (!*line) {
-            free(line);
-            continue;
+    while (!done) {
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(STDIN_FILENO, &fds);
+        FD_SET(sfd, &fds);
+        int nfds = (sfd > STDIN_FILENO ? sfd : STDIN_FILENO) + 1;
+        // Only there once a prompt segment is being computed in the background
+        int pfd = sh.prompt_template.worker ? sh.prompt_template.notify_fd : -1;
+        if (pfd != -1) {
+            FD_SET(pfd, &fds);
+            if (pfd >= nfds) nfds = pfd + 1;
         }
-        add_history(line);
-        char **cmd = cmd_parse(line);
-        if (!do_builtin(&sh, cmd))
-        {
-            pid_t pid = fork();
-            if (pid == 0)
-            {
-                /*  This is the child process  */
-                pid_t child = getpid();
-                setpgid(child, child);
-                tcsetpgrp(sh.shell_terminal, child);
-                signal(SIGINT, SIG_DFL);
-                signal(SIGQUIT, SIG_DFL);
-                signal(SIGTSTP, SIG_DFL);
-                signal(SIGTTIN, SIG_DFL);
-                signal(SIGTTOU, SIG_DFL);
-                execvp(cmd[0], cmd);
-                exit(EXIT_FAILURE);
-            }
-            else if (pid < 0)
-            {
-                // If fork failed we are in trouble!
-                perror("fork return < 0 Process creation failed!");
-                abort();
-            }
-            /*
-            This is in the parent put the child process into its own
-            process group and give it control of the terminal
-            to avoid a race condition
-            */
-            // printf("shell:%d , child%d\n",sh.shell_pgid, pid);
-            setpgid(pid, pid);
-            tcsetpgrp(sh.shell_terminal, pid);
-            int status;
-            int rval = waitpid(pid, &status, 0);
-            if (rval == -1)
-            {
-                fprintf(stderr, "Wait pid failed with -1\n");
-                explain_waitpid(status);
-            }
-            cmd_free(cmd);
-            // get control of the shell
-            tcsetpgrp(sh.shell_terminal, sh.shell_pgid);
+        if (select(nfds, &fds, NULL, NULL, NULL) == -1) {
+            if (errno == EINTR) continue;
+            perror("select");
+            break;
         }
-        else {
-            if (strcmp(cmd[0], "exit") == 0) {  // Exit shell if "exit" is entered
-                cmd_free(cmd);
-                free(line);
-                break;
-            }
-            cmd_free(cmd);
-            free(line);
-            continue;
+        if (FD_ISSET(sfd, &fds)) handle_sigchld(sfd);
+        if (pfd != -1 && FD_ISSET(pfd, &fds) && prompt_collect(&sh.prompt_template)) {
+            // A slow segment came in, patch it into the prompt on screen
+            update_prompt();
+            rl_redisplay();
         }
+        if (FD_ISSET(STDIN_FILENO, &fds)) rl_callback_read_char();
     }
 
+    rl_callback_handler_remove();
+    close(sfd);
     sh_destroy(&sh);
     return 0;
 }
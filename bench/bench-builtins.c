@@ -0,0 +1,83 @@
+/*
+ * Builtin vs external command benchmark. Runs the same command lines
+ * through sh_exec_line once as a builtin and once by the path of the
+ * system binary, which the shell has to start as a process, and reports
+ * ns/op plus how many processes each line started.
+ *
+ * usage: bench-builtins [-n iterations] [-j results.json]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "harness/bench.h"
+#include "../src/lab.h"
+
+struct pair {
+    const char *name;
+    const char *builtin;
+    const char *external;
+};
+
+static const struct pair pairs[] = {
+    { "true",   "true",                          "/bin/true" },
+    { "echo",   "echo hello world > /dev/null",  "/bin/echo hello world > /dev/null" },
+    { "printf", "printf '%s=%d\\n' x 42 > /dev/null", "/usr/bin/printf '%s=%d\\n' x 42 > /dev/null" },
+    { "test",   "[ -d / -a abc = abc ]",         "/usr/bin/[ -d / -a abc = abc ]" },
+    { "pwd",    "pwd > /dev/null",               "/bin/pwd > /dev/null" },
+};
+
+static double run(struct shell *sh, const char *cmd, int iterations) {
+    size_t len = strlen(cmd) + 1;
+    char *line = malloc(len);
+    double start = bench_now_ns();
+    for (int i = 0; i < iterations; i++) {
+        // sh_exec_line parses in place, so every run needs a fresh copy
+        memcpy(line, cmd, len);
+        sh_exec_line(sh, line);
+    }
+    double ns = bench_now_ns() - start;
+    free(line);
+    return ns;
+}
+
+static void measure(struct shell *sh, const char *name, const char *kind, const char *cmd, int iterations) {
+    run(sh, cmd, iterations / 10 + 1); // warm up
+    size_t allocs = bench_alloc_count, procs = bench_process_count;
+    double ns = run(sh, cmd, iterations);
+    char label[64];
+    snprintf(label, sizeof(label), "builtins/%s/%s", name, kind);
+    bench_report(label, iterations, ns, bench_alloc_count - allocs);
+    snprintf(label, sizeof(label), "builtins/%s/%s/procs", name, kind);
+    bench_report_value(label, "procs/op", (double)(bench_process_count - procs) / iterations);
+}
+
+int main(int argc, char **argv) {
+    int iterations = 2000;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:j:")) != -1) {
+        switch (opt) {
+            case 'n': iterations = atoi(optarg); break;
+            case 'j': break; // handled by bench_begin
+            default:
+                fprintf(stderr, "Usage: %s [-n iterations] [-j results.json]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    bench_begin("builtins", argc, argv);
+    struct shell sh = {0};
+    sh.shell_is_interactive = 0;
+    for (size_t i = 0; i < sizeof(pairs) / sizeof(pairs[0]); i++) {
+        measure(&sh, pairs[i].name, "builtin", pairs[i].builtin, iterations);
+        // Processes are slow, so the external side runs a tenth as often
+        char path[64];
+        snprintf(path, sizeof(path), "%.*s", (int)strcspn(pairs[i].external, " "), pairs[i].external);
+        if (access(path, X_OK) == 0) {
+            measure(&sh, pairs[i].name, "external", pairs[i].external, iterations / 10 + 1);
+        }
+    }
+    job_table_destroy(&sh.jobs);
+    cmd_hash_destroy(&sh.hash);
+    return bench_end();
+}
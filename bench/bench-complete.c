@@ -0,0 +1,112 @@
+/*
+ * Command completion benchmark. Fills a few PATH directories with 10k
+ * executables, then measures building the completion index, a Tab press
+ * (refresh plus prefix walk) and the refresh after one directory changed.
+ *
+ * usage: bench-complete [-n executables] [-j results.json]
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "harness/bench.h"
+#include "../src/lab.h"
+
+#define NDIRS 4
+
+static void count_name(const char *name, void *arg) {
+    *(size_t *)arg += name[0] != '\0';
+}
+
+// What the shell does on Tab: refresh, then walk the names with the prefix
+static double tab(struct cmd_index *x, const char *path_env, const char *prefix, int reps) {
+    size_t seen = 0;
+    double start = bench_now_ns();
+    for (int i = 0; i < reps; i++) {
+        cmd_index_refresh(x, path_env);
+        cmd_index_complete(x, prefix, count_name, &seen);
+    }
+    return bench_now_ns() - start;
+}
+
+int main(int argc, char **argv) {
+    int files = 10000;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:j:")) != -1) {
+        switch (opt) {
+            case 'n': files = atoi(optarg); break;
+            case 'j': break; // handled by bench_begin
+            default:
+                fprintf(stderr, "Usage: %s [-n executables] [-j results.json]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    char dirs[NDIRS][32];
+    char path_env[NDIRS * 33] = "";
+    char path[96];
+    for (int d = 0; d < NDIRS; d++) {
+        snprintf(dirs[d], sizeof(dirs[d]), "/tmp/bench-complete-XXXXXX");
+        if (!mkdtemp(dirs[d])) {
+            perror("mkdtemp");
+            return EXIT_FAILURE;
+        }
+        if (d) strcat(path_env, ":");
+        strcat(path_env, dirs[d]);
+    }
+    for (int i = 0; i < files; i++) {
+        snprintf(path, sizeof(path), "%s/cmd%05d", dirs[i % NDIRS], i);
+        close(open(path, O_WRONLY | O_CREAT, 0755));
+    }
+
+    bench_begin("complete", argc, argv);
+    struct cmd_index x = {0};
+    char name[64];
+    size_t allocs = bench_alloc_count;
+    double start = bench_now_ns();
+    cmd_index_refresh(&x, path_env);
+    snprintf(name, sizeof(name), "complete/build_%d", files);
+    bench_report(name, 1, bench_now_ns() - start, bench_alloc_count - allocs);
+
+    // Let the directories age past the racy window so refreshes are stats
+    struct timespec old[2] = { { .tv_sec = 1000000000 }, { .tv_sec = 1000000000 } };
+    for (int d = 0; d < NDIRS; d++) utimensat(AT_FDCWD, dirs[d], old, 0);
+    cmd_index_refresh(&x, path_env);
+
+    const char *prefixes[] = { "cmd01234", "cmd0123", "cmd01", "" };
+    for (size_t p = 0; p < sizeof(prefixes) / sizeof(prefixes[0]); p++) {
+        int reps = 1000;
+        allocs = bench_alloc_count;
+        double ns = tab(&x, path_env, prefixes[p], reps);
+        size_t matches = 0;
+        cmd_index_complete(&x, prefixes[p], count_name, &matches);
+        snprintf(name, sizeof(name), "complete/tab/%zu_matches", matches);
+        bench_report(name, reps, ns, bench_alloc_count - allocs);
+    }
+
+    // One new binary: only its directory is read again
+    int reps = 100;
+    start = bench_now_ns();
+    for (int i = 0; i < reps; i++) {
+        snprintf(path, sizeof(path), "%s/new%03d", dirs[0], i);
+        close(open(path, O_WRONLY | O_CREAT, 0755));
+        old[1].tv_sec++;
+        utimensat(AT_FDCWD, dirs[0], old, 0);
+        cmd_index_refresh(&x, path_env);
+    }
+    bench_report("complete/refresh_one_dir_changed", reps, bench_now_ns() - start, 0);
+    for (int i = 0; i < reps; i++) {
+        snprintf(path, sizeof(path), "%s/new%03d", dirs[0], i);
+        unlink(path);
+    }
+
+    cmd_index_destroy(&x);
+    for (int i = 0; i < files; i++) {
+        snprintf(path, sizeof(path), "%s/cmd%05d", dirs[i % NDIRS], i);
+        unlink(path);
+    }
+    for (int d = 0; d < NDIRS; d++) rmdir(dirs[d]);
+    return bench_end();
+}
@@ -0,0 +1,88 @@
+/*
+ * Environment benchmark. Starts from an environment padded to 2000
+ * variables, the size CI runners hand us, and compares env_get with a
+ * plain getenv scan for a variable near the end. It also measures building
+ * the table, export of a new and an existing variable, and fetching envp
+ * for a launch.
+ *
+ * usage: bench-env [-n iterations] [-v variables] [-j results.json]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "harness/bench.h"
+#include "../src/lab.h"
+
+// Keeps the compiler from dropping lookups whose result is unused
+static volatile size_t sink;
+
+int main(int argc, char **argv) {
+    int iterations = 1000000;
+    int nvars = 2000;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:v:j:")) != -1) {
+        switch (opt) {
+            case 'n': iterations = atoi(optarg); break;
+            case 'v': nvars = atoi(optarg); break;
+            case 'j': break; // handled by bench_begin
+            default:
+                fprintf(stderr, "Usage: %s [-n iterations] [-v variables] [-j results.json]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    char name[32], value[64];
+    for (int i = 0; i < nvars; i++) {
+        snprintf(name, sizeof(name), "CI_VAR_%d", i);
+        snprintf(value, sizeof(value), "value-of-ci-variable-%d", i);
+        setenv(name, value, 1);
+    }
+    setenv("LAB_LAST", "x", 1);
+    bench_begin("env", argc, argv);
+
+    size_t allocs = bench_alloc_count;
+    double start = bench_now_ns();
+    sink += env_get("LAB_LAST") != NULL;
+    snprintf(name, sizeof(name), "env/build/%d_vars", nvars);
+    bench_report(name, 1, bench_now_ns() - start, bench_alloc_count - allocs);
+
+    const struct {
+        const char *name;
+        const char *(*get)(const char *);
+    } lookups[] = {
+        { "getenv", (const char *(*)(const char *))getenv },
+        { "env_get", env_get },
+    };
+    for (size_t i = 0; i < sizeof(lookups) / sizeof(lookups[0]); i++) {
+        const char *keys[] = { "LAB_LAST", "LAB_MISSING" };
+        for (size_t k = 0; k < 2; k++) {
+            int n = i == 0 ? iterations / 100 + 1 : iterations;
+            allocs = bench_alloc_count;
+            start = bench_now_ns();
+            for (int r = 0; r < n; r++) sink += lookups[i].get(keys[k]) != NULL;
+            snprintf(name, sizeof(name), "env/%s/%s", lookups[i].name, k ? "missing" : "last");
+            bench_report(name, n, bench_now_ns() - start, bench_alloc_count - allocs);
+        }
+    }
+
+    // A new variable each time, then the same one over and over
+    int n = iterations / 100 + 1;
+    allocs = bench_alloc_count;
+    start = bench_now_ns();
+    for (int r = 0; r < n; r++) {
+        snprintf(name, sizeof(name), "LAB_NEW_%d", r);
+        env_set(name, "1");
+    }
+    bench_report("env/export/new", n, bench_now_ns() - start, bench_alloc_count - allocs);
+    allocs = bench_alloc_count;
+    start = bench_now_ns();
+    for (int r = 0; r < n; r++) env_set("LAB_LAST", "y");
+    bench_report("env/export/existing", n, bench_now_ns() - start, bench_alloc_count - allocs);
+
+    allocs = bench_alloc_count;
+    start = bench_now_ns();
+    for (int r = 0; r < iterations; r++) sink += env_envp() != NULL;
+    bench_report("env/envp", iterations, bench_now_ns() - start, bench_alloc_count - allocs);
+    return bench_end();
+}
@@ -0,0 +1,117 @@
+/*
+ * History benchmark. Fills a history file with synthetic commands and
+ * measures loading the newest entries the way the shell does at startup,
+ * indexing the whole file, and substring searches through the trigram
+ * index against a plain strstr scan.
+ *
+ * usage: bench-history [-n entries] [-j results.json]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "harness/bench.h"
+#include "../src/lab.h"
+
+static const char *words[] = {
+    "git", "commit", "-m", "make", "-j8", "ls", "-la", "cd", "src", "grep", "-rn",
+    "TODO", "build", "docker", "run", "--rm", "ssh", "deploy", "tests", "vim", "main.c",
+    "cargo", "python3", "script.py", "kubectl", "get", "pods", "--namespace", "staging",
+};
+#define NWORDS (sizeof(words) / sizeof(words[0]))
+
+static void fill(const char *path, long entries) {
+    struct hist_file h;
+    if (hist_open(&h, path) == -1) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    srand(42);
+    char line[256];
+    for (long i = 0; i < entries; i++) {
+        size_t len = 0;
+        int nwords = 2 + rand() % 6;
+        for (int w = 0; w < nwords; w++) {
+            len += snprintf(line + len, sizeof(line) - len, "%s ", words[rand() % NWORDS]);
+        }
+        // A number makes most lines unique, as real history tends to be
+        snprintf(line + len, sizeof(line) - len, "%d", rand() % 100000);
+        hist_add(&h, line);
+    }
+    hist_close(&h);
+}
+
+static void count_line(const char *line, void *arg) {
+    *(size_t *)arg += line[0] != '\0';
+}
+
+// Newest match the slow way, for comparison
+static ssize_t scan(struct hist_file *h, const char *query) {
+    for (size_t i = hist_count(h); i-- > 0;) {
+        if (strstr(hist_entry(h, i, NULL), query)) return i;
+    }
+    return -1;
+}
+
+int main(int argc, char **argv) {
+    long entries = 1000000;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:j:")) != -1) {
+        switch (opt) {
+            case 'n': entries = atol(optarg); break;
+            case 'j': break; // handled by bench_begin
+            default:
+                fprintf(stderr, "Usage: %s [-n entries] [-j results.json]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    char path[] = "/tmp/bench-history-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        perror("mkstemp");
+        return EXIT_FAILURE;
+    }
+    close(fd);
+    fill(path, entries);
+
+    bench_begin("history", argc, argv);
+    struct hist_file h;
+    char name[64];
+
+    size_t seen = 0;
+    double start = bench_now_ns();
+    hist_open(&h, path);
+    hist_recent(&h, 1000, count_line, &seen);
+    bench_report("history/startup_recent_1000", 1, bench_now_ns() - start, 0);
+
+    size_t allocs = bench_alloc_count;
+    start = bench_now_ns();
+    hist_count(&h);
+    hist_search(&h, "xyz", SIZE_MAX);
+    snprintf(name, sizeof(name), "history/index_%ld", entries);
+    bench_report(name, 1, bench_now_ns() - start, bench_alloc_count - allocs);
+
+    // Recent hits, rare hits deep in the file and misses
+    const char *queries[] = { "git commit", "kubectl get pods --namespace staging 4", "99999", "no such command" };
+    const char *labels[] = { "common", "rare", "number", "miss" };
+    for (size_t q = 0; q < sizeof(queries) / sizeof(queries[0]); q++) {
+        int reps = 1000;
+        allocs = bench_alloc_count;
+        start = bench_now_ns();
+        for (int i = 0; i < reps; i++) hist_search(&h, queries[q], SIZE_MAX);
+        snprintf(name, sizeof(name), "history/search/%s/trigram", labels[q]);
+        bench_report(name, reps, bench_now_ns() - start, bench_alloc_count - allocs);
+
+        reps = 5;
+        start = bench_now_ns();
+        for (int i = 0; i < reps; i++) scan(&h, queries[q]);
+        snprintf(name, sizeof(name), "history/search/%s/scan", labels[q]);
+        bench_report(name, reps, bench_now_ns() - start, 0);
+    }
+
+    hist_close(&h);
+    unlink(path);
+    return bench_end();
+}
@@ -0,0 +1,134 @@
+/*
+ * Jump index benchmark. Records visits to a few hundred thousand made up
+ * directories, a handful of them visited far more often than the rest the
+ * way real use is skewed, then measures j style queries against the
+ * index: a word the favourites match, one only a single rarely visited
+ * directory matches, several words, and two that match nothing. The first
+ * has trigrams no directory has, the second falls in two long posting
+ * lists that have to be walked side by side. It also measures the first
+ * query after the file was replaced, recording a visit and the flush that
+ * rewrites the file.
+ *
+ * usage: bench-jump [-n iterations] [-p paths] [-j results.json]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "harness/bench.h"
+#include "../src/lab.h"
+
+static volatile size_t sink;
+
+static const char *words[] = {
+    "src", "lib", "docs", "build", "tests", "tools", "config", "assets",
+    "server", "client", "kernel", "drivers", "scripts", "vendor", "include", "examples",
+};
+#define NWORDS (sizeof(words) / sizeof(words[0]))
+
+static void make_path(char *buf, size_t size, size_t i) {
+    snprintf(buf, size, "/home/user/code/project%zu/%s/%s-%zu", i % 997, words[(i / 997) % NWORDS],
+             words[i % NWORDS], i);
+}
+
+static void query(struct jump_db *db, const char *name, char **q, int n) {
+    struct jump_match m[20];
+    size_t allocs = bench_alloc_count;
+    double start = bench_now_ns();
+    for (int r = 0; r < n; r++) sink += jump_query(db, q, NULL, 1700000000, m, 1);
+    bench_report(name, n, bench_now_ns() - start, bench_alloc_count - allocs);
+}
+
+int main(int argc, char **argv) {
+    int iterations = 10000;
+    size_t npaths = 300000;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:p:j:")) != -1) {
+        switch (opt) {
+            case 'n': iterations = atoi(optarg); break;
+            case 'p': npaths = strtoul(optarg, NULL, 10); break;
+            case 'j': break; // handled by bench_begin
+            default:
+                fprintf(stderr, "Usage: %s [-n iterations] [-p paths] [-j results.json]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    char dir[] = "/tmp/bench-jump-XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    char file[64], path[256], name[64];
+    snprintf(file, sizeof(file), "%s/jump", dir);
+    bench_begin("jump", argc, argv);
+
+    struct jump_db db;
+    if (jump_open(&db, file) == -1) {
+        perror(file);
+        return EXIT_FAILURE;
+    }
+    // Written out in large batches, a flush every 32 visits would take all day
+    db.flush_every = 4096;
+    time_t now = 1700000000;
+    double start = bench_now_ns();
+    for (size_t i = 0; i < npaths; i++) {
+        make_path(path, sizeof(path), i);
+        // Older directories were visited longer ago, every 64th a few more times
+        int visits = i % 64 ? 1 : 1 + (int)(i % 7);
+        for (int v = 0; v < visits; v++) jump_visit(&db, path, now - (time_t)(npaths - i) * 10);
+    }
+    for (size_t i = 0; i < 16; i++) {
+        make_path(path, sizeof(path), i * 101);
+        for (int v = 0; v < 50; v++) jump_visit(&db, path, now);
+    }
+    if (jump_flush(&db) == -1) {
+        perror("jump_flush");
+        return EXIT_FAILURE;
+    }
+    snprintf(name, sizeof(name), "jump/build/%zu_paths", npaths);
+    bench_report(name, npaths, bench_now_ns() - start, 0);
+    struct stat st;
+    if (stat(file, &st) == 0) bench_report_value("jump/file_size", "bytes", st.st_size);
+
+    // The first query maps the file the flush just replaced
+    char *any[] = { NULL };
+    start = bench_now_ns();
+    sink += jump_query(&db, any, NULL, now, (struct jump_match[1]){0}, 1);
+    bench_report("jump/first_query", 1, bench_now_ns() - start, 0);
+
+    char *popular[] = { "src", NULL };
+    char *several[] = { "project5", "docs", "tests", NULL };
+    make_path(path, sizeof(path), npaths / 2 + 1);
+    char *rare[] = { strrchr(path, '/') + 1, NULL };
+    char *missing[] = { "zzz", NULL };
+    char *missing_letters[] = { "servers", NULL };
+    query(&db, "jump/query/popular", popular, iterations);
+    query(&db, "jump/query/several_words", several, iterations);
+    query(&db, "jump/query/rare", rare, iterations / 10 + 1);
+    query(&db, "jump/query/no_match_filtered", missing, iterations / 10 + 1);
+    query(&db, "jump/query/no_match_scanned", missing_letters, iterations / 10 + 1);
+
+    // Recording a visit stays in memory until the flush
+    db.flush_every = SIZE_MAX;
+    int n = 32;
+    size_t allocs = bench_alloc_count;
+    start = bench_now_ns();
+    for (int r = 0; r < n; r++) {
+        make_path(path, sizeof(path), (size_t)r * 7919 % npaths);
+        jump_visit(&db, path, now);
+    }
+    bench_report("jump/visit", n, bench_now_ns() - start, bench_alloc_count - allocs);
+    allocs = bench_alloc_count;
+    start = bench_now_ns();
+    jump_flush(&db);
+    snprintf(name, sizeof(name), "jump/flush/%d_visits", n);
+    bench_report(name, 1, bench_now_ns() - start, bench_alloc_count - allocs);
+
+    jump_close(&db);
+    unlink(file);
+    rmdir(dir);
+    return bench_end();
+}
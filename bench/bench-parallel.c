@@ -0,0 +1,94 @@
+/*
+ * Parallel runner benchmark. Feeds the parallel builtin a list of short
+ * jobs, first /bin/true (launch and reap overhead) and then a small busy
+ * loop in sh (CPU bound), once with -j 1 and once with the default of one
+ * job per CPU. The speedup of the busy jobs shows whether every core is
+ * kept busy.
+ *
+ * usage: bench-parallel [-n jobs] [-j results.json]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "harness/bench.h"
+#include "../src/lab.h"
+
+// A memfd holding n copies of line
+static int make_input(const char *line, int n) {
+    int fd = memfd_create("bench-parallel", MFD_CLOEXEC);
+    if (fd == -1) {
+        perror("memfd_create");
+        exit(EXIT_FAILURE);
+    }
+    size_t len = strlen(line);
+    for (int i = 0; i < n; i++) {
+        if (write(fd, line, len) != (ssize_t)len) {
+            perror("write");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return fd;
+}
+
+static double run(struct shell *sh, int fd, size_t jobs) {
+    struct parallel_opts o = { .jobs = jobs };
+    lseek(fd, 0, SEEK_SET);
+    double start = bench_now_ns();
+    if (parallel_run(sh, fd, &o) != 0) {
+        fprintf(stderr, "parallel_run: a job failed\n");
+        exit(EXIT_FAILURE);
+    }
+    return bench_now_ns() - start;
+}
+
+int main(int argc, char **argv) {
+    int n = 400;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:j:")) != -1) {
+        switch (opt) {
+            case 'n': n = atoi(optarg); break;
+            case 'j': break; // handled by bench_begin
+            default:
+                fprintf(stderr, "Usage: %s [-n jobs] [-j results.json]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    bench_begin("parallel", argc, argv);
+    struct shell sh = {0};
+    sh.launch_mode = LAUNCH_SPAWN;
+    const struct {
+        const char *name;
+        const char *line;
+    } loads[] = {
+        { "true", "true\n" },
+        { "busy", "sh -c 'i=0; while [ $i -lt 20000 ]; do i=$((i+1)); done'\n" },
+    };
+    for (size_t i = 0; i < sizeof(loads) / sizeof(loads[0]); i++) {
+        int fd = make_input(loads[i].line, n);
+        run(&sh, fd, 0); // warm up
+        double serial = 0;
+        const size_t jobs[] = { 1, 0 };
+        for (size_t k = 0; k < 2; k++) {
+            size_t allocs = bench_alloc_count;
+            double ns = run(&sh, fd, jobs[k]);
+            char name[64];
+            snprintf(name, sizeof(name), "parallel/%s/%s", loads[i].name, jobs[k] ? "j1" : "jcpu");
+            bench_report(name, n, ns, bench_alloc_count - allocs);
+            if (jobs[k]) {
+                serial = ns;
+            } else {
+                snprintf(name, sizeof(name), "parallel/%s/speedup", loads[i].name);
+                bench_report_value(name, "x", serial / ns);
+            }
+        }
+        close(fd);
+    }
+
+    job_table_destroy(&sh.jobs);
+    cmd_hash_destroy(&sh.hash);
+    return bench_end();
+}
@@ -0,0 +1,250 @@
+/*
+ * Parser hot path microbenchmarks: cmd_parse, cmd_parse_inplace, cmd_free,
+ * trim_white, get_prompt and prompt_render over a few corpora that look like real input
+ * (including one that exercises the lexer's quoting and escapes),
+ * plus the long lines again under each whitespace scan kernel.
+ * Each operation runs in batches so the setup a mutating call needs (a
+ * fresh copy of the line) and the matching free stay out of the timing.
+ *
+ * usage: bench-parse [-j results.json]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "harness/bench.h"
+#include "../src/lab.h"
+
+#define BATCH 1024
+#define MIN_NS 2e8
+
+struct corpus {
+    const char *name;
+    char *line;
+};
+
+static char *lines[BATCH];
+static char **parsed[BATCH];
+
+// Fill every batch slot with a fresh copy of line for mutating calls
+static void refill(const char *line) {
+    size_t len = strlen(line) + 1;
+    for (int i = 0; i < BATCH; i++) memcpy(lines[i], line, len);
+}
+
+static void bench_cmd_parse(const struct corpus *c) {
+    char name[64];
+    double parse_ns = 0, free_ns = 0;
+    size_t parse_allocs = 0;
+    long ops = 0;
+    while (parse_ns < MIN_NS) {
+        size_t a = bench_alloc_count;
+        double t0 = bench_now_ns();
+        for (int i = 0; i < BATCH; i++) parsed[i] = cmd_parse(c->line);
+        double t1 = bench_now_ns();
+        parse_allocs += bench_alloc_count - a;
+        for (int i = 0; i < BATCH; i++) cmd_free(parsed[i]);
+        double t2 = bench_now_ns();
+        parse_ns += t1 - t0;
+        free_ns += t2 - t1;
+        ops += BATCH;
+    }
+    snprintf(name, sizeof(name), "cmd_parse/%s", c->name);
+    bench_report(name, ops, parse_ns, parse_allocs);
+    snprintf(name, sizeof(name), "cmd_free/%s", c->name);
+    bench_report(name, ops, free_ns, 0);
+}
+
+static void bench_cmd_parse_inplace(const struct corpus *c) {
+    char name[64];
+    double ns = 0;
+    size_t allocs = 0;
+    long ops = 0;
+    while (ns < MIN_NS) {
+        refill(c->line);
+        size_t a = bench_alloc_count;
+        double t0 = bench_now_ns();
+        for (int i = 0; i < BATCH; i++) parsed[i] = cmd_parse_inplace(lines[i]);
+        ns += bench_now_ns() - t0;
+        allocs += bench_alloc_count - a;
+        for (int i = 0; i < BATCH; i++) cmd_free(parsed[i]);
+        ops += BATCH;
+    }
+    snprintf(name, sizeof(name), "cmd_parse_inplace/%s", c->name);
+    bench_report(name, ops, ns, allocs);
+}
+
+static void bench_trim_white(const struct corpus *c) {
+    char name[64];
+    double ns = 0;
+    size_t allocs = 0;
+    long ops = 0;
+    volatile char *sink;
+    while (ns < MIN_NS) {
+        refill(c->line);
+        size_t a = bench_alloc_count;
+        double t0 = bench_now_ns();
+        for (int i = 0; i < BATCH; i++) sink = trim_white(lines[i]);
+        ns += bench_now_ns() - t0;
+        allocs += bench_alloc_count - a;
+        ops += BATCH;
+    }
+    (void)sink;
+    snprintf(name, sizeof(name), "trim_white/%s", c->name);
+    bench_report(name, ops, ns, allocs);
+}
+
+static void bench_get_prompt(const char *name, const char *value) {
+    if (value) {
+        setenv("MY_PROMPT", value, 1);
+    } else {
+        unsetenv("MY_PROMPT");
+    }
+    double ns = 0;
+    size_t allocs = 0;
+    long ops = 0;
+    char *prompts[BATCH];
+    while (ns < MIN_NS) {
+        size_t a = bench_alloc_count;
+        double t0 = bench_now_ns();
+        for (int i = 0; i < BATCH; i++) prompts[i] = get_prompt("MY_PROMPT");
+        ns += bench_now_ns() - t0;
+        allocs += bench_alloc_count - a;
+        for (int i = 0; i < BATCH; i++) free(prompts[i]);
+        ops += BATCH;
+    }
+    bench_report(name, ops, ns, allocs);
+}
+
+// Rendering a compiled template, what the shell pays before every line.
+// The git segment is read from the cache, the lookup itself runs on the
+// prompt thread.
+static void bench_prompt_render(const char *name, const char *tmpl) {
+    struct prompt p;
+    if (prompt_compile(&p, tmpl) == -1) {
+        perror("prompt_compile");
+        exit(EXIT_FAILURE);
+    }
+    struct shell sh = {0};
+    free(prompt_render(&p, &sh));
+    double ns = 0;
+    size_t allocs = 0;
+    long ops = 0;
+    char *prompts[BATCH];
+    while (ns < MIN_NS) {
+        size_t a = bench_alloc_count;
+        double t0 = bench_now_ns();
+        for (int i = 0; i < BATCH; i++) prompts[i] = prompt_render(&p, &sh);
+        ns += bench_now_ns() - t0;
+        allocs += bench_alloc_count - a;
+        for (int i = 0; i < BATCH; i++) free(prompts[i]);
+        ops += BATCH;
+    }
+    bench_report(name, ops, ns, allocs);
+    prompt_destroy(&p);
+}
+
+// Raw kernel speed over a multi-KB line of words and blanks
+static void bench_scan(const char *kernel, const char *line) {
+    char name[64];
+    size_t len = strlen(line);
+    double ns = 0;
+    long ops = 0;
+    volatile size_t sink = 0;
+    while (ns < MIN_NS) {
+        double t0 = bench_now_ns();
+        for (int i = 0; i < BATCH; i++) {
+            // Walk the whole line the way the lexer does, a byte that
+            // ends a word but is not a blank is stepped over on its own
+            size_t pos = 0;
+            while (pos < len) {
+                pos += scan_blank(line + pos, len - pos);
+                pos += scan_word(line + pos, len - pos);
+                if (pos < len && !scan_blank(line + pos, 1)) pos++;
+            }
+            sink += pos;
+        }
+        ns += bench_now_ns() - t0;
+        ops += BATCH;
+    }
+    (void)sink;
+    snprintf(name, sizeof(name), "scan/%s/%zuB", kernel, len);
+    bench_report(name, ops, ns, 0);
+}
+
+// A compiler line with well over 100 arguments
+static char *long_line(void) {
+    size_t cap = 8192, len = 0;
+    char *s = malloc(cap);
+    len += snprintf(s, cap, "gcc -Wall -Wextra -O2 -Iinclude -c");
+    for (int i = 0; i < 150 && len + 32 < cap; i++) {
+        len += snprintf(s + len, cap - len, " src/module_%03d.c", i);
+    }
+    return s;
+}
+
+// Words buried in long runs of blanks on both sides
+static char *whitespace_line(void) {
+    size_t cap = 4096;
+    char *s = malloc(cap);
+    size_t len = 0;
+    memset(s, ' ', 1024);
+    len = 1024;
+    const char *words[] = { "ls", "-l", "-a", "--color=auto", "/tmp" };
+    for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+        len += snprintf(s + len, cap - len, "%s%*s", words[i], 40, "");
+    }
+    memset(s + len, ' ', 1024);
+    s[len + 1024] = '\0';
+    return s;
+}
+
+int main(int argc, char **argv) {
+    bench_begin("parse", argc, argv);
+
+    struct corpus corpora[] = {
+        { "short", strdup("ls -la /tmp") },
+        { "medium", strdup("grep -rn --include=*.c cmd_parse src tests | sort | uniq -c") },
+        { "long_150_args", long_line() },
+        { "pathological_ws", whitespace_line() },
+        { "quoted", strdup("git commit -m \"fix: don't drop 'quoted' args\" --author='A U Thor <a@u.th>' a\\ b") },
+    };
+    size_t ncorpora = sizeof(corpora) / sizeof(corpora[0]);
+
+    size_t maxlen = 0;
+    for (size_t i = 0; i < ncorpora; i++) {
+        size_t len = strlen(corpora[i].line);
+        if (len > maxlen) maxlen = len;
+    }
+    for (int i = 0; i < BATCH; i++) lines[i] = malloc(maxlen + 1);
+
+    for (size_t i = 0; i < ncorpora; i++) {
+        bench_cmd_parse(&corpora[i]);
+        bench_cmd_parse_inplace(&corpora[i]);
+        bench_trim_white(&corpora[i]);
+    }
+
+    // The same hot paths once per whitespace kernel to show the speedup
+    const char *kernels[] = { "scalar", "sse2", "avx2" };
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+        if (scan_select(kernels[k]) == -1) continue;
+        for (size_t i = 2; i < 4; i++) {
+            struct corpus c = corpora[i];
+            char name[64];
+            snprintf(name, sizeof(name), "%s/%s", c.name, kernels[k]);
+            c.name = name;
+            bench_trim_white(&c);
+            bench_cmd_parse_inplace(&c);
+        }
+        bench_scan(kernels[k], corpora[3].line);
+    }
+    scan_select(NULL);
+    bench_get_prompt("get_prompt/default", NULL);
+    bench_get_prompt("get_prompt/custom", "lab> ");
+    bench_prompt_render("prompt_render/static", "lab> ");
+    bench_prompt_render("prompt_render/cwd_status_jobs", "\\u@\\h:\\w [\\?] \\j\\$ ");
+    bench_prompt_render("prompt_render/with_git", "\\w (\\g)\\$ ");
+
+    for (int i = 0; i < BATCH; i++) free(lines[i]);
+    for (size_t i = 0; i < ncorpora; i++) free(corpora[i].line);
+    return bench_end();
+}
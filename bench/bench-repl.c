@@ -0,0 +1,244 @@
+/*
+ * End to end throughput of the whole REPL path: parse, builtin check,
+ * launch, wait and terminal handoff. The real shell binary is driven one
+ * command at a time, through a pty (interactive, the prompt marks the end
+ * of a command) and through a pipe (batch mode with set -o timing, the
+ * usage line on stderr marks the end). Every launch mode runs /bin/true
+ * and a builtin, reporting p50/p99 latency and commands/s. The pipe mode
+ * also streams the whole batch at once to show peak throughput.
+ *
+ * usage: bench-repl [-s shell] [-n commands] [-j results.json]
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "harness/bench.h"
+#include "../src/lab.h"
+
+#define PROMPT_MARKER "@@lab-ready@@"
+#define TIMING_MARKER "real "
+#define TIMEOUT_MS 10000
+
+struct session {
+    pid_t pid;
+    int in_fd;      /* we write commands here */
+    int out_fd;     /* markers show up here */
+    const char *marker;
+    char buf[8192];
+    size_t len;
+};
+
+static const char *shell_path = "./myprogram";
+
+static void die(const char *what) {
+    perror(what);
+    exit(EXIT_FAILURE);
+}
+
+// Read until the marker shows up and drop everything up to and including it
+static void wait_for_marker(struct session *s) {
+    size_t mlen = strlen(s->marker);
+    while (1) {
+        char *hit = memmem(s->buf, s->len, s->marker, mlen);
+        if (hit) {
+            size_t used = hit - s->buf + mlen;
+            memmove(s->buf, s->buf + used, s->len - used);
+            s->len -= used;
+            return;
+        }
+        // Keep a tail in case the marker is split across reads
+        if (s->len > mlen) {
+            memmove(s->buf, s->buf + s->len - mlen, mlen);
+            s->len = mlen;
+        }
+        struct pollfd pfd = { .fd = s->out_fd, .events = POLLIN };
+        int r = poll(&pfd, 1, TIMEOUT_MS);
+        if (r == 0) {
+            fprintf(stderr, "timed out waiting for the shell\n");
+            exit(EXIT_FAILURE);
+        }
+        if (r == -1) {
+            if (errno == EINTR) continue;
+            die("poll");
+        }
+        ssize_t n = read(s->out_fd, s->buf + s->len, sizeof(s->buf) - s->len);
+        if (n <= 0) {
+            fprintf(stderr, "shell went away\n");
+            exit(EXIT_FAILURE);
+        }
+        s->len += n;
+    }
+}
+
+static void send_line(struct session *s, const char *line) {
+    size_t len = strlen(line);
+    while (len) {
+        ssize_t n = write(s->in_fd, line, len);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            die("write");
+        }
+        line += n;
+        len -= n;
+    }
+}
+
+static void start_pty(struct session *s, const char *mode) {
+    int master;
+    pid_t pid = forkpty(&master, NULL, NULL, NULL);
+    if (pid == -1) die("forkpty");
+    if (pid == 0) {
+        setenv("MY_PROMPT", PROMPT_MARKER, 1);
+        // An interactive shell records history and cd visits. Keep them
+        // out of the user's files and their I/O out of the latency.
+        setenv("MY_HISTFILE", "", 1);
+        setenv("MY_JUMPFILE", "", 1);
+        execl(shell_path, shell_path, "-l", mode, (char *)NULL);
+        _exit(127);
+    }
+    s->pid = pid;
+    s->in_fd = s->out_fd = master;
+    s->marker = PROMPT_MARKER;
+    s->len = 0;
+    wait_for_marker(s);
+}
+
+static void start_pipe(struct session *s, const char *mode) {
+    int in[2], err[2];
+    if (pipe2(in, O_CLOEXEC) == -1 || pipe2(err, O_CLOEXEC) == -1) die("pipe2");
+    pid_t pid = fork();
+    if (pid == -1) die("fork");
+    if (pid == 0) {
+        dup2(in[0], STDIN_FILENO);
+        dup2(err[1], STDERR_FILENO);
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull != -1) dup2(devnull, STDOUT_FILENO);
+        execl(shell_path, shell_path, "-l", mode, (char *)NULL);
+        _exit(127);
+    }
+    close(in[0]);
+    close(err[1]);
+    s->pid = pid;
+    s->in_fd = in[1];
+    s->out_fd = err[0];
+    s->marker = TIMING_MARKER;
+    s->len = 0;
+    // Every command now ends with exactly one usage line on stderr
+    send_line(s, "set -o timing\n");
+}
+
+static void stop(struct session *s) {
+    send_line(s, "exit\n");
+    if (s->in_fd != s->out_fd) close(s->in_fd);
+    close(s->out_fd);
+    waitpid(s->pid, NULL, 0);
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Run the command n times in lockstep and report its latency distribution
+static void lockstep(const char *label, bool pty, const char *mode, const char *cmd, int n) {
+    struct session s;
+    if (pty) {
+        start_pty(&s, mode);
+    } else {
+        start_pipe(&s, mode);
+    }
+
+    double *lat = malloc(n * sizeof(double));
+    if (!lat) die("malloc");
+    double start = bench_now_ns();
+    for (int i = 0; i < n; i++) {
+        double t0 = bench_now_ns();
+        send_line(&s, cmd);
+        wait_for_marker(&s);
+        lat[i] = bench_now_ns() - t0;
+    }
+    double total = bench_now_ns() - start;
+    stop(&s);
+
+    qsort(lat, n, sizeof(double), cmp_double);
+    char name[64];
+    snprintf(name, sizeof(name), "%s/p50", label);
+    bench_report_value(name, "us", lat[n / 2] / 1e3);
+    snprintf(name, sizeof(name), "%s/p99", label);
+    bench_report_value(name, "us", lat[(int)(n * 0.99)] / 1e3);
+    snprintf(name, sizeof(name), "%s/throughput", label);
+    bench_report_value(name, "cmds/s", n / (total / 1e9));
+    free(lat);
+}
+
+// Feed the whole batch at once and wait for the shell to drain it
+static void streamed(const char *label, const char *mode, const char *cmd, int n) {
+    int in[2];
+    if (pipe2(in, O_CLOEXEC) == -1) die("pipe2");
+    double start = bench_now_ns();
+    pid_t pid = fork();
+    if (pid == -1) die("fork");
+    if (pid == 0) {
+        dup2(in[0], STDIN_FILENO);
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull != -1) dup2(devnull, STDOUT_FILENO);
+        execl(shell_path, shell_path, "-l", mode, (char *)NULL);
+        _exit(127);
+    }
+    close(in[0]);
+    struct session s = { .in_fd = in[1] };
+    for (int i = 0; i < n; i++) send_line(&s, cmd);
+    close(in[1]);
+    waitpid(pid, NULL, 0);
+    double total = bench_now_ns() - start;
+
+    char name[64];
+    snprintf(name, sizeof(name), "%s/throughput", label);
+    bench_report_value(name, "cmds/s", n / (total / 1e9));
+}
+
+int main(int argc, char **argv) {
+    int n = 2000;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:n:j:")) != -1) {
+        switch (opt) {
+            case 's': shell_path = optarg; break;
+            case 'n': n = atoi(optarg); break;
+            case 'j': break; // handled by bench_begin
+            default:
+                fprintf(stderr, "Usage: %s [-s shell] [-n commands] [-j results.json]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (n < 1) n = 1;
+    signal(SIGPIPE, SIG_IGN);
+    bench_begin("repl", argc, argv);
+
+    struct { const char *name; const char *line; } workloads[] = {
+        { "true", "/bin/true\n" },
+        { "builtin", "cd .\n" },
+    };
+    enum launch_mode modes[] = { LAUNCH_FORK, LAUNCH_SPAWN };
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        const char *mode = launch_mode_name(modes[m]);
+        for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++) {
+            char label[64];
+            snprintf(label, sizeof(label), "repl/pty/%s/%s", mode, workloads[w].name);
+            lockstep(label, true, mode, workloads[w].line, n);
+            snprintf(label, sizeof(label), "repl/pipe/%s/%s", mode, workloads[w].name);
+            lockstep(label, false, mode, workloads[w].line, n);
+            snprintf(label, sizeof(label), "repl/stream/%s/%s", mode, workloads[w].name);
+            streamed(label, mode, workloads[w].line, n);
+        }
+    }
+    return bench_end();
+}
@@ -0,0 +1,107 @@
+/*
+ * Compiled script benchmark. Writes a script of builtin lines with quoted
+ * arguments and redirections, so what is measured is the shell and not the
+ * processes it starts, and runs it three ways: interpreted line by line
+ * with script_run_fd, compiled from scratch with no cache, and from the
+ * cache. It also measures what happens before the first line runs: mapping
+ * and checking the cache compared with compiling the text.
+ *
+ * usage: bench-script [-n runs] [-l lines] [-j results.json]
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "harness/bench.h"
+#include "../src/lab.h"
+
+static const char *lines[] = {
+    "true --verbose --output=/dev/null 'a quoted argument' \"and a double one\" x y z",
+    "[ first-word = first-word ]",
+    "test -n \"some text\" -a -z '' 2> /dev/null",
+    "printf '%s %s\\n' alpha beta > /dev/null",
+    "echo -n one two three four five six seven eight nine ten >> /dev/null",
+    "# a comment between commands",
+    "false 'this line fails'",
+};
+#define NLINES (sizeof(lines) / sizeof(lines[0]))
+
+int main(int argc, char **argv) {
+    int runs = 200;
+    int nlines = 2000;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:l:j:")) != -1) {
+        switch (opt) {
+            case 'n': runs = atoi(optarg); break;
+            case 'l': nlines = atoi(optarg); break;
+            case 'j': break; // handled by bench_begin
+            default:
+                fprintf(stderr, "Usage: %s [-n runs] [-l lines] [-j results.json]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    char dir[] = "/tmp/bench-script-XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    char path[64], name[64];
+    snprintf(path, sizeof(path), "%s/run.sh", dir);
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < nlines; i++) fprintf(f, "%s\n", lines[i % NLINES]);
+    fclose(f);
+    char *cache = script_cache_path(path);
+    bench_begin("script", argc, argv);
+
+    struct shell sh = {0};
+    for (int mode = 0; mode < 3; mode++) {
+        static const char *modes[] = { "interpret", "compile", "cached" };
+        unlink(cache);
+        if (mode == 2) script_run_file(&sh, path); // leaves the cache behind
+        size_t allocs = bench_alloc_count;
+        double start = bench_now_ns();
+        for (int r = 0; r < runs; r++) {
+            if (mode == 0) {
+                int fd = open(path, O_RDONLY | O_CLOEXEC);
+                script_run_fd(&sh, fd);
+                close(fd);
+            } else {
+                if (mode == 1) unlink(cache);
+                script_run_file(&sh, path);
+            }
+        }
+        snprintf(name, sizeof(name), "script/%s/%d_lines", modes[mode], nlines);
+        bench_report(name, runs, bench_now_ns() - start, bench_alloc_count - allocs);
+    }
+
+    // Time to first exec: everything script_run_file does before line one
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    for (int cached = 0; cached < 2; cached++) {
+        size_t allocs = bench_alloc_count;
+        double ns = 0;
+        for (int r = 0; r < runs; r++) {
+            if (!cached) unlink(cache);
+            struct script_code code;
+            double start = bench_now_ns();
+            script_code_load(path, fd, &code);
+            ns += bench_now_ns() - start;
+            script_code_free(&code);
+        }
+        snprintf(name, sizeof(name), "script/load/%s", cached ? "cached" : "compile");
+        bench_report(name, runs, ns, bench_alloc_count - allocs);
+    }
+    close(fd);
+
+    sh_destroy(&sh);
+    unlink(cache);
+    unlink(path);
+    rmdir(dir);
+    free(cache);
+    return bench_end();
+}
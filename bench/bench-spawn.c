@@ -0,0 +1,73 @@
+/*
+ * Spawn throughput benchmark. Starts /bin/true over and over with each
+ * launch mode and reports the average cost of one launch + wait. The shell
+ * is padded with touched heap memory first (-m MB) because fork has to copy
+ * page tables in proportion to the parent's RSS while posix_spawn does not.
+ *
+ * usage: bench-spawn [-n iterations] [-m ballast MB] [-j results.json]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "harness/bench.h"
+#include "../src/lab.h"
+
+static double run(struct shell *sh, int iterations) {
+    char *argv[] = { "true", NULL };
+    struct launch l = { .path = "/bin/true", .argv = argv, .foreground = false };
+
+    double start = bench_now_ns();
+    for (int i = 0; i < iterations; i++) {
+        pid_t pid = launch_process(sh, &l);
+        if (pid < 0) {
+            perror("launch_process");
+            exit(EXIT_FAILURE);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    return bench_now_ns() - start;
+}
+
+int main(int argc, char **argv) {
+    int iterations = 2000;
+    size_t ballast_mb = 256;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:m:j:")) != -1) {
+        switch (opt) {
+            case 'n': iterations = atoi(optarg); break;
+            case 'm': ballast_mb = strtoul(optarg, NULL, 10); break;
+            case 'j': break; // handled by bench_begin
+            default:
+                fprintf(stderr, "Usage: %s [-n iterations] [-m ballast MB] [-j results.json]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    // Touch every page so it is really part of the RSS
+    char *ballast = malloc(ballast_mb << 20);
+    if (ballast_mb && !ballast) {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+    memset(ballast, 1, ballast_mb << 20);
+
+    bench_begin("spawn", argc, argv);
+    struct shell sh = {0};
+    sh.shell_is_interactive = 0;
+    enum launch_mode modes[] = { LAUNCH_FORK, LAUNCH_SPAWN };
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        sh.launch_mode = modes[i];
+        run(&sh, iterations / 10 + 1); // warm up
+        size_t allocs = bench_alloc_count;
+        double ns = run(&sh, iterations);
+        char name[64];
+        snprintf(name, sizeof(name), "spawn/%s/rss_%zuMB", launch_mode_name(modes[i]), ballast_mb);
+        bench_report(name, iterations, ns, bench_alloc_count - allocs);
+    }
+
+    free(ballast);
+    return bench_end();
+}
@@ -0,0 +1,118 @@
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "bench.h"
+
+size_t bench_alloc_count;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+char *__real_strdup(const char *s);
+
+void *__wrap_malloc(size_t size) { bench_alloc_count++; return __real_malloc(size); }
+void *__wrap_calloc(size_t nmemb, size_t size) { bench_alloc_count++; return __real_calloc(nmemb, size); }
+void *__wrap_realloc(void *ptr, size_t size) { bench_alloc_count++; return __real_realloc(ptr, size); }
+char *__wrap_strdup(const char *s) { bench_alloc_count++; return __real_strdup(s); }
+
+size_t bench_process_count;
+
+pid_t __real_fork(void);
+int __real_posix_spawn(pid_t *pid, const char *path, const posix_spawn_file_actions_t *fa,
+                       const posix_spawnattr_t *attr, char *const argv[], char *const envp[]);
+int __real_posix_spawnp(pid_t *pid, const char *file, const posix_spawn_file_actions_t *fa,
+                        const posix_spawnattr_t *attr, char *const argv[], char *const envp[]);
+
+pid_t __wrap_fork(void) { bench_process_count++; return __real_fork(); }
+int __wrap_posix_spawn(pid_t *pid, const char *path, const posix_spawn_file_actions_t *fa,
+                       const posix_spawnattr_t *attr, char *const argv[], char *const envp[]) {
+    bench_process_count++;
+    return __real_posix_spawn(pid, path, fa, attr, argv, envp);
+}
+int __wrap_posix_spawnp(pid_t *pid, const char *file, const posix_spawn_file_actions_t *fa,
+                        const posix_spawnattr_t *attr, char *const argv[], char *const envp[]) {
+    bench_process_count++;
+    return __real_posix_spawnp(pid, file, fa, attr, argv, envp);
+}
+
+struct result {
+    char name[64];
+    char unit[16];
+    double value;
+    double allocs;  /* negative when not measured */
+};
+
+static const char *suite_name;
+static const char *json_path;
+static struct result *results;
+static size_t nresults;
+
+double bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+void bench_begin(const char *suite, int argc, char **argv) {
+    suite_name = suite;
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0) json_path = argv[i + 1];
+    }
+    printf("%-40s %14s %14s\n", "benchmark", "value", "allocs/op");
+}
+
+static void add(const char *name, const char *unit, double value, double allocs) {
+    struct result *r = realloc(results, (nresults + 1) * sizeof(*r));
+    if (!r) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+    }
+    results = r;
+    r = &results[nresults++];
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    snprintf(r->unit, sizeof(r->unit), "%s", unit);
+    r->value = value;
+    r->allocs = allocs;
+}
+
+void bench_report(const char *name, long ops, double ns, size_t allocs) {
+    double per_op = ns / ops;
+    double allocs_per_op = (double)allocs / ops;
+    printf("%-40s %11.1f ns %14.2f\n", name, per_op, allocs_per_op);
+    add(name, "ns/op", per_op, allocs_per_op);
+}
+
+void bench_report_value(const char *name, const char *unit, double value) {
+    printf("%-40s %11.1f %-9s\n", name, value, unit);
+    add(name, unit, value, -1);
+}
+
+int bench_end(void) {
+    int rval = 0;
+    if (json_path) {
+        FILE *out = fopen(json_path, "w");
+        if (!out) {
+            perror(json_path);
+            rval = 1;
+        } else {
+            fprintf(out, "{\n  \"suite\": \"%s\",\n  \"results\": [\n", suite_name);
+            for (size_t i = 0; i < nresults; i++) {
+                fprintf(out, "    {\"name\": \"%s\", \"unit\": \"%s\", \"value\": %.3f",
+                        results[i].name, results[i].unit, results[i].value);
+                if (results[i].allocs >= 0) {
+                    fprintf(out, ", \"allocs_per_op\": %.3f", results[i].allocs);
+                }
+                fprintf(out, "}%s\n", i + 1 < nresults ? "," : "");
+            }
+            fprintf(out, "  ]\n}\n");
+            fclose(out);
+        }
+    }
+    free(results);
+    results = NULL;
+    nresults = 0;
+    return rval;
+}
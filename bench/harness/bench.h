@@ -0,0 +1,32 @@
+#ifndef BENCH_H
+#define BENCH_H
+#include <stddef.h>
+
+/*
+ * Tiny benchmark harness shared by every program in bench/. Results are
+ * printed as a table and, when a path is given to bench_end, written out
+ * as JSON so runs can be compared release over release.
+ */
+
+/* Heap allocations made so far, counted through the linker --wrap flags */
+extern size_t bench_alloc_count;
+
+/* Processes started so far with fork, posix_spawn or posix_spawnp */
+extern size_t bench_process_count;
+
+/* CLOCK_MONOTONIC in nanoseconds */
+double bench_now_ns(void);
+
+/* Start a suite, parsing the -j <json path> option every benchmark takes */
+void bench_begin(const char *suite, int argc, char **argv);
+
+/* Record one result: ops operations took ns nanoseconds and allocs allocations */
+void bench_report(const char *name, long ops, double ns, size_t allocs);
+
+/* Record a result with its own metric, such as spawns/s or p99 latency */
+void bench_report_value(const char *name, const char *unit, double value);
+
+/* Print the JSON report (if asked for) and release the results */
+int bench_end(void);
+
+#endif
@@ -0,0 +1,405 @@
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "lab.h"
+
+// exit [n]
+static int builtin_exit(struct shell *sh, char **argv) {
+    // argv may be a slice of a pipeline so it is left for exit to reclaim
+    int code = argv[1] ? atoi(argv[1]) : sh ? sh->last_status : 0;
+    sh_destroy(sh);
+    exit(code);
+}
+
+// cd [dir|-]
+static int builtin_cd(struct shell *sh, char **argv) {
+    if (change_dir(sh, argv) == -1) {
+        fprintf(stderr, "cd: failed to change directory\n");
+        return EXIT_FAILURE;
+    }
+    // cd - says where it went
+    if (argv[1] && strcmp(argv[1], "-") == 0) {
+        const char *cwd = sh_cwd(sh);
+        if (cwd) {
+            out_str(cwd);
+            out_char('\n');
+        }
+    }
+    return 0;
+}
+
+// fg [%n] and bg [%n]
+static int builtin_fg_bg(struct shell *sh, char **argv) {
+    struct job *j = sh ? job_parse_spec(&sh->jobs, argv[1]) : NULL;
+    if (!j) {
+        fprintf(stderr, "%s: %s: no such job\n", argv[0], argv[1] ? argv[1] : "current");
+        return EXIT_FAILURE;
+    }
+    bool foreground = argv[0][0] == 'f';
+    printf("%s%s\n", j->cmdline, foreground ? "" : " &");
+    fflush(stdout);
+    j->background = !foreground;
+    return job_continue(sh, j, foreground);
+}
+
+// jobs
+static int builtin_jobs(struct shell *sh, char **argv) {
+    UNUSED(argv);
+    if (!sh) return 0;
+    for (size_t i = 0; i < sh->jobs.cap; i++) {
+        if (sh->jobs.jobs[i]) job_print(sh->jobs.jobs[i], stdout);
+    }
+    return 0;
+}
+
+// set [-o|+o option]
+static int builtin_set(struct shell *sh, char **argv) {
+    if (!sh) return 0;
+    struct { const char *name; bool *flag; } options[] = {
+        { "pipefail", &sh->pipefail },
+        { "timing",   &sh->timing },
+    };
+    size_t n = sizeof(options) / sizeof(options[0]);
+
+    if (!argv[1]) {
+        for (size_t i = 0; i < n; i++) {
+            printf("%-10s%s\n", options[i].name, *options[i].flag ? "on" : "off");
+        }
+        return 0;
+    }
+    if (argv[2] && (strcmp(argv[1], "-o") == 0 || strcmp(argv[1], "+o") == 0)) {
+        for (size_t i = 0; i < n; i++) {
+            if (strcmp(argv[2], options[i].name) == 0) {
+                *options[i].flag = argv[1][0] == '-';
+                return 0;
+            }
+        }
+    }
+    fprintf(stderr, "set: usage: set [-o|+o pipefail|timing]\n");
+    return 2;
+}
+
+// hash [-r] [name ...]
+static int builtin_hash(struct shell *sh, char **argv) {
+    if (!sh) return 0;
+    int rval = 0;
+    if (!argv[1]) {
+        cmd_hash_print(&sh->hash, stdout);
+    } else if (strcmp(argv[1], "-r") == 0) {
+        cmd_hash_clear(&sh->hash);
+    } else {
+        for (int i = 1; argv[i]; i++) {
+            if (!cmd_hash_add(&sh->hash, argv[i])) {
+                fprintf(stderr, "hash: %s: not found\n", argv[i]);
+                rval = EXIT_FAILURE;
+            }
+        }
+    }
+    return rval;
+}
+
+// pwd
+static int builtin_pwd(struct shell *sh, char **argv) {
+    UNUSED(argv);
+    // The cwd as of the last cd, no system call needed
+    const char *cwd = sh_cwd(sh);
+    char buf[PATH_MAX];
+    if (!cwd && !(cwd = getcwd(buf, sizeof(buf)))) {
+        perror("pwd");
+        return EXIT_FAILURE;
+    }
+    out_str(cwd);
+    out_char('\n');
+    return 0;
+}
+
+// true
+static int builtin_true(struct shell *sh, char **argv) {
+    UNUSED(sh);
+    UNUSED(argv);
+    return 0;
+}
+
+// false
+static int builtin_false(struct shell *sh, char **argv) {
+    UNUSED(sh);
+    UNUSED(argv);
+    return 1;
+}
+
+// history -s text: every entry containing text, oldest first
+static int history_search(struct shell *sh, const char *text) {
+    ssize_t *ids = NULL;
+    size_t n = 0, cap = 0;
+    for (ssize_t id = hist_search(&sh->history, text, SIZE_MAX); id >= 0;
+         id = hist_search(&sh->history, text, id)) {
+        if (n == cap) {
+            cap = cap ? cap * 2 : 16;
+            ssize_t *grown = realloc(ids, cap * sizeof(*ids));
+            if (!grown) {
+                free(ids);
+                perror("history");
+                return EXIT_FAILURE;
+            }
+            ids = grown;
+        }
+        ids[n++] = id;
+    }
+    for (size_t i = n; i-- > 0;) {
+        out_printf("%5zd  %s\n", ids[i] + 1, hist_entry(&sh->history, ids[i], NULL));
+    }
+    free(ids);
+    return n ? 0 : 1;
+}
+
+// history [n] and history -s text
+static int builtin_history(struct shell *sh, char **argv) {
+    if (!sh) return 0;
+    if (argv[1] && strcmp(argv[1], "-s") == 0) {
+        if (!argv[2]) {
+            fprintf(stderr, "history: -s: text expected\n");
+            return 2;
+        }
+        return history_search(sh, argv[2]);
+    }
+    size_t n = hist_count(&sh->history), first = 0;
+    if (argv[1]) {
+        char *end;
+        long want = strtol(argv[1], &end, 10);
+        if (*end || want < 0) {
+            fprintf(stderr, "history: %s: numeric argument required\n", argv[1]);
+            return 2;
+        }
+        if ((size_t)want < n) first = n - want;
+    }
+    for (size_t i = first; i < n; i++) {
+        out_printf("%5zu  %s\n", i + 1, hist_entry(&sh->history, i, NULL));
+    }
+    return 0;
+}
+
+// parallel [-j n] [-k] [--halt-on-error] [file]
+static int builtin_parallel(struct shell *sh, char **argv) {
+    if (!sh) return 0;
+    struct parallel_opts o = {0};
+    int i;
+    for (i = 1; argv[i] && argv[i][0] == '-' && argv[i][1]; i++) {
+        if (strcmp(argv[i], "--halt-on-error") == 0) {
+            o.halt_on_error = true;
+        } else if (strcmp(argv[i], "-k") == 0) {
+            o.keep_order = true;
+        } else if (strncmp(argv[i], "-j", 2) == 0) {
+            const char *n = argv[i][2] ? argv[i] + 2 : argv[++i];
+            char *end;
+            long jobs = n ? strtol(n, &end, 10) : 0;
+            if (!n || *end || jobs < 1) {
+                fprintf(stderr, "parallel: -j: positive number required\n");
+                return 2;
+            }
+            o.jobs = jobs;
+        } else {
+            fprintf(stderr, "parallel: usage: parallel [-j n] [-k] [--halt-on-error] [file]\n");
+            return 2;
+        }
+    }
+
+    int fd = STDIN_FILENO;
+    if (argv[i] && strcmp(argv[i], "-") != 0) {
+        fd = open(argv[i], O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            fprintf(stderr, "parallel: %s: %s\n", argv[i], strerror(errno));
+            return EXIT_FAILURE;
+        }
+    }
+    int rval = parallel_run(sh, fd, &o);
+    if (fd != STDIN_FILENO) close(fd);
+    return rval;
+}
+
+// True if name can be an environment variable: a letter or _, then
+// letters, digits and _
+static bool valid_name(const char *name, size_t len) {
+    if (!len || isdigit((unsigned char)name[0])) return false;
+    for (size_t i = 0; i < len; i++) {
+        if (!isalnum((unsigned char)name[i]) && name[i] != '_') return false;
+    }
+    return true;
+}
+
+// export [name[=value] ...]
+static int builtin_export(struct shell *sh, char **argv) {
+    UNUSED(sh);
+    if (!argv[1]) {
+        for (char **e = env_envp(); *e; e++) {
+            out_str("export ");
+            out_str(*e);
+            out_char('\n');
+        }
+        return 0;
+    }
+    int rval = 0;
+    for (int i = 1; argv[i]; i++) {
+        const char *eq = strchr(argv[i], '=');
+        size_t len = eq ? (size_t)(eq - argv[i]) : strlen(argv[i]);
+        if (!valid_name(argv[i], len)) {
+            fprintf(stderr, "export: `%s': not a valid identifier\n", argv[i]);
+            rval = EXIT_FAILURE;
+            continue;
+        }
+        // There are no unexported variables, so a bare name has nothing to do
+        if (!eq) continue;
+        char name[len + 1];
+        memcpy(name, argv[i], len);
+        name[len] = '\0';
+        if (env_set(name, eq + 1) == -1) {
+            fprintf(stderr, "export: %s: %s\n", name, strerror(errno));
+            rval = EXIT_FAILURE;
+        }
+    }
+    return rval;
+}
+
+// unset name ...
+static int builtin_unset(struct shell *sh, char **argv) {
+    UNUSED(sh);
+    int rval = 0;
+    for (int i = 1; argv[i]; i++) {
+        if (!valid_name(argv[i], strlen(argv[i]))) {
+            fprintf(stderr, "unset: `%s': not a valid identifier\n", argv[i]);
+            rval = EXIT_FAILURE;
+        } else if (env_unset(argv[i]) == -1) {
+            fprintf(stderr, "unset: %s: %s\n", argv[i], strerror(errno));
+            rval = EXIT_FAILURE;
+        }
+    }
+    return rval;
+}
+
+// env, only ever run without arguments (see BUILTIN_BARE)
+static int builtin_env(struct shell *sh, char **argv) {
+    UNUSED(sh);
+    if (argv[1]) {
+        fprintf(stderr, "env: arguments are for the external env\n");
+        return 125;
+    }
+    for (char **e = env_envp(); *e; e++) {
+        out_str(*e);
+        out_char('\n');
+    }
+    return 0;
+}
+
+// Every builtin the shell knows about. Add new ones here.
+static const struct builtin builtins[] = {
+    { "exit", builtin_exit,  BUILTIN_PARENT },
+    { "cd",   builtin_cd,    BUILTIN_PARENT },
+    { "fg",   builtin_fg_bg, BUILTIN_PARENT },
+    { "bg",   builtin_fg_bg, BUILTIN_PARENT },
+    { "jobs", builtin_jobs,  BUILTIN_PARENT },
+    { "set",  builtin_set,   BUILTIN_PARENT },
+    { "hash", builtin_hash,  BUILTIN_PARENT },
+    { "history", builtin_history, BUILTIN_PARENT },
+    { "parallel", builtin_parallel, BUILTIN_PARENT },
+    { "pushd", builtin_pushd, BUILTIN_PARENT },
+    { "popd",  builtin_popd,  BUILTIN_PARENT },
+    { "dirs",  builtin_dirs,  BUILTIN_PARENT },
+    { "j",     builtin_j,     BUILTIN_PARENT },
+    { "export", builtin_export, BUILTIN_PARENT },
+    { "unset",  builtin_unset,  BUILTIN_PARENT },
+    // Stand-ins for external commands, run in the shell to save a fork
+    { "echo",   builtin_echo,   0 },
+    { "printf", builtin_printf, 0 },
+    { "pwd",    builtin_pwd,    0 },
+    { "true",   builtin_true,   0 },
+    { "false",  builtin_false,  0 },
+    { "test",   builtin_test,   0 },
+    { "[",      builtin_test,   0 },
+    { "env",    builtin_env,    BUILTIN_BARE },
+};
+#define N_BUILTINS (sizeof(builtins) / sizeof(builtins[0]))
+
+// Perfect hash over the names above: slot i holds the builtin whose seeded
+// hash lands there, and no two builtins share a slot. The size is the next
+// power of two at or above 4 * N_BUILTINS so a seed is found in a few tries.
+#define SLOT_BITS(n) ((n) <= 2 ? 3 : (n) <= 4 ? 4 : (n) <= 8 ? 5 : (n) <= 16 ? 6 : (n) <= 32 ? 7 : 8)
+#define N_SLOTS (1u << SLOT_BITS(N_BUILTINS))
+_Static_assert(N_BUILTINS <= 64, "grow SLOT_BITS for more builtins");
+
+static const struct builtin *slots[N_SLOTS];
+static unsigned long seed;
+static bool built;
+
+static unsigned long seeded_hash(const char *s, unsigned long h) {
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211UL;
+    }
+    return h ^ (h >> 29);
+}
+
+// Try seeds until every builtin lands in its own slot. The names are
+// fixed at compile time so the result is the same on every run.
+static void build_table(void) {
+    for (seed = 14695981039346656037UL;; seed++) {
+        memset(slots, 0, sizeof(slots));
+        size_t i;
+        for (i = 0; i < N_BUILTINS; i++) {
+            const struct builtin **slot = &slots[seeded_hash(builtins[i].name, seed) & (N_SLOTS - 1)];
+            if (*slot) break;
+            *slot = &builtins[i];
+        }
+        if (i == N_BUILTINS) break;
+    }
+    built = true;
+}
+
+const struct builtin *builtin_find(const char *name) {
+    if (!name) return NULL;
+    if (!built) build_table();
+    const struct builtin *b = slots[seeded_hash(name, seed) & (N_SLOTS - 1)];
+    return b && strcmp(b->name, name) == 0 ? b : NULL;
+}
+
+// Run a builtin and report the time and resources it used in the shell
+int do_builtin_timed(struct shell *sh, char **argv) {
+    struct cmd_usage u = {0};
+    struct rusage before, after;
+    getrusage(RUSAGE_SELF, &before);
+    clock_gettime(CLOCK_MONOTONIC, &u.start);
+
+    do_builtin(sh, argv);
+
+    clock_gettime(CLOCK_MONOTONIC, &u.end);
+    getrusage(RUSAGE_SELF, &after);
+    fflush(stdout);
+    timersub(&after.ru_utime, &before.ru_utime, &u.utime);
+    timersub(&after.ru_stime, &before.ru_stime, &u.stime);
+    u.maxrss = after.ru_maxrss;
+    u.nvcsw = after.ru_nvcsw - before.ru_nvcsw;
+    u.nivcsw = after.ru_nivcsw - before.ru_nivcsw;
+    usage_print(&u, stderr);
+    return sh->last_status;
+}
+
+// Handles built-in commands like exit, cd, and fg
+bool do_builtin(struct shell *sh, char **argv) {
+    if (!argv || !argv[0]) {
+        return false;
+    }
+
+    const struct builtin *b = builtin_find(argv[0]);
+    if (!b) return false;
+
+    int status = b->fn(sh, argv);
+    if (out_flush() == -1) {
+        fprintf(stderr, "%s: write error: %s\n", argv[0], strerror(errno));
+        if (!status) status = EXIT_FAILURE;
+    }
+    if (sh) sh->last_status = status;
+    return true;
+}
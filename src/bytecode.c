@@ -0,0 +1,430 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "lab.h"
+
+/*
+ * Compiled scripts. A script has no expansions, so everything pipeline_parse
+ * works out for a line is fixed by its text. The compiler keeps that result,
+ * a run of instructions over 32 bit words:
+ *
+ *   OP_RUN   op|flags ncmds nredirs nwords
+ *            per stage:  argc word...
+ *            per redir:  fd kind src stage word
+ *   OP_FAIL  op status       a line that did not parse
+ *
+ * Each word is an offset into a pool of NUL terminated strings after the
+ * code. The header, code and pool are one image, written as is to a hidden
+ * cache file next to the script. Running a cached script maps the image,
+ * checks it once, and rebuilds each struct pipeline from it without lexing.
+ *
+ * The header records the script's mtime, size and a hash of its text. A
+ * matching mtime and size is trusted as is. When only the mtime moved, as
+ * after a touch or a checkout, the text is hashed and the cache still used
+ * if it is unchanged, and written back with the new mtime.
+ */
+
+#define CODE_MAGIC 0x3143424cU  // "LBC1"
+// Bump whenever the format or what pipeline_parse produces changes
+#define CODE_VERSION 3
+
+enum {
+    OP_RUN = 1,
+    OP_FAIL,
+};
+
+#define CODE_BACKGROUND 0x100
+#define CODE_TIMED 0x200
+
+struct code_head {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t src_size;
+    int64_t src_sec;    // mtime of the script
+    int64_t src_nsec;
+    uint64_t src_hash;  // of the script text, see hash_text
+    uint32_t ncode;     // words of code
+    uint32_t pool_len;  // bytes of strings
+};
+
+_Static_assert(sizeof(struct code_head) == 48, "header is 48 bytes");
+
+// 64 bit FNV-1a, the same as lab_hash_str but for text with NULs in it
+static uint64_t hash_text(const char *s, size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static const struct code_head *head(const struct script_code *c) {
+    return (const struct code_head *)c->image;
+}
+
+static const uint32_t *code(const struct script_code *c) {
+    return (const uint32_t *)(c->image + sizeof(struct code_head));
+}
+
+static char *pool(const struct script_code *c) {
+    return c->image + sizeof(struct code_head) + head(c)->ncode * sizeof(uint32_t);
+}
+
+// Everything script_exec trusts: sizes, opcodes and every word offset
+static bool valid(const char *image, size_t len) {
+    if (len < sizeof(struct code_head)) return false;
+    const struct code_head *h = (const void *)image;
+    if (h->magic != CODE_MAGIC || h->version != CODE_VERSION) return false;
+    if ((len - sizeof(*h)) / sizeof(uint32_t) < h->ncode) return false;
+    if (len - sizeof(*h) - h->ncode * sizeof(uint32_t) != h->pool_len) return false;
+    const uint32_t *ip = (const void *)(image + sizeof(*h));
+    const uint32_t *end = ip + h->ncode;
+    const char *p = image + sizeof(*h) + h->ncode * sizeof(uint32_t);
+    if (h->pool_len && p[h->pool_len - 1]) return false;
+
+    while (ip < end) {
+        if ((*ip & 0xff) == OP_FAIL) {
+            if (end - ip < 2) return false;
+            ip += 2;
+            continue;
+        }
+        if ((*ip & 0xff) != OP_RUN || end - ip < 4) return false;
+        uint32_t ncmds = ip[1], nredirs = ip[2], nwords = ip[3];
+        ip += 4;
+        if (!ncmds) return false;
+        uint32_t words = 0;
+        for (uint32_t i = 0; i < ncmds; i++) {
+            if (ip == end || !*ip || (size_t)(end - ip - 1) < *ip) return false;
+            uint32_t argc = *ip++;
+            words += argc;
+            for (uint32_t k = 0; k < argc; k++) {
+                if (*ip++ >= h->pool_len) return false;
+            }
+        }
+        if (words != nwords || (size_t)(end - ip) / 5 < nredirs) return false;
+        for (uint32_t i = 0; i < nredirs; i++, ip += 5) {
+            if (ip[0] > 9 || ip[1] > REDIR_STRING || ip[3] >= ncmds || ip[4] >= h->pool_len) return false;
+            // In stage order, as pipeline_launch hands them out
+            if (i && ip[3] < ip[-2]) return false;
+        }
+    }
+    return true;
+}
+
+// The image as it is built
+struct emitter {
+    uint32_t *code;
+    size_t n;
+    size_t cap;
+    char *pool;
+    size_t pool_len;
+    size_t pool_cap;
+    bool failed;
+};
+
+static void emit(struct emitter *e, uint32_t w) {
+    if (e->n == e->cap) {
+        size_t cap = e->cap ? e->cap * 2 : 256;
+        uint32_t *c = realloc(e->code, cap * sizeof(*c));
+        if (!c) {
+            e->failed = true;
+            return;
+        }
+        e->code = c;
+        e->cap = cap;
+    }
+    e->code[e->n++] = w;
+}
+
+static void emit_word(struct emitter *e, const char *s) {
+    size_t len = strlen(s) + 1;
+    if (e->pool_len + len > e->pool_cap) {
+        size_t cap = e->pool_cap ? e->pool_cap : 4096;
+        while (cap < e->pool_len + len) cap *= 2;
+        char *p = realloc(e->pool, cap);
+        if (!p) {
+            e->failed = true;
+            return;
+        }
+        e->pool = p;
+        e->pool_cap = cap;
+    }
+    emit(e, e->pool_len);
+    memcpy(e->pool + e->pool_len, s, len);
+    e->pool_len += len;
+}
+
+// Compile one line the way sh_exec_line would run it
+static void compile_line(struct emitter *e, char *line) {
+    line = trim_white(line);
+    if (!*line || *line == '#') return;
+
+    struct pipeline p;
+    if (pipeline_parse(line, &p) == -1) {
+        emit(e, OP_FAIL);
+        emit(e, errno == E2BIG ? 126 : 2);
+    } else {
+        uint32_t nwords = 0;
+        for (size_t i = 0; i < p.ncmds; i++) {
+            for (char **a = p.cmds[i]; *a; a++) nwords++;
+        }
+        emit(e, OP_RUN | (p.background ? CODE_BACKGROUND : 0) | (p.timed ? CODE_TIMED : 0));
+        emit(e, p.ncmds);
+        emit(e, p.nredirs);
+        emit(e, nwords);
+        for (size_t i = 0; i < p.ncmds; i++) {
+            size_t argc = 0;
+            while (p.cmds[i][argc]) argc++;
+            emit(e, argc);
+            for (size_t k = 0; k < argc; k++) emit_word(e, p.cmds[i][k]);
+        }
+        for (size_t i = 0; i < p.nredirs; i++) {
+            const struct redir *r = &p.redirs[i];
+            emit(e, r->fd);
+            emit(e, r->kind);
+            emit(e, r->src);
+            emit(e, r->stage);
+            emit_word(e, r->word);
+        }
+    }
+    pipeline_free(&p);
+}
+
+int script_compile(const char *buf, size_t len, const struct stat *st, struct script_code *c) {
+    memset(c, 0, sizeof(*c));
+    struct emitter e = {0};
+    size_t cap = 256;
+    char *line = malloc(cap);
+    if (!line) return -1;
+
+    // Each line is parsed in a copy, the text itself stays untouched
+    for (const char *p = buf, *end = buf + len; p < end && !e.failed;) {
+        const char *nl = memchr(p, '\n', end - p);
+        size_t n = (nl ? nl : end) - p;
+        if (n + 1 > cap) {
+            while (cap < n + 1) cap *= 2;
+            char *bigger = realloc(line, cap);
+            if (!bigger) {
+                e.failed = true;
+                break;
+            }
+            line = bigger;
+        }
+        memcpy(line, p, n);
+        line[n] = '\0';
+        compile_line(&e, line);
+        p += n + 1;
+    }
+    free(line);
+
+    size_t size = sizeof(struct code_head) + e.n * sizeof(uint32_t) + e.pool_len;
+    char *image = e.failed || e.n > UINT32_MAX || e.pool_len > UINT32_MAX ? NULL : malloc(size);
+    if (image) {
+        struct code_head h = {
+            .magic = CODE_MAGIC,
+            .version = CODE_VERSION,
+            .src_size = len,
+            .src_sec = st ? st->st_mtim.tv_sec : 0,
+            .src_nsec = st ? st->st_mtim.tv_nsec : 0,
+            .src_hash = hash_text(buf, len),
+            .ncode = e.n,
+            .pool_len = e.pool_len,
+        };
+        memcpy(image, &h, sizeof(h));
+        if (e.n) memcpy(image + sizeof(h), e.code, e.n * sizeof(uint32_t));
+        if (e.pool_len) memcpy(image + sizeof(h) + e.n * sizeof(uint32_t), e.pool, e.pool_len);
+        c->image = image;
+        c->len = size;
+    }
+    free(e.code);
+    free(e.pool);
+    return image ? 0 : -1;
+}
+
+void script_code_free(struct script_code *c) {
+    if (c->mapped) munmap(c->image, c->len);
+    else free(c->image);
+    memset(c, 0, sizeof(*c));
+}
+
+char *script_cache_path(const char *path) {
+    const char *slash = strrchr(path, '/');
+    const char *name = slash ? slash + 1 : path;
+    size_t dir = name - path;
+    if (!*name) return NULL;
+    size_t len = dir + strlen(name) + sizeof("..labc");
+    char *cache = malloc(len);
+    if (cache) snprintf(cache, len, "%.*s.%s.labc", (int)dir, path, name);
+    return cache;
+}
+
+// Replace the cache with c, next to it first and then renamed into place
+static void save_cache(const char *cache_path, const struct script_code *c) {
+    size_t len = strlen(cache_path);
+    char *tmp = malloc(len + sizeof(".XXXXXX"));
+    if (!tmp) return;
+    memcpy(tmp, cache_path, len);
+    memcpy(tmp + len, ".XXXXXX", sizeof(".XXXXXX"));
+    int fd = mkostemp(tmp, O_CLOEXEC);
+    if (fd == -1) {
+        free(tmp);
+        return;
+    }
+    bool ok = true;
+    for (size_t done = 0; ok && done < c->len;) {
+        ssize_t n = write(fd, c->image + done, c->len - done);
+        if (n == -1 && errno == EINTR) continue;
+        ok = n > 0;
+        if (ok) done += n;
+    }
+    // A torn cache is harmless, valid rejects it, so there is no fsync
+    if (close(fd) == -1) ok = false;
+    if (!ok || rename(tmp, cache_path) == -1) unlink(tmp);
+    free(tmp);
+}
+
+// The cache at cache_path if it was compiled from the script open on fd
+static int load_cache(const char *cache_path, int fd, const struct stat *st, struct script_code *c) {
+    int cfd = open(cache_path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (cfd == -1) return -1;
+    struct stat cst;
+    // Only trust code written by us, whoever can write the directory
+    if (fstat(cfd, &cst) == -1 || !S_ISREG(cst.st_mode) || cst.st_uid != geteuid() ||
+        (size_t)cst.st_size < sizeof(struct code_head)) {
+        close(cfd);
+        return -1;
+    }
+    // Private and writable: argv strings point into it and must be char *
+    char *image = mmap(NULL, cst.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, cfd, 0);
+    close(cfd);
+    if (image == MAP_FAILED) return -1;
+    c->image = image;
+    c->len = cst.st_size;
+    c->mapped = true;
+
+    struct code_head *h = (struct code_head *)c->image;
+    bool fresh = h->magic == CODE_MAGIC && h->version == CODE_VERSION && h->src_size == (uint64_t)st->st_size;
+    bool moved = fresh && (h->src_sec != st->st_mtim.tv_sec || h->src_nsec != st->st_mtim.tv_nsec);
+    if (moved) {
+        // Touched or checked out again, the text decides
+        char *text = st->st_size ? mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+        if (text == MAP_FAILED) {
+            fresh = false;
+        } else {
+            fresh = hash_text(text, st->st_size) == h->src_hash;
+            if (text) munmap(text, st->st_size);
+        }
+    }
+    if (!fresh || !valid(c->image, c->len)) {
+        script_code_free(c);
+        return -1;
+    }
+    if (moved) {
+        // Record the new mtime so the next run trusts it without hashing.
+        // The mapping is private, the old cache stays as it was until the
+        // rename.
+        h->src_sec = st->st_mtim.tv_sec;
+        h->src_nsec = st->st_mtim.tv_nsec;
+        save_cache(cache_path, c);
+    }
+    return 0;
+}
+
+int script_code_load(const char *path, int fd, struct script_code *c) {
+    memset(c, 0, sizeof(*c));
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) return -1;
+    char *cache = script_cache_path(path);
+    if (cache && load_cache(cache, fd, &st, c) == 0) {
+        free(cache);
+        return 0;
+    }
+
+    char *text = st.st_size ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    int rval = -1;
+    if (text != MAP_FAILED) {
+        if (text) madvise(text, st.st_size, MADV_SEQUENTIAL);
+        rval = script_compile(text ? text : "", st.st_size, &st, c);
+        if (text) munmap(text, st.st_size);
+    }
+    // A directory we cannot write to only costs the next run a compile
+    if (rval == 0 && cache) save_cache(cache, c);
+    free(cache);
+    return rval;
+}
+
+// Room for n items of size bytes in *buf, which holds *cap of them
+static void *reserve(void *buf, size_t *cap, size_t n, size_t size) {
+    if (n <= *cap) return buf;
+    size_t want = *cap ? *cap : 16;
+    while (want < n) want *= 2;
+    void *p = realloc(buf, want * size);
+    if (!p) {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    *cap = want;
+    return p;
+}
+
+int script_exec(struct shell *sh, const struct script_code *c) {
+    // Compiled here or checked by load_cache, either way it holds together
+    const uint32_t *ip = code(c);
+    const uint32_t *end = ip + head(c)->ncode;
+    char *strings = pool(c);
+
+    // One pipeline's arrays, reused by every line
+    char **argv = NULL;
+    char ***cmds = NULL;
+    struct redir *redirs = NULL;
+    size_t argv_cap = 0, cmds_cap = 0, redirs_cap = 0;
+
+    while (ip < end) {
+        if ((*ip & 0xff) == OP_FAIL) {
+            sh->last_status = ip[1];
+            fprintf(stderr, ip[1] == 126 ? "argument list too long\n" : "syntax error\n");
+            ip += 2;
+            sh_report_jobs(sh);
+            continue;
+        }
+
+        struct pipeline p = {0};
+        p.background = *ip & CODE_BACKGROUND;
+        p.timed = *ip & CODE_TIMED;
+        p.ncmds = ip[1];
+        p.nredirs = ip[2];
+        argv = reserve(argv, &argv_cap, ip[3] + p.ncmds, sizeof(*argv));
+        cmds = reserve(cmds, &cmds_cap, p.ncmds, sizeof(*cmds));
+        redirs = reserve(redirs, &redirs_cap, p.nredirs, sizeof(*redirs));
+        ip += 4;
+
+        char **a = argv;
+        for (size_t i = 0; i < p.ncmds; i++) {
+            cmds[i] = a;
+            for (uint32_t argc = *ip++; argc; argc--) *a++ = strings + *ip++;
+            *a++ = NULL;
+        }
+        for (size_t i = 0; i < p.nredirs; i++, ip += 5) {
+            // Fresh every run, redir_prepare keeps descriptors in src
+            redirs[i] = (struct redir){
+                .fd = ip[0], .kind = ip[1], .src = (int)ip[2], .stage = ip[3], .word = strings + ip[4],
+            };
+        }
+        p.argv = argv;
+        p.cmds = cmds;
+        p.redirs = p.nredirs ? redirs : NULL;
+        sh_exec_pipeline(sh, &p);
+        sh_report_jobs(sh);
+    }
+
+    free(argv);
+    free(cmds);
+    free(redirs);
+    return sh->last_status;
+}
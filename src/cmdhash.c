@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "lab.h"
+
+#define CMD_HASH_MIN_CAP 64
+
+// FNV-1a string hash
+unsigned long lab_hash_str(const char *s) {
+    unsigned long h = 14695981039346656037UL;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211UL;
+    }
+    return h;
+}
+
+// Returns true if path names an executable regular file
+static bool is_executable(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, X_OK) == 0;
+}
+
+// Walks the PATH list the same way execvp does and returns a malloc'd
+// absolute path for name, or NULL if it is not found
+char *path_search(const char *path_env, const char *name) {
+    if (!path_env || !name || !*name) return NULL;
+
+    size_t nlen = strlen(name);
+    const char *dir = path_env;
+    while (1) {
+        const char *end = strchr(dir, ':');
+        size_t dlen = end ? (size_t)(end - dir) : strlen(dir);
+        // An empty PATH element means the current directory
+        const char *d = dlen ? dir : ".";
+        if (!dlen) dlen = 1;
+
+        char *full = malloc(dlen + nlen + 2);
+        if (!full) return NULL;
+        memcpy(full, d, dlen);
+        full[dlen] = '/';
+        memcpy(full + dlen + 1, name, nlen + 1);
+        if (is_executable(full)) return full;
+        free(full);
+
+        if (!end) break;
+        dir = end + 1;
+    }
+    return NULL;
+}
+
+// Drop every entry but keep the slot array and statistics
+void cmd_hash_clear(struct cmd_hash *h) {
+    if (!h) return;
+    for (size_t i = 0; i < h->cap; i++) {
+        free(h->slots[i].name);
+        free(h->slots[i].path);
+        h->slots[i].name = NULL;
+        h->slots[i].path = NULL;
+        h->slots[i].hits = 0;
+    }
+    h->count = 0;
+}
+
+// Release everything owned by the cache
+void cmd_hash_destroy(struct cmd_hash *h) {
+    if (!h) return;
+    cmd_hash_clear(h);
+    free(h->slots);
+    free(h->path_env);
+    cmd_index_destroy(&h->index);
+    memset(h, 0, sizeof(*h));
+}
+
+// Finds the slot holding name or the empty slot where it belongs
+static struct cmd_hash_entry *find_slot(struct cmd_hash *h, const char *name) {
+    size_t mask = h->cap - 1;
+    size_t i = lab_hash_str(name) & mask;
+    while (h->slots[i].name && strcmp(h->slots[i].name, name) != 0) {
+        i = (i + 1) & mask;
+    }
+    return &h->slots[i];
+}
+
+// Double the table once it is 70% full
+static int grow(struct cmd_hash *h) {
+    if (h->cap && (h->count + 1) * 10 < h->cap * 7) return 0;
+
+    size_t ncap = h->cap ? h->cap * 2 : CMD_HASH_MIN_CAP;
+    struct cmd_hash_entry *old = h->slots;
+    size_t ocap = h->cap;
+    h->slots = calloc(ncap, sizeof(*h->slots));
+    if (!h->slots) {
+        h->slots = old;
+        return -1;
+    }
+    h->cap = ncap;
+    for (size_t i = 0; i < ocap; i++) {
+        if (old[i].name) *find_slot(h, old[i].name) = old[i];
+    }
+    free(old);
+    return 0;
+}
+
+// Throw the cache away when PATH no longer matches what it was built from
+static void check_path(struct cmd_hash *h) {
+    const char *path_env = env_get("PATH");
+    if (!path_env) path_env = "";
+    if (h->path_env && strcmp(h->path_env, path_env) == 0) return;
+
+    cmd_hash_clear(h);
+    free(h->path_env);
+    h->path_env = strdup(path_env);
+}
+
+// Resolve name against PATH and remember the result
+static struct cmd_hash_entry *insert(struct cmd_hash *h, const char *name) {
+    // Once completion has read PATH there is no need to probe it again
+    char *path = h->index.nodes && cmd_index_refresh(&h->index, h->path_env) == 0
+                     ? cmd_index_path(&h->index, name)
+                     : path_search(h->path_env, name);
+    if (!path) return NULL;
+    if (grow(h) == -1) {
+        free(path);
+        return NULL;
+    }
+    struct cmd_hash_entry *e = find_slot(h, name);
+    if (e->name) {
+        free(e->path);
+    } else {
+        e->name = strdup(name);
+        e->hits = 0;
+        h->count++;
+    }
+    e->path = path;
+    return e;
+}
+
+const char *cmd_hash_lookup(struct cmd_hash *h, const char *name) {
+    if (!name || !*name) return NULL;
+    // Anything with a slash is used as-is, just like execvp
+    if (strchr(name, '/')) return name;
+
+    check_path(h);
+    h->lookups++;
+    if (h->cap) {
+        struct cmd_hash_entry *e = find_slot(h, name);
+        if (e->name) {
+            h->hits++;
+            e->hits++;
+            return e->path;
+        }
+    }
+    struct cmd_hash_entry *e = insert(h, name);
+    if (!e) return NULL;
+    e->hits++;
+    return e->path;
+}
+
+const char *cmd_hash_add(struct cmd_hash *h, const char *name) {
+    if (!name || !*name || strchr(name, '/')) return NULL;
+    check_path(h);
+    struct cmd_hash_entry *e = insert(h, name);
+    return e ? e->path : NULL;
+}
+
+const struct cmd_index *cmd_hash_index(struct cmd_hash *h) {
+    check_path(h);
+    if (!h->path_env || cmd_index_refresh(&h->index, h->path_env) == -1) return NULL;
+    return &h->index;
+}
+
+void cmd_hash_print(const struct cmd_hash *h, FILE *out) {
+    if (!h->count) {
+        fprintf(out, "hash: hash table empty\n");
+    } else {
+        fprintf(out, "hits\tcommand\n");
+        for (size_t i = 0; i < h->cap; i++) {
+            if (h->slots[i].name) {
+                fprintf(out, "%4lu\t%s\n", h->slots[i].hits, h->slots[i].path);
+            }
+        }
+    }
+    double rate = h->lookups ? 100.0 * h->hits / h->lookups : 0.0;
+    fprintf(out, "hit rate: %lu/%lu (%.1f%%)\n", h->hits, h->lookups, rate);
+}
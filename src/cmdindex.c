@@ -0,0 +1,330 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "lab.h"
+
+/*
+ * Index of every executable on PATH for command completion. Each PATH
+ * directory keeps a sorted list of the executables it held when it was
+ * last read, and a byte trie holds the union of all of them. A directory
+ * is read again only when its mtime changes, and then only the names that
+ * came or went touch the trie. Trie children are kept in byte order, so a
+ * walk lists names sorted the way strcmp sorts them.
+ *
+ * Every trie node counts the directories that have a name ending there
+ * and the live names below it. A name that disappears just drops its
+ * counts, and walks skip subtrees with nothing live left.
+ */
+
+struct cmd_trie_node {
+    uint32_t child;    // first child, 0 for none (the root is never a child)
+    uint32_t sibling;  // next child of the same parent, larger byte
+    uint32_t ends;     // directories holding the name that ends here
+    uint32_t live;     // names below, this one included, with ends > 0
+    unsigned char c;
+};
+
+struct cmd_dir {
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    bool scanned;
+    bool racy;        // changed so close to the scan it might change again unseen
+    char *pool;       // the names, NUL separated
+    size_t *names;    // offsets into pool, sorted by name
+    size_t n;
+};
+
+// The node for byte c under parent, added in order if create is set
+static uint32_t trie_child(struct cmd_index *x, uint32_t parent, unsigned char c, bool create) {
+    uint32_t *link = &x->nodes[parent].child;
+    while (*link && x->nodes[*link].c < c) link = &x->nodes[*link].sibling;
+    if (*link && x->nodes[*link].c == c) return *link;
+    if (!create) return 0;
+
+    if (x->nnodes == x->cap) {
+        size_t cap = x->cap * 2;
+        struct cmd_trie_node *nodes = realloc(x->nodes, cap * sizeof(*nodes));
+        if (!nodes) return 0;
+        // link pointed into the old array
+        link = (uint32_t *)((char *)nodes + ((char *)link - (char *)x->nodes));
+        x->nodes = nodes;
+        x->cap = cap;
+    }
+    uint32_t id = x->nnodes++;
+    x->nodes[id] = (struct cmd_trie_node){ .sibling = *link, .c = c };
+    *link = id;
+    return id;
+}
+
+// Add (delta 1) or drop (delta -1) one directory's claim on name
+static int trie_update(struct cmd_index *x, const char *name, int delta) {
+    uint32_t path[NAME_MAX + 1];
+    size_t depth = 0;
+    uint32_t node = 0;
+    path[depth++] = 0;
+    for (const unsigned char *s = (const unsigned char *)name; *s; s++) {
+        node = trie_child(x, node, *s, delta > 0);
+        if (!node) return delta > 0 ? -1 : 0;
+        path[depth++] = node;
+    }
+    struct cmd_trie_node *end = &x->nodes[node];
+    bool was_live = end->ends > 0;
+    end->ends += delta;
+    bool is_live = end->ends > 0;
+    if (was_live != is_live) {
+        for (size_t i = 0; i < depth; i++) x->nodes[path[i]].live += is_live ? 1 : -1;
+        x->count += is_live ? 1 : -1;
+    }
+    return 0;
+}
+
+static int name_cmp(const void *a, const void *b, void *pool) {
+    return strcmp((char *)pool + *(const size_t *)a, (char *)pool + *(const size_t *)b);
+}
+
+// Binary search of d's sorted names
+static bool has_name(const struct cmd_dir *d, const char *name) {
+    size_t lo = 0, hi = d->n;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        int cmp = strcmp(name, d->pool + d->names[mid]);
+        if (cmp == 0) return true;
+        if (cmp < 0) hi = mid;
+        else lo = mid + 1;
+    }
+    return false;
+}
+
+// Read the executables in d into a fresh sorted list. A directory that
+// cannot be opened simply has no names.
+static int read_dir(struct cmd_dir *d, char **pool, size_t **names, size_t *count) {
+    *pool = NULL;
+    *names = NULL;
+    *count = 0;
+    int dfd = open(d->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd == -1) return 0;
+    DIR *dir = fdopendir(dfd);
+    if (!dir) {
+        close(dfd);
+        return 0;
+    }
+
+    size_t used = 0, size = 0, cap = 0;
+    struct dirent *e;
+    while ((e = readdir(dir))) {
+        if (e->d_name[0] == '.' && (!e->d_name[1] || (e->d_name[1] == '.' && !e->d_name[2]))) continue;
+        if (e->d_type != DT_REG && e->d_type != DT_LNK && e->d_type != DT_UNKNOWN) continue;
+        // Same test as path_search: an executable regular file. Names from
+        // the last read passed it already, a chmod does not touch the
+        // directory mtime either way.
+        if (!has_name(d, e->d_name)) {
+            struct stat st;
+            if (fstatat(dfd, e->d_name, &st, 0) == -1 || !S_ISREG(st.st_mode)) continue;
+            if (faccessat(dfd, e->d_name, X_OK, 0) == -1) continue;
+        }
+
+        size_t len = strlen(e->d_name) + 1;
+        if (used + len > size) {
+            size = size ? size * 2 : 4096;
+            while (used + len > size) size *= 2;
+            char *grown = realloc(*pool, size);
+            if (!grown) goto fail;
+            *pool = grown;
+        }
+        if (*count == cap) {
+            cap = cap ? cap * 2 : 64;
+            size_t *grown = realloc(*names, cap * sizeof(**names));
+            if (!grown) goto fail;
+            *names = grown;
+        }
+        memcpy(*pool + used, e->d_name, len);
+        (*names)[(*count)++] = used;
+        used += len;
+    }
+    qsort_r(*names, *count, sizeof(**names), name_cmp, *pool);
+    closedir(dir);
+    return 0;
+fail:
+    closedir(dir);
+    free(*pool);
+    free(*names);
+    *pool = NULL;
+    *names = NULL;
+    *count = 0;
+    return -1;
+}
+
+// Read d again and move the trie over to what it holds now. st is the
+// directory's stat, NULL if it is gone.
+static int rescan(struct cmd_index *x, struct cmd_dir *d, const struct stat *st) {
+    char *pool = NULL;
+    size_t *names = NULL, n = 0;
+    time_t now = time(NULL);
+    if (st && read_dir(d, &pool, &names, &n) == -1) return -1;
+
+    // Both lists are sorted, so one merge finds what came and went
+    size_t i = 0, j = 0;
+    while (i < d->n || j < n) {
+        int cmp = i == d->n ? 1 : j == n ? -1 : strcmp(d->pool + d->names[i], pool + names[j]);
+        if (cmp < 0) {
+            trie_update(x, d->pool + d->names[i++], -1);
+        } else if (cmp > 0) {
+            if (trie_update(x, pool + names[j++], 1) == -1) {
+                free(pool);
+                free(names);
+                return -1;
+            }
+        } else {
+            i++;
+            j++;
+        }
+    }
+    x->rescans++;
+
+    free(d->pool);
+    free(d->names);
+    d->pool = pool;
+    d->names = names;
+    d->n = n;
+    d->scanned = st != NULL;
+    if (st) {
+        d->dev = st->st_dev;
+        d->ino = st->st_ino;
+        d->mtime = st->st_mtim;
+        // An mtime only moves once per clock tick, so a change made in the
+        // same tick as this scan would go unnoticed. Look again next time.
+        d->racy = st->st_mtim.tv_sec >= now - 1;
+    }
+    return 0;
+}
+
+void cmd_index_destroy(struct cmd_index *x) {
+    for (size_t i = 0; i < x->ndirs; i++) {
+        free(x->dirs[i].path);
+        free(x->dirs[i].pool);
+        free(x->dirs[i].names);
+    }
+    free(x->dirs);
+    free(x->nodes);
+    free(x->path_env);
+    memset(x, 0, sizeof(*x));
+}
+
+// Start over with the directories in path_env and an empty trie
+static int reset(struct cmd_index *x, const char *path_env) {
+    cmd_index_destroy(x);
+    x->path_env = strdup(path_env);
+    x->cap = 256;
+    x->nodes = malloc(x->cap * sizeof(*x->nodes));
+    size_t n = 1;
+    for (const char *p = path_env; *p; p++) n += *p == ':';
+    x->dirs = calloc(n, sizeof(*x->dirs));
+    if (!x->path_env || !x->nodes || !x->dirs) return -1;
+    x->nodes[0] = (struct cmd_trie_node){0};
+    x->nnodes = 1;
+
+    for (const char *dir = path_env;; dir++) {
+        size_t len = strcspn(dir, ":");
+        // An empty PATH element means the current directory
+        x->dirs[x->ndirs].path = len ? strndup(dir, len) : strdup(".");
+        if (!x->dirs[x->ndirs++].path) return -1;
+        dir += len;
+        if (!*dir) break;
+    }
+    return 0;
+}
+
+int cmd_index_refresh(struct cmd_index *x, const char *path_env) {
+    if (!path_env) path_env = "";
+    if ((!x->path_env || strcmp(x->path_env, path_env) != 0) && reset(x, path_env) == -1) {
+        cmd_index_destroy(x);
+        return -1;
+    }
+
+    for (size_t i = 0; i < x->ndirs; i++) {
+        struct cmd_dir *d = &x->dirs[i];
+        struct stat st;
+        if (stat(d->path, &st) == -1) {
+            // Gone, or never there: drop whatever it had
+            if (d->n || d->scanned) rescan(x, d, NULL);
+            continue;
+        }
+        if (d->scanned && !d->racy && d->dev == st.st_dev && d->ino == st.st_ino &&
+            d->mtime.tv_sec == st.st_mtim.tv_sec && d->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+            continue;
+        }
+        if (rescan(x, d, &st) == -1) {
+            // The trie may be half updated, build it all again next time
+            cmd_index_destroy(x);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+char *cmd_index_path(const struct cmd_index *x, const char *name) {
+    // The trie answers the common case, a name that is nowhere
+    uint32_t node = 0;
+    for (const unsigned char *s = (const unsigned char *)name; *s && node != UINT32_MAX; s++) {
+        uint32_t c = x->nodes[node].child;
+        while (c && x->nodes[c].c < *s) c = x->nodes[c].sibling;
+        node = c && x->nodes[c].c == *s ? c : UINT32_MAX;
+    }
+    if (!*name || node == UINT32_MAX || !x->nodes[node].ends) return NULL;
+
+    // The first directory in PATH order wins, like execvp
+    for (size_t i = 0; i < x->ndirs; i++) {
+        const struct cmd_dir *d = &x->dirs[i];
+        if (!has_name(d, name)) continue;
+        size_t dlen = strlen(d->path), nlen = strlen(name);
+        char *full = malloc(dlen + nlen + 2);
+        if (!full) return NULL;
+        memcpy(full, d->path, dlen);
+        full[dlen] = '/';
+        memcpy(full + dlen + 1, name, nlen + 1);
+        return full;
+    }
+    return NULL;
+}
+
+// Depth first walk in byte order, buf holds the name down to node
+static void walk(const struct cmd_index *x, uint32_t node, char *buf, size_t depth,
+                 void (*fn)(const char *name, void *arg), void *arg) {
+    if (x->nodes[node].ends) {
+        buf[depth] = '\0';
+        fn(buf, arg);
+    }
+    for (uint32_t c = x->nodes[node].child; c; c = x->nodes[c].sibling) {
+        if (!x->nodes[c].live) continue;
+        buf[depth] = x->nodes[c].c;
+        walk(x, c, buf, depth + 1, fn, arg);
+    }
+}
+
+size_t cmd_index_complete(const struct cmd_index *x, const char *prefix,
+                          void (*fn)(const char *name, void *arg), void *arg) {
+    if (!x->nodes) return 0;
+    size_t len = strlen(prefix);
+    if (len > NAME_MAX) return 0;
+    char buf[NAME_MAX + 1];
+    uint32_t node = 0;
+    for (size_t i = 0; i < len; i++) {
+        uint32_t c = x->nodes[node].child;
+        while (c && x->nodes[c].c < (unsigned char)prefix[i]) c = x->nodes[c].sibling;
+        if (!c || x->nodes[c].c != (unsigned char)prefix[i]) return 0;
+        node = c;
+        buf[i] = prefix[i];
+    }
+    size_t found = x->nodes[node].live;
+    if (found) walk(x, node, buf, len, fn, arg);
+    return found;
+}
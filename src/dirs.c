@@ -0,0 +1,183 @@
+#include <errno.h>
+#include <pwd.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "lab.h"
+
+/*
+ * The working directory and the directory stack. Every cd through the
+ * shell resolves the new directory once and keeps it in sh->cwd, so pwd,
+ * the prompt and anything else that needs the cwd read a string instead of
+ * calling getcwd. PWD and OLDPWD are exported for the commands the shell
+ * starts, and the new directory is recorded in the jump index.
+ */
+
+const char *sh_cwd(struct shell *sh) {
+    // The first caller pays for getcwd, a cd keeps it current after that
+    if (sh && !sh->cwd) sh->cwd = getcwd(NULL, 0);
+    return sh ? sh->cwd : NULL;
+}
+
+// chdir to path and move the cached cwd into OLDPWD
+static int go(struct shell *sh, const char *path) {
+    char *old = sh ? (char *)sh_cwd(sh) : getcwd(NULL, 0);
+    if (chdir(path) != 0) {
+        perror("cd");
+        if (!sh) free(old);
+        return -1;
+    }
+
+    char *cwd = getcwd(NULL, 0);
+    if (cwd) env_set("PWD", cwd);
+    if (old) env_set("OLDPWD", old);
+    if (sh) {
+        if (cwd) jump_visit(&sh->jumps, cwd, time(NULL));
+        free(sh->oldpwd);
+        sh->oldpwd = old;
+        sh->cwd = cwd;
+    } else {
+        free(old);
+        free(cwd);
+    }
+    return 0;
+}
+
+// Change working directory
+int change_dir(struct shell *sh, char **dir) {
+    if (!dir || !dir[1] || !dir[1][0]) {
+        const char *home = env_get("HOME");
+        if (!home) {
+            struct passwd *pw = getpwuid(getuid());
+            if (pw) home = pw->pw_dir;
+        }
+        if (!home) {
+            fprintf(stderr, "cd: HOME not set\n");
+            return -1;
+        }
+        return go(sh, home);
+    }
+    if (strcmp(dir[1], "-") == 0) {
+        const char *old = sh && sh->oldpwd ? sh->oldpwd : env_get("OLDPWD");
+        if (!old) {
+            fprintf(stderr, "cd: OLDPWD not set\n");
+            return -1;
+        }
+        // go frees the old OLDPWD, which may be this very string
+        char *path = strdup(old);
+        if (!path) return -1;
+        int rval = go(sh, path);
+        free(path);
+        return rval;
+    }
+    return go(sh, dir[1]);
+}
+
+void dir_stack_destroy(struct dir_stack *s) {
+    for (size_t i = 0; i < s->n; i++) free(s->dirs[i]);
+    free(s->dirs);
+    memset(s, 0, sizeof(*s));
+}
+
+static int push(struct dir_stack *s, char *dir) {
+    if (s->n == s->cap) {
+        size_t cap = s->cap ? s->cap * 2 : 8;
+        char **dirs = realloc(s->dirs, cap * sizeof(*dirs));
+        if (!dirs) return -1;
+        s->dirs = dirs;
+        s->cap = cap;
+    }
+    s->dirs[s->n++] = dir;
+    return 0;
+}
+
+// One directory the way dirs shows it, with $HOME as ~
+static void print_dir(const char *dir) {
+    const char *home = env_get("HOME");
+    size_t hlen = home ? strlen(home) : 0;
+    if (hlen > 1 && strncmp(dir, home, hlen) == 0 && (dir[hlen] == '/' || !dir[hlen])) {
+        out_char('~');
+        dir += hlen;
+    }
+    out_str(dir);
+}
+
+// The cwd, then the stack from the top down
+static void print_stack(struct shell *sh) {
+    const char *cwd = sh_cwd(sh);
+    print_dir(cwd ? cwd : ".");
+    for (size_t i = sh->dirs.n; i-- > 0;) {
+        out_char(' ');
+        print_dir(sh->dirs.dirs[i]);
+    }
+    out_char('\n');
+}
+
+// dirs [-c]
+int builtin_dirs(struct shell *sh, char **argv) {
+    if (!sh) return 0;
+    if (argv[1] && strcmp(argv[1], "-c") == 0) {
+        dir_stack_destroy(&sh->dirs);
+        return 0;
+    }
+    if (argv[1]) {
+        fprintf(stderr, "dirs: usage: dirs [-c]\n");
+        return 2;
+    }
+    print_stack(sh);
+    return 0;
+}
+
+// pushd [dir]
+int builtin_pushd(struct shell *sh, char **argv) {
+    if (!sh) return 0;
+    const char *cwd = sh_cwd(sh);
+    char *here = cwd ? strdup(cwd) : NULL;
+    if (!here) {
+        perror("pushd");
+        return EXIT_FAILURE;
+    }
+
+    char *to = argv[1];
+    char *top = NULL;
+    if (!to) {
+        // With no directory the top two entries trade places
+        if (!sh->dirs.n) {
+            fprintf(stderr, "pushd: no other directory\n");
+            free(here);
+            return EXIT_FAILURE;
+        }
+        top = sh->dirs.dirs[sh->dirs.n - 1];
+        to = top;
+    }
+    char *dir[] = { "cd", to, NULL };
+    if (change_dir(sh, dir) == -1) {
+        free(here);
+        return EXIT_FAILURE;
+    }
+    if (top) {
+        free(top);
+        sh->dirs.dirs[sh->dirs.n - 1] = here;
+    } else if (push(&sh->dirs, here) == -1) {
+        perror("pushd");
+        free(here);
+        return EXIT_FAILURE;
+    }
+    print_stack(sh);
+    return 0;
+}
+
+// popd
+int builtin_popd(struct shell *sh, char **argv) {
+    UNUSED(argv);
+    if (!sh) return 0;
+    if (!sh->dirs.n) {
+        fprintf(stderr, "popd: directory stack empty\n");
+        return EXIT_FAILURE;
+    }
+    char *dir[] = { "cd", sh->dirs.dirs[sh->dirs.n - 1], NULL };
+    if (change_dir(sh, dir) == -1) return EXIT_FAILURE;
+    free(sh->dirs.dirs[--sh->dirs.n]);
+    print_stack(sh);
+    return 0;
+}
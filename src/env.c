@@ -0,0 +1,247 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include "lab.h"
+
+extern char **environ;
+
+/*
+ * The environment behind a hash table. environ stays the list of
+ * variables, but it points at an array owned here: export and unset patch
+ * one slot of it in place, so getenv, execve and posix_spawn all see the
+ * current variables without an envp being built for every command. A hash
+ * from name to slot makes a lookup cost the same with 20 variables or
+ * 2000. The strings the shell started with are used where they are, only
+ * exported ones are allocated.
+ *
+ * Code outside the shell can still call setenv or unsetenv (libraries, the
+ * tests). setenv of a new name gives environ a new array, anything else
+ * rewrites slots of ours, so a lookup checks the array and the slot it
+ * found before trusting the table, and rebuilds it from environ if they
+ * no longer match.
+ */
+
+#define ENV_MIN_SLOTS 64
+
+struct env_var {
+    char *str;       // "NAME=value", also in envp at the same index
+    size_t name_len;
+    bool owned;      // allocated by env_set
+};
+
+static struct {
+    char **envp;     // what environ points at, NULL terminated
+    struct env_var *vars;
+    size_t n;
+    size_t cap;      // room in envp and vars, the terminator included
+    uint32_t *slots; // index into vars plus one, 0 for an empty slot
+    size_t nslots;
+} env;
+
+static size_t hash_name(const char *name, size_t len) {
+    size_t h = 14695981039346656037UL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)name[i];
+        h *= 1099511628211UL;
+    }
+    return h ^ (h >> 29);
+}
+
+// The slot holding name, or the empty slot where it would go
+static size_t find_slot(const char *name, size_t len) {
+    size_t mask = env.nslots - 1;
+    size_t k = hash_name(name, len) & mask;
+    while (env.slots[k]) {
+        const struct env_var *v = &env.vars[env.slots[k] - 1];
+        if (v->name_len == len && memcmp(v->str, name, len) == 0) break;
+        k = (k + 1) & mask;
+    }
+    return k;
+}
+
+// Empty slot k, moving later entries of its probe run back so no lookup
+// stops early at the hole
+static void slot_delete(size_t k) {
+    size_t mask = env.nslots - 1;
+    size_t hole = k;
+    for (size_t j = (k + 1) & mask; env.slots[j]; j = (j + 1) & mask) {
+        const struct env_var *v = &env.vars[env.slots[j] - 1];
+        size_t home = hash_name(v->str, v->name_len) & mask;
+        // Entry j may fill the hole if its home is not in (hole, j]
+        if ((j > hole && (home <= hole || home > j)) || (j < hole && home <= hole && home > j)) {
+            env.slots[hole] = env.slots[j];
+            hole = j;
+        }
+    }
+    env.slots[hole] = 0;
+}
+
+static int slots_resize(size_t nslots) {
+    uint32_t *slots = calloc(nslots, sizeof(*slots));
+    if (!slots) return -1;
+    free(env.slots);
+    env.slots = slots;
+    env.nslots = nslots;
+    for (size_t i = 0; i < env.n; i++) {
+        env.slots[find_slot(env.vars[i].str, env.vars[i].name_len)] = i + 1;
+    }
+    return 0;
+}
+
+// Build the table from whatever environ holds now. Strings env_set made
+// that are still there stay ours, the rest were dropped behind our back.
+static int load(void) {
+    size_t n = 0;
+    for (char **e = environ; e && *e; e++) n++;
+    size_t cap = n + 16, nslots = ENV_MIN_SLOTS;
+    while (nslots < cap * 2) nslots *= 2;
+    char **envp = malloc(cap * sizeof(*envp));
+    struct env_var *vars = malloc(cap * sizeof(*vars));
+    uint32_t *slots = calloc(nslots, sizeof(*slots));
+    if (!envp || !vars || !slots) {
+        free(envp);
+        free(vars);
+        free(slots);
+        return -1;
+    }
+
+    // Swap the new arrays in, keeping the old ones to check ownership
+    char **old_envp = env.envp;
+    struct env_var *old_vars = env.vars;
+    uint32_t *old_slots = env.slots;
+    size_t old_n = env.n;
+    env.envp = envp;
+    env.vars = vars;
+    env.slots = slots;
+    env.nslots = nslots;
+    env.cap = cap;
+    env.n = 0;
+    for (size_t i = 0; i < n; i++) {
+        char *str = environ[i];
+        char *eq = strchr(str, '=');
+        if (!eq) continue;
+        size_t len = eq - str;
+        size_t k = find_slot(str, len);
+        // getenv finds the first of two equal names, so does the table
+        if (env.slots[k]) continue;
+        env.vars[env.n] = (struct env_var){ str, len, false };
+        env.envp[env.n] = str;
+        env.slots[k] = ++env.n;
+    }
+    env.envp[env.n] = NULL;
+    environ = env.envp;
+
+    for (size_t j = 0; j < old_n; j++) {
+        if (!old_vars[j].owned) continue;
+        size_t k = find_slot(old_vars[j].str, old_vars[j].name_len);
+        if (env.slots[k] && env.vars[env.slots[k] - 1].str == old_vars[j].str) {
+            env.vars[env.slots[k] - 1].owned = true;
+        } else {
+            free(old_vars[j].str);
+        }
+    }
+    free(old_envp);
+    free(old_vars);
+    free(old_slots);
+    return 0;
+}
+
+// Make sure the table describes environ, -1 if it could not be rebuilt
+static int sync_env(void) {
+    if (env.envp && environ == env.envp && !env.envp[env.n]) return 0;
+    return load();
+}
+
+// Index of the variable called name (len bytes), -1 if there is none and
+// -2 if the table could not be built
+static ssize_t lookup(const char *name, size_t len) {
+    if (sync_env() == -1) return -2;
+    size_t k = find_slot(name, len);
+    if (!env.slots[k]) return -1;
+    size_t i = env.slots[k] - 1;
+    if (env.envp[i] == env.vars[i].str) return i;
+    // Rewritten by setenv or shifted by unsetenv, look again from scratch
+    if (load() == -1) return -2;
+    k = find_slot(name, len);
+    return env.slots[k] ? (ssize_t)env.slots[k] - 1 : -1;
+}
+
+const char *env_get(const char *name) {
+    ssize_t i = lookup(name, strlen(name));
+    if (i == -2) return getenv(name);
+    return i < 0 ? NULL : env.vars[i].str + env.vars[i].name_len + 1;
+}
+
+int env_set(const char *name, const char *value) {
+    size_t len = strlen(name), vlen = strlen(value);
+    if (!len || memchr(name, '=', len)) {
+        errno = EINVAL;
+        return -1;
+    }
+    ssize_t i = lookup(name, len);
+    if (i == -2) return -1;
+    char *str = malloc(len + vlen + 2);
+    if (!str) return -1;
+    memcpy(str, name, len);
+    str[len] = '=';
+    memcpy(str + len + 1, value, vlen + 1);
+
+    if (i >= 0) {
+        // Replaced where it stands, nothing else moves
+        struct env_var *v = &env.vars[i];
+        if (v->owned) free(v->str);
+        *v = (struct env_var){ str, len, true };
+        env.envp[i] = str;
+        return 0;
+    }
+
+    if (env.n + 1 == env.cap) {
+        size_t cap = env.cap * 2;
+        char **envp = realloc(env.envp, cap * sizeof(*envp));
+        if (envp) {
+            // environ must never point at a freed array
+            env.envp = envp;
+            environ = envp;
+        }
+        struct env_var *vars = envp ? realloc(env.vars, cap * sizeof(*vars)) : NULL;
+        if (!vars) {
+            free(str);
+            return -1;
+        }
+        env.vars = vars;
+        env.cap = cap;
+    }
+    if ((env.n + 1) * 2 > env.nslots && slots_resize(env.nslots * 2) == -1) {
+        free(str);
+        return -1;
+    }
+    env.vars[env.n] = (struct env_var){ str, len, true };
+    env.envp[env.n] = str;
+    env.slots[find_slot(name, len)] = ++env.n;
+    env.envp[env.n] = NULL;
+    return 0;
+}
+
+int env_unset(const char *name) {
+    size_t len = strlen(name);
+    ssize_t i = lookup(name, len);
+    if (i == -2) return -1;
+    if (i == -1) return 0;
+
+    slot_delete(find_slot(name, len));
+    if (env.vars[i].owned) free(env.vars[i].str);
+    // The last variable fills the gap, order means nothing in envp
+    size_t last = --env.n;
+    if ((size_t)i != last) {
+        env.vars[i] = env.vars[last];
+        env.envp[i] = env.envp[last];
+        env.slots[find_slot(env.vars[i].str, env.vars[i].name_len)] = i + 1;
+    }
+    env.envp[last] = NULL;
+    return 0;
+}
+
+char **env_envp(void) {
+    return sync_env() == -1 ? environ : env.envp;
+}
@@ -0,0 +1,253 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <string.h>
+#include "lab.h"
+
+/*
+ * The echo and printf builtins. Both write through the buffered output
+ * layer in out.c and share the backslash escape handling.
+ */
+
+// Writes the escape sequence at s (just past the backslash) and returns
+// how many bytes of s it used. Sets *stop for \c, which ends all output.
+// In %b arguments octal escapes are written \0NNN, in formats \NNN.
+static size_t put_escape(const char *s, bool zero_octal, bool *stop) {
+    static const char from[] = "\\abfnrtv\"'";
+    static const char to[] = "\\\a\b\f\n\r\t\v\"'";
+    const char *hit = *s ? strchr(from, *s) : NULL;
+    if (hit) {
+        out_char(to[hit - from]);
+        return 1;
+    }
+    if (*s == 'c') {
+        *stop = true;
+        return 1;
+    }
+    size_t used = 0;
+    if (zero_octal && *s == '0') used++;
+    if (s[used] >= '0' && s[used] <= '7') {
+        unsigned v = 0;
+        size_t digits = 0;
+        while (digits < 3 && s[used] >= '0' && s[used] <= '7') {
+            v = v * 8 + (s[used++] - '0');
+            digits++;
+        }
+        out_char((char)v);
+        return used;
+    }
+    if (used) {
+        out_char('\0');
+        return used;
+    }
+    // Not an escape we know, keep the backslash
+    out_char('\\');
+    return 0;
+}
+
+// Writes s expanding backslash escapes, returns false after a \c
+static bool put_escaped(const char *s, bool zero_octal) {
+    bool stop = false;
+    while (*s && !stop) {
+        const char *bs = strchr(s, '\\');
+        if (!bs) {
+            out_str(s);
+            break;
+        }
+        out_write(s, bs - s);
+        s = bs + 1;
+        s += put_escape(s, zero_octal, &stop);
+    }
+    return !stop;
+}
+
+// echo [-neE] [arg ...]
+int builtin_echo(struct shell *sh, char **argv) {
+    UNUSED(sh);
+    bool newline = true, escapes = false;
+    int i = 1;
+    // Options only count if every letter is one of n, e and E
+    for (; argv[i] && argv[i][0] == '-' && argv[i][1]; i++) {
+        const char *o = argv[i] + 1;
+        if (o[strspn(o, "neE")]) break;
+        for (; *o; o++) {
+            if (*o == 'n') newline = false;
+            else escapes = *o == 'e';
+        }
+    }
+    for (bool first = true; argv[i]; i++, first = false) {
+        if (!first) out_char(' ');
+        if (!escapes) {
+            out_str(argv[i]);
+        } else if (!put_escaped(argv[i], true)) {
+            return 0;
+        }
+    }
+    if (newline) out_char('\n');
+    return 0;
+}
+
+// Numeric value of a printf argument. 'c or "c gives the character code.
+static bool arg_number(const char *arg, bool is_signed, intmax_t *sv, uintmax_t *uv) {
+    if (!arg) {
+        *sv = 0;
+        *uv = 0;
+        return true;
+    }
+    if (arg[0] == '\'' || arg[0] == '"') {
+        *sv = (unsigned char)arg[1];
+        *uv = (unsigned char)arg[1];
+        return true;
+    }
+    char *end;
+    errno = 0;
+    if (is_signed) {
+        *sv = strtoimax(arg, &end, 0);
+    } else {
+        // Negative values wrap like they do in C
+        *uv = arg[strspn(arg, " \t")] == '-' ? (uintmax_t)strtoimax(arg, &end, 0)
+                                              : strtoumax(arg, &end, 0);
+    }
+    if (end == arg || *end || errno) {
+        fprintf(stderr, "printf: %s: invalid number\n", arg);
+        return false;
+    }
+    return true;
+}
+
+// Formats one conversion with the C printf. flags are the ones given in
+// the format, width and precision are always passed as arguments (a
+// negative precision means none). Returns false if the argument was bad.
+static bool put_conversion(const char *flags, char conv, const char *arg, int width, int prec) {
+    char fmt[16];
+    bool ok = true;
+    size_t f = snprintf(fmt, sizeof(fmt) - 3, "%%%s*.*", flags);
+
+    switch (conv) {
+        case 'd': case 'i': {
+            intmax_t sv = 0; uintmax_t uv = 0;
+            ok = arg_number(arg, true, &sv, &uv);
+            fmt[f++] = 'j'; fmt[f++] = conv; fmt[f] = '\0';
+            out_printf(fmt, width, prec, sv);
+            break;
+        }
+        case 'o': case 'u': case 'x': case 'X': {
+            intmax_t sv = 0; uintmax_t uv = 0;
+            ok = arg_number(arg, false, &sv, &uv);
+            fmt[f++] = 'j'; fmt[f++] = conv; fmt[f] = '\0';
+            out_printf(fmt, width, prec, uv);
+            break;
+        }
+        case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': {
+            char *end = NULL;
+            double d = arg ? strtod(arg, &end) : 0;
+            if (arg && (end == arg || *end)) {
+                fprintf(stderr, "printf: %s: invalid number\n", arg);
+                ok = false;
+            }
+            fmt[f++] = conv; fmt[f] = '\0';
+            out_printf(fmt, width, prec, d);
+            break;
+        }
+        case 'c':
+            fmt[f++] = 'c'; fmt[f] = '\0';
+            out_printf(fmt, width, prec, arg ? arg[0] : '\0');
+            break;
+        default:
+            fmt[f++] = 's'; fmt[f] = '\0';
+            out_printf(fmt, width, prec, arg ? arg : "");
+            break;
+    }
+    return ok;
+}
+
+// printf format [arg ...]
+int builtin_printf(struct shell *sh, char **argv) {
+    UNUSED(sh);
+    if (!argv[1]) {
+        fprintf(stderr, "printf: usage: printf format [arguments]\n");
+        return 2;
+    }
+    const char *format = argv[1];
+    char **args = argv + 2;
+    int status = 0;
+
+    // The format is reused until the arguments run out
+    do {
+        char **start = args;
+        for (const char *p = format; *p; p++) {
+            if (*p == '\\') {
+                bool stop = false;
+                p += put_escape(p + 1, false, &stop);
+                if (stop) return status;
+                continue;
+            }
+            if (*p != '%') {
+                const char *next = p + strcspn(p, "\\%");
+                out_write(p, next - p);
+                p = next - 1;
+                continue;
+            }
+            if (p[1] == '%') {
+                out_char('%');
+                p++;
+                continue;
+            }
+
+            // %[flags][width][.precision]conversion, * takes an argument
+            const char *spec = p++;
+            char flags[8];
+            size_t nflags = 0;
+            while (*p && strchr("-+ #0", *p)) {
+                if (nflags < sizeof(flags) - 1) flags[nflags++] = *p;
+                p++;
+            }
+            flags[nflags] = '\0';
+            int width = 0, prec = -1;
+            if (*p == '*') {
+                intmax_t v = 0; uintmax_t u;
+                if (!arg_number(*args, true, &v, &u)) status = 1;
+                if (*args) args++;
+                width = v > INT_MAX ? INT_MAX : v < -INT_MAX ? -INT_MAX : (int)v;
+                p++;
+            } else {
+                while (*p >= '0' && *p <= '9') {
+                    if (width < INT_MAX / 10) width = width * 10 + (*p - '0');
+                    p++;
+                }
+            }
+            if (*p == '.') {
+                p++;
+                prec = 0;
+                if (*p == '*') {
+                    intmax_t v = 0; uintmax_t u;
+                    if (!arg_number(*args, true, &v, &u)) status = 1;
+                    if (*args) args++;
+                    prec = v > INT_MAX ? INT_MAX : v < 0 ? -1 : (int)v;
+                    p++;
+                } else {
+                    while (*p >= '0' && *p <= '9') {
+                        if (prec < INT_MAX / 10) prec = prec * 10 + (*p - '0');
+                        p++;
+                    }
+                }
+            }
+            char conv = *p;
+            if (!conv || !strchr("diouxXeEfFgGcsb", conv)) {
+                fprintf(stderr, "printf: %.*s: invalid conversion\n", (int)(p - spec + (conv != 0)), spec);
+                return 1;
+            }
+
+            const char *arg = *args;
+            if (*args) args++;
+            if (conv == 'b') {
+                if (arg && !put_escaped(arg, true)) return status;
+                continue;
+            }
+            if (!put_conversion(flags, conv, arg, width, prec)) status = 1;
+        }
+        // A format with no conversions is printed once
+        if (args == start) break;
+    } while (*args);
+    return status;
+}
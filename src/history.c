@@ -0,0 +1,272 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "lab.h"
+
+/*
+ * Binary history file. The file is nothing but records laid end to end:
+ *
+ *   header  magic, text length, time          16 bytes
+ *   text    the line and at least one NUL, padded to 8 bytes
+ *   footer  total record size, tail magic      8 bytes
+ *
+ * Every record goes out in a single write(2) on an O_APPEND descriptor, so
+ * any number of shells can append at once without locking: the kernel
+ * places each write at the current end of file as a whole. The footer lets
+ * the newest entries be read walking backwards from the end, touching only
+ * the pages they sit on, and the offset index over the whole file is only
+ * built when something asks for entries by number.
+ */
+
+#define HIST_MAGIC 0x5453484cU  // "LHST"
+#define HIST_TAIL  0x4c494154U  // "TAIL"
+// Longer lines are not worth keeping
+#define HIST_MAX_LINE (1u << 20)
+
+struct hist_head {
+    uint32_t magic;
+    uint32_t len;
+    int64_t time;
+};
+
+struct hist_foot {
+    uint32_t size;
+    uint32_t magic;
+};
+
+_Static_assert(sizeof(struct hist_head) == 16, "record header is 16 bytes");
+_Static_assert(sizeof(struct hist_foot) == 8, "record footer is 8 bytes");
+
+// Bytes a record with len bytes of text takes up in the file
+static size_t record_size(size_t len) {
+    return sizeof(struct hist_head) + ((len + 8) & ~(size_t)7) + sizeof(struct hist_foot);
+}
+
+// Whether a complete valid record starts at off, its header copied to *r.
+// *partial is set when the header is fine but the rest is not in the file
+// yet, which is what a record still being written looks like. After a torn
+// write records can sit at any offset, so nothing is read in place.
+static bool record_at(const struct hist_file *h, size_t off, size_t end, struct hist_head *r,
+                      bool *partial) {
+    *partial = false;
+    if (end - off < sizeof(*r)) {
+        *partial = true;
+        return false;
+    }
+    memcpy(r, h->map + off, sizeof(*r));
+    if (r->magic != HIST_MAGIC || r->len > HIST_MAX_LINE) return false;
+    size_t size = record_size(r->len);
+    if (end - off < size) {
+        *partial = true;
+        return false;
+    }
+    struct hist_foot f;
+    memcpy(&f, h->map + off + size - sizeof(f), sizeof(f));
+    return f.magic == HIST_TAIL && f.size == size;
+}
+
+// Offset of the first complete record at or after off, h->size if none
+static size_t next_record(const struct hist_file *h, size_t off) {
+    const uint32_t magic = HIST_MAGIC;
+    while (off < h->size) {
+        const char *p = memmem(h->map + off, h->size - off, &magic, sizeof(magic));
+        if (!p) break;
+        off = p - h->map;
+        struct hist_head r;
+        bool partial;
+        if (record_at(h, off, h->size, &r, &partial)) return off;
+        off++;
+    }
+    return h->size;
+}
+
+int hist_open(struct hist_file *h, const char *path) {
+    memset(h, 0, sizeof(*h));
+    h->fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (h->fd == -1) return -1;
+
+    // Refuse anything that is not already a history file, such as a text
+    // history left at the same path, rather than append records to it
+    uint32_t magic;
+    ssize_t n = pread(h->fd, &magic, sizeof(magic), 0);
+    if (n == -1 || (n > 0 && (n != sizeof(magic) || magic != HIST_MAGIC))) {
+        int err = n == -1 ? errno : EINVAL;
+        close(h->fd);
+        errno = err;
+        return -1;
+    }
+    h->active = true;
+    return 0;
+}
+
+void hist_close(struct hist_file *h) {
+    if (!h->active) return;
+    if (h->map) munmap(h->map, h->map_len);
+    close(h->fd);
+    free(h->off);
+    hist_index_destroy(h);
+    memset(h, 0, sizeof(*h));
+}
+
+int hist_add(struct hist_file *h, const char *line) {
+    if (!h->active) return 0;
+    size_t len = strlen(line);
+    if (len > HIST_MAX_LINE) return 0;
+
+    size_t size = record_size(len);
+    char stack[512];
+    char *rec = size <= sizeof(stack) ? stack : malloc(size);
+    if (!rec) return -1;
+    struct hist_head head = { .magic = HIST_MAGIC, .len = len, .time = time(NULL) };
+    struct hist_foot foot = { .size = size, .magic = HIST_TAIL };
+    memcpy(rec, &head, sizeof(head));
+    memcpy(rec + sizeof(head), line, len);
+    memset(rec + sizeof(head) + len, 0, size - sizeof(head) - sizeof(foot) - len);
+    memcpy(rec + size - sizeof(foot), &foot, sizeof(foot));
+
+    // One write so the record can never interleave with another shell's
+    ssize_t n;
+    do {
+        n = write(h->fd, rec, size);
+    } while (n == -1 && errno == EINTR);
+    if (rec != stack) free(rec);
+    if (n != (ssize_t)size) {
+        // A short write leaves a torn record that readers skip over
+        if (n >= 0) errno = ENOSPC;
+        return -1;
+    }
+    return 0;
+}
+
+// Map everything the file holds now. The mapping is rounded up to whole
+// pages and only grows, reads never look past h->size.
+static int map_file(struct hist_file *h) {
+    struct stat st;
+    if (fstat(h->fd, &st) == -1) return -1;
+    size_t size = st.st_size;
+    if (size < h->size) {
+        // Truncated under us, start over
+        h->n = 0;
+        h->scanned = 0;
+        hist_index_destroy(h);
+    }
+    h->size = size;
+    if (size <= h->map_len) return 0;
+
+    long page = sysconf(_SC_PAGESIZE);
+    size_t want = (size + page - 1) & ~(size_t)(page - 1);
+    void *m = h->map ? mremap(h->map, h->map_len, want, MREMAP_MAYMOVE)
+                     : mmap(NULL, want, PROT_READ, MAP_SHARED, h->fd, 0);
+    if (m == MAP_FAILED) return -1;
+    h->map = m;
+    h->map_len = want;
+    return 0;
+}
+
+// Index every record appended since the last call
+static int index_file(struct hist_file *h) {
+    if (map_file(h) == -1) return -1;
+    while (h->scanned < h->size) {
+        struct hist_head r;
+        bool partial;
+        if (!record_at(h, h->scanned, h->size, &r, &partial)) {
+            // A record still being written is the last thing in the file,
+            // so wait while nothing complete follows. Otherwise this is
+            // what a torn write left, of any length, and the next record
+            // is found a byte at a time.
+            size_t next = next_record(h, h->scanned + 1);
+            if (next == h->size) break;
+            h->scanned = next;
+            continue;
+        }
+        if (h->n == h->cap) {
+            size_t cap = h->cap ? h->cap * 2 : 256;
+            size_t *off = realloc(h->off, cap * sizeof(*off));
+            if (!off) return -1;
+            h->off = off;
+            h->cap = cap;
+        }
+        h->off[h->n++] = h->scanned;
+        h->scanned += record_size(r.len);
+    }
+    return 0;
+}
+
+size_t hist_count(struct hist_file *h) {
+    // On failure the entries indexed so far are still good
+    if (h->active) index_file(h);
+    return h->n;
+}
+
+const char *hist_entry(const struct hist_file *h, size_t i, time_t *when) {
+    if (i >= h->n) return NULL;
+    const char *rec = h->map + h->off[i];
+    if (when) {
+        struct hist_head r;
+        memcpy(&r, rec, sizeof(r));
+        *when = r.time;
+    }
+    return rec + sizeof(struct hist_head);
+}
+
+size_t hist_recent(struct hist_file *h, size_t n, void (*fn)(const char *line, void *arg), void *arg) {
+    if (!h->active || !n || map_file(h) == -1) return 0;
+
+    size_t *found = malloc(n * sizeof(*found));
+    if (!found) return 0;
+    size_t count = 0, end = h->size;
+    // Hop back over the footers until n records are found or the file
+    // begins. Anything odd, like a torn record, means the forward index has
+    // to sort it out instead.
+    while (count < n && end > 0) {
+        struct hist_foot f;
+        struct hist_head r;
+        bool partial;
+        if (end < sizeof(r) + sizeof(f)) {
+            count = SIZE_MAX;
+            break;
+        }
+        memcpy(&f, h->map + end - sizeof(f), sizeof(f));
+        if (f.magic != HIST_TAIL || f.size > end || f.size % 8 ||
+            !record_at(h, end - f.size, end, &r, &partial)) {
+            count = SIZE_MAX;
+            break;
+        }
+        end -= f.size;
+        found[count++] = end;
+    }
+    if (count == SIZE_MAX) {
+        count = 0;
+        if (index_file(h) == 0) {
+            size_t first = h->n > n ? h->n - n : 0;
+            while (count < h->n - first) {
+                found[count] = h->off[h->n - 1 - count];
+                count++;
+            }
+        }
+    }
+
+    // Oldest first, the way they were entered
+    for (size_t i = count; i-- > 0;) {
+        fn((const char *)(h->map + found[i] + sizeof(struct hist_head)), arg);
+    }
+    free(found);
+    return count;
+}
+
+char *hist_default_path(void) {
+    const char *env = env_get("MY_HISTFILE");
+    if (env) return *env ? strdup(env) : NULL;
+    const char *home = env_get("HOME");
+    if (!home || !*home) return NULL;
+    size_t len = strlen(home) + sizeof("/.lab_history");
+    char *path = malloc(len);
+    if (path) snprintf(path, len, "%s/.lab_history", home);
+    return path;
+}
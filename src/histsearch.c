@@ -0,0 +1,203 @@
+#include <stdint.h>
+#include <string.h>
+#include "lab.h"
+
+/*
+ * Substring search over the history file through a trigram index. Every
+ * three byte sequence in an entry maps to the list of entries containing
+ * it. A query is answered by intersecting the lists of its rarest trigrams
+ * and checking the few entries left with strstr.
+ *
+ * The lists are delta encoded LEB128: each entry number is stored as the
+ * distance from the one before it, seven bits a byte with the high bit set
+ * on all but the last byte. Most deltas fit in one byte, so a million
+ * entries cost about a byte per distinct trigram per entry. Because only
+ * the last byte of a number has the high bit clear a list can also be
+ * decoded backwards, which is the direction a reverse search wants.
+ */
+
+#define GRAM_MIN_CAP 1024
+// Lists intersected for one query, the rest only pay for strstr
+#define QUERY_GRAMS 4
+
+struct hist_gram {
+    uint32_t key;    // the three bytes plus one, 0 marks a free slot
+    uint32_t last;   // newest entry in the list
+    uint32_t len;    // bytes used
+    uint32_t cap;
+    uint8_t *bytes;
+};
+
+static uint32_t gram_key(const char *s) {
+    return ((uint32_t)(unsigned char)s[0] << 16 | (uint32_t)(unsigned char)s[1] << 8 |
+            (unsigned char)s[2]) + 1;
+}
+
+static size_t gram_slot(uint32_t key, size_t cap) {
+    return (key * 2654435761u) & (cap - 1);
+}
+
+static struct hist_gram *gram_find(const struct hist_file *h, uint32_t key) {
+    for (size_t i = gram_slot(key, h->gram_cap);; i = (i + 1) & (h->gram_cap - 1)) {
+        if (h->grams[i].key == key) return &h->grams[i];
+        if (!h->grams[i].key) return NULL;
+    }
+}
+
+static int grams_grow(struct hist_file *h) {
+    size_t cap = h->gram_cap ? h->gram_cap * 2 : GRAM_MIN_CAP;
+    struct hist_gram *grams = calloc(cap, sizeof(*grams));
+    if (!grams) return -1;
+    for (size_t i = 0; i < h->gram_cap; i++) {
+        if (!h->grams[i].key) continue;
+        size_t j = gram_slot(h->grams[i].key, cap);
+        while (grams[j].key) j = (j + 1) & (cap - 1);
+        grams[j] = h->grams[i];
+    }
+    free(h->grams);
+    h->grams = grams;
+    h->gram_cap = cap;
+    return 0;
+}
+
+// Append entry id to the list for key unless it is already the newest
+static int gram_add(struct hist_file *h, uint32_t key, uint32_t id) {
+    struct hist_gram *g = gram_find(h, key);
+    if (!g) {
+        if ((h->gram_count + 1) * 2 > h->gram_cap && grams_grow(h) == -1) return -1;
+        size_t i = gram_slot(key, h->gram_cap);
+        while (h->grams[i].key) i = (i + 1) & (h->gram_cap - 1);
+        g = &h->grams[i];
+        g->key = key;
+        h->gram_count++;
+    } else if (g->len && g->last == id) {
+        return 0;
+    }
+    if (g->cap - g->len < 5) {
+        uint32_t cap = g->cap ? g->cap * 2 : 8;
+        uint8_t *bytes = realloc(g->bytes, cap);
+        if (!bytes) return -1;
+        g->bytes = bytes;
+        g->cap = cap;
+    }
+    // Entry 0 starts every list at a delta of id + 1 so no delta is 0
+    uint32_t delta = g->len ? id - g->last : id + 1;
+    while (delta >= 0x80) {
+        g->bytes[g->len++] = (delta & 0x7f) | 0x80;
+        delta >>= 7;
+    }
+    g->bytes[g->len++] = delta;
+    g->last = id;
+    return 0;
+}
+
+// Bring the index up to date with the entries indexed in h
+static int index_entries(struct hist_file *h) {
+    if (!h->grams && grams_grow(h) == -1) return -1;
+    for (; h->indexed < h->n; h->indexed++) {
+        const char *s = hist_entry(h, h->indexed, NULL);
+        for (size_t i = 0; s[i] && s[i + 1] && s[i + 2]; i++) {
+            if (gram_add(h, gram_key(s + i), h->indexed) == -1) return -1;
+        }
+    }
+    return 0;
+}
+
+void hist_index_update(struct hist_file *h) {
+    // Nothing to keep current until a search has built the index
+    if (!h->grams) return;
+    hist_count(h);
+    index_entries(h);
+}
+
+// Walks one list from newest to oldest
+struct cursor {
+    const uint8_t *start;
+    const uint8_t *p;   // just past the delta of id
+    int64_t id;         // current entry, -1 once the list is used up
+};
+
+static void cursor_init(struct cursor *c, const struct hist_gram *g) {
+    c->start = g->bytes;
+    c->p = g->bytes + g->len;
+    c->id = g->last;
+}
+
+// Step to the next older entry in the list
+static void cursor_prev(struct cursor *c) {
+    // The delta that led to id ends at p, its first byte follows the
+    // previous number's last byte (the only kind with the high bit clear)
+    const uint8_t *q = c->p - 1;
+    while (q > c->start && (q[-1] & 0x80)) q--;
+    uint32_t delta = 0;
+    int shift = 0;
+    for (const uint8_t *b = q; b < c->p; b++, shift += 7) {
+        delta |= (uint32_t)(*b & 0x7f) << shift;
+    }
+    // Past the first entry the delta was id + 1, leaving -1
+    c->p = q;
+    c->id -= delta;
+}
+
+// Move back to the newest entry at or below id
+static void cursor_seek(struct cursor *c, int64_t id) {
+    while (c->id > id) cursor_prev(c);
+}
+
+ssize_t hist_search(struct hist_file *h, const char *query, size_t before) {
+    if (!h->active) return -1;
+    hist_count(h);
+    if (before > h->n) before = h->n;
+    size_t qlen = strlen(query);
+
+    // Too short for a trigram: just look
+    if (qlen < 3 || index_entries(h) == -1) {
+        for (size_t i = before; i-- > 0;) {
+            if (strstr(hist_entry(h, i, NULL), query)) return i;
+        }
+        return -1;
+    }
+
+    // The rarest trigrams in the query, any missing one means no match
+    const struct hist_gram *pick[QUERY_GRAMS];
+    size_t npick = 0;
+    for (size_t i = 0; i + 2 < qlen; i++) {
+        const struct hist_gram *g = gram_find(h, gram_key(query + i));
+        if (!g) return -1;
+        size_t at = npick < QUERY_GRAMS ? npick++ : QUERY_GRAMS;
+        while (at > 0 && pick[at - 1]->len > g->len) {
+            if (at < QUERY_GRAMS) pick[at] = pick[at - 1];
+            at--;
+        }
+        if (at < QUERY_GRAMS) pick[at] = g;
+    }
+
+    // Leapfrog the lists backwards until they agree on an entry
+    struct cursor c[QUERY_GRAMS];
+    for (size_t i = 0; i < npick; i++) cursor_init(&c[i], pick[i]);
+    int64_t id = (int64_t)before - 1;
+    while (id >= 0) {
+        size_t i;
+        for (i = 0; i < npick; i++) {
+            cursor_seek(&c[i], id);
+            if (c[i].id != id) break;
+        }
+        if (i < npick) {
+            // List i has nothing at id, its next entry is the new candidate
+            id = c[i].id;
+            continue;
+        }
+        if (strstr(hist_entry(h, id, NULL), query)) return id;
+        id--;
+    }
+    return -1;
+}
+
+void hist_index_destroy(struct hist_file *h) {
+    for (size_t i = 0; i < h->gram_cap; i++) free(h->grams[i].bytes);
+    free(h->grams);
+    h->grams = NULL;
+    h->gram_cap = 0;
+    h->gram_count = 0;
+    h->indexed = 0;
+}
@@ -0,0 +1,276 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "lab.h"
+
+// Join the stages back into a printable command line
+static char *job_text(const struct pipeline *p) {
+    size_t len = 0;
+    for (size_t i = 0; i < p->ncmds; i++) {
+        for (char **a = p->cmds[i]; *a; a++) len += strlen(*a) + 1;
+        len += 2;
+    }
+    char *text = malloc(len + 1);
+    if (!text) return NULL;
+
+    char *out = text;
+    for (size_t i = 0; i < p->ncmds; i++) {
+        if (i) out = stpcpy(out, "| ");
+        for (char **a = p->cmds[i]; *a; a++) {
+            out = stpcpy(out, *a);
+            *out++ = ' ';
+        }
+    }
+    if (out > text) out--;
+    *out = '\0';
+    return text;
+}
+
+struct job *job_add(struct job_table *t, const struct pipeline *p) {
+    // Reuse the lowest free job number
+    size_t slot = 0;
+    while (slot < t->cap && t->jobs[slot]) slot++;
+    if (slot == t->cap) {
+        size_t ncap = t->cap ? t->cap * 2 : 16;
+        struct job **jobs = realloc(t->jobs, ncap * sizeof(*jobs));
+        if (!jobs) return NULL;
+        memset(jobs + t->cap, 0, (ncap - t->cap) * sizeof(*jobs));
+        t->jobs = jobs;
+        t->cap = ncap;
+    }
+
+    struct job *j = calloc(1, sizeof(*j));
+    if (!j) return NULL;
+    j->procs = calloc(p->ncmds, sizeof(*j->procs));
+    j->cmdline = job_text(p);
+    if (!j->procs || !j->cmdline) {
+        free(j->procs);
+        free(j->cmdline);
+        free(j);
+        return NULL;
+    }
+    j->nprocs = p->ncmds;
+    j->id = (int)slot + 1;
+    clock_gettime(CLOCK_MONOTONIC, &j->usage.start);
+    t->jobs[slot] = j;
+    t->count++;
+    return j;
+}
+
+void job_remove(struct job_table *t, struct job *j) {
+    if (!j) return;
+    t->jobs[j->id - 1] = NULL;
+    t->count--;
+    free(j->procs);
+    free(j->cmdline);
+    free(j);
+}
+
+void job_table_destroy(struct job_table *t) {
+    for (size_t i = 0; i < t->cap; i++) {
+        if (t->jobs[i]) job_remove(t, t->jobs[i]);
+    }
+    free(t->jobs);
+    memset(t, 0, sizeof(*t));
+}
+
+struct job *job_find(struct job_table *t, int id) {
+    if (id < 1 || (size_t)id > t->cap) return NULL;
+    return t->jobs[id - 1];
+}
+
+struct job *job_current(struct job_table *t) {
+    for (size_t i = t->cap; i-- > 0;) {
+        if (t->jobs[i]) return t->jobs[i];
+    }
+    return NULL;
+}
+
+struct job *job_parse_spec(struct job_table *t, const char *spec) {
+    if (!spec) return job_current(t);
+    if (*spec == '%') spec++;
+    if (!*spec || strcmp(spec, "+") == 0 || strcmp(spec, "%") == 0) {
+        return job_current(t);
+    }
+    char *end;
+    long id = strtol(spec, &end, 10);
+    if (*end || id < 1 || id > 0x7fffffff) return NULL;
+    return job_find(t, (int)id);
+}
+
+bool job_is_done(const struct job *j) {
+    for (size_t i = 0; i < j->nprocs; i++) {
+        if (!j->procs[i].done) return false;
+    }
+    return true;
+}
+
+bool job_is_stopped(const struct job *j) {
+    bool stopped = false;
+    for (size_t i = 0; i < j->nprocs; i++) {
+        if (!j->procs[i].done && !j->procs[i].stopped) return false;
+        if (j->procs[i].stopped) stopped = true;
+    }
+    return stopped;
+}
+
+int job_exit_status(const struct job *j, bool pipefail) {
+    // The last stage decides unless pipefail asks for the last failure
+    int rval = j->procs[j->nprocs - 1].code;
+    if (pipefail) {
+        for (size_t i = j->nprocs; i-- > 0;) {
+            if (j->procs[i].code) return j->procs[i].code;
+        }
+    }
+    return rval;
+}
+
+// Fold the resources of one finished process into its job
+static void add_usage(struct cmd_usage *u, const struct rusage *ru) {
+    timeradd(&u->utime, &ru->ru_utime, &u->utime);
+    timeradd(&u->stime, &ru->ru_stime, &u->stime);
+    if (ru->ru_maxrss > u->maxrss) u->maxrss = ru->ru_maxrss;
+    u->nvcsw += ru->ru_nvcsw;
+    u->nivcsw += ru->ru_nivcsw;
+}
+
+int job_update(struct job_table *t, pid_t pid, int status, const struct rusage *ru) {
+    for (size_t i = 0; i < t->cap; i++) {
+        struct job *j = t->jobs[i];
+        if (!j) continue;
+        for (size_t k = 0; k < j->nprocs; k++) {
+            struct job_proc *proc = &j->procs[k];
+            if (proc->pid != pid) continue;
+
+            if (WIFSTOPPED(status)) {
+                proc->stopped = true;
+                proc->code = 128 + WSTOPSIG(status);
+            } else if (WIFCONTINUED(status)) {
+                proc->stopped = false;
+            } else {
+                proc->stopped = false;
+                proc->done = true;
+                proc->code = status_to_exit(status);
+                if (ru) add_usage(&j->usage, ru);
+                if (job_is_done(j)) clock_gettime(CLOCK_MONOTONIC, &j->usage.end);
+            }
+            j->notified = false;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void job_reap(struct job_table *t) {
+    int status;
+    struct rusage ru;
+    pid_t pid;
+    while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &ru)) > 0) {
+        job_update(t, pid, status, &ru);
+    }
+}
+
+void job_print(const struct job *j, FILE *out) {
+    const char *state = job_is_done(j) ? "Done" : job_is_stopped(j) ? "Stopped" : "Running";
+    fprintf(out, "[%d]  %-24s%s%s\n", j->id, state, j->cmdline,
+            strcmp(state, "Running") == 0 ? " &" : "");
+}
+
+bool job_has_news(const struct job_table *t) {
+    for (size_t i = 0; i < t->cap; i++) {
+        const struct job *j = t->jobs[i];
+        if (j && !j->notified && (job_is_done(j) || job_is_stopped(j))) return true;
+    }
+    return false;
+}
+
+void job_notify(struct job_table *t, FILE *out) {
+    for (size_t i = 0; i < t->cap; i++) {
+        struct job *j = t->jobs[i];
+        if (!j || j->notified) continue;
+        if (job_is_done(j)) {
+            if (out) job_print(j, out);
+            if (out && j->timed) usage_print(&j->usage, out);
+            job_remove(t, j);
+        } else if (job_is_stopped(j)) {
+            if (out) job_print(j, out);
+            j->notified = true;
+        }
+    }
+}
+
+int job_wait_fg(struct shell *sh, struct job *j) {
+    // Any child may report here, background jobs are recorded for later
+    while (!job_is_done(j) && !job_is_stopped(j)) {
+        int status;
+        struct rusage ru;
+        pid_t pid = wait4(-1, &status, WUNTRACED, &ru);
+        if (pid == -1) {
+            if (errno == EINTR) continue;
+            // Nothing left to wait for, someone else reaped our children
+            for (size_t i = 0; i < j->nprocs; i++) j->procs[i].done = true;
+            clock_gettime(CLOCK_MONOTONIC, &j->usage.end);
+            break;
+        }
+        job_update(&sh->jobs, pid, status, &ru);
+    }
+
+    // get control of the shell
+    if (sh->shell_is_interactive) {
+        tcsetpgrp(sh->shell_terminal, sh->shell_pgid);
+        j->has_tmodes = tcgetattr(sh->shell_terminal, &j->tmodes) == 0;
+        tcsetattr(sh->shell_terminal, TCSADRAIN, &sh->shell_tmodes);
+    }
+
+    int rval = job_exit_status(j, sh->pipefail);
+    if (job_is_done(j)) {
+        if (j->timed) usage_print(&j->usage, stderr);
+        job_remove(&sh->jobs, j);
+    } else {
+        fprintf(stderr, "\n");
+        job_print(j, stderr);
+        j->notified = true;
+    }
+    return rval;
+}
+
+// Send sig to every process of j still running. Without job control they
+// stay in the shell's process group, so j has no group of its own.
+static void job_signal(struct shell *sh, struct job *j, int sig) {
+    if (sh->shell_is_interactive) {
+        if (kill(-j->pgid, sig) == -1) perror("kill");
+        return;
+    }
+    for (size_t i = 0; i < j->nprocs; i++) {
+        if (j->procs[i].pid && !j->procs[i].done) kill(j->procs[i].pid, sig);
+    }
+}
+
+int job_continue(struct shell *sh, struct job *j, bool foreground) {
+    for (size_t i = 0; i < j->nprocs; i++) j->procs[i].stopped = false;
+    j->notified = false;
+
+    if (foreground) {
+        if (sh->shell_is_interactive) {
+            tcsetpgrp(sh->shell_terminal, j->pgid);
+            if (j->has_tmodes) tcsetattr(sh->shell_terminal, TCSADRAIN, &j->tmodes);
+        }
+        job_signal(sh, j, SIGCONT);
+        return job_wait_fg(sh, j);
+    }
+    job_signal(sh, j, SIGCONT);
+    return 0;
+}
+
+void usage_print(const struct cmd_usage *u, FILE *out) {
+    double real = (u->end.tv_sec - u->start.tv_sec) + (u->end.tv_nsec - u->start.tv_nsec) / 1e9;
+    fprintf(out, "real %.3fs  user %ld.%03lds  sys %ld.%03lds  maxrss %ldKB  ctxsw %ld/%ld\n",
+            real,
+            (long)u->utime.tv_sec, (long)u->utime.tv_usec / 1000,
+            (long)u->stime.tv_sec, (long)u->stime.tv_usec / 1000,
+            u->maxrss, u->nvcsw, u->nivcsw);
+}
@@ -0,0 +1,690 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+#include "lab.h"
+
+/*
+ * Frecency index of the directories cd visits, in the spirit of z. A
+ * directory's frecency is its rank, roughly its visit count, times a
+ * weight for how long ago the last visit was. The file is laid out to be
+ * queried where it is mapped:
+ *
+ *   header   counts and sizes of the parts below       32 bytes
+ *   records  rank, bound, last visit, path, masks      32 bytes each
+ *   slots    hash table from path to record            4 bytes each
+ *   buckets  start of each trigram posting list        4 bytes each
+ *   postings record numbers, ascending per list        4 bytes each
+ *   pool     the paths, each followed by a NUL
+ *
+ * The weight only shrinks as time passes, so a record's frecency at the
+ * last flush is a bound on its frecency from then on. Records are sorted by
+ * that bound, best first, and a query stops as soon as the bound cannot
+ * beat what it has found. The trigrams of each last component are hashed
+ * into a fixed number of buckets, so a word of three or more characters
+ * only looks at the records in every list its trigrams fall in.
+ *
+ * The file is never written in place. Visits collect in memory, and a
+ * flush writes the merged index to a temporary file and renames it over
+ * the old one, so a reader maps either the old index or the new one. Two
+ * shells flushing at the same moment can lose the visits of one of them,
+ * which only costs a little rank.
+ */
+
+#define JUMP_MAGIC 0x504d4a4cU  // "LJMP"
+// Visits held in memory before they are written out
+#define JUMP_FLUSH 32
+// When the ranks add up to more than this they all shrink by JUMP_AGE, and
+// directories that fall below JUMP_MIN_RANK are forgotten
+#define JUMP_MAX_TOTAL 100000.0
+#define JUMP_AGE 0.9
+#define JUMP_MIN_RANK 0.1
+#define JUMP_MAX_PATH UINT16_MAX
+#define JUMP_BUCKET_BITS 16
+#define JUMP_BUCKETS (1u << JUMP_BUCKET_BITS)
+// Matches tried by j, in case the best few are gone
+#define JUMP_TRIES 8
+// Matches listed by j -l
+#define JUMP_LIST 20
+
+struct jump_head {
+    uint32_t magic;
+    uint32_t count;   // records
+    uint32_t nslots;  // path hash table, a power of two
+    uint32_t npost;   // postings in all lists together
+    uint64_t pool_len;
+    double total;     // sum of the ranks, for aging
+};
+
+struct jump_rec {
+    float rank;
+    float bound;    // frecency at the last flush, records sorted by it
+    int64_t last;
+    uint32_t off;   // the path in the pool
+    uint32_t hash;  // of the whole path, see rec_of
+    uint32_t sig;   // characters in the last component, see sig
+    uint16_t len;
+    uint16_t base;  // where the last component starts
+};
+
+_Static_assert(sizeof(struct jump_head) == 32, "header is 32 bytes");
+_Static_assert(sizeof(struct jump_rec) == 32, "record is 32 bytes");
+
+struct jump_visit {
+    char *path;
+    uint32_t hash;
+    double count;
+    int64_t last;
+};
+
+// The parts of a mapped file
+struct jump_view {
+    const struct jump_head *h;
+    const struct jump_rec *recs;
+    const uint32_t *slots;   // record number plus one, 0 for an empty slot
+    const uint32_t *buckets; // JUMP_BUCKETS + 1 offsets into posts
+    const uint32_t *posts;
+    const char *pool;
+};
+
+// One bit per letter, digits and punctuation share the rest. A word can
+// only be in a component whose mask has all of the word's bits.
+static uint32_t sig(const char *s, size_t len) {
+    uint32_t m = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = s[i] | 0x20;
+        if (c >= 'a' && c <= 'z') {
+            m |= 1u << (c - 'a');
+        } else if (s[i] >= '0' && s[i] <= '9') {
+            m |= 1u << (26 + (s[i] - '0') % 3);
+        } else {
+            m |= 1u << (29 + (unsigned char)s[i] % 3);
+        }
+    }
+    return m;
+}
+
+static unsigned char fold(char c) {
+    return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : (unsigned char)c;
+}
+
+// Bucket of the trigram starting at s, case folded like strcasestr
+static uint32_t bucket(const char *s) {
+    uint32_t g = fold(s[0]) << 16 | fold(s[1]) << 8 | fold(s[2]);
+    return (g * 2654435761u) >> (32 - JUMP_BUCKET_BITS);
+}
+
+// Start of the last component of path
+static size_t base_of(const char *path, size_t len) {
+    while (len > 1 && path[len - 1] == '/') len--;
+    size_t i = len;
+    while (i > 0 && path[i - 1] != '/') i--;
+    return i;
+}
+
+// z's weights: an hour, a day and a week since the last visit
+static double weight(int64_t age) {
+    if (age < 3600) return 4.0;
+    if (age < 86400) return 2.0;
+    if (age < 7 * 86400) return 0.5;
+    return 0.25;
+}
+
+static uint32_t path_hash(const char *path) {
+    return (uint32_t)lab_hash_str(path);
+}
+
+static struct jump_view view(const char *map) {
+    struct jump_view v;
+    v.h = (const void *)map;
+    v.recs = (const void *)(map + sizeof(*v.h));
+    v.slots = (const void *)(v.recs + v.h->count);
+    v.buckets = v.slots + v.h->nslots;
+    v.posts = v.buckets + JUMP_BUCKETS + 1;
+    v.pool = (const char *)(v.posts + v.h->npost);
+    return v;
+}
+
+// Bytes a file with these counts takes up
+static size_t file_size(size_t count, size_t nslots, size_t npost, size_t pool_len) {
+    return sizeof(struct jump_head) + count * sizeof(struct jump_rec) +
+           (nslots + JUMP_BUCKETS + 1 + npost) * sizeof(uint32_t) + pool_len;
+}
+
+// The sizes in the header must add up to the file. Everything else is
+// checked as it is read, so mapping touches one page and a damaged file
+// reads as having fewer directories.
+static bool valid(const char *map, size_t size) {
+    if (size < sizeof(struct jump_head)) return false;
+    const struct jump_head *h = (const void *)map;
+    if (h->magic != JUMP_MAGIC || (h->nslots & (h->nslots - 1)) || h->nslots < h->count) return false;
+    return h->pool_len <= size && file_size(h->count, h->nslots, h->npost, h->pool_len) == size;
+}
+
+// The path of r, NULL if the record does not hold together
+static const char *rec_path(const struct jump_view *v, const struct jump_rec *r) {
+    uint64_t pool_len = v->h->pool_len;
+    if (r->off >= pool_len || pool_len - r->off <= r->len || r->base > r->len) return NULL;
+    const char *path = v->pool + r->off;
+    return path[r->len] ? NULL : path;
+}
+
+static void unmap(struct jump_db *db) {
+    if (db->map) munmap((void *)db->map, db->map_len);
+    db->map = NULL;
+    db->map_len = 0;
+}
+
+// Map the file at db->path unless the mapping already shows it. The file
+// is only ever replaced, so the same inode and size means the same index.
+static int map_current(struct jump_db *db) {
+    struct stat st;
+    if (stat(db->path, &st) == -1) {
+        if (errno != ENOENT) return -1;
+        unmap(db);
+        return 0;
+    }
+    if (db->map && st.st_dev == db->dev && st.st_ino == db->ino && (size_t)st.st_size == db->map_len) {
+        return 0;
+    }
+    unmap(db);
+    int fd = open(db->path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return errno == ENOENT ? 0 : -1;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+    if (!valid(map, st.st_size)) {
+        munmap(map, st.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+    db->map = map;
+    db->map_len = st.st_size;
+    db->dev = st.st_dev;
+    db->ino = st.st_ino;
+    return 0;
+}
+
+// The record for path, or NULL if the file has none
+static const struct jump_rec *rec_of(const struct jump_view *v, const char *path, uint32_t hash) {
+    if (!v->h || !v->h->nslots) return NULL;
+    uint32_t mask = v->h->nslots - 1;
+    for (uint32_t k = hash & mask, n = 0; v->slots[k] && n < v->h->nslots; k = (k + 1) & mask, n++) {
+        if (v->slots[k] > v->h->count) return NULL;
+        const struct jump_rec *r = &v->recs[v->slots[k] - 1];
+        if (r->hash != hash) continue;
+        const char *p = rec_path(v, r);
+        if (p && strcmp(p, path) == 0) return r;
+    }
+    return NULL;
+}
+
+int jump_open(struct jump_db *db, const char *path) {
+    memset(db, 0, sizeof(*db));
+    db->path = strdup(path);
+    if (!db->path) return -1;
+    // Refuse anything that is not already an index rather than replace it
+    if (map_current(db) == -1) {
+        int err = errno;
+        free(db->path);
+        db->path = NULL;
+        errno = err;
+        return -1;
+    }
+    db->flush_every = JUMP_FLUSH;
+    db->active = true;
+    return 0;
+}
+
+static void drop_pending(struct jump_db *db) {
+    for (size_t i = 0; i < db->npending; i++) free(db->pending[i].path);
+    db->npending = 0;
+    db->visits = 0;
+}
+
+void jump_close(struct jump_db *db) {
+    if (!db->active) return;
+    jump_flush(db);
+    unmap(db);
+    free(db->pending);
+    free(db->path);
+    memset(db, 0, sizeof(*db));
+}
+
+static struct jump_visit *pending_find(struct jump_db *db, const char *path, uint32_t hash) {
+    for (size_t i = 0; i < db->npending; i++) {
+        if (db->pending[i].hash == hash && strcmp(db->pending[i].path, path) == 0) return &db->pending[i];
+    }
+    return NULL;
+}
+
+int jump_visit(struct jump_db *db, const char *dir, time_t now) {
+    if (!db->active) return 0;
+    size_t len = strlen(dir);
+    if (!len || len >= JUMP_MAX_PATH) return 0;
+    uint32_t hash = path_hash(dir);
+    struct jump_visit *v = pending_find(db, dir, hash);
+    if (!v) {
+        if (db->npending == db->pending_cap) {
+            size_t cap = db->pending_cap ? db->pending_cap * 2 : 16;
+            struct jump_visit *p = realloc(db->pending, cap * sizeof(*p));
+            if (!p) return -1;
+            db->pending = p;
+            db->pending_cap = cap;
+        }
+        char *path = strdup(dir);
+        if (!path) return -1;
+        v = &db->pending[db->npending++];
+        *v = (struct jump_visit){ .path = path, .hash = hash };
+    }
+    v->count += 1;
+    if (now > v->last) v->last = now;
+    if (++db->visits >= db->flush_every) return jump_flush(db);
+    return 0;
+}
+
+// A directory on its way into the new file
+struct entry {
+    const char *path;
+    double rank;
+    int64_t last;
+    float bound;
+    uint32_t hash;
+    uint16_t len;
+};
+
+static int by_bound(const void *a, const void *b) {
+    float x = ((const struct entry *)a)->bound, y = ((const struct entry *)b)->bound;
+    return x > y ? -1 : x < y;
+}
+
+static int write_index(const char *path, struct iovec *iov, size_t niov) {
+    size_t len = strlen(path);
+    char *tmp = malloc(len + sizeof(".XXXXXX"));
+    if (!tmp) return -1;
+    memcpy(tmp, path, len);
+    memcpy(tmp + len, ".XXXXXX", sizeof(".XXXXXX"));
+    int fd = mkostemp(tmp, O_CLOEXEC);
+    if (fd == -1) {
+        free(tmp);
+        return -1;
+    }
+
+    int rval = 0;
+    for (size_t i = 0; i < niov;) {
+        ssize_t n = writev(fd, iov + i, niov - i);
+        if (n <= 0) {
+            rval = -1;
+            break;
+        }
+        // Step past what was written, whole buffers and then part of one
+        while (i < niov && (size_t)n >= iov[i].iov_len) n -= iov[i++].iov_len;
+        if (i < niov) {
+            iov[i].iov_base = (char *)iov[i].iov_base + n;
+            iov[i].iov_len -= n;
+        }
+    }
+    // The rename must not be able to land before the data
+    if (rval == 0) rval = fdatasync(fd);
+    int err = errno;
+    if (close(fd) == -1 && rval == 0) rval = -1, err = errno;
+    if (rval == 0 && rename(tmp, path) == -1) rval = -1, err = errno;
+    if (rval == -1) {
+        unlink(tmp);
+        errno = err;
+    }
+    free(tmp);
+    return rval;
+}
+
+// Fill posts with the record numbers in each bucket, listed once per record
+// and in record order. Counted first, so buckets can be laid out in place.
+static uint32_t *build_postings(const struct jump_rec *recs, size_t count, const char *pool,
+                                uint32_t *buckets, size_t *npost) {
+    uint32_t *seen = malloc(JUMP_BUCKETS * sizeof(*seen));
+    if (!seen) return NULL;
+    memset(buckets, 0, (JUMP_BUCKETS + 1) * sizeof(*buckets));
+    for (int pass = 0; pass < 2; pass++) {
+        uint32_t *posts = NULL;
+        if (pass == 1) {
+            // Turn the counts into where each list ends, then fill backwards
+            for (size_t b = 0; b < JUMP_BUCKETS; b++) buckets[b + 1] += buckets[b];
+            *npost = buckets[JUMP_BUCKETS];
+            posts = malloc((*npost ? *npost : 1) * sizeof(*posts));
+            if (!posts) break;
+        }
+        memset(seen, 0xff, JUMP_BUCKETS * sizeof(*seen));
+        for (size_t i = count; i-- > 0;) {
+            const char *c = pool + recs[i].off + recs[i].base;
+            for (size_t k = 0; k + 2 < (size_t)(recs[i].len - recs[i].base); k++) {
+                uint32_t b = bucket(c + k);
+                if (seen[b] == i) continue;
+                seen[b] = i;
+                if (pass == 0) buckets[b + 1]++;
+                else posts[--buckets[b + 1]] = i;
+            }
+        }
+        if (pass == 1) {
+            // Filling backwards left every entry at the start of its list
+            memmove(buckets, buckets + 1, JUMP_BUCKETS * sizeof(*buckets));
+            buckets[JUMP_BUCKETS] = *npost;
+            free(seen);
+            return posts;
+        }
+    }
+    free(seen);
+    return NULL;
+}
+
+int jump_flush(struct jump_db *db) {
+    if (!db->active || !db->npending) return 0;
+    // Merge into whatever is on disk now, another shell may have flushed
+    if (map_current(db) == -1) {
+        drop_pending(db);
+        return -1;
+    }
+    struct jump_view v = db->map ? view(db->map) : (struct jump_view){0};
+    size_t n = v.h ? v.h->count : 0;
+    double total = v.h ? v.h->total : 0;
+    for (size_t k = 0; k < db->npending; k++) total += db->pending[k].count;
+    double scale = total > JUMP_MAX_TOTAL ? JUMP_AGE : 1.0;
+
+    struct entry *e = malloc((n + db->npending) * sizeof(*e));
+    bool *updated = calloc(n + 1, sizeof(*updated));
+    if (!e || !updated) {
+        free(e);
+        free(updated);
+        drop_pending(db);
+        return -1;
+    }
+    size_t count = 0, pool_len = 0;
+    int64_t newest = 0;
+    for (size_t k = 0; k < db->npending; k++) {
+        const struct jump_visit *p = &db->pending[k];
+        struct entry x = { p->path, p->count, p->last, 0, p->hash, strlen(p->path) };
+        const struct jump_rec *r = rec_of(&v, p->path, p->hash);
+        if (r) {
+            x.rank += r->rank;
+            if (r->last > x.last) x.last = r->last;
+            updated[r - v.recs] = true;
+        }
+        e[count++] = x;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (updated[i]) continue;
+        const struct jump_rec *r = &v.recs[i];
+        const char *path = rec_path(&v, r);
+        if (path) e[count++] = (struct entry){ path, r->rank, r->last, 0, r->hash, r->len };
+    }
+    free(updated);
+
+    // Age, then bound every frecency from the newest visit on
+    size_t kept = 0;
+    total = 0;
+    for (size_t i = 0; i < count; i++) {
+        e[i].rank *= scale;
+        if (e[i].rank < JUMP_MIN_RANK) continue;
+        if (e[i].last > newest) newest = e[i].last;
+        total += e[i].rank;
+        pool_len += e[i].len + 1;
+        e[kept++] = e[i];
+    }
+    count = kept;
+    for (size_t i = 0; i < count; i++) e[i].bound = e[i].rank * weight(newest - e[i].last);
+    qsort(e, count, sizeof(*e), by_bound);
+
+    size_t nslots = 16;
+    while (nslots < count * 2) nslots *= 2;
+    struct jump_rec *recs = malloc((count ? count : 1) * sizeof(*recs));
+    uint32_t *slots = calloc(nslots, sizeof(*slots));
+    uint32_t *buckets = malloc((JUMP_BUCKETS + 1) * sizeof(*buckets));
+    char *pool = malloc(pool_len ? pool_len : 1);
+    uint32_t *posts = NULL;
+    size_t npost = 0;
+    int rval = -1;
+    if (recs && slots && buckets && pool) {
+        size_t off = 0;
+        for (size_t i = 0; i < count; i++) {
+            size_t base = base_of(e[i].path, e[i].len);
+            recs[i] = (struct jump_rec){
+                .rank = e[i].rank, .bound = e[i].bound, .last = e[i].last, .off = off,
+                .hash = e[i].hash, .sig = sig(e[i].path + base, e[i].len - base),
+                .len = e[i].len, .base = base,
+            };
+            memcpy(pool + off, e[i].path, e[i].len + 1);
+            off += e[i].len + 1;
+            size_t k = e[i].hash & (nslots - 1);
+            while (slots[k]) k = (k + 1) & (nslots - 1);
+            slots[k] = i + 1;
+        }
+        posts = build_postings(recs, count, pool, buckets, &npost);
+    }
+    if (posts) {
+        struct jump_head h = {
+            .magic = JUMP_MAGIC, .count = count, .nslots = nslots, .npost = npost,
+            .pool_len = pool_len, .total = total,
+        };
+        struct iovec iov[] = {
+            { &h, sizeof(h) },
+            { recs, count * sizeof(*recs) },
+            { slots, nslots * sizeof(*slots) },
+            { buckets, (JUMP_BUCKETS + 1) * sizeof(*buckets) },
+            { posts, npost * sizeof(*posts) },
+            { pool, pool_len },
+        };
+        rval = write_index(db->path, iov, sizeof(iov) / sizeof(iov[0]));
+    }
+    free(e);
+    free(recs);
+    free(slots);
+    free(buckets);
+    free(posts);
+    free(pool);
+    drop_pending(db);
+    return rval;
+}
+
+struct query {
+    char **words;
+    size_t nwords;
+    size_t *lens;
+    uint32_t sig;    // of the last word
+};
+
+// The words in order, case ignored, the last one in the last component
+static bool matches(const struct query *q, const char *path, size_t base) {
+    const char *p = path;
+    for (size_t i = 0; i < q->nwords; i++) {
+        if (i + 1 == q->nwords && p < path + base) p = path + base;
+        const char *hit = strcasestr(p, q->words[i]);
+        if (!hit) return false;
+        p = hit + q->lens[i];
+    }
+    return true;
+}
+
+// Put path into out, kept best first, if it makes the cut
+static void insert(struct jump_match *out, size_t *found, size_t max, const char *path, double score) {
+    if (*found == max && score <= out[max - 1].score) return;
+    size_t i = *found < max ? (*found)++ : max - 1;
+    for (; i > 0 && out[i - 1].score < score; i--) out[i] = out[i - 1];
+    out[i] = (struct jump_match){ path, score };
+}
+
+// Score record i if it matches, true once no later record can make the cut
+static bool consider(struct jump_db *db, const struct jump_view *v, const struct query *q, size_t i,
+                     const char *exclude, time_t now, struct jump_match *out, size_t *found, size_t max) {
+    const struct jump_rec *r = &v->recs[i];
+    if (*found == max && r->bound <= out[max - 1].score) return true;
+    if ((r->sig & q->sig) != q->sig) return false;
+    const char *path = rec_path(v, r);
+    if (!path || !matches(q, path, r->base)) return false;
+    if (exclude && strcmp(path, exclude) == 0) return false;
+    // Pending visits are scored with their record afterwards
+    if (db->npending && pending_find(db, path, r->hash)) return false;
+    insert(out, found, max, path, r->rank * weight(now - r->last));
+    return false;
+}
+
+// First entry of the sorted list [p, end) that is at least x
+static const uint32_t *seek(const uint32_t *p, const uint32_t *end, uint32_t x) {
+    size_t step = 1;
+    while (p + step < end && p[step] < x) step *= 2;
+    const uint32_t *hi = p + step < end ? p + step : end;
+    while (p < hi) {
+        const uint32_t *mid = p + (hi - p) / 2;
+        if (*mid < x) p = mid + 1;
+        else hi = mid;
+    }
+    return p;
+}
+
+// Walk the records in every bucket of the last word's trigrams, in order.
+// Those are the only ones that can have the word in their last component.
+static void query_grams(struct jump_db *db, const struct jump_view *v, const struct query *q,
+                        const char *exclude, time_t now, struct jump_match *out, size_t *found,
+                        size_t max) {
+    const char *word = q->words[q->nwords - 1];
+    size_t len = q->lens[q->nwords - 1];
+    const uint32_t *cur[32], *end[32];
+    size_t nl = 0;
+    for (size_t k = 0; k + 2 < len && nl < 32; k++) {
+        uint32_t b = bucket(word + k);
+        if (v->buckets[b] > v->buckets[b + 1] || v->buckets[b + 1] > v->h->npost) return;
+        bool dup = false;
+        for (size_t j = 0; j < nl; j++) dup |= cur[j] == v->posts + v->buckets[b];
+        if (dup) continue;
+        cur[nl] = v->posts + v->buckets[b];
+        end[nl] = v->posts + v->buckets[b + 1];
+        if (cur[nl] == end[nl]) return;
+        nl++;
+    }
+    // Leapfrog: move every list up to the largest head until they agree
+    uint32_t x = *cur[0];
+    for (;;) {
+        size_t agree = 0;
+        for (size_t j = 0; j < nl; j++) {
+            cur[j] = seek(cur[j], end[j], x);
+            if (cur[j] == end[j]) return;
+            if (*cur[j] == x) {
+                agree++;
+            } else {
+                x = *cur[j];
+                break;
+            }
+        }
+        if (agree < nl) continue;
+        if (x >= v->h->count) return;
+        if (consider(db, v, q, x, exclude, now, out, found, max)) return;
+        x++;
+    }
+}
+
+size_t jump_query(struct jump_db *db, char **words, const char *exclude, time_t now,
+                  struct jump_match *out, size_t max) {
+    if (!db->active || !max) return 0;
+    // A missing or broken file still leaves the pending visits
+    if (map_current(db) == -1) unmap(db);
+
+    struct query q = { .words = words };
+    while (words[q.nwords]) q.nwords++;
+    size_t stack[8];
+    q.lens = q.nwords <= 8 ? stack : malloc(q.nwords * sizeof(*q.lens));
+    if (!q.lens) return 0;
+    for (size_t i = 0; i < q.nwords; i++) q.lens[i] = strlen(words[i]);
+    if (q.nwords) q.sig = sig(words[q.nwords - 1], q.lens[q.nwords - 1]);
+
+    size_t found = 0;
+    struct jump_view v = db->map ? view(db->map) : (struct jump_view){0};
+    if (v.h && q.nwords && q.lens[q.nwords - 1] >= 3) {
+        query_grams(db, &v, &q, exclude, now, out, &found, max);
+    } else if (v.h) {
+        for (size_t i = 0; i < v.h->count; i++) {
+            if (consider(db, &v, &q, i, exclude, now, out, &found, max)) break;
+        }
+    }
+
+    // Directories visited since the last flush, with what the file has
+    for (size_t k = 0; k < db->npending; k++) {
+        const struct jump_visit *p = &db->pending[k];
+        size_t len = strlen(p->path), base = base_of(p->path, len);
+        if (!matches(&q, p->path, base)) continue;
+        if (exclude && strcmp(p->path, exclude) == 0) continue;
+        double rank = p->count;
+        int64_t last = p->last;
+        const struct jump_rec *r = rec_of(&v, p->path, p->hash);
+        if (r) {
+            rank += r->rank;
+            if (r->last > last) last = r->last;
+        }
+        insert(out, &found, max, p->path, rank * weight(now - last));
+    }
+    if (q.lens != stack) free(q.lens);
+    return found;
+}
+
+char *jump_default_path(void) {
+    const char *env = env_get("MY_JUMPFILE");
+    if (env) return *env ? strdup(env) : NULL;
+    const char *home = env_get("HOME");
+    if (!home || !*home) return NULL;
+    size_t len = strlen(home) + sizeof("/.lab_jump");
+    char *path = malloc(len);
+    if (path) snprintf(path, len, "%s/.lab_jump", home);
+    return path;
+}
+
+// j [-l] [word ...]
+int builtin_j(struct shell *sh, char **argv) {
+    if (!sh) return 0;
+    if (!sh->jumps.active) {
+        fprintf(stderr, "j: no jump index, directories are not being recorded\n");
+        return EXIT_FAILURE;
+    }
+    bool list = argv[1] && strcmp(argv[1], "-l") == 0;
+    char **words = argv + 1 + list;
+    struct jump_match m[JUMP_LIST];
+    time_t now = time(NULL);
+
+    if (list || !*words) {
+        size_t n = jump_query(&sh->jumps, words, NULL, now, m, JUMP_LIST);
+        // Best last, next to the prompt
+        for (size_t i = n; i-- > 0;) out_printf("%10.1f  %s\n", m[i].score, m[i].path);
+        return n ? 0 : EXIT_FAILURE;
+    }
+
+    // Jumping to where we are is no jump, and directories can disappear
+    size_t n = jump_query(&sh->jumps, words, sh_cwd(sh), now, m, JUMP_TRIES);
+    for (size_t i = 0; i < n; i++) {
+        struct stat st;
+        if (stat(m[i].path, &st) == -1 || !S_ISDIR(st.st_mode)) continue;
+        // change_dir records the visit, which may replace the mapping
+        char *to = strdup(m[i].path);
+        if (!to) {
+            perror("j");
+            return EXIT_FAILURE;
+        }
+        char *dir[] = { "cd", to, NULL };
+        int rval = change_dir(sh, dir);
+        free(to);
+        return rval == -1 ? EXIT_FAILURE : 0;
+    }
+    fprintf(stderr, "j: no match for");
+    for (size_t i = 0; words[i]; i++) fprintf(stderr, " %s", words[i]);
+    fprintf(stderr, "\n");
+    return EXIT_FAILURE;
+}
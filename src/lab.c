@@ -1,8 +1,9 @@
+#include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <pwd.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 #include "lab.h"
@@ -14,30 +15,61 @@
 
 
 // Parses command-line arguments
-void parse_args(int argc, char **argv) {
+void parse_args(struct shell *sh, int argc, char **argv) {
     int opt;
-    while ((opt = getopt(argc, argv, "v")) != -1) {
+    // Stop at the script name, the rest of the line is for the script
+    while ((opt = getopt(argc, argv, "+vl:c:")) != -1) {
         switch (opt) {
             case 'v':
                 printf("lab version %d.%d\n", lab_VERSION_MAJOR, lab_VERSION_MINOR);
                 exit(EXIT_SUCCESS);
+            case 'l':
+                if (launch_mode_parse(optarg, &sh->launch_mode) == 0) break;
+                fprintf(stderr, "%s: unknown launch mode '%s'\n", argv[0], optarg);
+                /* fall through */
             default:
-                fprintf(stderr, "Usage: %s [-v]\n", argv[0]);
+                fprintf(stderr, "Usage: %s [-v] [-l fork|spawn] [-c command | script]\n", argv[0]);
                 exit(EXIT_FAILURE);
+            case 'c':
+                sh->command = optarg;
+                break;
         }
     }
+    if (!sh->command && optind < argc) {
+        sh->script = argv[optind];
+    }
 }
 
 // Initializes the shell environment
 void sh_init(struct shell *sh) {
     sh->shell_terminal = STDIN_FILENO;
-    sh->shell_is_interactive = isatty(sh->shell_terminal);
+    // Scripts and -c commands never run interactively
+    sh->shell_is_interactive = !sh->script && !sh->command && isatty(sh->shell_terminal);
+    sh->shell_pgid = getpgrp();
+    if (sh->shell_is_interactive) {
+        // Loop until we are in the foreground
+        while (tcgetpgrp(sh->shell_terminal) != (sh->shell_pgid = getpgrp())) {
+            kill(-sh->shell_pgid, SIGTTIN);
+        }
+        // Put ourselves in our own process group, this fails harmlessly
+        // when the shell already leads its session
+        sh->shell_pgid = getpid();
+        if (setpgid(sh->shell_pgid, sh->shell_pgid) == -1) {
+            sh->shell_pgid = getpgrp();
+        }
+        tcsetpgrp(sh->shell_terminal, sh->shell_pgid);
+        tcgetattr(sh->shell_terminal, &sh->shell_tmodes);
+    }
     if (sh->prompt) {
         free(sh->prompt);
         sh->prompt = NULL;
     }
 
     sh->prompt = get_prompt("MY_PROMPT");
+    prompt_destroy(&sh->prompt_template);
+    if (prompt_compile(&sh->prompt_template, sh->prompt) == -1) {
+        perror("prompt");
+    }
 }
 
 // Cleanup shell resources
@@ -48,113 +80,286 @@ void sh_destroy(struct shell *sh) {
         free(sh->prompt);
         sh->prompt = NULL;
     }
+    cmd_hash_destroy(&sh->hash);
+    job_table_destroy(&sh->jobs);
+    hist_close(&sh->history);
+    prompt_destroy(&sh->prompt_template);
+    free(sh->cwd);
+    free(sh->oldpwd);
+    sh->cwd = NULL;
+    sh->oldpwd = NULL;
+    dir_stack_destroy(&sh->dirs);
+    jump_close(&sh->jumps);
 }
 
-// Trim leading/trailing whitespace from a string
+// Trim leading/trailing whitespace (space, tab, newline, carriage return)
+// from a string using the vectorized scan kernels
 char *trim_white(char *line) {
     if (!line) return NULL;
 
-    while (*line == ' ') line++;
-
-    char *end = line + strlen(line) - 1;
-    while (end > line && *end == ' ') end--;
-    *(end + 1) = '\0';
+    size_t len = strlen(line);
+    size_t start = scan_blank(line, len);
+    line += start;
+    line[scan_blank_rev(line, len - start)] = '\0';
 
     return line;
 }
 
-// Parses command input into arguments
-char **cmd_parse(const char *line) {
-    if (!line) return NULL;
+// Slots handed out before the argv has to grow. A line of n bytes holds at
+// most n tokens, so short lines get exactly what they can use.
+#define ARGV_INIT 64
+
+// Growable argv for the tokenizer. With an arena the token bytes sit right
+// behind the slots in the same block and move with it when it grows.
+struct argv_builder {
+    char **v;       // the block, slots first
+    size_t n;       // tokens stored
+    size_t cap;     // slots, including the one for the NULL terminator
+    char *buf;      // start of the bytes being tokenized
+    size_t len;     // bytes at buf, not counting its NUL
+    bool arena;     // buf lives inside v and must move with it
+    size_t bytes;   // what execve would need for the argv so far
+    size_t limit;   // the ARG_MAX budget
+    unsigned first; // quoting of the first token, LEX_SQUOTED and friends
+};
+
+// Byte budget execve allows for the arguments, looked up once. Linux only
+// fails at exec time, so the parser enforces it up front.
+static size_t arg_max(void) {
+    static size_t limit;
+    if (!limit) {
+        long v = sysconf(_SC_ARG_MAX);
+        limit = v > 0 ? (size_t)v : SIZE_MAX;
+    }
+    return limit;
+}
 
-    int max_args = 128;
-    char **cmd = calloc(max_args, sizeof(char *));
-    if (!cmd) {
-        perror("calloc failed");
+// Sets up b with room for the argv of a len byte line. If arena is set the
+// block also holds a copy of line (len + 1 bytes) behind the slots.
+static void argv_init(struct argv_builder *b, const char *line, size_t len, bool arena) {
+    b->n = 0;
+    b->first = 0;
+    b->cap = len + 1 < ARGV_INIT ? len + 1 : ARGV_INIT;
+    b->len = len;
+    b->arena = arena;
+    b->bytes = sizeof(char *);
+    b->limit = arg_max();
+    b->v = malloc(b->cap * sizeof(char *) + (arena ? len + 1 : 0));
+    if (!b->v) {
+        perror("malloc failed");
         exit(EXIT_FAILURE);
     }
+    if (arena) {
+        b->buf = (char *)(b->v + b->cap);
+        memcpy(b->buf, line, len + 1);
+    } else {
+        b->buf = (char *)line;
+    }
+}
 
-    char *input_copy = strdup(line);
-    if (!input_copy) {
-        perror("strdup failed");
-        free(cmd);
+// Doubles the slots. Arena token bytes are shifted up behind the new slots
+// and the tokens already stored are rebased to follow them.
+static void argv_grow(struct argv_builder *b) {
+    size_t cap = b->cap * 2;
+    size_t extra = b->arena ? b->len + 1 : 0;
+    char **v = realloc(b->v, cap * sizeof(char *) + extra);
+    if (!v) {
+        perror("realloc failed");
         exit(EXIT_FAILURE);
     }
+    if (b->arena) {
+        char *old = (char *)(v + b->cap);
+        char *buf = (char *)(v + cap);
+        memmove(buf, old, extra);
+        for (size_t i = 0; i < b->n; i++) {
+            if (!lex_op(v[i])) v[i] = buf + (v[i] - b->buf);
+        }
+        b->buf = buf;
+    }
+    b->v = v;
+    b->cap = cap;
+}
 
-    char *token = strtok(input_copy, " ");
-    int i = 0;
-    while (token && i < max_args - 1) {
-        cmd[i] = strdup(token);
-        if (!cmd[i]) {
-            perror("strdup failed");
-            free(input_copy);
-            cmd_free(cmd);
-            exit(EXIT_FAILURE);
+// Appends a token of len bytes. Returns -1 once the argv no longer fits in
+// the ARG_MAX budget.
+static int argv_push(struct argv_builder *b, char *tok, size_t len) {
+    b->bytes += len + 1 + sizeof(char *);
+    if (b->bytes > b->limit) return -1;
+    if (b->n + 1 == b->cap) {
+        size_t off = tok - b->buf;
+        argv_grow(b);
+        if (!lex_op(tok)) tok = b->buf + off;
+    }
+    b->v[b->n++] = tok;
+    return 0;
+}
+
+// Lexes the builder's bytes in place into words and operators and NULL
+// terminates the argv. On failure the block is freed and errno says why.
+static char **split_tokens(struct argv_builder *b) {
+    struct lexer lx;
+    struct lex_token tok;
+    int r;
+    lex_init(&lx, b->buf, b->len);
+    while ((r = lex_next(&lx, &tok)) == 1) {
+        if (b->n == 0) b->first = tok.flags;
+        if (argv_push(b, tok.text, tok.len) == -1) {
+            errno = E2BIG;
+            r = -1;
+            break;
         }
-        token = strtok(NULL, " ");
-        i++;
+        // Growing an arena moves the bytes being lexed
+        lx.buf = b->buf;
+    }
+    if (r == -1) {
+        free(b->v);
+        return NULL;
     }
-    cmd[i] = NULL;
+    b->v[b->n] = NULL;
+    return b->v;
+}
+
+// Parses command input into arguments. The argv array and the token bytes
+// live in one block (a per-line arena) so cmd_free releases it in one call.
+char **cmd_parse(const char *line) {
+    if (!line) return NULL;
+
+    struct argv_builder b;
+    argv_init(&b, line, strlen(line), true);
+    return split_tokens(&b);
+}
+
+// Parses command input into arguments without copying it. Tokens are NUL
+// terminated inside line and the argv array points straight into it.
+char **cmd_parse_inplace(char *line) {
+    if (!line) return NULL;
+
+    struct argv_builder b;
+    argv_init(&b, line, strlen(line), false);
+    return split_tokens(&b);
+}
 
-    free(input_copy);
+// Same as cmd_parse_inplace, also telling the caller how argv[0] was quoted
+char **cmd_parse_inplace_flags(char *line, unsigned *first) {
+    *first = 0;
+    if (!line) return NULL;
 
-    return cmd;
+    struct argv_builder b;
+    argv_init(&b, line, strlen(line), false);
+    char **argv = split_tokens(&b);
+    if (argv) *first = b.first;
+    return argv;
 }
 
 
 // Frees memory allocated for command arguments
 void cmd_free(char **cmd) {
-    if (!cmd) return;
-
-    for (int i = 0; cmd[i] != NULL; i++) {
-        free(cmd[i]);
-        cmd[i] = NULL;
-    }
     free(cmd);
 }
 
 
-// Handles built-in commands like exit, cd, and fg
-bool do_builtin(struct shell *sh, char **argv) {
-    if (!argv || !argv[0]) {
-        return false;
+// Runs a single builtin in the shell itself. Its redirections are applied
+// to the shell's own fds and undone afterwards.
+static void run_builtin(struct shell *sh, struct pipeline *p) {
+    int saved_buf[8];
+    int *saved = saved_buf;
+    if (p->nredirs > sizeof(saved_buf) / sizeof(saved_buf[0])) {
+        saved = malloc(p->nredirs * sizeof(int));
+        if (!saved) {
+            perror("malloc failed");
+            exit(EXIT_FAILURE);
+        }
     }
 
-    // Exit command
-    if (strcmp(argv[0], "exit") == 0) {
-        sh_destroy(sh);
-        cmd_free(argv);
-        exit(0);
+    // Output still buffered for the old fds must go there first
+    if (p->nredirs) fflush(stdout);
+    if (redir_prepare(p->redirs, p->nredirs, false) == -1) {
+        sh->last_status = EXIT_FAILURE;
+    } else {
+        if (redir_apply(p->redirs, p->nredirs, saved) == -1) {
+            sh->last_status = EXIT_FAILURE;
+        } else if (p->timed || sh->timing) {
+            do_builtin_timed(sh, p->cmds[0]);
+        } else {
+            do_builtin(sh, p->cmds[0]);
+        }
+        if (p->nredirs) {
+            fflush(stdout);
+            fflush(stderr);
+            redir_restore(p->redirs, p->nredirs, saved);
+            redir_release(p->redirs, p->nredirs);
+        }
     }
+    if (saved != saved_buf) free(saved);
+}
 
-    // cd command
-    if (strcmp(argv[0], "cd") == 0) {
-        if (change_dir(argv) == -1) {
-            fprintf(stderr, "cd: failed to change directory\n");
-        }
-        return true;
+// The first stage running a builtin that must run in the shell, or NULL
+static const struct builtin *parent_builtin(const struct pipeline *p) {
+    for (size_t i = 0; i < p->ncmds; i++) {
+        const struct builtin *b = builtin_find(p->cmds[i][0]);
+        if (b && (b->flags & BUILTIN_PARENT)) return b;
     }
+    return NULL;
+}
 
-    // fg command
-    if (strcmp(argv[0], "fg") == 0) {
-        pid_t pid = tcgetpgrp(STDIN_FILENO);
-        if (pid > 0) {
-            tcsetpgrp(STDIN_FILENO, pid);
-            kill(-pid, SIGCONT);
-            waitpid(pid, NULL, WUNTRACED);
-            tcsetpgrp(STDIN_FILENO, getpgrp());
+// Runs a parsed line: a lone builtin in the shell, anything else as a job
+int sh_exec_pipeline(struct shell *sh, struct pipeline *p) {
+    const struct builtin *b = builtin_find(p->cmds[0][0]);
+    // env NAME=value cmd and the like are the external command's job
+    if (b && (b->flags & BUILTIN_BARE) && p->cmds[0][1]) b = NULL;
+    if (p->ncmds == 1 && !p->background && b) {
+        run_builtin(sh, p);
+    } else if ((b = parent_builtin(p))) {
+        // A pipeline stage or background job is a child, where cd or exit
+        // would do nothing, and running a same-named program is worse
+        fprintf(stderr, "%s: cannot run in a pipeline or in the background\n", b->name);
+        sh->last_status = EXIT_FAILURE;
+    } else {
+        sh->last_status = pipeline_run(sh, p);
+    }
+    return sh->last_status;
+}
+
+// Runs one line of input, shared by the REPL and batch mode
+int sh_exec_line(struct shell *sh, char *line) {
+    // do nothing on blank lines or comments
+    line = trim_white(line);
+    if (!*line || *line == '#') return sh->last_status;
+
+    // Tokens point into line so it must outlive the pipeline
+    struct pipeline p;
+    if (pipeline_parse(line, &p) == -1) {
+        if (errno == E2BIG) {
+            fprintf(stderr, "argument list too long\n");
+            sh->last_status = 126;
         } else {
-            fprintf(stderr, "No stopped process to resume\n");
+            fprintf(stderr, "syntax error\n");
+            sh->last_status = 2;
         }
-        return true;
+    } else {
+        sh_exec_pipeline(sh, &p);
     }
+    pipeline_free(&p);
+    sh_report_jobs(sh);
+    return sh->last_status;
+}
 
-    return false;
+// Report jobs that changed state while a line ran. Only an interactive
+// user wants to hear about them. The interactive shell reaps on SIGCHLD
+// in its main loop, batch mode has no loop so it reaps here, or finished
+// background jobs would stay zombies until the next foreground wait.
+void sh_report_jobs(struct shell *sh) {
+    if (sh->shell_is_interactive) {
+        job_notify(&sh->jobs, stderr);
+    } else {
+        job_reap(&sh->jobs);
+        job_notify(&sh->jobs, NULL);
+    }
 }
 
 // Retrieve shell prompt
 char *get_prompt(const char *env) {
-    const char *env_value = getenv(env);
+    const char *env_value = env_get(env);
     if (env_value != NULL && strlen(env_value) > 0) {
         // Use the environment variables value
         return strdup(env_value);
@@ -164,30 +369,3 @@ char *get_prompt(const char *env) {
     }
 }
 
-
-
-
-// Change working directory
-int change_dir(char **dir) {
-    if (!dir || !dir[1] || !dir[1][0]) {
-        const char *home = getenv("HOME");
-        if (!home) {
-            struct passwd *pw = getpwuid(getuid());
-            if (pw) home = pw->pw_dir;
-        }
-        if (!home) {
-            fprintf(stderr, "cd: HOME not set\n");
-            return -1;
-        }
-        if (chdir(home) != 0) {
-            perror("cd");
-            return -1;
-        }
-        return 0;
-    }
-    if (chdir(dir[1]) != 0) {
-        perror("cd");
-        return -1;
-    }
-    return 0;
-}
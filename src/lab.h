@@ -1,9 +1,14 @@
 #ifndef LAB_H
 #define LAB_H
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
 #define lab_VERSION_MAJOR 1
@@ -15,6 +20,344 @@ extern "C"
 {
 #endif
 
+  struct cmd_hash_entry
+  {
+    char *name;
+    char *path;
+    unsigned long hits;
+  };
+
+  struct cmd_trie_node;
+  struct cmd_dir;
+
+  /**
+   * Every executable on PATH in a byte trie, for completion. Directories
+   * are read again only when their mtime changes.
+   */
+  struct cmd_index
+  {
+    struct cmd_dir *dirs;        /* one per PATH element, in PATH order */
+    size_t ndirs;
+    struct cmd_trie_node *nodes; /* the trie, node 0 is the root */
+    size_t nnodes;
+    size_t cap;
+    size_t count;                /* distinct names */
+    char *path_env;              /* the PATH the directories came from */
+    unsigned long rescans;       /* directories read so far */
+  };
+
+  /**
+   * Open addressing table mapping command names to the absolute path they
+   * resolve to on PATH (the bash style `hash` table). The table remembers
+   * the PATH it was built from and empties itself when PATH changes.
+   */
+  struct cmd_hash
+  {
+    struct cmd_hash_entry *slots;
+    size_t cap;
+    size_t count;
+    char *path_env;
+    unsigned long lookups;
+    unsigned long hits;
+    struct cmd_index index; /* answers misses once completion built it */
+  };
+
+  /**
+   * How external commands are started. LAUNCH_FORK uses fork followed by
+   * execve in the child. LAUNCH_SPAWN uses posix_spawn which never copies
+   * the shell's page tables.
+   */
+  enum launch_mode
+  {
+    LAUNCH_FORK = 0,
+    LAUNCH_SPAWN,
+  };
+
+  /**
+   * What a redirection does to its fd.
+   */
+  enum redir_kind
+  {
+    REDIR_IN,     /* < file */
+    REDIR_OUT,    /* > file */
+    REDIR_APPEND, /* >> file */
+    REDIR_DUP,    /* <&n or >&n, as in 2>&1 */
+    REDIR_STRING  /* <<< word */
+  };
+
+  /**
+   * One redirection of a pipeline stage. They are applied in the order
+   * they appear on the line, after the stage's pipes are connected.
+   */
+  struct redir
+  {
+    int fd;               /* descriptor the command sees */
+    enum redir_kind kind;
+    const char *word;     /* file name or here-string text */
+    int src;              /* REDIR_DUP: fd to copy, else -1 or see redir_prepare */
+    size_t stage;         /* index of the pipeline stage */
+  };
+
+  /**
+   * Everything needed to start one external process.
+   */
+  struct launch
+  {
+    const char *path; /* resolved program to exec */
+    char **argv;      /* NULL terminated argument list */
+    pid_t pgid;       /* process group to join, 0 starts a new one */
+    bool foreground;  /* give the process group the terminal */
+    int fd_in;        /* becomes stdin, 0 or -1 to inherit */
+    int fd_out;       /* becomes stdout, 1 or -1 to inherit */
+    const struct redir *redirs; /* applied after fd_in and fd_out */
+    size_t nredirs;
+  };
+
+  /**
+   * A parsed line of one or more commands joined by pipes. Every stage in
+   * cmds is a NULL terminated slice of the single argv token array.
+   */
+  struct pipeline
+  {
+    char **argv;   /* tokens from cmd_parse_inplace, cut at each pipe */
+    char ***cmds;  /* argv of each stage */
+    size_t ncmds;  /* number of stages */
+    struct redir *redirs; /* every stage's redirections, in stage order */
+    size_t nredirs;
+    bool background; /* line ended with & */
+    bool timed;      /* line started with the time keyword */
+  };
+
+  /**
+   * Operators the lexer knows. Operator tokens point at static text owned
+   * by the lexer, see lex_op.
+   */
+  enum lex_op
+  {
+    LEX_WORD,   /* not an operator */
+    LEX_PIPE,   /* | */
+    LEX_AMP,    /* & */
+    LEX_AND_IF, /* && */
+    LEX_LESS,     /* < */
+    LEX_GREAT,    /* > */
+    LEX_DGREAT,   /* >> */
+    LEX_LESSAND,  /* <& */
+    LEX_GREATAND, /* >& */
+    LEX_DLESS,    /* << (here documents, not supported) */
+    LEX_TLESS,    /* <<< */
+    LEX_NOPS,
+    LEX_IO_NUMBER = LEX_NOPS /* the single digit fd in front of < or > */
+  };
+
+#define LEX_SQUOTED 0x1 /* part of the word was in single quotes */
+#define LEX_DQUOTED 0x2 /* part of the word was in double quotes */
+#define LEX_ESCAPED 0x4 /* the word had a backslash escape */
+
+  /**
+   * One token from lex_next.
+   */
+  struct lex_token
+  {
+    char *text;       /* NUL terminated, quotes and escapes removed */
+    size_t len;       /* bytes in text */
+    unsigned flags;   /* LEX_SQUOTED, LEX_DQUOTED, LEX_ESCAPED */
+    enum lex_op op;   /* LEX_WORD for words */
+  };
+
+  /**
+   * Lexer state for one buffer. Indexes rather than pointers are kept so
+   * the buffer may be moved between calls to lex_next.
+   */
+  struct lexer
+  {
+    char *buf;      /* the bytes being lexed, rewritten in place */
+    size_t len;
+    size_t i;       /* read index */
+    size_t w;       /* write index, never past i */
+    size_t start;   /* where the current word begins */
+    unsigned flags; /* quoting seen in the current word */
+    int state;
+    int held;       /* byte to look at again, -1 if none */
+  };
+
+  /**
+   * One process of a job, updated as wait reports on it.
+   */
+  struct job_proc
+  {
+    pid_t pid;     /* 0 if the stage never started */
+    int code;      /* exit status, see status_to_exit */
+    bool done;
+    bool stopped;
+  };
+
+  /**
+   * Wall clock time and resources used by a job, summed over all of its
+   * processes as reported by wait4 (maxrss is the largest of them).
+   */
+  struct cmd_usage
+  {
+    struct timespec start;  /* CLOCK_MONOTONIC at launch */
+    struct timespec end;    /* CLOCK_MONOTONIC when the last process exited */
+    struct timeval utime;
+    struct timeval stime;
+    long maxrss;            /* kilobytes */
+    long nvcsw;             /* voluntary context switches */
+    long nivcsw;            /* involuntary context switches */
+  };
+
+  /**
+   * A pipeline the shell started and has not reported as finished yet.
+   */
+  struct job
+  {
+    int id;                 /* the n in %n */
+    pid_t pgid;
+    char *cmdline;
+    struct job_proc *procs; /* one per pipeline stage */
+    size_t nprocs;
+    bool background;
+    bool notified;          /* the user has seen the current state */
+    bool has_tmodes;
+    struct termios tmodes;  /* terminal modes saved when it stopped */
+    bool timed;             /* report usage when it finishes */
+    struct cmd_usage usage;
+  };
+
+  /**
+   * Every live job indexed by job number - 1.
+   */
+  struct job_table
+  {
+    struct job **jobs;
+    size_t cap;
+    size_t count;
+  };
+
+  /**
+   * The persistent history file, see hist_open. Nothing is mapped or
+   * indexed until entries are asked for.
+   */
+  struct hist_gram;
+
+  struct hist_file
+  {
+    bool active;     /* hist_open succeeded */
+    int fd;          /* O_APPEND descriptor, every record is one write */
+    char *map;       /* read only shared mapping of the file */
+    size_t map_len;  /* bytes mapped, whole pages */
+    size_t size;     /* file size when last mapped */
+    size_t *off;     /* offset of every indexed record */
+    size_t n;        /* records indexed */
+    size_t cap;      /* slots in off */
+    size_t scanned;  /* bytes of the file the index covers */
+    struct hist_gram *grams; /* trigram index, built by the first search */
+    size_t gram_cap;
+    size_t gram_count;
+    size_t indexed;  /* entries in the trigram index */
+  };
+
+  struct prompt_seg;
+  struct prompt_worker;
+
+  /**
+   * A prompt template compiled into segments, see prompt_compile.
+   */
+  struct prompt
+  {
+    struct prompt_seg *segs;
+    size_t nsegs;
+    char *source;     /* the template, literals point into it */
+    char **extra;     /* literals that did not fit in source */
+    size_t nextra;
+    bool async;       /* has segments computed in the background */
+    int notify_fd;    /* readable when a background segment changed */
+    struct prompt_worker *worker; /* started by the first render that needs it */
+  };
+
+  /**
+   * Options of the parallel builtin.
+   */
+  struct parallel_opts
+  {
+    size_t jobs;        /* most commands running at once, 0 for one per CPU */
+    bool keep_order;    /* print output in input order, not as jobs finish */
+    bool halt_on_error; /* start nothing after a failure, terminate the rest */
+  };
+
+  /**
+   * A script compiled by script_compile: a header, the instructions and the
+   * words they use, laid out the same in memory and in the cache file.
+   */
+  struct script_code
+  {
+    char *image;
+    size_t len;
+    bool mapped;    /* image is the mapped cache file, else malloc'd */
+  };
+
+  /**
+   * Directories saved by pushd, the top of the stack last.
+   */
+  struct dir_stack
+  {
+    char **dirs;
+    size_t n;
+    size_t cap;
+  };
+
+  /**
+   * The frecency index of visited directories, see jump_open. Visits are
+   * held in memory and merged into the file every flush_every of them.
+   */
+  struct jump_visit;
+
+  struct jump_db
+  {
+    bool active;        /* jump_open succeeded */
+    char *path;         /* the index file, only ever replaced whole */
+    const char *map;    /* read only mapping of the file, NULL if empty */
+    size_t map_len;
+    dev_t dev;          /* which file is mapped, to notice a replacement */
+    ino_t ino;
+    struct jump_visit *pending; /* directories visited since the last flush */
+    size_t npending;
+    size_t pending_cap;
+    size_t visits;      /* visits since the last flush */
+    size_t flush_every; /* visits that trigger a flush */
+  };
+
+  /**
+   * A directory found by jump_query. path points into the index and stays
+   * valid until the next call that takes the same jump_db.
+   */
+  struct jump_match
+  {
+    const char *path;
+    double score;
+  };
+
+  struct shell;
+
+  /**
+   * A builtin command. The handler returns the exit status of the command.
+   */
+  typedef int (*builtin_fn)(struct shell *sh, char **argv);
+
+  /* The builtin changes shell state so it must run in the shell itself,
+     sh_exec_pipeline refuses it in a pipeline or in the background */
+  #define BUILTIN_PARENT 0x1
+  /* The builtin only stands in for the external command of the same name
+     when it has no arguments, with arguments the command runs instead */
+  #define BUILTIN_BARE 0x2
+
+  struct builtin
+  {
+    const char *name;
+    builtin_fn fn;
+    unsigned flags;
+  };
+
   struct shell
   {
     int shell_is_interactive;
@@ -22,6 +365,20 @@ extern "C"
     struct termios shell_tmodes;
     int shell_terminal;
     char *prompt;
+    struct cmd_hash hash;
+    enum launch_mode launch_mode;
+    bool pipefail;
+    bool timing;     /* report usage after every command */
+    int last_status;
+    struct job_table jobs;
+    const char *script;  /* script file given on the command line */
+    const char *command; /* command given with -c */
+    struct hist_file history; /* persistent history, interactive only */
+    struct prompt prompt_template; /* MY_PROMPT compiled, rendered into prompt */
+    char *cwd;       /* canonical cwd, NULL until first needed, see sh_cwd */
+    char *oldpwd;    /* the cwd before the last cd */
+    struct dir_stack dirs; /* pushd and popd */
+    struct jump_db jumps; /* directories visited by cd, interactive only */
   };
 
 
@@ -37,31 +394,161 @@ extern "C"
    */
   char *get_prompt(const char *env);
 
+  /**
+   * @brief Compile a prompt template. Text is copied as is, except for
+   * these escapes:
+   *
+   * \w the cwd with $HOME shown as ~, \W its last component, \? the
+   * last exit status, \j the number of jobs, \$ # for root and $ for
+   * everyone else, \g the git branch, \u the user, \h the host name
+   * up to the first dot, \n a newline, \e an escape character, \[
+   * and \] around text that takes no space on screen, \\ a backslash.
+   *
+   * @param p The prompt to set up, release it with prompt_destroy even if
+   * this fails
+   * @param template The template, usually from get_prompt
+   * @return 0 on success, -1 if memory ran out
+   */
+  int prompt_compile(struct prompt *p, const char *template);
+
+  /**
+   * @brief Render the prompt for the shell's current state. Never blocks:
+   * \g shows what the background thread last found for the cwd, which
+   * may be nothing yet, and asks it to look again.
+   *
+   * @param p The compiled prompt
+   * @param sh The shell, may be NULL
+   * @return The prompt, the caller must free it
+   */
+  char *prompt_render(struct prompt *p, struct shell *sh);
+
+  /**
+   * @brief Consume the notification on notify_fd.
+   *
+   * @param p The compiled prompt
+   * @return True if a background segment changed and the prompt should be
+   * rendered again
+   */
+  bool prompt_collect(struct prompt *p);
+
+  /**
+   * @brief Stop the background thread and free the prompt.
+   *
+   * @param p The compiled prompt
+   */
+  void prompt_destroy(struct prompt *p);
+
   /**
    * Changes the current working directory of the shell. Uses the linux system
    * call chdir. With no arguments the users home directory is used as the
-   * directory to change to.
+   * directory to change to, and - goes back to the previous directory. On
+   * success the new directory is resolved once and cached in sh->cwd, the
+   * old one moves to sh->oldpwd, and PWD and OLDPWD are exported.
    *
+   * @param sh The shell, may be NULL
    * @param dir The directory to change to
    * @return  On success, zero is returned.  On error, -1 is returned, and
    * errno is set to indicate the error.
    */
-  int change_dir(char **dir);
+  int change_dir(struct shell *sh, char **dir);
+
+  /**
+   * @brief The shell's working directory without a system call. Only the
+   * first call, before any cd, asks getcwd.
+   *
+   * @param sh The shell, may be NULL
+   * @return The absolute path with symlinks resolved, NULL if sh is NULL
+   * or getcwd failed
+   */
+  const char *sh_cwd(struct shell *sh);
+
+  /**
+   * @brief Free the directories on a stack and empty it.
+   *
+   * @param s The stack
+   */
+  void dir_stack_destroy(struct dir_stack *s);
+
+  /**
+   * @brief The pushd builtin: pushd dir saves the cwd on the stack and
+   * changes to dir. Without dir the cwd and the top of the stack trade
+   * places. Prints the stack as dirs does.
+   *
+   * @param sh The shell, may be NULL
+   * @param argv The command
+   * @return 0, 1 if the directory could not be entered
+   */
+  int builtin_pushd(struct shell *sh, char **argv);
+
+  /**
+   * @brief The popd builtin: changes to the directory on top of the stack
+   * and removes it, then prints the stack.
+   *
+   * @param sh The shell, may be NULL
+   * @param argv The command
+   * @return 0, 1 if the stack is empty or the directory is gone
+   */
+  int builtin_popd(struct shell *sh, char **argv);
+
+  /**
+   * @brief The dirs builtin: dirs prints the cwd followed by the stack from
+   * the top down, with $HOME shown as ~. dirs -c empties the stack.
+   *
+   * @param sh The shell, may be NULL
+   * @param argv The command
+   * @return 0, 2 on misuse
+   */
+  int builtin_dirs(struct shell *sh, char **argv);
 
   /**
    * @brief Convert line read from the user into to format that will work with
-   * execvp. We limit the number of arguments to ARG_MAX loaded from sysconf.
-   * This function allocates memory that must be reclaimed with the cmd_free
-   * function.
+   * execvp. There is no fixed limit on the number of arguments: the argv
+   * grows as needed until the strings and pointers no longer fit in the
+   * ARG_MAX byte budget from sysconf, which fails the parse. Words are
+   * split, unquoted and unescaped by the lexer (see lex_next).
+   * The argv array and every token are carved out of a single allocation
+   * (a per-line arena) that must be reclaimed with the cmd_free function.
+   * Do not free individual tokens.
    *
    * @param line The line to process
    *
-   * @return The line read in a format suitable for exec
+   * @return The line read in a format suitable for exec, or NULL with errno
+   * set to E2BIG if the arguments exceed ARG_MAX or EINVAL if a quote is
+   * left open (see lex_next)
    */
   char **cmd_parse(char const *line);
 
   /**
-   * @brief Free the line that was constructed with parse_cmd
+   * @brief Same as cmd_parse but tokenizes the caller's buffer in place.
+   * Each token is NUL terminated inside line and the returned argv points
+   * into it, so line must stay alive (and unmodified) until the argv is
+   * released with cmd_free. Only the argv array itself is allocated. The
+   * same ARG_MAX budget as cmd_parse applies.
+   *
+   * @param line The mutable line to process
+   *
+   * @return The line read in a format suitable for exec, or NULL with errno
+   * set as for cmd_parse
+   */
+  char **cmd_parse_inplace(char *line);
+
+  /**
+   * @brief Same as cmd_parse_inplace and also reports how the first token
+   * was quoted, so a keyword can be told from a quoted word with the same
+   * text ('time' is a command, time is the keyword).
+   *
+   * @param line The mutable line to process
+   * @param first Set to the LEX_SQUOTED, LEX_DQUOTED and LEX_ESCAPED flags
+   * of argv[0], 0 if there is no token
+   *
+   * @return As for cmd_parse_inplace
+   */
+  char **cmd_parse_inplace_flags(char *line, unsigned *first);
+
+  /**
+   * @brief Free the line that was constructed with parse_cmd or
+   * cmd_parse_inplace. This releases the argv array and, for cmd_parse, all
+   * of its tokens in one call.
    *
    * @param line the line to free
    */
@@ -69,9 +556,10 @@ extern "C"
 
   /**
    * @brief Trim the whitespace from the start and end of a string.
-   * For example "   ls -a   " becomes "ls -a". This function modifies
-   * the argument line so that all printable chars are moved to the
-   * front of the string
+   * For example "   ls -a   " becomes "ls -a". Spaces, tabs, newlines and
+   * carriage returns are all whitespace. This function modifies the
+   * argument line by terminating it after the last printable char and
+   * returns a pointer to the first one.
    *
    * @param line The line to trim
    * @return The new line with no whitespace
@@ -79,12 +567,93 @@ extern "C"
   char *trim_white(char *line);
 
 
+  /**
+   * @brief Length of the run of blanks (space, tab, newline, carriage
+   * return) at the start of the n bytes at p.
+   *
+   * @param p The bytes to scan
+   * @param n How many bytes may be read
+   * @return Index of the first non-blank, n if there is none
+   */
+  size_t scan_blank(const char *p, size_t n);
+
+  /**
+   * @brief Length of the plain word bytes at the start of the n bytes at
+   * p, the run the lexer copies as is. It ends at the first blank, operator
+   * byte (| & < >), quote or backslash.
+   *
+   * @param p The bytes to scan
+   * @param n How many bytes may be read
+   * @return Index of the first byte that ends the run, n if there is none
+   */
+  size_t scan_word(const char *p, size_t n);
+
+  /**
+   * @brief Length of the n bytes at p once trailing blanks are dropped.
+   *
+   * @param p The bytes to scan
+   * @param n How many bytes may be read
+   * @return Index just past the last non-blank, 0 if there is none
+   */
+  size_t scan_blank_rev(const char *p, size_t n);
+
+  /**
+   * @brief Choose the scan kernel: "scalar", "sse2" or "avx2". NULL picks
+   * the widest one the CPU supports, which is also the default.
+   *
+   * @param name The kernel name or NULL
+   * @return 0 on success, -1 if the kernel is unknown or unsupported
+   */
+  int scan_select(const char *name);
+
+  /**
+   * @brief The name of the scan kernel in use.
+   *
+   * @return A static string
+   */
+  const char *scan_kernel(void);
+
+  /**
+   * @brief Start lexing the len bytes at buf, which must be followed by a
+   * NUL. Words are unquoted and NUL terminated in place, so buf is
+   * rewritten as tokens are read. If buf moves, update lx->buf.
+   *
+   * @param lx The lexer
+   * @param buf The line to lex
+   * @param len Length of the line
+   */
+  void lex_init(struct lexer *lx, char *buf, size_t len);
+
+  /**
+   * @brief Read the next token. Blanks separate words. Single quotes keep
+   * everything literally, double quotes keep everything but a backslash
+   * before $ ` " \ or newline, and an unquoted backslash escapes the next
+   * byte. The unquoted operators are | & && < > >> <& >& << and <<<, a
+   * lone digit right in front of < or > comes back as LEX_IO_NUMBER, and
+   * an unquoted # at the start of a word comments out the rest of the line.
+   *
+   * @param lx The lexer
+   * @param tok Filled in with the token
+   * @return 1 for a token, 0 at the end of the line, -1 with errno set to
+   * EINVAL for an unterminated quote or trailing backslash
+   */
+  int lex_next(struct lexer *lx, struct lex_token *tok);
+
+  /**
+   * @brief Tell an operator token from a word. Only tokens produced by the
+   * lexer as operators match, a quoted "|" is a word.
+   *
+   * @param tok A token from lex_next, cmd_parse or cmd_parse_inplace
+   * @return The operator or LEX_WORD
+   */
+  enum lex_op lex_op(const char *tok);
+
   /**
    * @brief Takes an argument list and checks if the first argument is a
    * built in command such as exit, cd, jobs, etc. If the command is a
    * built in command this function will handle the command and then return
    * true. If the first argument is NOT a built in command this function will
-   * return false.
+   * return false. The exit status of a builtin is stored in sh->last_status.
    *
    * @param sh The shell
    * @param argv The command to check
@@ -93,34 +662,885 @@ extern "C"
   bool do_builtin(struct shell *sh, char **argv);
 
   /**
-   * @brief Initialize the shell for use. Allocate all data structures
-   * Grab control of the terminal and put the shell in its own
-   * process group. NOTE: This function will block until the shell is
-   * in its own program group. Attaching a debugger will always cause
-   * this function to fail because the debugger maintains control of
-   * the subprocess it is debugging.
+   * @brief Look up a builtin by name. The builtins live in a perfect hash
+   * table so this costs one hash and one string compare no matter how many
+   * builtins there are.
    *
-   * @param sh
+   * @param name The command name
+   * @return The builtin or NULL if name is not a builtin
    */
-  void sh_init(struct shell *sh);
+  const struct builtin *builtin_find(const char *name);
 
   /**
-   * @brief Destroy shell. Free any allocated memory and resources and exit
-   * normally.
+   * @brief Run one line of input: blank lines and # comments are skipped,
+   * builtins run in the shell and everything else is launched as a
+   * pipeline. The line is tokenized in place. Jobs are reported afterwards
+   * with sh_report_jobs.
    *
-   * @param sh
+   * @param sh The shell
+   * @param line The mutable line to run
+   * @return The exit status of the line, also stored in sh->last_status
    */
-  void sh_destroy(struct shell *sh);
+  int sh_exec_line(struct shell *sh, char *line);
 
   /**
-   * @brief Parse command line args from the user when the shell was launched
+   * @brief Finish off jobs after a line. An interactive shell prints the
+   * ones that finished or stopped, its main loop reaps on SIGCHLD. Batch
+   * mode reaps every child that exited and drops finished jobs silently.
    *
-   * @param argc Number of args
-   * @param argv The arg array
+   * @param sh The shell
+   */
+  void sh_report_jobs(struct shell *sh);
+
+  /**
+   * @brief Run a parsed line the way sh_exec_line does: a single builtin
+   * in the foreground runs in the shell, anything else is launched as a
+   * pipeline. A pipeline or background job with a BUILTIN_PARENT builtin
+   * in any stage fails with status 1 without running. Jobs are not
+   * reported.
+   *
+   * @param sh The shell
+   * @param p The parsed line
+   * @return The exit status of the line, also stored in sh->last_status
+   */
+  int sh_exec_pipeline(struct shell *sh, struct pipeline *p);
+
+  /**
+   * @brief Run every line in buf, splitting lines in place. buf[len] must
+   * be writable so a final line without a newline can be terminated.
+   *
+   * @param sh The shell
+   * @param buf The script text
+   * @param len The length of the text
+   * @return The exit status of the last line
+   */
+  int script_run_buffer(struct shell *sh, char *buf, size_t len);
+
+  /**
+   * @brief Run the script read from fd without readline, history or a
+   * prompt. Regular files are memory mapped and run in place, anything
+   * else is read in large chunks. When commands inherit fd (it is not
+   * close-on-exec, like stdin) it is left just past each line before the
+   * line runs, and lines a command reads are skipped. A shared fd that
+   * cannot seek is read a byte at a time.
+   *
+   * @param sh The shell
+   * @param fd The open script
+   * @return The exit status of the last line
+   */
+  int script_run_fd(struct shell *sh, int fd);
+
+  /**
+   * @brief Open the script at path and run it. A regular file runs from its
+   * compiled form, see script_code_load, anything else with script_run_fd.
+   *
+   * @param sh The shell
+   * @param path The script to run
+   * @return The exit status of the last line, 127 if path cannot be opened
+   */
+  int script_run_file(struct shell *sh, const char *path);
+
+  /**
+   * @brief Compile script text: every line is parsed once into the stages,
+   * words and redirections of its pipeline. A line that does not parse
+   * compiles to the error it would report.
+   *
+   * @param buf The script text, not modified
+   * @param len The length of the text
+   * @param st The script's stat, recorded so a cache can be checked
+   * @param code The compiled script, free with script_code_free
+   * @return 0 on success, -1 if memory ran out
    */
-  void parse_args(int argc, char **argv);
+  int script_compile(const char *buf, size_t len, const struct stat *st, struct script_code *code);
 
+  /**
+   * @brief The compiled form of the script open on fd at path. The cache
+   * next to the script is used when its recorded mtime and size match the
+   * script, or when the text still hashes the same. Otherwise the script
+   * is compiled and the cache replaced.
+   *
+   * @param path The script's path, which names the cache
+   * @param fd The open script
+   * @param code The compiled script, free with script_code_free
+   * @return 0 on success, -1 if fd is not a regular file or cannot be read
+   */
+  int script_code_load(const char *path, int fd, struct script_code *code);
+
+  /**
+   * @brief Run a compiled script. Each line behaves as it would under
+   * sh_exec_line, nothing is lexed again.
+   *
+   * @param sh The shell
+   * @param code The compiled script
+   * @return The exit status of the last line
+   */
+  int script_exec(struct shell *sh, const struct script_code *code);
+
+  /**
+   * @brief Release a compiled script.
+   *
+   * @param code The compiled script
+   */
+  void script_code_free(struct script_code *code);
+
+  /**
+   * @brief Where the compiled form of the script at path is cached: a
+   * hidden file next to it, dir/.name.labc for dir/name.
+   *
+   * @param path The script
+   * @return A malloc'd path, NULL if path names no file
+   */
+  char *script_cache_path(const char *path);
 
+  /**
+   * @brief Look up an environment variable through the shell's hash table
+   * of the environment, in constant time however many variables there are.
+   * Changes made with setenv or unsetenv are picked up too.
+   *
+   * @param name The variable
+   * @return Its value, or NULL if it is not set. Valid until the variable
+   * is changed.
+   */
+  const char *env_get(const char *name);
+
+  /**
+   * @brief Set an environment variable for the shell and every command it
+   * starts from now on. environ is updated in place.
+   *
+   * @param name The variable, must not be empty or contain =
+   * @param value Its new value
+   * @return 0 on success, -1 with errno set on a bad name or no memory
+   */
+  int env_set(const char *name, const char *value);
+
+  /**
+   * @brief Remove an environment variable. Removing one that is not set
+   * is not an error.
+   *
+   * @param name The variable
+   * @return 0 on success, -1 if the table could not be built
+   */
+  int env_unset(const char *name);
+
+  /**
+   * @brief The environment for execve and posix_spawn. It is the array
+   * environ points at, kept up to date by env_set and env_unset rather than
+   * built per command.
+   *
+   * @return The NULL terminated list of NAME=value strings
+   */
+  char **env_envp(void);
+
+  /**
+   * @brief Run every line read from fd as a pipeline, with at most o->jobs
+   * of them at once. Blank lines and # comments are skipped. Each job reads
+   * /dev/null and its stdout and stderr are collected and written out in
+   * one piece when it ends, so the output of jobs never interleaves.
+   *
+   * @param sh The shell
+   * @param fd Where the command lines come from, read to the end first
+   * @param o The options
+   * @return 0 if every job succeeded, else the number that failed (at most
+   * 101). With o->halt_on_error the status of the first job that failed,
+   * 130 if interrupted.
+   */
+  int parallel_run(struct shell *sh, int fd, const struct parallel_opts *o);
+
+  /**
+   * @brief The echo builtin: echo [-neE] [arg ...]. -n drops the newline and
+   * -e expands backslash escapes as printf %b does.
+   *
+   * @param sh The shell, may be NULL
+   * @param argv The command
+   * @return 0
+   */
+  int builtin_echo(struct shell *sh, char **argv);
+
+  /**
+   * @brief The printf builtin: printf format [arg ...]. Supports the
+   * diouxXeEfFgGcsb conversions with flags, width and precision (also as
+   * *), backslash escapes, and reuses the format while arguments remain.
+   *
+   * @param sh The shell, may be NULL
+   * @param argv The command
+   * @return 0, 1 if an argument was not a valid number, 2 on misuse
+   */
+  int builtin_printf(struct shell *sh, char **argv);
+
+  /**
+   * @brief The test and [ builtins: string, integer and file tests joined
+   * with !, -a, -o and parentheses.
+   *
+   * @param sh The shell, may be NULL
+   * @param argv The command, ending in ] when argv[0] is [
+   * @return 0 if the expression is true, 1 if false, 2 on a syntax error
+   */
+  int builtin_test(struct shell *sh, char **argv);
+
+  /**
+   * @brief Append n bytes to the builtin output buffer. It is written to
+   * fd 1 when it fills up or by out_flush.
+   *
+   * @param s The bytes
+   * @param n How many
+   */
+  void out_write(const char *s, size_t n);
+
+  /**
+   * @brief Append a string to the builtin output buffer.
+   *
+   * @param s The string
+   */
+  void out_str(const char *s);
+
+  /**
+   * @brief Append one byte to the builtin output buffer.
+   *
+   * @param c The byte
+   */
+  void out_char(char c);
+
+  /**
+   * @brief Append printf style output to the builtin output buffer.
+   *
+   * @param fmt The format
+   */
+  void out_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+  /**
+   * @brief Write out the builtin output buffer, after anything still in
+   * the stdout stdio buffer. do_builtin calls this when a builtin returns.
+   *
+   * @return 0, or -1 with errno set if any write since the last flush failed
+   */
+  int out_flush(void);
+
+  /**
+   * @brief Open or create a binary history file for appending. Only the
+   * descriptor is opened, the file is mapped on first use. Several shells
+   * can have the same file open and append to it at once.
+   *
+   * @param h The history to set up
+   * @param path The file
+   * @return 0 on success, -1 with errno set on failure. EINVAL means path
+   * holds something other than a history file and was left alone.
+   */
+  int hist_open(struct hist_file *h, const char *path);
+
+  /**
+   * @brief Unmap and close a history file. Safe on one that never opened.
+   *
+   * @param h The history
+   */
+  void hist_close(struct hist_file *h);
+
+  /**
+   * @brief Append a line to the history file as a single O_APPEND write.
+   * Does nothing if the history is not open.
+   *
+   * @param h The history
+   * @param line The line
+   * @return 0 on success, -1 with errno set if the write failed
+   */
+  int hist_add(struct hist_file *h, const char *line);
+
+  /**
+   * @brief Count the entries, indexing whatever was appended to the file
+   * since the last call, by this shell or any other.
+   *
+   * @param h The history
+   * @return The number of entries
+   */
+  size_t hist_count(struct hist_file *h);
+
+  /**
+   * @brief Get an indexed entry. The string points into the mapping and
+   * stays valid until the next hist_count or hist_recent call.
+   *
+   * @param h The history
+   * @param i The entry, 0 is the oldest
+   * @param when Set to the time the entry was added if not NULL
+   * @return The line, or NULL if i is out of range
+   */
+  const char *hist_entry(const struct hist_file *h, size_t i, time_t *when);
+
+  /**
+   * @brief Call fn for the newest n entries, oldest first. The records are
+   * found by walking back from the end of the file so a big file costs no
+   * more than a small one.
+   *
+   * @param h The history
+   * @param n How many entries at most
+   * @param fn Called with each line
+   * @param arg Passed to fn
+   * @return The number of entries passed to fn
+   */
+  size_t hist_recent(struct hist_file *h, size_t n, void (*fn)(const char *line, void *arg), void *arg);
+
+  /**
+   * @brief Find the newest entry older than before that contains query.
+   * The first search builds a trigram index over the history, later ones
+   * only index what was added since.
+   *
+   * @param h The history
+   * @param query The substring to look for
+   * @param before Only entries below this number are searched, pass
+   * SIZE_MAX to search everything
+   * @return The entry number or -1 if no entry matches
+   */
+  ssize_t hist_search(struct hist_file *h, const char *query, size_t before);
+
+  /**
+   * @brief Index entries added since the last search. Does nothing before
+   * the first search, so a shell that never searches never builds the
+   * index.
+   *
+   * @param h The history
+   */
+  void hist_index_update(struct hist_file *h);
+
+  /**
+   * @brief Free the trigram index. The next search rebuilds it.
+   *
+   * @param h The history
+   */
+  void hist_index_destroy(struct hist_file *h);
+
+  /**
+   * @brief The history file to use: $MY_HISTFILE if set, else
+   * ~/.lab_history. An empty MY_HISTFILE turns persistent history off.
+   *
+   * @return A malloc'd path or NULL for no history file
+   */
+  char *hist_default_path(void);
+
+  /**
+   * @brief Open the directory jump index at path. A missing file is fine,
+   * it is created by the first flush. Nothing is read beyond a header
+   * check until a query needs it.
+   *
+   * @param db The index
+   * @param path The index file
+   * @return 0 on success, -1 with errno set. EINVAL means path holds
+   * something that is not a jump index.
+   */
+  int jump_open(struct jump_db *db, const char *path);
+
+  /**
+   * @brief Flush pending visits and release the index.
+   *
+   * @param db The index
+   */
+  void jump_close(struct jump_db *db);
+
+  /**
+   * @brief Record a visit to dir. The visit counts in queries right away and
+   * reaches the file with the next flush, which happens on its own after
+   * flush_every visits.
+   *
+   * @param db The index, nothing happens unless it is open
+   * @param dir An absolute directory
+   * @param now The time of the visit
+   * @return 0, -1 if an automatic flush failed
+   */
+  int jump_visit(struct jump_db *db, const char *dir, time_t now);
+
+  /**
+   * @brief Merge the pending visits into the file. The new index is written
+   * to a temporary file next to it and renamed over the old one, so readers
+   * see either the old or the new index and never a partial one.
+   *
+   * @param db The index
+   * @return 0 on success, -1 with errno set. The pending visits are dropped
+   * either way.
+   */
+  int jump_flush(struct jump_db *db);
+
+  /**
+   * @brief The directories with the highest frecency that match words, best
+   * first. A directory matches when the words appear in it in order, ignoring
+   * case, with the last word in its last component. Frecency is the visit
+   * count weighted by the time since the last visit.
+   *
+   * @param db The index
+   * @param words NULL terminated list of words, an empty list matches all
+   * @param exclude A directory to leave out, or NULL
+   * @param now The time the weights are computed for
+   * @param out Where the matches go
+   * @param max Room in out
+   * @return The number of matches stored in out
+   */
+  size_t jump_query(struct jump_db *db, char **words, const char *exclude, time_t now,
+                    struct jump_match *out, size_t max);
+
+  /**
+   * @brief The jump index to use: $MY_JUMPFILE if set, else ~/.lab_jump. An
+   * empty MY_JUMPFILE turns recording off.
+   *
+   * @return A malloc'd path or NULL for no index
+   */
+  char *jump_default_path(void);
+
+  /**
+   * @brief The j builtin: j word... changes to the best match of
+   * jump_query that still exists. j -l [word...] and j alone list the best
+   * matches with their scores, the best last.
+   *
+   * @param sh The shell
+   * @param argv The command
+   * @return 0, 1 if nothing matched
+   */
+  int builtin_j(struct shell *sh, char **argv);
+
+  /**
+   * @brief Run a builtin with do_builtin and print the time and resources
+   * it used, see usage_print.
+   *
+   * @param sh The shell
+   * @param argv The builtin to run
+   * @return The exit status of the builtin
+   */
+  int do_builtin_timed(struct shell *sh, char **argv);
+
+  /**
+   * @brief Initialize the shell for use. Allocate all data structures
+   * Grab control of the terminal and put the shell in its own
+   * process group. NOTE: This function will block until the shell is
+   * in its own program group. Attaching a debugger will always cause
+   * this function to fail because the debugger maintains control of
+   * the subprocess it is debugging.
+   *
+   * @param sh
+   */
+  void sh_init(struct shell *sh);
+
+  /**
+   * @brief Destroy shell. Free any allocated memory and resources and exit
+   * normally.
+   *
+   * @param sh
+   */
+  void sh_destroy(struct shell *sh);
+
+  /**
+   * @brief Parse command line args from the user when the shell was launched.
+   * Options that configure the shell are stored in sh, so call this before
+   * sh_init on a zeroed shell. -c sets sh->command and the first operand
+   * sets sh->script; either one makes the shell non-interactive.
+   *
+   * @param sh The shell
+   * @param argc Number of args
+   * @param argv The arg array
+   */
+  void parse_args(struct shell *sh, int argc, char **argv);
+
+
+  /**
+   * @brief 64 bit FNV-1a hash of a NUL terminated string.
+   *
+   * @param s The string to hash
+   * @return The hash value
+   */
+  unsigned long lab_hash_str(const char *s);
+
+  /**
+   * @brief Search each directory in path_env (a PATH style list) for an
+   * executable named name. The caller must free the returned string.
+   *
+   * @param path_env The colon separated directory list
+   * @param name The command to look for
+   * @return The absolute path or NULL if name was not found
+   */
+  char *path_search(const char *path_env, const char *name);
+
+  /**
+   * @brief Resolve a command name to the path that should be passed to
+   * execve. Names containing a slash are returned unchanged. Other names are
+   * served from the cache, falling back to a PATH search on a miss. The
+   * cache is dropped first if PATH changed since it was filled. The result
+   * is owned by the cache and stays valid until the next cache update.
+   *
+   * @param h The cache
+   * @param name The command name (argv[0])
+   * @return The path to exec or NULL if the command was not found
+   */
+  const char *cmd_hash_lookup(struct cmd_hash *h, const char *name);
+
+  /**
+   * @brief Search PATH for name and (re)place the result in the cache
+   * without counting it as a lookup.
+   *
+   * @param h The cache
+   * @param name The command name
+   * @return The cached path or NULL if name was not found
+   */
+  const char *cmd_hash_add(struct cmd_hash *h, const char *name);
+
+  /**
+   * @brief Remove every entry from the cache.
+   *
+   * @param h The cache
+   */
+  void cmd_hash_clear(struct cmd_hash *h);
+
+  /**
+   * @brief Free all memory held by the cache.
+   *
+   * @param h The cache
+   */
+  void cmd_hash_destroy(struct cmd_hash *h);
+
+  /**
+   * @brief Bring the index up to date with path_env. The first call, or one
+   * with a different PATH, reads every directory. Later calls stat each
+   * directory and read again only the ones whose mtime changed.
+   *
+   * @param x The index
+   * @param path_env The colon separated directory list
+   * @return 0 on success, -1 if memory ran out (the index is then empty)
+   */
+  int cmd_index_refresh(struct cmd_index *x, const char *path_env);
+
+  /**
+   * @brief Call fn for every command name starting with prefix, in strcmp
+   * order. Names found in several directories are listed once.
+   *
+   * @param x The index
+   * @param prefix What the names must start with
+   * @param fn Called with each name
+   * @param arg Passed to fn
+   * @return The number of names passed to fn
+   */
+  size_t cmd_index_complete(const struct cmd_index *x, const char *prefix,
+                            void (*fn)(const char *name, void *arg), void *arg);
+
+  /**
+   * @brief Resolve name the way path_search does, from the index as of the
+   * last refresh instead of the file system.
+   *
+   * @param x The index
+   * @param name The command name
+   * @return A malloc'd absolute path, or NULL if name is not on PATH
+   */
+  char *cmd_index_path(const struct cmd_index *x, const char *name);
+
+  /**
+   * @brief Free everything held by the index.
+   *
+   * @param x The index
+   */
+  void cmd_index_destroy(struct cmd_index *x);
+
+  /**
+   * @brief Refresh the completion index of the cache's PATH, building it
+   * on first use. From then on cache misses are resolved from the index
+   * rather than by probing every PATH directory.
+   *
+   * @param h The cache
+   * @return The index, or NULL if it could not be built
+   */
+  const struct cmd_index *cmd_hash_index(struct cmd_hash *h);
+
+  /**
+   * @brief Print every entry with its hit count followed by the overall
+   * cache hit rate.
+   *
+   * @param h The cache
+   * @param out Where to print
+   */
+  void cmd_hash_print(const struct cmd_hash *h, FILE *out);
+  /**
+   * @brief Create what the redirections need from the shell before the
+   * command starts. Each here-string is written to a close-on-exec pipe (or
+   * a memfd if it is larger than PIPE_BUF). With open_files set, files are
+   * opened close-on-exec as well, for posix_spawn which can then just dup2
+   * them and any error names the file. The fds go in src, all at 10 or
+   * above so none of them is a fd another redirection replaces.
+   *
+   * @param r The redirections
+   * @param n How many
+   * @param open_files Open the files too
+   * @return 0 on success, -1 after printing why, nothing is left open
+   */
+  int redir_prepare(struct redir *r, size_t n, bool open_files);
+
+  /**
+   * @brief Close what redir_prepare opened. Safe to call more than once.
+   *
+   * @param r The redirections
+   * @param n How many
+   */
+  void redir_release(struct redir *r, size_t n);
+
+  /**
+   * @brief Apply redirections to the calling process with one open and at
+   * most one dup2 each. With saved NULL this is the child side before exec:
+   * files are opened close-on-exec and only their dup2'd copies survive the
+   * exec. Otherwise the shell applies them to itself for a builtin, saving
+   * each fd it replaces in saved so redir_restore can undo them.
+   *
+   * @param r The redirections, prepared with redir_prepare (files it did
+   * not open are opened here)
+   * @param n How many
+   * @param saved NULL, or room for n saved fds
+   * @return 0 on success, -1 after printing why (anything applied before
+   * the failure is still recorded in saved)
+   */
+  int redir_apply(const struct redir *r, size_t n, int *saved);
+
+  /**
+   * @brief Undo redir_apply for a builtin, in reverse order.
+   *
+   * @param r The redirections
+   * @param n How many
+   * @param saved The fds saved by redir_apply
+   */
+  void redir_restore(const struct redir *r, size_t n, int *saved);
+
+  /**
+   * @brief Start an external process as described by l using the shell's
+   * launch mode. Both modes put the child in its process group, hand it the
+   * terminal when it runs in the foreground of an interactive shell, and
+   * restore the default disposition of the job control signals.
+   *
+   * @param sh The shell
+   * @param l What to launch
+   * @return The child pid or -1 with errno set if it could not be started
+   */
+  pid_t launch_process(struct shell *sh, const struct launch *l);
+
+  /**
+   * @brief The exit status of a command that could not be executed.
+   *
+   * @param err The errno of the failed exec or spawn
+   * @return 127 if the command was not found, 126 otherwise
+   */
+  int launch_status(int err);
+
+  /**
+   * @brief Print "name: error" to stderr for a command that could not be
+   * executed. Only calls that are safe in a forked child are used.
+   *
+   * @param name The command, argv[0]
+   * @param err The errno of the failed exec or spawn
+   */
+  void launch_report(const char *name, int err);
+
+  /**
+   * @brief Parse a launch mode name ("fork" or "spawn").
+   *
+   * @param name The name to parse
+   * @param mode Set to the parsed mode on success
+   * @return 0 on success, -1 if the name is not known
+   */
+  int launch_mode_parse(const char *name, enum launch_mode *mode);
+
+  /**
+   * @brief The name of a launch mode.
+   *
+   * @param mode The mode
+   * @return A static string
+   */
+  const char *launch_mode_name(enum launch_mode mode);
+  /**
+   * @brief Split line into the stages of a pipeline. The line is tokenized
+   * in place (see cmd_parse_inplace) so it must outlive the pipeline. The
+   * pipeline must be released with pipeline_free, even on failure.
+   *
+   * @param line The mutable line to parse
+   * @param p The pipeline to fill in
+   * Redirections are taken out of each stage's argv and collected in
+   * p->redirs.
+   *
+   * @return 0 on success, -1 with errno set to EINVAL if the line is empty,
+   * a stage has no command, a redirection has no target or the line has a
+   * list operator (&&, || or an & before its end), or to E2BIG if it
+   * exceeds ARG_MAX
+   */
+  int pipeline_parse(char *line, struct pipeline *p);
+
+  /**
+   * @brief Free the memory held by a pipeline.
+   *
+   * @param p The pipeline
+   */
+  void pipeline_free(struct pipeline *p);
+
+  /**
+   * @brief Start every stage of a pipeline in one process group connected by
+   * close-on-exec pipes and record it as a new job. Nothing is waited for.
+   *
+   * @param sh The shell
+   * @param p The pipeline to start
+   * @return The new job or NULL if it could not be created
+   */
+  struct job *pipeline_launch(struct shell *sh, struct pipeline *p);
+
+  /**
+   * @brief Launch a pipeline and, unless it ends with &, wait for it in the
+   * foreground. The result is the exit status of the last stage, or with
+   * sh->pipefail set the status of the last stage that failed. Background
+   * pipelines return 0 right away and stay in the job table.
+   *
+   * @param sh The shell
+   * @param p The pipeline to run
+   * @return The exit status of the pipeline
+   */
+  int pipeline_run(struct shell *sh, struct pipeline *p);
+
+  /**
+   * @brief Add a job for pipeline p using the lowest free job number. The
+   * process ids are filled in by the caller.
+   *
+   * @param t The job table
+   * @param p The pipeline the job runs
+   * @return The new job or NULL if out of memory
+   */
+  struct job *job_add(struct job_table *t, const struct pipeline *p);
+
+  /**
+   * @brief Remove a job from the table and free it.
+   *
+   * @param t The job table
+   * @param j The job to remove
+   */
+  void job_remove(struct job_table *t, struct job *j);
+
+  /**
+   * @brief Free every job and the table itself.
+   *
+   * @param t The job table
+   */
+  void job_table_destroy(struct job_table *t);
+
+  /**
+   * @brief Look up a job by number.
+   *
+   * @param t The job table
+   * @param id The job number
+   * @return The job or NULL
+   */
+  struct job *job_find(struct job_table *t, int id);
+
+  /**
+   * @brief The current job, which is the one with the highest number.
+   *
+   * @param t The job table
+   * @return The job or NULL if there are no jobs
+   */
+  struct job *job_current(struct job_table *t);
+
+  /**
+   * @brief Resolve a job spec such as %2, 2, %+ or %%. NULL means the
+   * current job.
+   *
+   * @param t The job table
+   * @param spec The job spec or NULL
+   * @return The job or NULL if there is no such job
+   */
+  struct job *job_parse_spec(struct job_table *t, const char *spec);
+
+  /**
+   * @brief Record a status reported by wait4 for pid. The resources used
+   * by a process that exited are added to its job.
+   *
+   * @param t The job table
+   * @param pid The process the status belongs to
+   * @param status The wait status
+   * @param ru The resources reported by wait4, may be NULL
+   * @return 0 if pid belongs to a job, -1 otherwise
+   */
+  int job_update(struct job_table *t, pid_t pid, int status, const struct rusage *ru);
+
+  /**
+   * @brief Print the wall clock time, CPU time, peak RSS and context
+   * switches of a command on one line.
+   *
+   * @param u The usage to print
+   * @param out Where to print
+   */
+  void usage_print(const struct cmd_usage *u, FILE *out);
+
+  /**
+   * @brief Collect the status of every child that changed state without
+   * blocking. Call this whenever SIGCHLD is delivered.
+   *
+   * @param t The job table
+   */
+  void job_reap(struct job_table *t);
+
+  /**
+   * @brief True once every process in the job has exited.
+   */
+  bool job_is_done(const struct job *j);
+
+  /**
+   * @brief True if every process still running in the job is stopped.
+   */
+  bool job_is_stopped(const struct job *j);
+
+  /**
+   * @brief The exit status of a job, see pipeline_run.
+   *
+   * @param j The job
+   * @param pipefail Use the status of the last stage that failed
+   * @return The exit status
+   */
+  int job_exit_status(const struct job *j, bool pipefail);
+
+  /**
+   * @brief Print one line describing the job, as the jobs builtin does.
+   *
+   * @param j The job
+   * @param out Where to print
+   */
+  void job_print(const struct job *j, FILE *out);
+
+  /**
+   * @brief True if some job finished or stopped since the user was told.
+   *
+   * @param t The job table
+   */
+  bool job_has_news(const struct job_table *t);
+
+  /**
+   * @brief Tell the user about jobs that finished or stopped and drop the
+   * finished ones from the table.
+   *
+   * @param t The job table
+   * @param out Where to print
+   */
+  void job_notify(struct job_table *t, FILE *out);
+
+  /**
+   * @brief Wait until a foreground job finishes or stops, then take the
+   * terminal back. Finished jobs are removed from the table.
+   *
+   * @param sh The shell
+   * @param j The job to wait for
+   * @return The exit status of the job, 128 + signal if it stopped
+   */
+  int job_wait_fg(struct shell *sh, struct job *j);
+
+  /**
+   * @brief Send SIGCONT to a job, in the foreground (waiting for it) or in
+   * the background.
+   *
+   * @param sh The shell
+   * @param j The job
+   * @param foreground Give it the terminal and wait for it
+   * @return The exit status of a foreground job, 0 in the background
+   */
+  int job_continue(struct shell *sh, struct job *j, bool foreground);
+
+  /**
+   * @brief Convert a status from waitpid into an exit status, using 128 plus
+   * the signal number for processes that were killed.
+   *
+   * @param status The wait status
+   * @return The exit status
+   */
+  int status_to_exit(int status);
 
 #ifdef __cplusplus
 } // extern "C"
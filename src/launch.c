@@ -0,0 +1,182 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "lab.h"
+
+// Signals the shell changes that every child must see at their defaults
+static const int child_signals[] = { SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU };
+#define N_CHILD_SIGNALS (sizeof(child_signals) / sizeof(child_signals[0]))
+
+const char *launch_mode_name(enum launch_mode mode) {
+    switch (mode) {
+        case LAUNCH_FORK:  return "fork";
+        case LAUNCH_SPAWN: return "spawn";
+    }
+    return "unknown";
+}
+
+int launch_mode_parse(const char *name, enum launch_mode *mode) {
+    if (!name) return -1;
+    if (strcmp(name, "fork") == 0) {
+        *mode = LAUNCH_FORK;
+    } else if (strcmp(name, "spawn") == 0) {
+        *mode = LAUNCH_SPAWN;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+int launch_status(int err) {
+    return err == ENOENT ? 127 : 126;
+}
+
+// A forked child may not take the locks stdio and strerror can, only
+// write(2) is used. glibc's strerrordesc_np returns a constant string.
+void launch_report(const char *name, int err) {
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 32)
+    const char *msg = strerrordesc_np(err);
+#else
+    const char *msg = strerror(err);
+#endif
+    if (!msg) msg = "Unknown error";
+    struct iovec iov[] = {
+        { (void *)name, strlen(name) },
+        { ": ", 2 },
+        { (void *)msg, strlen(msg) },
+        { "\n", 1 },
+    };
+    // One writev so the line is not split by another process' output
+    ssize_t rval = writev(STDERR_FILENO, iov, 4);
+    (void)rval;
+}
+
+// Child side of the fork path: join the process group, take the terminal
+// and reset signals before exec
+static void fork_child(struct shell *sh, const struct launch *l, char **envp) {
+    // Without job control children stay in the shell's process group
+    if (sh->shell_is_interactive) {
+        pid_t pid = getpid();
+        pid_t pgid = l->pgid ? l->pgid : pid;
+        setpgid(pid, pgid);
+        if (l->foreground) tcsetpgrp(sh->shell_terminal, pgid);
+    }
+    for (size_t i = 0; i < N_CHILD_SIGNALS; i++) {
+        signal(child_signals[i], SIG_DFL);
+    }
+    // The shell blocks SIGCHLD for its signalfd, children start clean
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+    // The pipe ends are close-on-exec, only the dup2'd copies survive
+    if (l->fd_in > STDIN_FILENO) dup2(l->fd_in, STDIN_FILENO);
+    if (l->fd_out > STDOUT_FILENO) dup2(l->fd_out, STDOUT_FILENO);
+    if (redir_apply(l->redirs, l->nredirs, NULL) == -1) _exit(EXIT_FAILURE);
+
+    execve(l->path, l->argv, envp);
+    // The cached entry may be stale so let libc search PATH
+    execvp(l->argv[0], l->argv);
+    launch_report(l->argv[0], errno);
+    _exit(launch_status(errno));
+}
+
+static pid_t launch_fork(struct shell *sh, const struct launch *l, char **envp) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        fork_child(sh, l, envp);
+    }
+    return pid;
+}
+
+// The spawn side of redir_apply. The shell has already opened every file
+// at 10 or above (see redir_prepare), so each redirection is a single dup2
+// in the child. n>&n is still a dup2, which clears its close-on-exec.
+static void add_redirs(posix_spawn_file_actions_t *fa, const struct redir *r, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        posix_spawn_file_actions_adddup2(fa, r[i].src, r[i].fd);
+    }
+}
+
+// posix_spawn path. glibc implements this with clone(CLONE_VM|CLONE_VFORK)
+// so no page tables are copied no matter how large the shell has grown.
+static pid_t launch_spawn(struct shell *sh, const struct launch *l, char **envp) {
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_t fa;
+    sigset_t defaults, mask;
+    pid_t pid = -1;
+
+    if (posix_spawnattr_init(&attr) != 0) return -1;
+    if (posix_spawn_file_actions_init(&fa) != 0) {
+        posix_spawnattr_destroy(&attr);
+        return -1;
+    }
+
+    sigemptyset(&defaults);
+    for (size_t i = 0; i < N_CHILD_SIGNALS; i++) {
+        sigaddset(&defaults, child_signals[i]);
+    }
+    sigemptyset(&mask);
+    short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+    // Without job control children stay in the shell's process group
+    if (sh->shell_is_interactive) flags |= POSIX_SPAWN_SETPGROUP;
+    posix_spawnattr_setflags(&attr, flags);
+    posix_spawnattr_setpgroup(&attr, l->pgid);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setsigmask(&attr, &mask);
+
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 35)
+    // Hand over the terminal inside the child, just like the fork path, so
+    // it can never read the tty before it owns it
+    if (l->foreground && sh->shell_is_interactive) {
+        posix_spawn_file_actions_addtcsetpgrp_np(&fa, sh->shell_terminal);
+    }
+#endif
+    if (l->fd_in > STDIN_FILENO) {
+        posix_spawn_file_actions_adddup2(&fa, l->fd_in, STDIN_FILENO);
+    }
+    if (l->fd_out > STDOUT_FILENO) {
+        posix_spawn_file_actions_adddup2(&fa, l->fd_out, STDOUT_FILENO);
+    }
+    add_redirs(&fa, l->redirs, l->nredirs);
+
+    int rval = posix_spawn(&pid, l->path, &fa, &attr, l->argv, envp);
+    if (rval == ENOENT || rval == EACCES) {
+        rval = posix_spawnp(&pid, l->argv[0], &fa, &attr, l->argv, envp);
+    }
+    if (rval != 0) {
+        errno = rval;
+        pid = -1;
+    }
+
+    posix_spawn_file_actions_destroy(&fa);
+    posix_spawnattr_destroy(&attr);
+    return pid;
+}
+
+pid_t launch_process(struct shell *sh, const struct launch *l) {
+    // The environment as it stands, no copy is made per command
+    char **envp = env_envp();
+    pid_t pid;
+    if (sh->launch_mode == LAUNCH_SPAWN) {
+        pid = launch_spawn(sh, l, envp);
+    } else {
+        pid = launch_fork(sh, l, envp);
+    }
+    if (pid < 0) return -1;
+
+    /*
+    Also do this in the parent so the child is in its process group
+    and owns the terminal no matter which side runs first
+    */
+    if (sh->shell_is_interactive) {
+        pid_t pgid = l->pgid ? l->pgid : pid;
+        setpgid(pid, pgid);
+        if (l->foreground) tcsetpgrp(sh->shell_terminal, pgid);
+    }
+    return pid;
+}
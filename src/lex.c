@@ -0,0 +1,254 @@
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include "lab.h"
+
+/*
+ * Table driven lexer. Every byte is mapped to a character class and the
+ * (state, class) pair looks up the next state and a set of actions, so a
+ * line is lexed in one left to right pass. A byte is looked at a second
+ * time only when it ends a word and also starts an operator (a|b), which
+ * keeps the lexer linear on any input.
+ *
+ * Quote removal happens in place: the write index never passes the read
+ * index, so the unquoted text of each token is copied down over the bytes
+ * already consumed and NUL terminated there.
+ */
+
+enum lex_class {
+    C_OTHER, C_BLANK, C_NL, C_PIPE, C_AMP, C_LT, C_GT, C_SQ, C_DQ, C_BSL,
+    C_HASH,
+    C_DQSPEC, /* $ and ` which a backslash escapes inside double quotes */
+    C_END,    /* end of input, never stored in the class table */
+    NCLASS
+};
+
+enum lex_state {
+    S_BLANK, S_WORD, S_SQ, S_DQ, S_ESC, S_DQESC, S_AMP, S_LT, S_LT2, S_GT,
+    S_COMMENT, NSTATE
+};
+
+#define A_KEEP  0x001 /* copy the byte into the token */
+#define A_BSL   0x002 /* copy a backslash first */
+#define A_BEGIN 0x004 /* start a new word at the write index */
+#define A_END   0x008 /* terminate the word and return it */
+#define A_AGAIN 0x010 /* look at the same byte again in the next state */
+#define A_IONUM 0x020 /* the word ends at < or >, a lone digit is an fd */
+#define A_DONE  0x040 /* no more tokens */
+#define A_ERR   0x080 /* unterminated quote or escape */
+#define A_SQF   0x100 /* the word has single quoted parts */
+#define A_DQF   0x200 /* the word has double quoted parts */
+#define A_ESCF  0x400 /* the word has backslash escapes */
+
+// Taking an edge moves to next, applies act and, if op is set, returns
+// that operator
+struct lex_edge {
+    uint8_t next;
+    uint8_t op;
+    uint16_t act;
+};
+
+// Operator tokens point here, so lex_op can tell an operator from a word
+// that merely has the same text (a quoted '|')
+static char op_text[LEX_NOPS][4] = {
+    [LEX_PIPE] = "|", [LEX_AMP] = "&", [LEX_AND_IF] = "&&",
+    [LEX_LESS] = "<", [LEX_GREAT] = ">", [LEX_DGREAT] = ">>",
+    [LEX_LESSAND] = "<&", [LEX_GREATAND] = ">&", [LEX_DLESS] = "<<",
+    [LEX_TLESS] = "<<<",
+};
+
+// The fd in front of a redirection (2>) is only recognized for 0-9, the
+// minimum POSIX asks for, so each one can be a static token too
+static char io_text[10][2] = { "0", "1", "2", "3", "4", "5", "6", "7", "8", "9" };
+
+static uint8_t char_class[256] = {
+    [' '] = C_BLANK, ['\t'] = C_BLANK, ['\r'] = C_BLANK, ['\n'] = C_NL,
+    ['|'] = C_PIPE, ['&'] = C_AMP, ['<'] = C_LT, ['>'] = C_GT,
+    ['\''] = C_SQ, ['"'] = C_DQ, ['\\'] = C_BSL, ['#'] = C_HASH,
+    ['$'] = C_DQSPEC, ['`'] = C_DQSPEC,
+};
+
+#define E(n, a) { n, 0, a }
+#define O(n, op, a) { n, op, a }
+
+// After an operator byte that may start a longer operator. Bytes that do
+// not extend it return the short operator and are looked at again; only
+// the &, < and > columns can differ.
+#define SHORT(op) O(S_BLANK, op, A_AGAIN)
+#define OP_ROW(op, amp, lt, gt) { \
+    SHORT(op), SHORT(op), SHORT(op), SHORT(op), amp, lt, gt, \
+    SHORT(op), SHORT(op), SHORT(op), SHORT(op), SHORT(op), SHORT(op) }
+
+// Columns are in enum lex_class order:
+//   other  blank  newline  |  &  <  >  '  "  \  #  $`  end
+static const struct lex_edge lex_table[NSTATE][NCLASS] = {
+    [S_BLANK] = {
+        E(S_WORD, A_BEGIN | A_KEEP), E(S_BLANK, 0), E(S_BLANK, 0),
+        O(S_BLANK, LEX_PIPE, 0), E(S_AMP, 0), E(S_LT, 0), E(S_GT, 0),
+        E(S_SQ, A_BEGIN | A_SQF), E(S_DQ, A_BEGIN | A_DQF),
+        E(S_ESC, A_BEGIN | A_ESCF), E(S_COMMENT, 0),
+        E(S_WORD, A_BEGIN | A_KEEP), E(S_BLANK, A_DONE),
+    },
+    [S_WORD] = {
+        E(S_WORD, A_KEEP), E(S_BLANK, A_END), E(S_BLANK, A_END),
+        E(S_BLANK, A_END | A_AGAIN), E(S_BLANK, A_END | A_AGAIN),
+        E(S_BLANK, A_END | A_AGAIN | A_IONUM), E(S_BLANK, A_END | A_AGAIN | A_IONUM),
+        E(S_SQ, A_SQF), E(S_DQ, A_DQF), E(S_ESC, A_ESCF), E(S_WORD, A_KEEP),
+        E(S_WORD, A_KEEP), E(S_BLANK, A_END | A_AGAIN),
+    },
+    [S_SQ] = {
+        E(S_SQ, A_KEEP), E(S_SQ, A_KEEP), E(S_SQ, A_KEEP),
+        E(S_SQ, A_KEEP), E(S_SQ, A_KEEP), E(S_SQ, A_KEEP), E(S_SQ, A_KEEP),
+        E(S_WORD, 0), E(S_SQ, A_KEEP), E(S_SQ, A_KEEP), E(S_SQ, A_KEEP),
+        E(S_SQ, A_KEEP), E(S_SQ, A_ERR),
+    },
+    [S_DQ] = {
+        E(S_DQ, A_KEEP), E(S_DQ, A_KEEP), E(S_DQ, A_KEEP),
+        E(S_DQ, A_KEEP), E(S_DQ, A_KEEP), E(S_DQ, A_KEEP), E(S_DQ, A_KEEP),
+        E(S_DQ, A_KEEP), E(S_WORD, 0), E(S_DQESC, 0), E(S_DQ, A_KEEP),
+        E(S_DQ, A_KEEP), E(S_DQ, A_ERR),
+    },
+    // A backslash-newline is a line continuation and vanishes
+    [S_ESC] = {
+        E(S_WORD, A_KEEP), E(S_WORD, A_KEEP), E(S_WORD, 0),
+        E(S_WORD, A_KEEP), E(S_WORD, A_KEEP), E(S_WORD, A_KEEP), E(S_WORD, A_KEEP),
+        E(S_WORD, A_KEEP), E(S_WORD, A_KEEP), E(S_WORD, A_KEEP), E(S_WORD, A_KEEP),
+        E(S_WORD, A_KEEP), E(S_ESC, A_ERR),
+    },
+    // Inside double quotes a backslash only escapes $ ` " \ and newline
+    [S_DQESC] = {
+        E(S_DQ, A_BSL | A_KEEP), E(S_DQ, A_BSL | A_KEEP), E(S_DQ, 0),
+        E(S_DQ, A_BSL | A_KEEP), E(S_DQ, A_BSL | A_KEEP),
+        E(S_DQ, A_BSL | A_KEEP), E(S_DQ, A_BSL | A_KEEP),
+        E(S_DQ, A_BSL | A_KEEP), E(S_DQ, A_KEEP), E(S_DQ, A_KEEP), E(S_DQ, A_BSL | A_KEEP),
+        E(S_DQ, A_KEEP), E(S_DQESC, A_ERR),
+    },
+    [S_AMP] = OP_ROW(LEX_AMP, O(S_BLANK, LEX_AND_IF, 0), SHORT(LEX_AMP), SHORT(LEX_AMP)),
+    [S_LT] = OP_ROW(LEX_LESS, O(S_BLANK, LEX_LESSAND, 0), E(S_LT2, 0), SHORT(LEX_LESS)),
+    [S_LT2] = OP_ROW(LEX_DLESS, SHORT(LEX_DLESS), O(S_BLANK, LEX_TLESS, 0), SHORT(LEX_DLESS)),
+    [S_GT] = OP_ROW(LEX_GREAT, O(S_BLANK, LEX_GREATAND, 0), SHORT(LEX_GREAT), O(S_BLANK, LEX_DGREAT, 0)),
+    [S_COMMENT] = {
+        E(S_COMMENT, 0), E(S_COMMENT, 0), E(S_BLANK, 0),
+        E(S_COMMENT, 0), E(S_COMMENT, 0), E(S_COMMENT, 0), E(S_COMMENT, 0),
+        E(S_COMMENT, 0), E(S_COMMENT, 0), E(S_COMMENT, 0), E(S_COMMENT, 0),
+        E(S_COMMENT, 0), E(S_BLANK, A_AGAIN),
+    },
+};
+
+// Set up lx to lex the len bytes at buf, which must be followed by a NUL
+void lex_init(struct lexer *lx, char *buf, size_t len) {
+    lx->buf = buf;
+    lx->len = len;
+    lx->i = 0;
+    lx->w = 0;
+    lx->start = 0;
+    lx->flags = 0;
+    lx->state = S_BLANK;
+    lx->held = -1;
+}
+
+// Returns the next token in tok
+int lex_next(struct lexer *lx, struct lex_token *tok) {
+    for (;;) {
+        int cls;
+        int c = 0;
+        if (lx->held >= 0) {
+            c = lx->held;
+            cls = char_class[c];
+        } else if (lx->i < lx->len) {
+            // Runs of blanks between words are skipped a vector at a time
+            if (lx->state == S_BLANK && char_class[(unsigned char)lx->buf[lx->i]] == C_BLANK) {
+                lx->i += scan_blank(lx->buf + lx->i, lx->len - lx->i);
+                if (lx->i == lx->len) continue;
+            }
+            c = (unsigned char)lx->buf[lx->i];
+            cls = char_class[c];
+        } else {
+            cls = C_END;
+        }
+
+        const struct lex_edge *e = &lex_table[lx->state][cls];
+        unsigned act = e->act;
+        lx->state = e->next;
+        if (act & A_AGAIN) {
+            lx->held = cls == C_END ? -1 : c;
+        } else if (lx->held >= 0) {
+            lx->held = -1;
+            lx->i++;
+        } else if (cls != C_END) {
+            lx->i++;
+        }
+
+        if (act & A_BEGIN) {
+            lx->start = lx->w;
+            lx->flags = 0;
+        }
+        if (act & A_BSL) lx->buf[lx->w++] = '\\';
+        if (act & A_KEEP) {
+            lx->buf[lx->w++] = (char)c;
+            // Most bytes just stay in their word or quote, copy those in
+            // a tight loop instead of a full trip through the table
+            // (locals, since stores through a char pointer may alias lx)
+            const struct lex_edge *row = lex_table[lx->state];
+            char *buf = lx->buf;
+            size_t i = lx->i, w = lx->w, len = lx->len;
+            int state = lx->state;
+            if (state == S_WORD) {
+                // Unquoted words are found a vector at a time, and need
+                // no copy until a quote or escape has been removed
+                size_t n = scan_word(buf + i, len - i);
+                if (w != i) memmove(buf + w, buf + i, n);
+                i += n;
+                w += n;
+            }
+            while (i < len) {
+                const struct lex_edge *d = &row[char_class[(unsigned char)buf[i]]];
+                if (d->next != state || d->act != A_KEEP) break;
+                buf[w++] = buf[i++];
+            }
+            lx->i = i;
+            lx->w = w;
+        }
+        if (act & A_SQF) lx->flags |= LEX_SQUOTED;
+        if (act & A_DQF) lx->flags |= LEX_DQUOTED;
+        if (act & A_ESCF) lx->flags |= LEX_ESCAPED;
+
+        if (act & A_END) {
+            tok->text = lx->buf + lx->start;
+            tok->len = lx->w - lx->start;
+            tok->flags = lx->flags;
+            tok->op = LEX_WORD;
+            lx->buf[lx->w++] = '\0';
+            // An unquoted lone digit right before < or > names an fd
+            if ((act & A_IONUM) && tok->len == 1 && !tok->flags &&
+                tok->text[0] >= '0' && tok->text[0] <= '9') {
+                tok->text = io_text[tok->text[0] - '0'];
+                tok->op = LEX_IO_NUMBER;
+            }
+            return 1;
+        }
+        if (e->op) {
+            tok->op = e->op;
+            tok->text = op_text[tok->op];
+            tok->len = strlen(tok->text);
+            tok->flags = 0;
+            return 1;
+        }
+        if (act & A_DONE) return 0;
+        if (act & A_ERR) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+}
+
+// Which operator tok is, LEX_WORD if it is not one of ours
+enum lex_op lex_op(const char *tok) {
+    const char *base = op_text[0];
+    if (tok >= base && tok < base + sizeof(op_text)) {
+        return (enum lex_op)((tok - base) / sizeof(op_text[0]));
+    }
+    base = io_text[0];
+    if (tok >= base && tok < base + sizeof(io_text)) return LEX_IO_NUMBER;
+    return LEX_WORD;
+}
@@ -0,0 +1,91 @@
+#include <errno.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include "lab.h"
+
+/*
+ * Buffered output for the builtins that replace external commands. Output
+ * is collected here and written to fd 1 in one go when the builtin ends
+ * (or the buffer fills), so `echo a b c` costs a single write. fd 1 is
+ * looked up at flush time, which is what makes redirections apply.
+ */
+
+#define OUT_SIZE 8192
+
+static char out_buf[OUT_SIZE];
+static size_t out_len;
+static int out_error;
+
+// Write out the buffer. The first error sticks until out_flush reports it,
+// later output is dropped. Anything the shell printed through stdio came
+// first so it goes out first.
+static void drain(void) {
+    fflush(stdout);
+    size_t off = 0;
+    while (off < out_len && !out_error) {
+        ssize_t n = write(STDOUT_FILENO, out_buf + off, out_len - off);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            out_error = errno;
+            break;
+        }
+        off += n;
+    }
+    out_len = 0;
+}
+
+int out_flush(void) {
+    drain();
+    if (out_error) {
+        errno = out_error;
+        out_error = 0;
+        return -1;
+    }
+    return 0;
+}
+
+void out_write(const char *s, size_t n) {
+    while (n) {
+        if (out_len == OUT_SIZE) drain();
+        size_t chunk = OUT_SIZE - out_len < n ? OUT_SIZE - out_len : n;
+        memcpy(out_buf + out_len, s, chunk);
+        out_len += chunk;
+        s += chunk;
+        n -= chunk;
+    }
+}
+
+void out_str(const char *s) {
+    out_write(s, strlen(s));
+}
+
+void out_char(char c) {
+    if (out_len == OUT_SIZE) out_write(&c, 1);
+    else out_buf[out_len++] = c;
+}
+
+void out_printf(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    size_t room = OUT_SIZE - out_len;
+    int n = vsnprintf(out_buf + out_len, room, fmt, ap);
+    va_end(ap);
+    if (n < 0) return;
+    if ((size_t)n < room) {
+        out_len += n;
+        return;
+    }
+
+    // Did not fit: format into a buffer of the right size instead
+    char *tmp = malloc(n + 1);
+    if (!tmp) {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    va_start(ap, fmt);
+    vsnprintf(tmp, n + 1, fmt, ap);
+    va_end(ap);
+    out_write(tmp, n);
+    free(tmp);
+}
@@ -0,0 +1,422 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include "lab.h"
+
+/*
+ * The parallel builtin. Every input line is a pipeline started with
+ * pipeline_launch, at most o->jobs at a time. Each job's stdout and stderr
+ * go to pipes of their own, so one poll loop sees both the output and the
+ * SIGCHLD (through a signalfd) of every job. A job is over once all its
+ * processes exited and both pipes reached EOF; then its output is written
+ * out in one piece, so jobs never interleave.
+ */
+
+// Status when more than this many jobs failed, as GNU parallel does
+#define MAX_FAILED 101
+
+struct capture {
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+struct pjob {
+    struct job *job;
+    size_t seq;             // position in the input
+    int fds[2];             // stdout and stderr read ends, -1 at EOF
+    struct capture out[2];
+    int status;
+};
+
+struct prun {
+    struct shell *sh;
+    const struct parallel_opts *o;
+    struct pjob **running;
+    size_t nrunning;
+    struct pjob **held;     // -k: finished jobs by seq until their turn
+    size_t next_out;        // -k: the next seq to print
+    int null_fd;
+    size_t failed;
+    bool halting;
+    int halt_status;
+};
+
+// One CPU per job unless asked otherwise, counting only the CPUs this
+// process may run on
+static size_t default_jobs(void) {
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0) {
+        return CPU_COUNT(&set);
+    }
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (size_t)n : 1;
+}
+
+static int write_all(int fd, const char *s, size_t n) {
+    while (n) {
+        ssize_t w = write(fd, s, n);
+        if (w == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        s += w;
+        n -= w;
+    }
+    return 0;
+}
+
+static void pjob_free(struct pjob *pj) {
+    for (int i = 0; i < 2; i++) {
+        if (pj->fds[i] != -1) close(pj->fds[i]);
+        free(pj->out[i].data);
+    }
+    free(pj);
+}
+
+// Write a finished job's output and let it go
+static void emit(struct pjob *pj) {
+    write_all(STDOUT_FILENO, pj->out[0].data, pj->out[0].len);
+    write_all(STDERR_FILENO, pj->out[1].data, pj->out[1].len);
+    pjob_free(pj);
+}
+
+// Start line seq with its output captured and stdin at /dev/null. The
+// capture dups go in front of each stage's own redirections so 2>&1 or
+// > file on the line still win.
+static struct pjob *start(struct prun *r, char *line, size_t seq) {
+    struct pjob *pj = calloc(1, sizeof(*pj));
+    if (!pj) return NULL;
+    pj->seq = seq;
+    pj->fds[0] = pj->fds[1] = -1;
+
+    struct pipeline p;
+    if (pipeline_parse(line, &p) == -1) {
+        const char *why = errno == E2BIG ? "argument list too long" : "syntax error";
+        pj->status = errno == E2BIG ? 126 : 2;
+        pj->out[1].len = asprintf(&pj->out[1].data, "parallel: job %zu: %s\n", seq + 1, why);
+        if (pj->out[1].len == (size_t)-1) pj->out[1] = (struct capture){0};
+        pipeline_free(&p);
+        return pj;
+    }
+
+    int out[2] = { -1, -1 }, err[2] = { -1, -1 };
+    struct redir *redirs = malloc((p.nredirs + p.ncmds + 2) * sizeof(*redirs));
+    if (!redirs || pipe2(out, O_CLOEXEC) == -1 || pipe2(err, O_CLOEXEC) == -1) {
+        int saved = errno;
+        for (int i = 0; i < 2; i++) {
+            if (out[i] != -1) close(out[i]);
+            if (err[i] != -1) close(err[i]);
+        }
+        errno = saved;
+        free(redirs);
+        pipeline_free(&p);
+        free(pj);
+        return NULL;
+    }
+    size_t n = 0, own = 0;
+    for (size_t i = 0; i < p.ncmds; i++) {
+        if (i == 0) redirs[n++] = (struct redir){ 0, REDIR_DUP, NULL, r->null_fd, i };
+        if (i + 1 == p.ncmds) redirs[n++] = (struct redir){ 1, REDIR_DUP, NULL, out[1], i };
+        redirs[n++] = (struct redir){ 2, REDIR_DUP, NULL, err[1], i };
+        while (own < p.nredirs && p.redirs[own].stage == i) redirs[n++] = p.redirs[own++];
+    }
+    free(p.redirs);
+    p.redirs = redirs;
+    p.nredirs = n;
+    // Never the foreground: jobs must not take the terminal from each other
+    p.background = true;
+
+    pj->job = pipeline_launch(r->sh, &p);
+    pipeline_free(&p);
+    close(out[1]);
+    close(err[1]);
+    pj->fds[0] = out[0];
+    pj->fds[1] = err[0];
+    if (!pj->job) {
+        pjob_free(pj);
+        return NULL;
+    }
+    return pj;
+}
+
+// Send SIGTERM to everything still running
+static void terminate(struct prun *r) {
+    for (size_t i = 0; i < r->nrunning; i++) {
+        struct job *j = r->running[i]->job;
+        if (!j) continue;
+        if (r->sh->shell_is_interactive && j->pgid) {
+            kill(-j->pgid, SIGTERM);
+            continue;
+        }
+        for (size_t k = 0; k < j->nprocs; k++) {
+            if (j->procs[k].pid && !j->procs[k].done) kill(j->procs[k].pid, SIGTERM);
+        }
+    }
+}
+
+// Record a job that is over and print it, or hold it for -k
+static void finish(struct prun *r, struct pjob *pj) {
+    if (pj->job) {
+        pj->status = job_exit_status(pj->job, r->sh->pipefail);
+        job_remove(&r->sh->jobs, pj->job);
+        pj->job = NULL;
+    }
+    if (pj->status) {
+        r->failed++;
+        if (r->o->halt_on_error && !r->halting) {
+            r->halting = true;
+            r->halt_status = pj->status;
+            terminate(r);
+        }
+    }
+
+    if (!r->o->keep_order) {
+        emit(pj);
+        return;
+    }
+    r->held[pj->seq] = pj;
+    while (r->held[r->next_out]) {
+        emit(r->held[r->next_out]);
+        r->held[r->next_out++] = NULL;
+    }
+}
+
+// Read what is waiting on one capture pipe, closing it at EOF
+static void drain(struct pjob *pj, int which) {
+    struct capture *c = &pj->out[which];
+    if (c->cap - c->len < 4096) {
+        size_t cap = c->cap ? c->cap * 2 : 8192;
+        char *data = realloc(c->data, cap);
+        if (!data) {
+            // Keep the job moving, its output is lost
+            c->len = 0;
+            char scratch[4096];
+            if (read(pj->fds[which], scratch, sizeof(scratch)) > 0) return;
+            close(pj->fds[which]);
+            pj->fds[which] = -1;
+            return;
+        }
+        c->data = data;
+        c->cap = cap;
+    }
+    ssize_t n = read(pj->fds[which], c->data + c->len, c->cap - c->len);
+    if (n > 0) {
+        c->len += n;
+    } else if (n == 0 || errno != EINTR) {
+        close(pj->fds[which]);
+        pj->fds[which] = -1;
+    }
+}
+
+// Collect every child that exited
+static void reap(struct shell *sh) {
+    int status;
+    struct rusage ru;
+    pid_t pid;
+    while ((pid = wait4(-1, &status, WNOHANG, &ru)) > 0) {
+        job_update(&sh->jobs, pid, status, &ru);
+    }
+}
+
+static void ignore_signal(int signo) {
+    UNUSED(signo);
+}
+
+// The whole input, with a spare byte past len for the last line's NUL
+static char *read_input(int fd, size_t *len) {
+    size_t cap = 64 * 1024;
+    char *buf = malloc(cap);
+    *len = 0;
+    while (buf) {
+        ssize_t n = read(fd, buf + *len, cap - *len - 1);
+        if (n == 0) return buf;
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        *len += n;
+        if (*len + 1 == cap) {
+            char *bigger = realloc(buf, cap * 2);
+            if (!bigger) break;
+            buf = bigger;
+            cap *= 2;
+        }
+    }
+    free(buf);
+    return NULL;
+}
+
+// Cut buf into lines in place, leaving out blank lines and comments
+static int split_lines(char *buf, size_t len, char ***out, size_t *count) {
+    char **lines = NULL;
+    size_t n = 0, cap = 0;
+    for (char *p = buf, *end = buf + len; p < end;) {
+        char *nl = memchr(p, '\n', end - p);
+        char *eol = nl ? nl : end;
+        *eol = '\0';
+        char *line = trim_white(p);
+        p = eol + 1;
+        if (!*line || *line == '#') continue;
+        if (n == cap) {
+            cap = cap ? cap * 2 : 256;
+            char **grown = realloc(lines, cap * sizeof(*lines));
+            if (!grown) {
+                free(lines);
+                return -1;
+            }
+            lines = grown;
+        }
+        lines[n++] = line;
+    }
+    *out = lines;
+    *count = n;
+    return 0;
+}
+
+int parallel_run(struct shell *sh, int fd, const struct parallel_opts *o) {
+    size_t len, nlines;
+    char **lines;
+    char *buf = read_input(fd, &len);
+    if (!buf || split_lines(buf, len, &lines, &nlines) == -1) {
+        perror("parallel");
+        free(buf);
+        return EXIT_FAILURE;
+    }
+    if (!nlines) {
+        free(buf);
+        return 0;
+    }
+
+    struct parallel_opts opts = *o;
+    if (!opts.jobs) opts.jobs = default_jobs();
+    if (opts.jobs > nlines) opts.jobs = nlines;
+    struct prun r = { .sh = sh, .o = &opts };
+    r.running = malloc(opts.jobs * sizeof(*r.running));
+    r.held = opts.keep_order ? calloc(nlines + 1, sizeof(*r.held)) : NULL;
+    struct pollfd *pfds = malloc((1 + 2 * opts.jobs) * sizeof(*pfds));
+    r.null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (!r.running || (opts.keep_order && !r.held) || !pfds || r.null_fd == -1) {
+        perror("parallel");
+        free(buf);
+        free(lines);
+        free(r.running);
+        free(r.held);
+        free(pfds);
+        if (r.null_fd != -1) close(r.null_fd);
+        return EXIT_FAILURE;
+    }
+
+    // SIGCHLD and SIGINT arrive through the signalfd only. The shell
+    // ignores SIGINT, and an ignored signal is never queued, so it gets a
+    // handler that is never called while the signal is blocked.
+    sigset_t mask, old_mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+    struct sigaction sa = { .sa_handler = ignore_signal }, old_int;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, &old_int);
+    int sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sfd == -1) perror("parallel: signalfd");
+
+    bool interrupted = false;
+    size_t next = 0;
+    while (sfd != -1) {
+        while (!r.halting && next < nlines && r.nrunning < opts.jobs) {
+            struct pjob *pj = start(&r, lines[next], next);
+            if (!pj) {
+                // Out of memory or fds: wait for a slot, or give up
+                if (r.nrunning) break;
+                perror("parallel");
+                r.halting = true;
+                r.halt_status = EXIT_FAILURE;
+                break;
+            }
+            next++;
+            if (pj->job) {
+                r.running[r.nrunning++] = pj;
+            } else {
+                // The line did not parse, nothing to wait for
+                finish(&r, pj);
+            }
+        }
+        if (!r.nrunning) break;
+
+        nfds_t n = 0;
+        pfds[n++] = (struct pollfd){ .fd = sfd, .events = POLLIN };
+        for (size_t i = 0; i < r.nrunning; i++) {
+            for (int w = 0; w < 2; w++) pfds[n++] = (struct pollfd){ .fd = r.running[i]->fds[w], .events = POLLIN };
+        }
+        if (poll(pfds, n, -1) == -1) {
+            if (errno == EINTR) continue;
+            perror("parallel: poll");
+            break;
+        }
+
+        if (pfds[0].revents) {
+            struct signalfd_siginfo info;
+            while (read(sfd, &info, sizeof(info)) == sizeof(info)) {
+                if (info.ssi_signo == SIGINT && !interrupted) {
+                    interrupted = r.halting = true;
+                    terminate(&r);
+                }
+            }
+            reap(sh);
+        }
+        // Each job's two slots follow the signalfd in running order
+        for (size_t i = 0; i < r.nrunning; i++) {
+            struct pjob *pj = r.running[i];
+            for (int w = 0; w < 2; w++) {
+                if (pj->fds[w] != -1 && pfds[1 + 2 * i + w].revents) drain(pj, w);
+            }
+        }
+        // Close the gaps left by the jobs that are over. Slot order only
+        // matters for the pollfds, which are rebuilt next time around.
+        size_t kept = 0;
+        for (size_t i = 0; i < r.nrunning; i++) {
+            struct pjob *pj = r.running[i];
+            if (job_is_done(pj->job) && pj->fds[0] == -1 && pj->fds[1] == -1) {
+                finish(&r, pj);
+            } else {
+                r.running[kept++] = pj;
+            }
+        }
+        r.nrunning = kept;
+    }
+
+    // Only left over if the loop broke on an error: let them go unwatched
+    for (size_t i = 0; i < r.nrunning; i++) {
+        r.running[i]->job = NULL;
+        pjob_free(r.running[i]);
+    }
+    if (r.held) {
+        for (size_t i = 0; i < nlines; i++) {
+            if (r.held[i]) emit(r.held[i]);
+        }
+    }
+
+    if (sfd != -1) close(sfd);
+    sigaction(SIGINT, &old_int, NULL);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    close(r.null_fd);
+    free(buf);
+    free(lines);
+    free(r.running);
+    free(r.held);
+    free(pfds);
+
+    if (interrupted) return 128 + SIGINT;
+    if (r.halting) return r.halt_status;
+    return r.failed > MAX_FAILED ? MAX_FAILED : (int)r.failed;
+}
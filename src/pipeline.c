@@ -0,0 +1,225 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "lab.h"
+
+// Moves the redirections of stage i out of its argv and into p->redirs
+static int take_redirs(struct pipeline *p, size_t i) {
+    char **argv = p->cmds[i];
+    size_t k = 0;
+    for (size_t j = 0; argv[j]; j++) {
+        enum lex_op op = lex_op(argv[j]);
+        int fd = -1;
+        if (op == LEX_IO_NUMBER) {
+            // The lexer only makes these right in front of < or >
+            fd = argv[j][0] - '0';
+            op = lex_op(argv[++j]);
+        }
+        if (op < LEX_LESS || op > LEX_TLESS) {
+            argv[k++] = argv[j];
+            continue;
+        }
+
+        char *word = argv[j + 1];
+        if (!word || lex_op(word) != LEX_WORD || op == LEX_DLESS) return -1;
+        struct redir *r = &p->redirs[p->nredirs++];
+        r->fd = fd != -1 ? fd : (op == LEX_LESS || op == LEX_LESSAND || op == LEX_TLESS) ? 0 : 1;
+        r->word = word;
+        r->src = -1;
+        r->stage = i;
+        switch (op) {
+            case LEX_LESS:   r->kind = REDIR_IN; break;
+            case LEX_GREAT:  r->kind = REDIR_OUT; break;
+            case LEX_DGREAT: r->kind = REDIR_APPEND; break;
+            case LEX_TLESS:  r->kind = REDIR_STRING; break;
+            default: {
+                // <&n and >&n copy another fd, which must be a number
+                char *end;
+                long src = strtol(word, &end, 10);
+                if (!*word || *end || src < 0 || src > INT_MAX) return -1;
+                r->kind = REDIR_DUP;
+                r->src = (int)src;
+            }
+        }
+        j++;
+    }
+    argv[k] = NULL;
+    return 0;
+}
+
+int pipeline_parse(char *line, struct pipeline *p) {
+    memset(p, 0, sizeof(*p));
+    unsigned first;
+    p->argv = cmd_parse_inplace_flags(line, &first);
+    if (!p->argv) return -1;
+    if (!p->argv[0]) goto syntax;
+
+    // One stage per pipe plus one
+    size_t n = 1, nredirs = 0;
+    for (size_t i = 0; p->argv[i]; i++) {
+        enum lex_op op = lex_op(p->argv[i]);
+        if (op == LEX_PIPE) n++;
+        if (op >= LEX_LESS && op <= LEX_TLESS) nredirs++;
+        // Lists are not supported: & only ends the line, && never parses.
+        // || lexes as two pipes and fails below as an empty stage.
+        if (op == LEX_AND_IF || (op == LEX_AMP && p->argv[i + 1])) goto syntax;
+    }
+    p->cmds = malloc(n * sizeof(char **));
+    p->redirs = nredirs ? malloc(nredirs * sizeof(struct redir)) : NULL;
+    if (!p->cmds || (nredirs && !p->redirs)) {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+
+    // Cut argv at every pipe so each stage is a NULL terminated slice of it
+    p->cmds[p->ncmds++] = p->argv;
+    for (size_t i = 0; p->argv[i]; i++) {
+        if (lex_op(p->argv[i]) == LEX_PIPE) {
+            p->argv[i] = NULL;
+            p->cmds[p->ncmds++] = &p->argv[i + 1];
+        }
+    }
+
+    // A trailing & operator runs the line in the background
+    char **last = p->cmds[p->ncmds - 1];
+    size_t n_last = 0;
+    while (last[n_last]) n_last++;
+    if (n_last && lex_op(last[n_last - 1]) == LEX_AMP) {
+        last[n_last - 1] = NULL;
+        p->background = true;
+    }
+
+    // The time keyword reports on the whole pipeline it starts. Only the
+    // bare word is the keyword, 'time' or \time runs a command named time.
+    if (p->cmds[0][0] && !first && strcmp(p->cmds[0][0], "time") == 0) {
+        p->timed = true;
+        p->cmds[0]++;
+    }
+
+    for (size_t i = 0; i < p->ncmds; i++) {
+        if (take_redirs(p, i) == -1) goto syntax;
+    }
+
+    // Every stage needs a command: reject "| a", "a |" and "a | | b"
+    for (size_t i = 0; i < p->ncmds; i++) {
+        if (!p->cmds[i][0]) goto syntax;
+    }
+    return 0;
+
+syntax:
+    errno = EINVAL;
+    return -1;
+}
+
+void pipeline_free(struct pipeline *p) {
+    if (!p) return;
+    cmd_free(p->argv);
+    free(p->cmds);
+    free(p->redirs);
+    p->argv = NULL;
+    p->cmds = NULL;
+    p->redirs = NULL;
+    p->nredirs = 0;
+    p->ncmds = 0;
+}
+
+// Convert a wait status to the shell's $? convention
+int status_to_exit(int status) {
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return EXIT_FAILURE;
+}
+
+struct job *pipeline_launch(struct shell *sh, struct pipeline *p) {
+    // Builtin output still sitting in our buffer must come out first
+    fflush(stdout);
+
+    struct job *j = job_add(&sh->jobs, p);
+    if (!j) {
+        perror("job_add");
+        return NULL;
+    }
+    j->background = p->background;
+    j->timed = p->timed || sh->timing;
+
+    // Start every stage before waiting on any of them. Pipes, here-strings
+    // and redirected files are all close-on-exec so the only copies a child
+    // keeps are the ones it dup2'd into place.
+    int fd_in = -1;
+    size_t r = 0;
+    for (size_t i = 0; i < p->ncmds; i++) {
+        struct job_proc *proc = &j->procs[i];
+        struct redir *redirs = &p->redirs[r];
+        size_t nredirs = 0;
+        while (r < p->nredirs && p->redirs[r].stage == i) {
+            r++;
+            nredirs++;
+        }
+        int fds[2] = { -1, -1 };
+        if (i + 1 < p->ncmds && pipe2(fds, O_CLOEXEC) == -1) {
+            perror("pipe2");
+            for (size_t k = i; k < p->ncmds; k++) {
+                j->procs[k].done = true;
+                j->procs[k].code = EXIT_FAILURE;
+            }
+            break;
+        }
+
+        char **argv = p->cmds[i];
+        const char *path = cmd_hash_lookup(&sh->hash, argv[0]);
+        if (!path) {
+            fprintf(stderr, "%s: command not found\n", argv[0]);
+            proc->done = true;
+            proc->code = 127;
+        } else if (redir_prepare(redirs, nredirs, sh->launch_mode == LAUNCH_SPAWN) == -1) {
+            proc->done = true;
+            proc->code = EXIT_FAILURE;
+        } else {
+            struct launch l = {
+                .path = path,
+                .argv = argv,
+                .pgid = j->pgid,
+                .foreground = !p->background,
+                .fd_in = fd_in,
+                .fd_out = fds[1],
+                .redirs = redirs,
+                .nredirs = nredirs,
+            };
+            proc->pid = launch_process(sh, &l);
+            if (proc->pid < 0) {
+                int err = errno;
+                launch_report(argv[0], err);
+                proc->pid = 0;
+                proc->done = true;
+                proc->code = launch_status(err);
+            } else if (!j->pgid) {
+                j->pgid = proc->pid;
+            }
+            redir_release(redirs, nredirs);
+        }
+
+        // The children hold their own copies now
+        if (fd_in != -1) close(fd_in);
+        if (fds[1] != -1) close(fds[1]);
+        fd_in = fds[0];
+    }
+    if (fd_in != -1) close(fd_in);
+    return j;
+}
+
+int pipeline_run(struct shell *sh, struct pipeline *p) {
+    struct job *j = pipeline_launch(sh, p);
+    if (!j) return EXIT_FAILURE;
+
+    if (p->background) {
+        if (sh->shell_is_interactive) fprintf(stderr, "[%d] %d\n", j->id, j->pgid);
+        return 0;
+    }
+    return job_wait_fg(sh, j);
+}
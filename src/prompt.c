@@ -0,0 +1,393 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "lab.h"
+
+/*
+ * Prompt templates. MY_PROMPT is compiled once into a list of segments:
+ * literal text, and escapes that are filled in every time the prompt is
+ * drawn. Segments that only read shell state or make one cheap syscall
+ * render on the spot. The git branch means walking up the directory tree
+ * and reading files, which can stall on a slow file system, so it comes
+ * from a cache filled by a background thread. A render always uses what
+ * the cache has for the cwd right away, possibly nothing or a stale
+ * branch, and asks the thread to look again. When the answer changes the
+ * thread makes notify_fd readable and the main loop draws the prompt
+ * again.
+ */
+
+enum seg_kind {
+    SEG_TEXT,
+    SEG_CWD,       // \w
+    SEG_BASENAME,  // \W
+    SEG_STATUS,    // \?
+    SEG_JOBS,      // \j
+    SEG_DOLLAR,    // \$
+    SEG_GIT,       // \g
+};
+
+struct prompt_seg {
+    enum seg_kind kind;
+    const char *text;  // SEG_TEXT, points into the compiled copy
+    size_t len;
+};
+
+// Directories the git branch is remembered for
+#define GIT_CACHE 16
+
+struct git_entry {
+    char *cwd;
+    char *branch;  // NULL when cwd is not in a repository
+};
+
+struct prompt_worker {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    char *want;      // cwd to look at next, NULL when idle
+    bool stop;
+    struct git_entry cache[GIT_CACHE];
+    size_t next;     // slot to reuse when the cache is full
+};
+
+// A growable string for rendering
+struct strbuf {
+    char *s;
+    size_t len;
+    size_t cap;
+};
+
+static void sb_add(struct strbuf *b, const char *s, size_t n) {
+    if (b->len + n + 1 > b->cap) {
+        size_t cap = b->cap ? b->cap * 2 : 64;
+        while (b->len + n + 1 > cap) cap *= 2;
+        char *grown = realloc(b->s, cap);
+        if (!grown) return;
+        b->s = grown;
+        b->cap = cap;
+    }
+    memcpy(b->s + b->len, s, n);
+    b->len += n;
+    b->s[b->len] = '\0';
+}
+
+static void sb_str(struct strbuf *b, const char *s) {
+    sb_add(b, s, strlen(s));
+}
+
+static int add_seg(struct prompt *p, enum seg_kind kind, const char *text, size_t len) {
+    // Neighbouring text is merged, \\ and \n split literals otherwise
+    if (kind == SEG_TEXT && p->nsegs && p->segs[p->nsegs - 1].kind == SEG_TEXT &&
+        p->segs[p->nsegs - 1].text + p->segs[p->nsegs - 1].len == text) {
+        p->segs[p->nsegs - 1].len += len;
+        return 0;
+    }
+    struct prompt_seg *segs = realloc(p->segs, (p->nsegs + 1) * sizeof(*segs));
+    if (!segs) return -1;
+    p->segs = segs;
+    p->segs[p->nsegs++] = (struct prompt_seg){ kind, text, len };
+    return 0;
+}
+
+int prompt_compile(struct prompt *p, const char *template) {
+    memset(p, 0, sizeof(*p));
+    p->notify_fd = -1;
+    // Escapes become literals in place, so the copy never grows
+    char *src = strdup(template);
+    if (!src) return -1;
+    p->source = src;
+
+    char host[HOST_NAME_MAX + 1] = "";
+    char *w = src;
+    for (const char *r = src; *r;) {
+        const char *text = w;
+        if (*r != '\\' || !r[1]) {
+            *w++ = *r++;
+            if (add_seg(p, SEG_TEXT, text, 1) == -1) return -1;
+            continue;
+        }
+        char c = r[1];
+        r += 2;
+        enum seg_kind kind = SEG_TEXT;
+        const char *lit = NULL;
+        switch (c) {
+            case 'w': kind = SEG_CWD; break;
+            case 'W': kind = SEG_BASENAME; break;
+            case '?': kind = SEG_STATUS; break;
+            case 'j': kind = SEG_JOBS; break;
+            case '$': kind = SEG_DOLLAR; break;
+            case 'g': kind = SEG_GIT; p->async = true; break;
+            case 'n': lit = "\n"; break;
+            case 'e': lit = "\033"; break;
+            case '\\': lit = "\\"; break;
+            // readline must not count what is between \[ and \] as visible
+            case '[': lit = "\001"; break;
+            case ']': lit = "\002"; break;
+            case 'u': {
+                // User and host do not change, fill them in now
+                struct passwd *pw = getpwuid(getuid());
+                lit = pw ? pw->pw_name : "";
+                break;
+            }
+            case 'h':
+                if (!*host && gethostname(host, sizeof(host)) == 0) host[strcspn(host, ".")] = '\0';
+                lit = host;
+                break;
+            default:
+                r -= 2;
+                *w++ = *r++;
+                if (add_seg(p, SEG_TEXT, text, 1) == -1) return -1;
+                continue;
+        }
+        if (!lit) {
+            if (add_seg(p, kind, NULL, 0) == -1) return -1;
+            continue;
+        }
+        // A literal longer than its escape goes into its own allocation
+        size_t len = strlen(lit);
+        if (len <= 2) {
+            memcpy(w, lit, len);
+            w += len;
+        } else {
+            char **extra = realloc(p->extra, (p->nextra + 1) * sizeof(*extra));
+            if (!extra) return -1;
+            p->extra = extra;
+            text = p->extra[p->nextra] = strdup(lit);
+            if (!text) return -1;
+            p->nextra++;
+        }
+        if (add_seg(p, SEG_TEXT, text, len) == -1) return -1;
+    }
+    return 0;
+}
+
+// Name of the branch checked out in the repository holding cwd, or the
+// short commit id when HEAD is detached. NULL outside a repository.
+static char *git_branch(const char *cwd) {
+    char dir[PATH_MAX], path[PATH_MAX + 16];
+    snprintf(dir, sizeof(dir), "%s", cwd);
+    for (;;) {
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/.git", dir);
+        if (stat(path, &st) == 0) {
+            if (S_ISREG(st.st_mode)) {
+                // A worktree or submodule: .git holds "gitdir: <dir>"
+                char buf[PATH_MAX];
+                int fd = open(path, O_RDONLY | O_CLOEXEC);
+                ssize_t n = fd == -1 ? -1 : read(fd, buf, sizeof(buf) - 1);
+                if (fd != -1) close(fd);
+                if (n <= 8 || strncmp(buf, "gitdir: ", 8) != 0) return NULL;
+                buf[n] = '\0';
+                buf[strcspn(buf, "\n")] = '\0';
+                if (buf[8] == '/') snprintf(path, sizeof(path), "%s/HEAD", buf + 8);
+                else snprintf(path, sizeof(path), "%s/%s/HEAD", dir, buf + 8);
+            } else {
+                snprintf(path, sizeof(path), "%s/.git/HEAD", dir);
+            }
+            break;
+        }
+        char *slash = strrchr(dir, '/');
+        if (!slash || slash == dir) return NULL;
+        *slash = '\0';
+    }
+
+    char head[256];
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return NULL;
+    ssize_t n = read(fd, head, sizeof(head) - 1);
+    close(fd);
+    if (n <= 0) return NULL;
+    head[n] = '\0';
+    head[strcspn(head, "\n")] = '\0';
+    const char *ref = "ref: refs/heads/";
+    if (strncmp(head, ref, strlen(ref)) == 0) return strdup(head + strlen(ref));
+    if (strncmp(head, "ref: ", 5) == 0) return strdup(head + 5);
+    return strndup(head, 7);
+}
+
+static struct git_entry *cache_find(struct prompt_worker *wk, const char *cwd) {
+    for (size_t i = 0; i < GIT_CACHE; i++) {
+        if (wk->cache[i].cwd && strcmp(wk->cache[i].cwd, cwd) == 0) return &wk->cache[i];
+    }
+    return NULL;
+}
+
+static bool same(const char *a, const char *b) {
+    return a == b || (a && b && strcmp(a, b) == 0);
+}
+
+static void *worker_main(void *arg) {
+    struct prompt *p = arg;
+    struct prompt_worker *wk = p->worker;
+    pthread_mutex_lock(&wk->lock);
+    for (;;) {
+        while (!wk->want && !wk->stop) pthread_cond_wait(&wk->wake, &wk->lock);
+        if (wk->stop) break;
+        char *cwd = wk->want;
+        wk->want = NULL;
+        pthread_mutex_unlock(&wk->lock);
+
+        // The slow part runs without the lock, renders never wait on it
+        char *branch = git_branch(cwd);
+
+        pthread_mutex_lock(&wk->lock);
+        struct git_entry *e = cache_find(wk, cwd);
+        bool changed = !e || !same(e->branch, branch);
+        if (!e) {
+            e = &wk->cache[wk->next];
+            wk->next = (wk->next + 1) % GIT_CACHE;
+            free(e->cwd);
+            free(e->branch);
+            e->cwd = cwd;
+            e->branch = branch;
+        } else {
+            free(cwd);
+            free(e->branch);
+            e->branch = branch;
+        }
+        if (changed) {
+            uint64_t one = 1;
+            if (write(p->notify_fd, &one, sizeof(one)) == -1) {
+                // Already readable, the main loop will look anyway
+            }
+        }
+    }
+    pthread_mutex_unlock(&wk->lock);
+    return NULL;
+}
+
+// Start the git worker the first time a prompt needs it
+static struct prompt_worker *worker(struct prompt *p) {
+    if (p->worker) return p->worker;
+    struct prompt_worker *wk = calloc(1, sizeof(*wk));
+    if (!wk) return NULL;
+    p->notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (p->notify_fd == -1) {
+        free(wk);
+        return NULL;
+    }
+    pthread_mutex_init(&wk->lock, NULL);
+    pthread_cond_init(&wk->wake, NULL);
+    p->worker = wk;
+    // The thread starts with every signal blocked, so SIGINT and SIGCHLD
+    // always go to the main thread and the signalfds it reads
+    sigset_t all, old_mask;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old_mask);
+    int rval = pthread_create(&wk->thread, NULL, worker_main, p);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    if (rval != 0) {
+        pthread_mutex_destroy(&wk->lock);
+        pthread_cond_destroy(&wk->wake);
+        free(wk);
+        p->worker = NULL;
+        close(p->notify_fd);
+        p->notify_fd = -1;
+        return NULL;
+    }
+    return wk;
+}
+
+// Cached branch for cwd, and a request to check it again
+static void render_git(struct prompt *p, const char *cwd, struct strbuf *b) {
+    struct prompt_worker *wk = worker(p);
+    if (!wk) return;
+    pthread_mutex_lock(&wk->lock);
+    struct git_entry *e = cache_find(wk, cwd);
+    if (e && e->branch) sb_str(b, e->branch);
+    if (!wk->want || strcmp(wk->want, cwd) != 0) {
+        free(wk->want);
+        wk->want = strdup(cwd);
+        pthread_cond_signal(&wk->wake);
+    }
+    pthread_mutex_unlock(&wk->lock);
+}
+
+char *prompt_render(struct prompt *p, struct shell *sh) {
+    struct strbuf b = {0};
+    char buf[PATH_MAX];
+    const char *cwd = NULL;
+    char num[24];
+    for (size_t i = 0; i < p->nsegs; i++) {
+        const struct prompt_seg *s = &p->segs[i];
+        if (s->kind == SEG_CWD || s->kind == SEG_BASENAME || s->kind == SEG_GIT) {
+            if (!cwd) cwd = sh_cwd(sh);
+            if (!cwd) cwd = getcwd(buf, sizeof(buf)) ? buf : "?";
+        }
+        switch (s->kind) {
+            case SEG_TEXT:
+                sb_add(&b, s->text, s->len);
+                break;
+            case SEG_CWD: {
+                const char *home = env_get("HOME");
+                size_t hlen = home ? strlen(home) : 0;
+                if (hlen > 1 && strncmp(cwd, home, hlen) == 0 && (cwd[hlen] == '/' || !cwd[hlen])) {
+                    sb_str(&b, "~");
+                    sb_str(&b, cwd + hlen);
+                } else {
+                    sb_str(&b, cwd);
+                }
+                break;
+            }
+            case SEG_BASENAME: {
+                const char *base = strrchr(cwd, '/');
+                sb_str(&b, base && base[1] ? base + 1 : cwd);
+                break;
+            }
+            case SEG_STATUS:
+                snprintf(num, sizeof(num), "%d", sh ? sh->last_status : 0);
+                sb_str(&b, num);
+                break;
+            case SEG_JOBS:
+                snprintf(num, sizeof(num), "%zu", sh ? sh->jobs.count : 0);
+                sb_str(&b, num);
+                break;
+            case SEG_DOLLAR:
+                sb_str(&b, geteuid() == 0 ? "#" : "$");
+                break;
+            case SEG_GIT:
+                render_git(p, cwd, &b);
+                break;
+        }
+    }
+    return b.s ? b.s : strdup("");
+}
+
+bool prompt_collect(struct prompt *p) {
+    uint64_t n;
+    return p->worker && read(p->notify_fd, &n, sizeof(n)) == sizeof(n);
+}
+
+void prompt_destroy(struct prompt *p) {
+    struct prompt_worker *wk = p->worker;
+    if (wk) {
+        pthread_mutex_lock(&wk->lock);
+        wk->stop = true;
+        pthread_cond_signal(&wk->wake);
+        pthread_mutex_unlock(&wk->lock);
+        pthread_join(wk->thread, NULL);
+        pthread_mutex_destroy(&wk->lock);
+        pthread_cond_destroy(&wk->wake);
+        free(wk->want);
+        for (size_t i = 0; i < GIT_CACHE; i++) {
+            free(wk->cache[i].cwd);
+            free(wk->cache[i].branch);
+        }
+        free(wk);
+        close(p->notify_fd);
+    }
+    for (size_t i = 0; i < p->nextra; i++) free(p->extra[i]);
+    free(p->extra);
+    free(p->segs);
+    free(p->source);
+    memset(p, 0, sizeof(*p));
+    p->notify_fd = -1;
+}
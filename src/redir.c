@@ -0,0 +1,149 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "lab.h"
+
+// Marks a saved slot whose redirection was never applied
+#define NOT_APPLIED (-2)
+
+// Flags for the files a redirection opens, -1 if it opens none
+static int open_flags(enum redir_kind kind) {
+    switch (kind) {
+        case REDIR_IN:     return O_RDONLY;
+        case REDIR_OUT:    return O_WRONLY | O_CREAT | O_TRUNC;
+        case REDIR_APPEND: return O_WRONLY | O_CREAT | O_APPEND;
+        default:           return -1;
+    }
+}
+
+// Write the here-string and its newline where the command can read it
+static int here_string(const char *word) {
+    size_t len = strlen(word);
+    int fd;
+    if (len + 1 <= PIPE_BUF) {
+        // Fits in the pipe without blocking, so no reader is needed yet
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) == -1) return -1;
+        if (write(fds[1], word, len) != (ssize_t)len || write(fds[1], "\n", 1) != 1) {
+            close(fds[0]);
+            close(fds[1]);
+            return -1;
+        }
+        close(fds[1]);
+        return fds[0];
+    }
+    fd = memfd_create("here-string", MFD_CLOEXEC);
+    if (fd == -1) return -1;
+    size_t off = 0;
+    while (off < len) {
+        ssize_t w = write(fd, word + off, len - off);
+        if (w <= 0) break;
+        off += w;
+    }
+    if (off < len || write(fd, "\n", 1) != 1 || lseek(fd, 0, SEEK_SET) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Move fd to 10 or above, out of the way of any fd a redirection names.
+// Otherwise a file opened for 4>a could land on 3 and be overwritten by a
+// later 3>b before it is copied.
+static int move_high(int fd) {
+    if (fd == -1 || fd >= 10) return fd;
+    int high = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+    int err = errno;
+    close(fd);
+    errno = err;
+    return high;
+}
+
+int redir_prepare(struct redir *r, size_t n, bool open_files) {
+    for (size_t i = 0; i < n; i++) {
+        int flags = open_flags(r[i].kind);
+        if (r[i].kind == REDIR_STRING) {
+            r[i].src = here_string(r[i].word);
+        } else if (open_files && flags != -1) {
+            r[i].src = open(r[i].word, flags | O_CLOEXEC, 0666);
+        } else {
+            continue;
+        }
+        r[i].src = move_high(r[i].src);
+        if (r[i].src == -1) {
+            fprintf(stderr, "%s: %s\n", r[i].word, strerror(errno));
+            redir_release(r, i);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void redir_release(struct redir *r, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (r[i].kind != REDIR_DUP && r[i].src != -1) {
+            close(r[i].src);
+            r[i].src = -1;
+        }
+    }
+}
+
+int redir_apply(const struct redir *r, size_t n, int *saved) {
+    for (size_t i = 0; i < n; i++) {
+        if (saved) saved[i] = NOT_APPLIED;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (saved) {
+            // Keep what the shell had on this fd, or -1 if it was closed
+            saved[i] = fcntl(r[i].fd, F_DUPFD_CLOEXEC, 10);
+            if (saved[i] == -1 && errno != EBADF) {
+                saved[i] = NOT_APPLIED;
+                goto fail;
+            }
+        }
+        // Files are opened here unless redir_prepare already did
+        int src = r[i].src;
+        int flags = src == -1 ? open_flags(r[i].kind) : -1;
+        if (flags != -1) {
+            src = open(r[i].word, flags | O_CLOEXEC, 0666);
+            if (src == -1) goto fail;
+        }
+        if (src == r[i].fd) {
+            // Already in place (n>&n, or the open got the fd itself)
+            if (flags != -1 && fcntl(src, F_SETFD, 0) == -1) goto fail;
+        } else if (dup2(src, r[i].fd) == -1) {
+            if (flags != -1) close(src);
+            goto fail;
+        } else if (flags != -1 && saved) {
+            // The shell must drop the original itself, a child about to
+            // exec leaves that to close-on-exec
+            close(src);
+        }
+        continue;
+fail:
+        if (r[i].kind == REDIR_DUP) {
+            fprintf(stderr, "%d: %s\n", r[i].src, strerror(errno));
+        } else {
+            fprintf(stderr, "%s: %s\n", r[i].word, strerror(errno));
+        }
+        return -1;
+    }
+    return 0;
+}
+
+void redir_restore(const struct redir *r, size_t n, int *saved) {
+    for (size_t i = n; i-- > 0;) {
+        if (saved[i] == NOT_APPLIED) continue;
+        if (saved[i] == -1) {
+            close(r[i].fd);
+        } else {
+            dup2(saved[i], r[i].fd);
+            close(saved[i]);
+        }
+        saved[i] = NOT_APPLIED;
+    }
+}
@@ -0,0 +1,204 @@
+#include <string.h>
+#include "lab.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+/*
+ * Whitespace scanning kernels. Blanks are space, tab, newline and carriage
+ * return. Word characters are anything the lexer copies into a word as is:
+ * not a blank, an operator byte (| & < >), a quote or a backslash. The
+ * SIMD kernels compare 16 or 32 bytes at a time, turn
+ * the result into a bitmask and find the boundary with a count of trailing
+ * (or leading) zeros. Tails shorter than a vector go through the scalar
+ * code so nothing past n is ever read.
+ */
+
+static inline bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static size_t blank_scalar(const char *p, size_t n) {
+    size_t i = 0;
+    while (i < n && is_blank(p[i])) i++;
+    return i;
+}
+
+static inline bool ends_word(char c) {
+    return is_blank(c) || c == '|' || c == '&' || c == '<' || c == '>' ||
+           c == '\'' || c == '"' || c == '\\';
+}
+
+static size_t word_scalar(const char *p, size_t n) {
+    size_t i = 0;
+    while (i < n && !ends_word(p[i])) i++;
+    return i;
+}
+
+static size_t blank_rev_scalar(const char *p, size_t n) {
+    while (n && is_blank(p[n - 1])) n--;
+    return n;
+}
+
+#ifdef SCAN_X86
+static inline unsigned blank_mask16(__m128i v) {
+    __m128i m = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+    return (unsigned)_mm_movemask_epi8(m);
+}
+
+static inline unsigned end_mask16(__m128i v) {
+    __m128i m = _mm_or_si128(
+        _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('|')), _mm_cmpeq_epi8(v, _mm_set1_epi8('&'))),
+                     _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('<')), _mm_cmpeq_epi8(v, _mm_set1_epi8('>')))),
+        _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\'')), _mm_cmpeq_epi8(v, _mm_set1_epi8('"'))),
+                     _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))));
+    return blank_mask16(v) | (unsigned)_mm_movemask_epi8(m);
+}
+
+static size_t blank_sse2(const char *p, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        unsigned m = ~blank_mask16(_mm_loadu_si128((const __m128i *)(p + i))) & 0xffff;
+        if (m) return i + __builtin_ctz(m);
+    }
+    return i + blank_scalar(p + i, n - i);
+}
+
+static size_t word_sse2(const char *p, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        unsigned m = end_mask16(_mm_loadu_si128((const __m128i *)(p + i)));
+        if (m) return i + __builtin_ctz(m);
+    }
+    return i + word_scalar(p + i, n - i);
+}
+
+static size_t blank_rev_sse2(const char *p, size_t n) {
+    while (n >= 16) {
+        unsigned m = ~blank_mask16(_mm_loadu_si128((const __m128i *)(p + n - 16))) & 0xffff;
+        if (m) return n - 16 + (31 - __builtin_clz(m)) + 1;
+        n -= 16;
+    }
+    return blank_rev_scalar(p, n);
+}
+
+__attribute__((target("avx2")))
+static inline unsigned blank_mask32(__m256i v) {
+    __m256i m = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'))));
+    return (unsigned)_mm256_movemask_epi8(m);
+}
+
+__attribute__((target("avx2")))
+static inline unsigned end_mask32(__m256i v) {
+    __m256i m = _mm256_or_si256(
+        _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('|')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('&'))),
+                        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('<')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('>')))),
+        _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\'')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'))),
+                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))));
+    return blank_mask32(v) | (unsigned)_mm256_movemask_epi8(m);
+}
+
+__attribute__((target("avx2")))
+static size_t blank_avx2(const char *p, size_t n) {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        unsigned m = ~blank_mask32(_mm256_loadu_si256((const __m256i *)(p + i)));
+        if (m) return i + __builtin_ctz(m);
+    }
+    return i + blank_scalar(p + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static size_t word_avx2(const char *p, size_t n) {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        unsigned m = end_mask32(_mm256_loadu_si256((const __m256i *)(p + i)));
+        if (m) return i + __builtin_ctz(m);
+    }
+    return i + word_scalar(p + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static size_t blank_rev_avx2(const char *p, size_t n) {
+    while (n >= 32) {
+        unsigned m = ~blank_mask32(_mm256_loadu_si256((const __m256i *)(p + n - 32)));
+        if (m) return n - 32 + (31 - __builtin_clz(m)) + 1;
+        n -= 32;
+    }
+    return blank_rev_scalar(p, n);
+}
+#endif
+
+struct scan_ops {
+    const char *name;
+    size_t (*blank)(const char *p, size_t n);
+    size_t (*word)(const char *p, size_t n);
+    size_t (*blank_rev)(const char *p, size_t n);
+};
+
+static const struct scan_ops kernels[] = {
+    { "scalar", blank_scalar, word_scalar, blank_rev_scalar },
+#ifdef SCAN_X86
+    { "sse2", blank_sse2, word_sse2, blank_rev_sse2 },
+    { "avx2", blank_avx2, word_avx2, blank_rev_avx2 },
+#endif
+};
+#define N_KERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+static const struct scan_ops *ops;
+
+static bool kernel_supported(const struct scan_ops *k) {
+#ifdef SCAN_X86
+    if (strcmp(k->name, "sse2") == 0) return __builtin_cpu_supports("sse2");
+    if (strcmp(k->name, "avx2") == 0) return __builtin_cpu_supports("avx2");
+#endif
+    return strcmp(k->name, "scalar") == 0;
+}
+
+// Pick the widest kernel this CPU can run
+static const struct scan_ops *pick(void) {
+    for (size_t i = N_KERNELS; i-- > 0;) {
+        if (kernel_supported(&kernels[i])) return &kernels[i];
+    }
+    return &kernels[0];
+}
+
+int scan_select(const char *name) {
+    if (!name) {
+        ops = pick();
+        return 0;
+    }
+    for (size_t i = 0; i < N_KERNELS; i++) {
+        if (strcmp(kernels[i].name, name) == 0 && kernel_supported(&kernels[i])) {
+            ops = &kernels[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *scan_kernel(void) {
+    if (!ops) ops = pick();
+    return ops->name;
+}
+
+size_t scan_blank(const char *p, size_t n) {
+    if (!ops) ops = pick();
+    return ops->blank(p, n);
+}
+
+size_t scan_word(const char *p, size_t n) {
+    if (!ops) ops = pick();
+    return ops->word(p, n);
+}
+
+size_t scan_blank_rev(const char *p, size_t n) {
+    if (!ops) ops = pick();
+    return ops->blank_rev(p, n);
+}
@@ -0,0 +1,161 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "lab.h"
+
+// Runs the lines in buf, which holds the bytes of fd from offset base.
+// With fd -1 nothing is read back. Otherwise fd is one commands inherit,
+// such as stdin, so it is left just past each line before the line runs:
+// a command that reads it gets the rest of the script rather than all of
+// it again, and lines a command read are not run by the shell too.
+static void run_lines(struct shell *sh, char *buf, size_t len, int fd, off_t base) {
+    char *p = buf;
+    char *end = buf + len;
+    while (p < end) {
+        char *nl = memchr(p, '\n', end - p);
+        char *eol = nl ? nl : end;
+        *eol = '\0';
+        off_t next = base + (eol - buf) + (nl != NULL);
+        if (fd != -1) lseek(fd, next, SEEK_SET);
+        sh_exec_line(sh, p);
+        p = eol + 1;
+        if (fd != -1) {
+            off_t now = lseek(fd, 0, SEEK_CUR);
+            if (now > next) p = now - base < (off_t)len ? buf + (now - base) : end;
+        }
+    }
+}
+
+int script_run_buffer(struct shell *sh, char *buf, size_t len) {
+    run_lines(sh, buf, len, -1, 0);
+    return sh->last_status;
+}
+
+// Runs a script that is already open. Regular files are mapped privately
+// so lines can be split in place without copying or a read per line.
+static int run_mapped(struct shell *sh, int fd, size_t size, bool shared) {
+    // A shared fd runs from where it is, the way it would be read
+    off_t start = shared ? lseek(fd, 0, SEEK_CUR) : 0;
+    if (start < 0) start = 0;
+    if ((size_t)start >= size) return 0;
+    long page = sysconf(_SC_PAGESIZE);
+    char *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) return -1;
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    size_t body = size;
+    char *tail = NULL;
+    // The last line needs a byte for its terminator. Past EOF the rest of
+    // the final page reads as zeros and is ours to write, unless the file
+    // ends exactly on a page boundary; then that line gets copied.
+    if (map[size - 1] != '\n' && size % page == 0) {
+        char *nl = memrchr(map, '\n', size);
+        body = nl ? (size_t)(nl - map) + 1 : 0;
+        tail = strndup(map + body, size - body);
+        if (!tail) {
+            munmap(map, size);
+            return -1;
+        }
+    }
+
+    int sfd = shared ? fd : -1;
+    if ((size_t)start < body) run_lines(sh, map + start, body - start, sfd, start);
+    // Unless a command already read the last line
+    if (tail && (!shared || lseek(fd, 0, SEEK_CUR) <= (off_t)body)) {
+        size_t skip = (size_t)start > body ? start - body : 0;
+        run_lines(sh, tail + skip, size - body - skip, sfd, body + skip);
+    }
+    free(tail);
+    munmap(map, size);
+    return 0;
+}
+
+// Fallback for pipes and terminals that cannot be mapped. Complete lines
+// are run straight out of the read buffer. A shared fd that can seek is
+// put back after each line and read again from wherever the commands
+// left it. One that cannot is read a byte at a time, as other shells do,
+// so nothing past the current line is taken from the commands.
+static void run_stream(struct shell *sh, int fd, bool shared) {
+    bool seekable = shared && lseek(fd, 0, SEEK_CUR) != -1;
+    bool bytewise = shared && !seekable;
+    size_t cap = 64 * 1024;
+    size_t len = 0;
+    char *buf = malloc(cap);
+    if (!buf) {
+        perror("malloc failed");
+        return;
+    }
+
+    ssize_t n;
+    while ((n = read(fd, buf + len, bytewise ? 1 : cap - len - 1)) != 0) {
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            perror("read");
+            break;
+        }
+        len += n;
+
+        // Run every complete line and keep the partial one for later.
+        // Older bytes hold no newline, those lines already ran.
+        char *nl = memrchr(buf + len - n, '\n', n);
+        if (nl) {
+            size_t used = nl - buf + 1;
+            if (seekable) {
+                run_lines(sh, buf, used, fd, lseek(fd, 0, SEEK_CUR) - len);
+                len = 0;
+                continue;
+            }
+            script_run_buffer(sh, buf, used);
+            memmove(buf, buf + used, len - used);
+            len -= used;
+        } else if (len + 1 == cap) {
+            char *bigger = realloc(buf, cap * 2);
+            if (!bigger) {
+                perror("realloc failed");
+                break;
+            }
+            buf = bigger;
+            cap *= 2;
+        }
+    }
+    // The last line may not end in a newline, we kept a byte for it
+    if (len) script_run_buffer(sh, buf, len);
+    free(buf);
+}
+
+int script_run_fd(struct shell *sh, int fd) {
+    // Commands inherit fd unless it is close-on-exec
+    int flags = fcntl(fd, F_GETFD);
+    bool shared = flags != -1 && !(flags & FD_CLOEXEC);
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        if (st.st_size == 0) return sh->last_status;
+        if (run_mapped(sh, fd, st.st_size, shared) == 0) return sh->last_status;
+    }
+    run_stream(sh, fd, shared);
+    return sh->last_status;
+}
+
+int script_run_file(struct shell *sh, const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 127;
+    }
+    // Regular files run compiled, from the cache when it is current
+    struct script_code code;
+    int rval;
+    if (script_code_load(path, fd, &code) == 0) {
+        rval = script_exec(sh, &code);
+        script_code_free(&code);
+    } else {
+        rval = script_run_fd(sh, fd);
+    }
+    close(fd);
+    return rval;
+}
@@ -0,0 +1,205 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "lab.h"
+
+/*
+ * The test and [ builtins. Expressions are parsed by recursive descent:
+ *
+ *   or      := and { -o and }
+ *   and     := not { -a not }
+ *   not     := ! not | primary
+ *   primary := ( or ) | unary-op word | word binary-op word | word
+ *
+ * A binary operator in second place always wins, so `test ! = x` and
+ * `test -f = -f` compare strings the way POSIX asks for up to four
+ * arguments.
+ */
+
+struct texpr {
+    char **argv;
+    int argc;
+    int i;
+    bool error;
+};
+
+static const char *const binary_ops[] = {
+    "=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge",
+    "-nt", "-ot", "-ef",
+};
+
+static bool is_binary(const char *s) {
+    if (!s) return false;
+    for (size_t i = 0; i < sizeof(binary_ops) / sizeof(binary_ops[0]); i++) {
+        if (strcmp(s, binary_ops[i]) == 0) return true;
+    }
+    return false;
+}
+
+static bool is_unary(const char *s) {
+    return s && s[0] == '-' && s[1] && !s[2] && strchr("bcdefghknprsStuwxzLOG", s[1]);
+}
+
+static const char *peek(struct texpr *t, int ahead) {
+    return t->i + ahead < t->argc ? t->argv[t->i + ahead] : NULL;
+}
+
+static void syntax(struct texpr *t, const char *what, const char *arg) {
+    if (!t->error) fprintf(stderr, "test: %s%s%s\n", arg ? arg : "", arg ? ": " : "", what);
+    t->error = true;
+}
+
+static bool integer(struct texpr *t, const char *s, intmax_t *v) {
+    char *end;
+    errno = 0;
+    *v = strtoimax(s, &end, 10);
+    while (*end == ' ' || *end == '\t') end++;
+    if (end == s || *end || errno) {
+        syntax(t, "integer expression expected", s);
+        return false;
+    }
+    return true;
+}
+
+static bool unary(char op, const char *arg) {
+    struct stat st;
+    switch (op) {
+        case 'n': return arg[0] != '\0';
+        case 'z': return arg[0] == '\0';
+        case 't': return isatty(atoi(arg));
+        case 'r': return access(arg, R_OK) == 0;
+        case 'w': return access(arg, W_OK) == 0;
+        case 'x': return access(arg, X_OK) == 0;
+        case 'h':
+        case 'L': return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+    }
+    if (stat(arg, &st) == -1) return false;
+    switch (op) {
+        case 'e': return true;
+        case 'f': return S_ISREG(st.st_mode);
+        case 'd': return S_ISDIR(st.st_mode);
+        case 'b': return S_ISBLK(st.st_mode);
+        case 'c': return S_ISCHR(st.st_mode);
+        case 'p': return S_ISFIFO(st.st_mode);
+        case 'S': return S_ISSOCK(st.st_mode);
+        case 's': return st.st_size > 0;
+        case 'g': return st.st_mode & S_ISGID;
+        case 'u': return st.st_mode & S_ISUID;
+        case 'k': return st.st_mode & S_ISVTX;
+        case 'O': return st.st_uid == geteuid();
+        case 'G': return st.st_gid == getegid();
+    }
+    return false;
+}
+
+static bool binary(struct texpr *t, const char *a, const char *op, const char *b) {
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) return strcmp(a, b) == 0;
+    if (strcmp(op, "!=") == 0) return strcmp(a, b) != 0;
+    if (strcmp(op, "<") == 0) return strcmp(a, b) < 0;
+    if (strcmp(op, ">") == 0) return strcmp(a, b) > 0;
+    if (strcmp(op, "-nt") == 0 || strcmp(op, "-ot") == 0 || strcmp(op, "-ef") == 0) {
+        struct stat sa, sb;
+        bool ha = stat(a, &sa) == 0, hb = stat(b, &sb) == 0;
+        if (strcmp(op, "-ef") == 0) {
+            return ha && hb && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+        }
+        if (strcmp(op, "-nt") == 0) {
+            return ha && (!hb || sa.st_mtim.tv_sec > sb.st_mtim.tv_sec ||
+                          (sa.st_mtim.tv_sec == sb.st_mtim.tv_sec && sa.st_mtim.tv_nsec > sb.st_mtim.tv_nsec));
+        }
+        return hb && (!ha || sa.st_mtim.tv_sec < sb.st_mtim.tv_sec ||
+                      (sa.st_mtim.tv_sec == sb.st_mtim.tv_sec && sa.st_mtim.tv_nsec < sb.st_mtim.tv_nsec));
+    }
+    intmax_t x, y;
+    if (!integer(t, a, &x) || !integer(t, b, &y)) return false;
+    if (strcmp(op, "-eq") == 0) return x == y;
+    if (strcmp(op, "-ne") == 0) return x != y;
+    if (strcmp(op, "-lt") == 0) return x < y;
+    if (strcmp(op, "-le") == 0) return x <= y;
+    if (strcmp(op, "-gt") == 0) return x > y;
+    return x >= y;
+}
+
+static bool expr_or(struct texpr *t);
+
+static bool primary(struct texpr *t) {
+    const char *a = peek(t, 0);
+    if (!a) {
+        syntax(t, "argument expected", NULL);
+        return false;
+    }
+    if (is_binary(peek(t, 1)) && peek(t, 2)) {
+        t->i += 3;
+        return binary(t, a, t->argv[t->i - 2], t->argv[t->i - 1]);
+    }
+    if (strcmp(a, "(") == 0 && peek(t, 1)) {
+        t->i++;
+        bool v = expr_or(t);
+        if (!peek(t, 0) || strcmp(peek(t, 0), ")") != 0) {
+            syntax(t, "')' expected", NULL);
+            return false;
+        }
+        t->i++;
+        return v;
+    }
+    if (is_unary(a) && peek(t, 1)) {
+        t->i += 2;
+        return unary(a[1], t->argv[t->i - 1]);
+    }
+    t->i++;
+    return a[0] != '\0';
+}
+
+static bool expr_not(struct texpr *t) {
+    const char *a = peek(t, 0);
+    // `! = x` compares "!" with "x", a lone `!` is just a string
+    if (a && strcmp(a, "!") == 0 && peek(t, 1) && !(is_binary(peek(t, 1)) && peek(t, 2))) {
+        t->i++;
+        return !expr_not(t);
+    }
+    return primary(t);
+}
+
+static bool expr_and(struct texpr *t) {
+    bool v = expr_not(t);
+    while (peek(t, 0) && strcmp(peek(t, 0), "-a") == 0 && peek(t, 1)) {
+        t->i++;
+        // Both sides are parsed even when the left one decides
+        bool r = expr_not(t);
+        v = v && r;
+    }
+    return v;
+}
+
+static bool expr_or(struct texpr *t) {
+    bool v = expr_and(t);
+    while (peek(t, 0) && strcmp(peek(t, 0), "-o") == 0 && peek(t, 1)) {
+        t->i++;
+        bool r = expr_and(t);
+        v = v || r;
+    }
+    return v;
+}
+
+// test expr and [ expr ]
+int builtin_test(struct shell *sh, char **argv) {
+    UNUSED(sh);
+    int argc = 0;
+    while (argv[argc]) argc++;
+    if (strcmp(argv[0], "[") == 0) {
+        if (strcmp(argv[argc - 1], "]") != 0) {
+            fprintf(stderr, "[: missing ']'\n");
+            return 2;
+        }
+        argc--;
+    }
+
+    struct texpr t = { .argv = argv + 1, .argc = argc - 1 };
+    if (t.argc == 0) return 1;
+    bool v = expr_or(&t);
+    if (!t.error && t.i < t.argc) syntax(&t, "too many arguments", t.argv[t.i]);
+    if (t.error) return 2;
+    return v ? 0 : 1;
+}
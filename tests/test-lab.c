@@ -1,10 +1,30 @@
+#include <errno.h>
+#include <fcntl.h>
 #include <string.h>
 #include "harness/unity.h"
 #include "../src/lab.h"
 #include <readline/readline.h>
 #include <readline/history.h>
+#include <limits.h>
+#include <poll.h>
+#include <dirent.h>
 #include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
+// Number of heap allocations made by the code under test, counted through
+// the linker --wrap flags in TEST_LDFLAGS
+static size_t alloc_count;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+char *__real_strdup(const char *s);
+
+void *__wrap_malloc(size_t size) { alloc_count++; return __real_malloc(size); }
+void *__wrap_calloc(size_t nmemb, size_t size) { alloc_count++; return __real_calloc(nmemb, size); }
+void *__wrap_realloc(void *ptr, size_t size) { alloc_count++; return __real_realloc(ptr, size); }
+char *__wrap_strdup(const char *s) { alloc_count++; return __real_strdup(s); }
 
 
 void setUp(void) {
@@ -153,7 +173,7 @@ void test_ch_dir_home(void)
      strncpy(line, "cd", 10);
      char **cmd = cmd_parse(line);
      char *expected = getenv("HOME");
-     change_dir(cmd);
+     change_dir(NULL, cmd);
      char *actual = getcwd(NULL,0);
      TEST_ASSERT_EQUAL_STRING(expected, actual);
      free(line);
@@ -166,7 +186,7 @@ void test_ch_dir_root(void)
      char *line = (char*) calloc(10, sizeof(char));
      strncpy(line, "cd /", 10);
      char **cmd = cmd_parse(line);
-     change_dir(cmd);
+     change_dir(NULL, cmd);
      char *actual = getcwd(NULL,0);
      TEST_ASSERT_EQUAL_STRING("/", actual);
      free(line);
@@ -180,7 +200,7 @@ void test_ch_dir_invalid(void)
     strncpy(line, "cd /nonexistentpath", 25);
     char **cmd = cmd_parse(line);
     
-    int result = change_dir(cmd);  
+    int result = change_dir(NULL, cmd);  
     TEST_ASSERT_EQUAL_INT(-1, result);  // Expect failure
 
     free(line);
@@ -250,6 +270,2036 @@ void test_cmd_parse_extra_spaces(void)
     cmd_free(rval);
 }
 
+void test_cmd_parse_single_allocation(void)
+{
+    const char *lines[] = {
+        "ls",
+        "ls -a -l",
+        "   gcc  -Wall -Wextra -O2 -c foo.c -o foo.o   ",
+        "a b c d e f g h i j k l m n o p q r s t u v w x y z 0 1 2 3 4 5 6 7 8 9",
+    };
+    for (size_t i = 0; i < sizeof(lines) / sizeof(lines[0]); i++) {
+        alloc_count = 0;
+        char **rval = cmd_parse(lines[i]);
+        TEST_ASSERT_TRUE(rval);
+        TEST_ASSERT_EQUAL_size_t(1, alloc_count);
+        cmd_free(rval);
+    }
+}
+
+void test_cmd_parse_inplace(void)
+{
+    char *line = strdup("  ls    -l -a ");
+    alloc_count = 0;
+    char **rval = cmd_parse_inplace(line);
+    TEST_ASSERT_EQUAL_size_t(1, alloc_count);
+    TEST_ASSERT_EQUAL_STRING("ls", rval[0]);
+    TEST_ASSERT_EQUAL_STRING("-l", rval[1]);
+    TEST_ASSERT_EQUAL_STRING("-a", rval[2]);
+    TEST_ASSERT_FALSE(rval[3]);
+    // Tokens must live inside the caller's buffer
+    TEST_ASSERT_TRUE(rval[0] >= line && rval[0] < line + 14);
+    TEST_ASSERT_TRUE(rval[2] >= line && rval[2] < line + 14);
+
+    cmd_free(rval);
+    free(line);
+}
+
+void test_cmd_hash_lookup(void)
+{
+    struct cmd_hash h = {0};
+    setenv("PATH", "/nonexistentpath:/bin:/usr/bin", 1);
+
+    const char *first = cmd_hash_lookup(&h, "sh");
+    TEST_ASSERT_TRUE(first);
+    TEST_ASSERT_EQUAL_STRING("/bin/sh", first);
+    TEST_ASSERT_EQUAL_STRING("/bin/sh", cmd_hash_lookup(&h, "sh"));
+    TEST_ASSERT_EQUAL_UINT(2, h.lookups);
+    TEST_ASSERT_EQUAL_UINT(1, h.hits);
+
+    // Slashes bypass the cache and unknown commands are not cached
+    TEST_ASSERT_EQUAL_STRING("./foo", cmd_hash_lookup(&h, "./foo"));
+    TEST_ASSERT_NULL(cmd_hash_lookup(&h, "no-such-command-here"));
+    TEST_ASSERT_EQUAL_size_t(1, h.count);
+
+    cmd_hash_destroy(&h);
+}
+
+void test_cmd_hash_path_change(void)
+{
+    struct cmd_hash h = {0};
+    char *saved = strdup(getenv("PATH"));
+    setenv("PATH", "/bin", 1);
+    TEST_ASSERT_EQUAL_STRING("/bin/sh", cmd_hash_lookup(&h, "sh"));
+
+    // A new PATH must invalidate everything resolved against the old one
+    setenv("PATH", "/usr/bin", 1);
+    TEST_ASSERT_EQUAL_STRING("/usr/bin/sh", cmd_hash_lookup(&h, "sh"));
+    TEST_ASSERT_EQUAL_UINT(0, h.hits);
+
+    setenv("PATH", saved, 1);
+    free(saved);
+    cmd_hash_destroy(&h);
+}
+
+void test_cmd_parse_pipe_token(void)
+{
+    char **rval = cmd_parse("ls -l|wc  | sort");
+    TEST_ASSERT_EQUAL_STRING("ls", rval[0]);
+    TEST_ASSERT_EQUAL_STRING("-l", rval[1]);
+    TEST_ASSERT_EQUAL_STRING("|", rval[2]);
+    TEST_ASSERT_EQUAL_STRING("wc", rval[3]);
+    TEST_ASSERT_EQUAL_STRING("|", rval[4]);
+    TEST_ASSERT_EQUAL_STRING("sort", rval[5]);
+    TEST_ASSERT_FALSE(rval[6]);
+    cmd_free(rval);
+}
+
+void test_pipeline_parse(void)
+{
+    char line[] = "cat foo | grep -v bar|wc -l";
+    struct pipeline p;
+    TEST_ASSERT_EQUAL_INT(0, pipeline_parse(line, &p));
+    TEST_ASSERT_EQUAL_size_t(3, p.ncmds);
+    TEST_ASSERT_EQUAL_STRING("cat", p.cmds[0][0]);
+    TEST_ASSERT_EQUAL_STRING("foo", p.cmds[0][1]);
+    TEST_ASSERT_FALSE(p.cmds[0][2]);
+    TEST_ASSERT_EQUAL_STRING("grep", p.cmds[1][0]);
+    TEST_ASSERT_EQUAL_STRING("bar", p.cmds[1][2]);
+    TEST_ASSERT_FALSE(p.cmds[1][3]);
+    TEST_ASSERT_EQUAL_STRING("wc", p.cmds[2][0]);
+    TEST_ASSERT_FALSE(p.cmds[2][2]);
+    pipeline_free(&p);
+}
+
+void test_pipeline_parse_empty_stage(void)
+{
+    const char *bad[] = { "| ls", "ls |", "ls | | wc" };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        char *line = strdup(bad[i]);
+        struct pipeline p;
+        TEST_ASSERT_EQUAL_INT(-1, pipeline_parse(line, &p));
+        pipeline_free(&p);
+        free(line);
+    }
+}
+
+void test_pipeline_run_status(void)
+{
+    struct shell sh = {0};
+    char line1[] = "false | true";
+    char line2[] = "true | grep -q x /dev/null | true";
+    struct pipeline p;
+
+    TEST_ASSERT_EQUAL_INT(0, pipeline_parse(line1, &p));
+    TEST_ASSERT_EQUAL_INT(0, pipeline_run(&sh, &p));
+    sh.pipefail = true;
+    TEST_ASSERT_EQUAL_INT(1, pipeline_run(&sh, &p));
+    pipeline_free(&p);
+
+    TEST_ASSERT_EQUAL_INT(0, pipeline_parse(line2, &p));
+    TEST_ASSERT_EQUAL_INT(1, pipeline_run(&sh, &p));
+    sh.pipefail = false;
+    TEST_ASSERT_EQUAL_INT(0, pipeline_run(&sh, &p));
+    pipeline_free(&p);
+    job_table_destroy(&sh.jobs);
+    cmd_hash_destroy(&sh.hash);
+}
+
+void test_job_ids_and_specs(void)
+{
+    struct job_table t = {0};
+    char line[] = "sleep 1 | cat";
+    struct pipeline p;
+    TEST_ASSERT_EQUAL_INT(0, pipeline_parse(line, &p));
+
+    struct job *a = job_add(&t, &p);
+    struct job *b = job_add(&t, &p);
+    struct job *c = job_add(&t, &p);
+    TEST_ASSERT_EQUAL_INT(1, a->id);
+    TEST_ASSERT_EQUAL_INT(3, c->id);
+    TEST_ASSERT_EQUAL_STRING("sleep 1 | cat", a->cmdline);
+    TEST_ASSERT_EQUAL_size_t(2, a->nprocs);
+
+    TEST_ASSERT_EQUAL_PTR(c, job_parse_spec(&t, NULL));
+    TEST_ASSERT_EQUAL_PTR(c, job_parse_spec(&t, "%%"));
+    TEST_ASSERT_EQUAL_PTR(b, job_parse_spec(&t, "%2"));
+    TEST_ASSERT_EQUAL_PTR(b, job_parse_spec(&t, "2"));
+    TEST_ASSERT_NULL(job_parse_spec(&t, "%9"));
+    TEST_ASSERT_NULL(job_parse_spec(&t, "%x"));
+
+    // Freed numbers are handed out again lowest first
+    job_remove(&t, b);
+    struct job *d = job_add(&t, &p);
+    TEST_ASSERT_EQUAL_INT(2, d->id);
+    TEST_ASSERT_EQUAL_size_t(3, t.count);
+
+    pipeline_free(&p);
+    job_table_destroy(&t);
+}
+
+void test_pipeline_parse_background(void)
+{
+    char line1[] = "sleep 1 &";
+    char line2[] = "sleep 1 | cat&";
+    char line3[] = "ls && echo";
+    struct pipeline p;
+
+    TEST_ASSERT_EQUAL_INT(0, pipeline_parse(line1, &p));
+    TEST_ASSERT_TRUE(p.background);
+    TEST_ASSERT_FALSE(p.cmds[0][2]);
+    pipeline_free(&p);
+
+    TEST_ASSERT_EQUAL_INT(0, pipeline_parse(line2, &p));
+    TEST_ASSERT_TRUE(p.background);
+    TEST_ASSERT_EQUAL_STRING("cat", p.cmds[1][0]);
+    pipeline_free(&p);
+
+    // Lists are syntax errors rather than arguments to the command
+    errno = 0;
+    TEST_ASSERT_EQUAL_INT(-1, pipeline_parse(line3, &p));
+    TEST_ASSERT_EQUAL_INT(EINVAL, errno);
+    pipeline_free(&p);
+    const char *lists[] = { "echo a & echo b", "test 3 -lt 5 && echo y", "false || echo n",
+                            "a | b & c", "a &&", "a & &", "&" };
+    for (size_t i = 0; i < sizeof(lists) / sizeof(lists[0]); i++) {
+        char *copy = strdup(lists[i]);
+        errno = 0;
+        TEST_ASSERT_EQUAL_INT(-1, pipeline_parse(copy, &p));
+        TEST_ASSERT_EQUAL_INT(EINVAL, errno);
+        pipeline_free(&p);
+        free(copy);
+    }
+}
+
+void test_background_jobs_reaped(void)
+{
+    struct shell sh = {0};
+    sh.launch_mode = LAUNCH_SPAWN;
+    for (int i = 0; i < 200; i++) {
+        char line[] = "true &";
+        struct pipeline p;
+        TEST_ASSERT_EQUAL_INT(0, pipeline_parse(line, &p));
+        TEST_ASSERT_EQUAL_INT(0, pipeline_run(&sh, &p));
+        pipeline_free(&p);
+    }
+    TEST_ASSERT_EQUAL_size_t(200, sh.jobs.count);
+
+    // Keep reaping until every job reported done
+    for (int tries = 0; tries < 500 && job_current(&sh.jobs); tries++) {
+        job_reap(&sh.jobs);
+        FILE *devnull = fopen("/dev/null", "w");
+        job_notify(&sh.jobs, devnull);
+        fclose(devnull);
+        usleep(10000);
+    }
+    TEST_ASSERT_EQUAL_size_t(0, sh.jobs.count);
+    // No zombies left behind
+    TEST_ASSERT_EQUAL_INT(-1, waitpid(-1, NULL, WNOHANG));
+
+    job_table_destroy(&sh.jobs);
+    cmd_hash_destroy(&sh.hash);
+}
+
+void test_batch_reaps_background_jobs(void)
+{
+    // Batch mode has no SIGCHLD loop, each line reaps what finished
+    struct shell sh = {0};
+    char line[] = "sleep 0 &";
+    sh_exec_line(&sh, line);
+    TEST_ASSERT_EQUAL_size_t(1, sh.jobs.count);
+    for (int tries = 0; tries < 500 && sh.jobs.count; tries++) {
+        usleep(10000);
+        char next[] = "true";
+        sh_exec_line(&sh, next);
+    }
+    TEST_ASSERT_EQUAL_size_t(0, sh.jobs.count);
+    TEST_ASSERT_EQUAL_INT(-1, waitpid(-1, NULL, WNOHANG));
+
+    // Without job control bg and fg signal the processes, there is no
+    // process group of the job's own
+    char bg_line[] = "sleep 0.2 &";
+    sh_exec_line(&sh, bg_line);
+    struct job *j = job_current(&sh.jobs);
+    TEST_ASSERT_NOT_NULL(j);
+    TEST_ASSERT_EQUAL_INT(0, kill(j->procs[0].pid, SIGSTOP));
+    for (int tries = 0; tries < 500 && !job_is_stopped(j); tries++) {
+        usleep(10000);
+        job_reap(&sh.jobs);
+    }
+    TEST_ASSERT_TRUE(job_is_stopped(j));
+    char bg[] = "bg > /dev/null";
+    TEST_ASSERT_EQUAL_INT(0, sh_exec_line(&sh, bg));
+    for (int tries = 0; tries < 500 && sh.jobs.count; tries++) {
+        usleep(10000);
+        char next[] = "true";
+        sh_exec_line(&sh, next);
+    }
+    TEST_ASSERT_EQUAL_size_t(0, sh.jobs.count);
+    sh_destroy(&sh);
+}
+
+void test_script_run_buffer(void)
+{
+    struct shell sh = {0};
+    char *cwd = getcwd(NULL, 0);
+    char buf[] = "#!/bin/lab\n\ncd /\n   # indented comment\ntrue | false\ncd /tmp";
+
+    TEST_ASSERT_EQUAL_INT(0, script_run_buffer(&sh, buf, strlen(buf)));
+    char *actual = getcwd(NULL, 0);
+    TEST_ASSERT_EQUAL_STRING("/tmp", actual);
+    free(actual);
+
+    char buf2[] = "cd /\ntrue | false\n";
+    TEST_ASSERT_EQUAL_INT(1, script_run_buffer(&sh, buf2, strlen(buf2)));
+
+    TEST_ASSERT_EQUAL_INT(0, chdir(cwd));
+    free(cwd);
+    sh_destroy(&sh);
+}
+
+void test_script_run_file_page_aligned(void)
+{
+    // A script exactly one page long whose last line has no newline
+    long page = sysconf(_SC_PAGESIZE);
+    char path[] = "/tmp/test-lab-script-XXXXXX";
+    int fd = mkstemp(path);
+    TEST_ASSERT_TRUE(fd != -1);
+    const char *last = "cd /";
+    size_t fill = page - strlen(last);
+    char *text = malloc(page);
+    memset(text, '#', fill);
+    text[fill - 1] = '\n';
+    memcpy(text + fill, last, strlen(last));
+    TEST_ASSERT_EQUAL_INT(page, write(fd, text, page));
+    close(fd);
+    free(text);
+
+    struct shell sh = {0};
+    char *cwd = getcwd(NULL, 0);
+    TEST_ASSERT_EQUAL_INT(0, chdir("/tmp"));
+    TEST_ASSERT_EQUAL_INT(0, script_run_file(&sh, path));
+    char *actual = getcwd(NULL, 0);
+    TEST_ASSERT_EQUAL_STRING("/", actual);
+    TEST_ASSERT_EQUAL_INT(127, script_run_file(&sh, "/nonexistentpath"));
+
+    TEST_ASSERT_EQUAL_INT(0, chdir(cwd));
+    free(actual);
+    free(cwd);
+    char *cache = script_cache_path(path);
+    unlink(cache);
+    free(cache);
+    unlink(path);
+    sh_destroy(&sh);
+}
+
+void test_builtin_find(void)
+{
+    const char *names[] = { "exit", "cd", "fg", "bg", "jobs", "set", "hash" };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        const struct builtin *b = builtin_find(names[i]);
+        TEST_ASSERT_NOT_NULL(b);
+        TEST_ASSERT_EQUAL_STRING(names[i], b->name);
+    }
+    const char *others[] = { "ls", "", "exi", "exitt", "CD", "hashh", "jj" };
+    for (size_t i = 0; i < sizeof(others) / sizeof(others[0]); i++) {
+        TEST_ASSERT_NULL(builtin_find(others[i]));
+    }
+}
+
+void test_do_builtin_status(void)
+{
+    struct shell sh = {0};
+    char line[] = "cd /nonexistentpath";
+    char **cmd = cmd_parse_inplace(line);
+    TEST_ASSERT_TRUE(do_builtin(&sh, cmd));
+    TEST_ASSERT_EQUAL_INT(1, sh.last_status);
+    cmd_free(cmd);
+
+    char line2[] = "ls /";
+    cmd = cmd_parse_inplace(line2);
+    TEST_ASSERT_FALSE(do_builtin(&sh, cmd));
+    cmd_free(cmd);
+
+    // Builtins that change the shell are refused where they would run in
+    // a child, the others fall back to the program of the same name
+    char *cwd = getcwd(NULL, 0);
+    const char *refused[] = { "cd / | cat", "echo x | cd /", "cd / &", "exit 3 | cat", "time fg | cat" };
+    for (size_t i = 0; i < sizeof(refused) / sizeof(refused[0]); i++) {
+        char *copy = strdup(refused[i]);
+        sh.last_status = 0;
+        TEST_ASSERT_EQUAL_INT(1, sh_exec_line(&sh, copy));
+        free(copy);
+    }
+    char *after = getcwd(NULL, 0);
+    TEST_ASSERT_EQUAL_STRING(cwd, after);
+    char line3[] = "echo x | true";
+    TEST_ASSERT_EQUAL_INT(0, sh_exec_line(&sh, line3));
+    free(cwd);
+    free(after);
+    sh_destroy(&sh);
+}
+
+void test_job_usage_accounting(void)
+{
+    struct job_table t = {0};
+    char line[] = "a | b";
+    struct pipeline p;
+    TEST_ASSERT_EQUAL_INT(0, pipeline_parse(line, &p));
+    struct job *j = job_add(&t, &p);
+    j->procs[0].pid = 1001;
+    j->procs[1].pid = 1002;
+
+    struct rusage ru = {0};
+    ru.ru_utime.tv_usec = 600000;
+    ru.ru_stime.tv_sec = 1;
+    ru.ru_maxrss = 2048;
+    ru.ru_nvcsw = 3;
+    TEST_ASSERT_EQUAL_INT(0, job_update(&t, 1001, 0, &ru));
+    TEST_ASSERT_FALSE(job_is_done(j));
+
+    ru.ru_maxrss = 1024;
+    ru.ru_nivcsw = 5;
+    TEST_ASSERT_EQUAL_INT(0, job_update(&t, 1002, 0, &ru));
+    TEST_ASSERT_EQUAL_INT(-1, job_update(&t, 1003, 0, &ru));
+    TEST_ASSERT_TRUE(job_is_done(j));
+
+    // CPU time and switches add up, peak RSS is the largest process
+    TEST_ASSERT_EQUAL_INT(1, j->usage.utime.tv_sec);
+    TEST_ASSERT_EQUAL_INT(200000, j->usage.utime.tv_usec);
+    TEST_ASSERT_EQUAL_INT(2, j->usage.stime.tv_sec);
+    TEST_ASSERT_EQUAL_INT(2048, j->usage.maxrss);
+    TEST_ASSERT_EQUAL_INT(6, j->usage.nvcsw);
+    TEST_ASSERT_EQUAL_INT(5, j->usage.nivcsw);
+    TEST_ASSERT_TRUE(j->usage.end.tv_sec || j->usage.end.tv_nsec);
+
+    pipeline_free(&p);
+    job_table_destroy(&t);
+}
+
+void test_pipeline_parse_time_keyword(void)
+{
+    char line[] = "time ls -l | wc";
+    struct pipeline p;
+    TEST_ASSERT_EQUAL_INT(0, pipeline_parse(line, &p));
+    TEST_ASSERT_TRUE(p.timed);
+    TEST_ASSERT_EQUAL_STRING("ls", p.cmds[0][0]);
+    TEST_ASSERT_EQUAL_STRING("wc", p.cmds[1][0]);
+    pipeline_free(&p);
+
+    // A quoted or escaped time is a command named time
+    const char *quoted[] = { "'time' true", "\\time true", "\"time\" true", "t'ime' true" };
+    for (size_t i = 0; i < sizeof(quoted) / sizeof(quoted[0]); i++) {
+        char *copy = strdup(quoted[i]);
+        TEST_ASSERT_EQUAL_INT(0, pipeline_parse(copy, &p));
+        TEST_ASSERT_FALSE(p.timed);
+        TEST_ASSERT_EQUAL_STRING("time", p.cmds[0][0]);
+        TEST_ASSERT_EQUAL_STRING("true", p.cmds[0][1]);
+        pipeline_free(&p);
+        free(copy);
+    }
+}
+
+void test_trim_white_all_blanks(void)
+{
+    char line[] = "\t\r\n ls -a \n\t\r";
+    TEST_ASSERT_EQUAL_STRING("ls -a", trim_white(line));
+}
+
+void test_cmd_parse_tabs_and_newlines(void)
+{
+    char **rval = cmd_parse("ls\t-l\r\n\t-a\n");
+    TEST_ASSERT_EQUAL_STRING("ls", rval[0]);
+    TEST_ASSERT_EQUAL_STRING("-l", rval[1]);
+    TEST_ASSERT_EQUAL_STRING("-a", rval[2]);
+    TEST_ASSERT_FALSE(rval[3]);
+    cmd_free(rval);
+}
+
+void test_scan_kernels_agree(void)
+{
+    // Every kernel must match the scalar one at every length and offset
+    const char alphabet[] = " \t\n\r|&<>'\"\\ab";
+    char buf[300];
+    unsigned seed = 12345;
+    const char *kernels[] = { "sse2", "avx2" };
+    for (int round = 0; round < 200; round++) {
+        size_t len = round + 1;
+        for (size_t i = 0; i < len; i++) {
+            seed = seed * 1103515245 + 12345;
+            // Long runs of one class so boundaries land past a vector
+            buf[i] = (seed >> 16) % 23 == 0 ? alphabet[(seed >> 8) % (sizeof(alphabet) - 1)] : (round & 1 ? ' ' : 'x');
+        }
+        for (size_t off = 0; off < 3 && off < len; off++) {
+            TEST_ASSERT_EQUAL_INT(0, scan_select("scalar"));
+            size_t b = scan_blank(buf + off, len - off);
+            size_t w = scan_word(buf + off, len - off);
+            size_t r = scan_blank_rev(buf + off, len - off);
+            for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+                if (scan_select(kernels[k]) == -1) continue;
+                TEST_ASSERT_EQUAL_size_t(b, scan_blank(buf + off, len - off));
+                TEST_ASSERT_EQUAL_size_t(w, scan_word(buf + off, len - off));
+                TEST_ASSERT_EQUAL_size_t(r, scan_blank_rev(buf + off, len - off));
+            }
+        }
+    }
+    TEST_ASSERT_EQUAL_INT(0, scan_select(NULL));
+    TEST_ASSERT_EQUAL_INT(-1, scan_select("neon9000"));
+}
+
+
+void test_cmd_parse_50k_tokens(void)
+{
+    // Generated file lists run to thousands of arguments; every one of
+    // them must survive the argv growing, in well under a second
+    const size_t n = 50000;
+    char *line = malloc(n * 8 + 1);
+    char *p = line;
+    for (size_t i = 0; i < n; i++) p += sprintf(p, "f%05zu%c", i, i % 1000 == 999 ? '|' : ' ');
+    *p = '\0';
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    char **rval = cmd_parse(line);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double ms = (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6;
+    TEST_ASSERT_TRUE(rval);
+    TEST_ASSERT_TRUE(ms < 250.0);
+
+    size_t argc = 0, pipes = 0;
+    char want[8];
+    for (size_t i = 0; rval[argc]; argc++) {
+        if (strcmp(rval[argc], "|") == 0) { pipes++; continue; }
+        snprintf(want, sizeof(want), "f%05zu", i++);
+        TEST_ASSERT_EQUAL_STRING(want, rval[argc]);
+    }
+    TEST_ASSERT_EQUAL_size_t(n + n / 1000, argc);
+    TEST_ASSERT_EQUAL_size_t(n / 1000, pipes);
+
+    cmd_free(rval);
+    free(line);
+}
+
+void test_cmd_parse_arg_max(void)
+{
+    long arg_max = sysconf(_SC_ARG_MAX);
+    if (arg_max <= 0) TEST_IGNORE_MESSAGE("ARG_MAX is unlimited");
+
+    // "a " costs two bytes of string plus a pointer once split, so half of
+    // ARG_MAX worth of them is always over budget
+    size_t len = (size_t)arg_max;
+    char *line = malloc(len + 1);
+    for (size_t i = 0; i < len; i += 2) { line[i] = 'a'; line[i + 1] = ' '; }
+    line[len] = '\0';
+
+    errno = 0;
+    TEST_ASSERT_NULL(cmd_parse(line));
+    TEST_ASSERT_EQUAL_INT(E2BIG, errno);
+
+    struct pipeline p;
+    errno = 0;
+    TEST_ASSERT_EQUAL_INT(-1, pipeline_parse(line, &p));
+    TEST_ASSERT_EQUAL_INT(E2BIG, errno);
+    pipeline_free(&p);
+    free(line);
+}
+
+void test_cmd_parse_quotes_and_escapes(void)
+{
+    char **rval = cmd_parse("echo \"a b\" 'x' it\\'s \"\\$HOME \\n\" '' a\"b\"'c'");
+    TEST_ASSERT_TRUE(rval);
+    TEST_ASSERT_EQUAL_STRING("echo", rval[0]);
+    TEST_ASSERT_EQUAL_STRING("a b", rval[1]);
+    TEST_ASSERT_EQUAL_STRING("x", rval[2]);
+    TEST_ASSERT_EQUAL_STRING("it's", rval[3]);
+    TEST_ASSERT_EQUAL_STRING("$HOME \\n", rval[4]);
+    TEST_ASSERT_EQUAL_STRING("", rval[5]);
+    TEST_ASSERT_EQUAL_STRING("abc", rval[6]);
+    TEST_ASSERT_FALSE(rval[7]);
+    cmd_free(rval);
+
+    // Open quotes and a trailing backslash are errors, not silent words
+    errno = 0;
+    TEST_ASSERT_NULL(cmd_parse("echo \"abc"));
+    TEST_ASSERT_EQUAL_INT(EINVAL, errno);
+    TEST_ASSERT_NULL(cmd_parse("echo 'abc"));
+    TEST_ASSERT_NULL(cmd_parse("echo abc\\"));
+}
+
+void test_lex_token_metadata(void)
+{
+    char line[] = "a 'b'|\"c\"d \\e&& f& # g h";
+    struct lexer lx;
+    struct lex_token t;
+    lex_init(&lx, line, strlen(line));
+
+    const char *text[] = { "a", "b", "|", "cd", "e", "&&", "f", "&" };
+    const unsigned flags[] = { 0, LEX_SQUOTED, 0, LEX_DQUOTED, LEX_ESCAPED, 0, 0, 0 };
+    const enum lex_op ops[] = { LEX_WORD, LEX_WORD, LEX_PIPE, LEX_WORD, LEX_WORD,
+                                LEX_AND_IF, LEX_WORD, LEX_AMP };
+    for (size_t i = 0; i < sizeof(text) / sizeof(text[0]); i++) {
+        TEST_ASSERT_EQUAL_INT(1, lex_next(&lx, &t));
+        TEST_ASSERT_EQUAL_STRING(text[i], t.text);
+        TEST_ASSERT_EQUAL_size_t(strlen(text[i]), t.len);
+        TEST_ASSERT_EQUAL_UINT(flags[i], t.flags);
+        TEST_ASSERT_EQUAL_INT(ops[i], t.op);
+        TEST_ASSERT_EQUAL_INT(ops[i], lex_op(t.text));
+    }
+    TEST_ASSERT_EQUAL_INT(0, lex_next(&lx, &t));
+}
+
+void test_pipeline_parse_quoted_operators(void)
+{
+    // Quoted | and & are arguments, not a pipe or a background job
+    char line[] = "grep '|' \"a & b\" x\\&";
+    struct pipeline p;
+    TEST_ASSERT_EQUAL_INT(0, pipeline_parse(line, &p));
+    TEST_ASSERT_EQUAL_size_t(1, p.ncmds);
+    TEST_ASSERT_FALSE(p.background);
+    TEST_ASSERT_EQUAL_STRING("|", p.cmds[0][1]);
+    TEST_ASSERT_EQUAL_STRING("a & b", p.cmds[0][2]);
+    TEST_ASSERT_EQUAL_STRING("x&", p.cmds[0][3]);
+    TEST_ASSERT_FALSE(p.cmds[0][4]);
+    pipeline_free(&p);
+}
+
+void test_lex_adversarial_linear(void)
+{
+    // Quote and escape soup must cost the same per byte as plain words:
+    // quadrupling the input may not take much more than four times as long
+    const char unit[] = "'a'\"\\\"b\"\\ |&&\\'\"'\"";
+    double ms[2];
+    for (int round = 0; round < 2; round++) {
+        size_t reps = round ? 40000 : 10000;
+        size_t len = reps * (sizeof(unit) - 1);
+        char *line = malloc(len + 1);
+        for (size_t i = 0; i < reps; i++) memcpy(line + i * (sizeof(unit) - 1), unit, sizeof(unit) - 1);
+        line[len] = '\0';
+
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        char **rval = cmd_parse_inplace(line);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        ms[round] = (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6;
+        TEST_ASSERT_TRUE(rval);
+        cmd_free(rval);
+        free(line);
+    }
+    TEST_ASSERT_TRUE(ms[1] < ms[0] * 8 + 5.0);
+}
+
+void test_lex_redirection_operators(void)
+{
+    char line[] = "a<b 2>>c >&1 <&0 <<<d 12>e '>'f 3\\>g";
+    struct lexer lx;
+    struct lex_token t;
+    lex_init(&lx, line, strlen(line));
+
+    const char *text[] = { "a", "<", "b", "2", ">>", "c", ">&", "1", "<&", "0",
+                           "<<<", "d", "12", ">", "e", ">f", "3>g" };
+    const enum lex_op ops[] = { LEX_WORD, LEX_LESS, LEX_WORD, LEX_IO_NUMBER, LEX_DGREAT,
+                                LEX_WORD, LEX_GREATAND, LEX_WORD, LEX_LESSAND, LEX_WORD,
+                                LEX_TLESS, LEX_WORD, LEX_WORD, LEX_GREAT, LEX_WORD,
+                                LEX_WORD, LEX_WORD };
+    for (size_t i = 0; i < sizeof(text) / sizeof(text[0]); i++) {
+        TEST_ASSERT_EQUAL_INT(1, lex_next(&lx, &t));
+        TEST_ASSERT_EQUAL_STRING(text[i], t.text);
+        TEST_ASSERT_EQUAL_INT(ops[i], t.op);
+        TEST_ASSERT_EQUAL_INT(ops[i], lex_op(t.text));
+    }
+    TEST_ASSERT_EQUAL_INT(0, lex_next(&lx, &t));
+}
+
+void test_pipeline_parse_redirections(void)
+{
+    char line[] = "sort -r <in 2>&1 | tee out >>log 2>err";
+    struct pipeline p;
+    TEST_ASSERT_EQUAL_INT(0, pipeline_parse(line, &p));
+    TEST_ASSERT_EQUAL_size_t(2, p.ncmds);
+    TEST_ASSERT_EQUAL_STRING("sort", p.cmds[0][0]);
+    TEST_ASSERT_EQUAL_STRING("-r", p.cmds[0][1]);
+    TEST_ASSERT_FALSE(p.cmds[0][2]);
+    TEST_ASSERT_EQUAL_STRING("tee", p.cmds[1][0]);
+    TEST_ASSERT_EQUAL_STRING("out", p.cmds[1][1]);
+    TEST_ASSERT_FALSE(p.cmds[1][2]);
+
+    TEST_ASSERT_EQUAL_size_t(4, p.nredirs);
+    const int fds[] = { 0, 2, 1, 2 };
+    const enum redir_kind kinds[] = { REDIR_IN, REDIR_DUP, REDIR_APPEND, REDIR_OUT };
+    const size_t stages[] = { 0, 0, 1, 1 };
+    for (size_t i = 0; i < 4; i++) {
+        TEST_ASSERT_EQUAL_INT(fds[i], p.redirs[i].fd);
+        TEST_ASSERT_EQUAL_INT(kinds[i], p.redirs[i].kind);
+        TEST_ASSERT_EQUAL_size_t(stages[i], p.redirs[i].stage);
+    }
+    TEST_ASSERT_EQUAL_INT(1, p.redirs[1].src);
+    TEST_ASSERT_EQUAL_STRING("log", p.redirs[2].word);
+    pipeline_free(&p);
+
+    // A redirection needs a target, and >& needs an fd number
+    const char *bad[] = { "ls >", "ls > | wc", "ls 2>&x", "cat << EOF", "> out" };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        char *copy = strdup(bad[i]);
+        errno = 0;
+        TEST_ASSERT_EQUAL_INT(-1, pipeline_parse(copy, &p));
+        TEST_ASSERT_EQUAL_INT(EINVAL, errno);
+        pipeline_free(&p);
+        free(copy);
+    }
+}
+
+// Reads the whole file at path into buf
+static const char *read_file(const char *path, char *buf, size_t size)
+{
+    FILE *f = fopen(path, "r");
+    TEST_ASSERT_NOT_NULL(f);
+    size_t n = fread(buf, 1, size - 1, f);
+    buf[n] = '\0';
+    fclose(f);
+    return buf;
+}
+
+void test_redirections_run(void)
+{
+    char dir[] = "/tmp/test-lab-redir-XXXXXX";
+    TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+    char *cwd = getcwd(NULL, 0);
+    TEST_ASSERT_EQUAL_INT(0, chdir(dir));
+
+    struct stat before, after;
+    fstat(STDOUT_FILENO, &before);
+    const enum launch_mode modes[] = { LAUNCH_FORK, LAUNCH_SPAWN };
+    for (size_t m = 0; m < 2; m++) {
+        struct shell sh = {0};
+        sh.launch_mode = modes[m];
+        char buf[256];
+        const char *lines[] = {
+            "echo one > out",
+            "echo two >>out",
+            "ls /nonexistent-lab-dir > err 2>&1",
+            "tr a-z A-Z <<< 'here string' > here",
+            "cat < out | wc -l > count",
+            // Only 0, 1, 2 and the directory ls itself opens may be seen
+            "ls /proc/self/fd < out > fds 2>/dev/null",
+            "set > opts",
+            // Above stderr, and crossed so the second target's file could
+            // land on the first one's fd
+            "sh -c 'echo three >&3' 3> fd3",
+            "sh -c 'echo four >&4; echo five >&3' 4> fd4 3> fd3b",
+            "sh -c 'echo six >&3' 3> fd3c 4>&3",
+        };
+        for (size_t i = 0; i < sizeof(lines) / sizeof(lines[0]); i++) {
+            char *line = strdup(lines[i]);
+            sh_exec_line(&sh, line);
+            free(line);
+        }
+        TEST_ASSERT_EQUAL_STRING("one\ntwo\n", read_file("out", buf, sizeof(buf)));
+        TEST_ASSERT_TRUE(strstr(read_file("err", buf, sizeof(buf)), "nonexistent-lab-dir") != NULL);
+        TEST_ASSERT_EQUAL_STRING("HERE STRING\n", read_file("here", buf, sizeof(buf)));
+        TEST_ASSERT_EQUAL_STRING("2\n", read_file("count", buf, sizeof(buf)));
+        TEST_ASSERT_EQUAL_STRING("0\n1\n2\n3\n", read_file("fds", buf, sizeof(buf)));
+        TEST_ASSERT_TRUE(strstr(read_file("opts", buf, sizeof(buf)), "pipefail") != NULL);
+        TEST_ASSERT_EQUAL_STRING("three\n", read_file("fd3", buf, sizeof(buf)));
+        TEST_ASSERT_EQUAL_STRING("four\n", read_file("fd4", buf, sizeof(buf)));
+        TEST_ASSERT_EQUAL_STRING("five\n", read_file("fd3b", buf, sizeof(buf)));
+        TEST_ASSERT_EQUAL_STRING("six\n", read_file("fd3c", buf, sizeof(buf)));
+
+        // A missing input file fails the command, not the shell
+        char line[] = "cat < missing";
+        TEST_ASSERT_EQUAL_INT(1, sh_exec_line(&sh, line));
+
+        job_table_destroy(&sh.jobs);
+        cmd_hash_destroy(&sh.hash);
+    }
+    // The builtin's redirection was undone
+    fstat(STDOUT_FILENO, &after);
+    TEST_ASSERT_TRUE(before.st_ino == after.st_ino && before.st_dev == after.st_dev);
+
+    const char *files[] = { "out", "err", "here", "count", "fds", "opts", "fd3", "fd4", "fd3b", "fd3c" };
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) unlink(files[i]);
+    TEST_ASSERT_EQUAL_INT(0, chdir(cwd));
+    rmdir(dir);
+    free(cwd);
+}
+
+void test_exec_failure_status(void)
+{
+    // A command that cannot be executed says why, with 127 when it is
+    // missing and 126 when it is there but cannot run, in both modes
+    char err[] = "/tmp/test-lab-exec-XXXXXX";
+    int fd = mkstemp(err);
+    TEST_ASSERT_TRUE(fd != -1);
+    const enum launch_mode modes[] = { LAUNCH_FORK, LAUNCH_SPAWN };
+    for (size_t m = 0; m < 2; m++) {
+        struct shell sh = {0};
+        sh.launch_mode = modes[m];
+        fflush(stderr);
+        int saved = dup(STDERR_FILENO);
+        TEST_ASSERT_EQUAL_INT(0, ftruncate(fd, 0));
+        lseek(fd, 0, SEEK_SET);
+        dup2(fd, STDERR_FILENO);
+        char missing[] = "./nonexist";
+        int missing_status = sh_exec_line(&sh, missing);
+        char denied[] = "/etc/passwd";
+        int denied_status = sh_exec_line(&sh, denied);
+        dup2(saved, STDERR_FILENO);
+        close(saved);
+
+        TEST_ASSERT_EQUAL_INT(127, missing_status);
+        TEST_ASSERT_EQUAL_INT(126, denied_status);
+        char buf[256];
+        TEST_ASSERT_EQUAL_STRING("./nonexist: No such file or directory\n"
+                                 "/etc/passwd: Permission denied\n",
+                                 read_file(err, buf, sizeof(buf)));
+        job_table_destroy(&sh.jobs);
+        cmd_hash_destroy(&sh.hash);
+    }
+    close(fd);
+    unlink(err);
+}
+
+void test_script_stdin_shared(void)
+{
+    // A script on stdin is shared with the commands it runs: they read on
+    // from the line after their own, and the shell skips what they read
+    char dir[] = "/tmp/test-lab-stdin-XXXXXX";
+    TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+    char *cwd = getcwd(NULL, 0);
+    TEST_ASSERT_EQUAL_INT(0, chdir(dir));
+    const struct {
+        const char *text;
+        const char *out;
+    } cases[] = {
+        { "echo first > out\ncat >> out\necho done >> out\n", "first\necho done >> out\n" },
+        // head puts back what it read past its line on a file, not a pipe
+        { "head -n 1 > out\nskipped\necho after >> out", "skipped\nafter\n" },
+    };
+    int saved = dup(STDIN_FILENO);
+    char buf[256];
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        for (int piped = 0; piped < 2; piped++) {
+            size_t len = strlen(cases[i].text);
+            int fd;
+            if (piped) {
+                int fds[2];
+                TEST_ASSERT_EQUAL_INT(0, pipe(fds));
+                TEST_ASSERT_EQUAL_INT(len, write(fds[1], cases[i].text, len));
+                close(fds[1]);
+                fd = fds[0];
+            } else {
+                fd = open("script", O_RDWR | O_CREAT | O_TRUNC, 0600);
+                TEST_ASSERT_EQUAL_INT(len, write(fd, cases[i].text, len));
+                lseek(fd, 0, SEEK_SET);
+            }
+            dup2(fd, STDIN_FILENO);
+            close(fd);
+            struct shell sh = {0};
+            script_run_fd(&sh, STDIN_FILENO);
+            sh_destroy(&sh);
+            read_file("out", buf, sizeof(buf));
+            if (i == 1 && piped) {
+                // head read the rest of the pipe, nothing is left to run
+                TEST_ASSERT_EQUAL_STRING("skipped\n", buf);
+            } else {
+                TEST_ASSERT_EQUAL_STRING(cases[i].out, buf);
+            }
+        }
+    }
+    dup2(saved, STDIN_FILENO);
+    close(saved);
+    unlink("out");
+    unlink("script");
+    TEST_ASSERT_EQUAL_INT(0, chdir(cwd));
+    rmdir(dir);
+    free(cwd);
+}
+
+void test_builtins_echo_printf(void)
+{
+    char dir[] = "/tmp/test-lab-builtin-XXXXXX";
+    TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+    char *cwd = getcwd(NULL, 0);
+    TEST_ASSERT_EQUAL_INT(0, chdir(dir));
+
+    struct shell sh = {0};
+    char buf[512];
+    const struct {
+        const char *line;
+        const char *out;
+        int status;
+    } cases[] = {
+        { "echo hello   world > out", "hello world\n", 0 },
+        { "echo -n no newline > out", "no newline", 0 },
+        { "echo -e 'a\\tb\\0101\\c' ignored > out", "a\tbA", 0 },
+        { "echo -x -e > out", "-x -e\n", 0 },
+        { "printf '%5d|%-4s|%x|%.2f|%c|%%\\n' 42 ab 255 3.14159 zed > out",
+          "   42|ab  |ff|3.14|z|%\n", 0 },
+        { "printf '%*.*s|%03o|%b\\n' 6 2 abc 8 'x\\ty' > out", "    ab|010|x\ty\n", 0 },
+        // The format is reused until the arguments run out
+        { "printf '<%s=%d>' a 1 b 2 c > out", "<a=1><b=2><c=0>", 0 },
+        { "printf '%d\\n' \"'A\" 0x10 -3 > out", "65\n16\n-3\n", 0 },
+        { "printf '%d\\n' 12abc > out 2>/dev/null", "12\n", 1 },
+        { "printf '%q' x > out 2>/dev/null", "", 1 },
+        { "printf > out 2>/dev/null", "", 2 },
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        char *line = strdup(cases[i].line);
+        TEST_ASSERT_EQUAL_INT_MESSAGE(cases[i].status, sh_exec_line(&sh, line), cases[i].line);
+        free(line);
+        TEST_ASSERT_EQUAL_STRING_MESSAGE(cases[i].out, read_file("out", buf, sizeof(buf)), cases[i].line);
+    }
+
+    // Output larger than the buffer arrives whole and in order
+    char *big = malloc(20001);
+    memset(big, 'x', 20000);
+    big[20000] = '\0';
+    char *line = malloc(20100);
+    snprintf(line, 20100, "echo %s > out", big);
+    TEST_ASSERT_EQUAL_INT(0, sh_exec_line(&sh, line));
+    struct stat st;
+    TEST_ASSERT_EQUAL_INT(0, stat("out", &st));
+    TEST_ASSERT_EQUAL_INT(20001, st.st_size);
+    free(line);
+    free(big);
+
+    char pwd[] = "pwd > out";
+    TEST_ASSERT_EQUAL_INT(0, sh_exec_line(&sh, pwd));
+    char *real = realpath(dir, NULL);
+    char expect[512];
+    snprintf(expect, sizeof(expect), "%s\n", real);
+    TEST_ASSERT_EQUAL_STRING(expect, read_file("out", buf, sizeof(buf)));
+    free(real);
+
+    sh_destroy(&sh);
+    unlink("out");
+    TEST_ASSERT_EQUAL_INT(0, chdir(cwd));
+    rmdir(dir);
+    free(cwd);
+}
+
+void test_builtin_test(void)
+{
+    const struct {
+        const char *line;
+        int status;
+    } cases[] = {
+        { "true", 0 },
+        { "false", 1 },
+        { "test", 1 },
+        { "test ''", 1 },
+        { "test word", 0 },
+        { "[ -d / ]", 0 },
+        { "[ -f / ]", 1 },
+        { "[ -e /nonexistent-lab-file ]", 1 },
+        { "test -n ''", 1 },
+        { "test -z ''", 0 },
+        { "[ abc = abc ]", 0 },
+        { "[ abc != abc ]", 1 },
+        { "[ a \\< b ]", 0 },
+        { "test 10 -gt 9", 0 },
+        { "test -5 -le -5", 0 },
+        { "test 3 -eq 4", 1 },
+        { "[ ! -d / ]", 1 },
+        { "[ ! = ! ]", 0 },
+        { "[ -d / -a -z x ]", 1 },
+        { "[ -d / -o -z x ]", 0 },
+        { "[ ( 1 -eq 2 -o a = a ) -a ! '' ]", 0 },
+        { "[ / -ef /. ]", 0 },
+        // Syntax errors are 2
+        { "[ 1 -eq x ] 2>/dev/null", 2 },
+        { "[ a b c ] 2>/dev/null", 2 },
+        { "[ ( a 2>/dev/null ]", 2 },
+        { "[ a 2>/dev/null", 2 },
+    };
+    struct shell sh = {0};
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        char *line = strdup(cases[i].line);
+        TEST_ASSERT_EQUAL_INT_MESSAGE(cases[i].status, sh_exec_line(&sh, line), cases[i].line);
+        free(line);
+    }
+    job_table_destroy(&sh.jobs);
+    cmd_hash_destroy(&sh.hash);
+}
+
+static void collect_line(const char *line, void *arg)
+{
+    char *buf = arg;
+    strcat(buf, line);
+    strcat(buf, "|");
+}
+
+void test_hist_roundtrip(void)
+{
+    char path[] = "/tmp/test-lab-hist-XXXXXX";
+    int fd = mkstemp(path);
+    TEST_ASSERT_TRUE(fd != -1);
+    close(fd);
+
+    struct hist_file h;
+    TEST_ASSERT_EQUAL_INT(0, hist_open(&h, path));
+    // Nothing is mapped until entries are needed
+    TEST_ASSERT_NULL(h.map);
+    TEST_ASSERT_EQUAL_INT(0, hist_count(&h));
+    const char *lines[] = { "ls -l", "", "echo 'a b'", "exactly8", "a line that is longer than one record slot" };
+    for (size_t i = 0; i < sizeof(lines) / sizeof(lines[0]); i++) {
+        TEST_ASSERT_EQUAL_INT(0, hist_add(&h, lines[i]));
+    }
+    TEST_ASSERT_EQUAL_INT(5, hist_count(&h));
+    hist_close(&h);
+
+    TEST_ASSERT_EQUAL_INT(0, hist_open(&h, path));
+    char buf[256] = "";
+    TEST_ASSERT_EQUAL_INT(2, hist_recent(&h, 2, collect_line, buf));
+    TEST_ASSERT_EQUAL_STRING("exactly8|a line that is longer than one record slot|", buf);
+    buf[0] = '\0';
+    TEST_ASSERT_EQUAL_INT(5, hist_recent(&h, 10, collect_line, buf));
+    TEST_ASSERT_EQUAL_STRING("ls -l||echo 'a b'|exactly8|a line that is longer than one record slot|", buf);
+
+    TEST_ASSERT_EQUAL_INT(5, hist_count(&h));
+    time_t when;
+    for (size_t i = 0; i < 5; i++) {
+        TEST_ASSERT_EQUAL_STRING(lines[i], hist_entry(&h, i, &when));
+        TEST_ASSERT_TRUE(when > 0 && when <= time(NULL));
+    }
+    TEST_ASSERT_NULL(hist_entry(&h, 5, NULL));
+
+    // Entries another writer appends show up on the next count
+    struct hist_file other;
+    TEST_ASSERT_EQUAL_INT(0, hist_open(&other, path));
+    TEST_ASSERT_EQUAL_INT(0, hist_add(&other, "from another shell"));
+    hist_close(&other);
+    TEST_ASSERT_EQUAL_INT(6, hist_count(&h));
+    TEST_ASSERT_EQUAL_STRING("from another shell", hist_entry(&h, 5, NULL));
+    hist_close(&h);
+    hist_close(&h);
+
+    // A file that is not a history file is left alone
+    fd = open(path, O_WRONLY | O_TRUNC);
+    TEST_ASSERT_EQUAL_INT(12, write(fd, "ls\ncd /tmp\n", 12));
+    close(fd);
+    TEST_ASSERT_EQUAL_INT(-1, hist_open(&h, path));
+    TEST_ASSERT_EQUAL_INT(EINVAL, errno);
+    TEST_ASSERT_FALSE(h.active);
+    hist_close(&h);
+    unlink(path);
+}
+
+void test_hist_concurrent_appends(void)
+{
+    char path[] = "/tmp/test-lab-hist-XXXXXX";
+    int fd = mkstemp(path);
+    TEST_ASSERT_TRUE(fd != -1);
+    close(fd);
+
+    // Several shells append at once, with records big enough to span pages
+    enum { WRITERS = 4, LINES = 300 };
+    pid_t pids[WRITERS];
+    for (int w = 0; w < WRITERS; w++) {
+        pids[w] = fork();
+        TEST_ASSERT_TRUE(pids[w] != -1);
+        if (pids[w] == 0) {
+            struct hist_file h;
+            if (hist_open(&h, path) == -1) _exit(1);
+            char line[9000];
+            for (int i = 0; i < LINES; i++) {
+                int len = snprintf(line, sizeof(line), "writer %d line %d ", w, i);
+                size_t pad = (size_t)(i % 7) * 1200;
+                memset(line + len, 'a' + w, pad);
+                line[len + pad] = '\0';
+                if (hist_add(&h, line) == -1) _exit(1);
+            }
+            hist_close(&h);
+            _exit(0);
+        }
+    }
+    for (int w = 0; w < WRITERS; w++) {
+        int status;
+        waitpid(pids[w], &status, 0);
+        TEST_ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+
+    struct hist_file h;
+    TEST_ASSERT_EQUAL_INT(0, hist_open(&h, path));
+    TEST_ASSERT_EQUAL_INT(WRITERS * LINES, hist_count(&h));
+    // Every record is whole and each writer's lines are in order
+    int next[WRITERS] = {0};
+    for (size_t i = 0; i < WRITERS * LINES; i++) {
+        int w, n, used;
+        const char *line = hist_entry(&h, i, NULL);
+        TEST_ASSERT_EQUAL_INT(2, sscanf(line, "writer %d line %d %n", &w, &n, &used));
+        TEST_ASSERT_EQUAL_INT(next[w]++, n);
+        TEST_ASSERT_EQUAL_INT((n % 7) * 1200, strspn(line + used, (char[]){ 'a' + w, 0 }));
+        TEST_ASSERT_EQUAL_CHAR('\0', line[used + (n % 7) * 1200]);
+    }
+    hist_close(&h);
+    unlink(path);
+}
+
+void test_hist_skips_torn_records(void)
+{
+    char path[] = "/tmp/test-lab-hist-XXXXXX";
+    int fd = mkstemp(path);
+    TEST_ASSERT_TRUE(fd != -1);
+    close(fd);
+
+    struct hist_file h;
+    TEST_ASSERT_EQUAL_INT(0, hist_open(&h, path));
+    TEST_ASSERT_EQUAL_INT(0, hist_add(&h, "before"));
+    // The start of a record whose write was cut short
+    TEST_ASSERT_EQUAL_INT(0, hist_add(&h, "torn record"));
+    struct stat st;
+    fstat(h.fd, &st);
+    // Cut short by an odd amount, so everything after it is misaligned
+    TEST_ASSERT_EQUAL_INT(0, ftruncate(h.fd, st.st_size - 5));
+    // Until more is appended it looks like a record still being written
+    TEST_ASSERT_EQUAL_INT(1, hist_count(&h));
+    TEST_ASSERT_EQUAL_INT(0, hist_add(&h, "after1"));
+    TEST_ASSERT_EQUAL_INT(2, hist_count(&h));
+    // A little garbage of its own, and a record that names a length far
+    // past the end of the file
+    TEST_ASSERT_EQUAL_INT(3, write(h.fd, "xyz", 3));
+    TEST_ASSERT_EQUAL_INT(0, hist_add(&h, "after2"));
+    TEST_ASSERT_EQUAL_INT(0, hist_add(&h, "claims to be long"));
+    fstat(h.fd, &st);
+    uint32_t len = 100000;
+    fd = open(path, O_WRONLY);
+    // Its length field, 48 bytes is what 17 bytes of text take up
+    TEST_ASSERT_EQUAL_INT(4, pwrite(fd, &len, 4, st.st_size - 48 + 4));
+    close(fd);
+    TEST_ASSERT_EQUAL_INT(0, hist_add(&h, "after3"));
+    TEST_ASSERT_EQUAL_INT(4, hist_count(&h));
+    const char *want[] = { "before", "after1", "after2", "after3" };
+    for (size_t i = 0; i < 4; i++) TEST_ASSERT_EQUAL_STRING(want[i], hist_entry(&h, i, NULL));
+    hist_close(&h);
+
+    // The backwards walk hits the torn record and falls back to the index
+    TEST_ASSERT_EQUAL_INT(0, hist_open(&h, path));
+    TEST_ASSERT_EQUAL_INT(4, hist_count(&h));
+    hist_close(&h);
+    TEST_ASSERT_EQUAL_INT(0, hist_open(&h, path));
+    char buf[64] = "";
+    TEST_ASSERT_EQUAL_INT(4, hist_recent(&h, 5, collect_line, buf));
+    TEST_ASSERT_EQUAL_STRING("before|after1|after2|after3|", buf);
+    hist_close(&h);
+    unlink(path);
+}
+
+void test_hist_search(void)
+{
+    char path[] = "/tmp/test-lab-hist-XXXXXX";
+    int fd = mkstemp(path);
+    TEST_ASSERT_TRUE(fd != -1);
+    close(fd);
+
+    struct hist_file h;
+    TEST_ASSERT_EQUAL_INT(0, hist_open(&h, path));
+    // Rare words put gaps of thousands between list entries, which takes
+    // more than one byte per delta
+    char line[128];
+    for (int i = 0; i < 5000; i++) {
+        snprintf(line, sizeof(line), "make -C dir%d target%d%s%s", i % 97, i % 13,
+                 i % 1000 == 7 ? " rareword" : "", i % 2 ? " odd" : "");
+        TEST_ASSERT_EQUAL_INT(0, hist_add(&h, line));
+    }
+    TEST_ASSERT_NULL(h.grams);
+
+    const char *queries[] = { "rareword", "dir42 ", "dir4", "target1", "ta", "d", "odd",
+                              "dir96 target12 odd", "rareword odd", "nothing like this", "" };
+    size_t n = hist_count(&h);
+    for (size_t q = 0; q < sizeof(queries) / sizeof(queries[0]); q++) {
+        // Every match, newest first, agrees with a plain scan
+        size_t before = SIZE_MAX;
+        size_t expect = n;
+        for (;;) {
+            while (expect > 0 && !strstr(hist_entry(&h, expect - 1, NULL), queries[q])) expect--;
+            ssize_t got = hist_search(&h, queries[q], before);
+            TEST_ASSERT_EQUAL_INT_MESSAGE((ssize_t)expect - 1, got, queries[q]);
+            if (got < 0) break;
+            before = got;
+            expect--;
+        }
+    }
+    TEST_ASSERT_NOT_NULL(h.grams);
+    TEST_ASSERT_EQUAL_INT(n, h.indexed);
+
+    // New entries are indexed incrementally, including other writers'
+    TEST_ASSERT_EQUAL_INT(0, hist_add(&h, "git rebase --onto main"));
+    hist_index_update(&h);
+    TEST_ASSERT_EQUAL_INT(n + 1, h.indexed);
+    struct hist_file other;
+    TEST_ASSERT_EQUAL_INT(0, hist_open(&other, path));
+    TEST_ASSERT_EQUAL_INT(0, hist_add(&other, "git rebase --abort"));
+    hist_close(&other);
+    TEST_ASSERT_EQUAL_INT(n + 1, hist_search(&h, "rebase", SIZE_MAX));
+    TEST_ASSERT_EQUAL_INT(n, hist_search(&h, "rebase", n + 1));
+    TEST_ASSERT_EQUAL_INT(-1, hist_search(&h, "rebase", n));
+    hist_close(&h);
+    unlink(path);
+}
+
+// Creates dir/name with the given mode
+static void make_file(const char *dir, const char *name, mode_t mode)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, mode);
+    TEST_ASSERT_TRUE(fd != -1);
+    close(fd);
+    chmod(path, mode);
+}
+
+static void join_name(const char *name, void *arg)
+{
+    strcat(arg, name);
+    strcat(arg, " ");
+}
+
+void test_cmd_index(void)
+{
+    char d1[] = "/tmp/test-lab-path1-XXXXXX";
+    char d2[] = "/tmp/test-lab-path2-XXXXXX";
+    TEST_ASSERT_NOT_NULL(mkdtemp(d1));
+    TEST_ASSERT_NOT_NULL(mkdtemp(d2));
+    make_file(d1, "gcc", 0755);
+    make_file(d1, "git", 0755);
+    make_file(d1, "gitk", 0755);
+    make_file(d1, "notes.txt", 0644);
+    make_file(d2, "git", 0755);
+    make_file(d2, "gzip", 0700);
+    make_file(d2, "g", 0755);
+    char sub[300];
+    snprintf(sub, sizeof(sub), "%s/gdir", d2);
+    TEST_ASSERT_EQUAL_INT(0, mkdir(sub, 0755));
+
+    char path_env[128];
+    snprintf(path_env, sizeof(path_env), "%s:/nonexistent-lab-dir:%s", d1, d2);
+    struct cmd_index x = {0};
+    TEST_ASSERT_EQUAL_INT(0, cmd_index_refresh(&x, path_env));
+    TEST_ASSERT_EQUAL_INT(5, x.count);
+
+    // Sorted, each name once, only executable files
+    char buf[256] = "";
+    TEST_ASSERT_EQUAL_INT(5, cmd_index_complete(&x, "g", join_name, buf));
+    TEST_ASSERT_EQUAL_STRING("g gcc git gitk gzip ", buf);
+    buf[0] = '\0';
+    TEST_ASSERT_EQUAL_INT(2, cmd_index_complete(&x, "git", join_name, buf));
+    TEST_ASSERT_EQUAL_STRING("git gitk ", buf);
+    TEST_ASSERT_EQUAL_INT(0, cmd_index_complete(&x, "notes", join_name, buf));
+    TEST_ASSERT_EQUAL_INT(0, cmd_index_complete(&x, "gd", join_name, buf));
+
+    // PATH order decides which one runs
+    char expect[300];
+    char *got = cmd_index_path(&x, "git");
+    snprintf(expect, sizeof(expect), "%s/git", d1);
+    TEST_ASSERT_EQUAL_STRING(expect, got);
+    free(got);
+    got = cmd_index_path(&x, "gzip");
+    snprintf(expect, sizeof(expect), "%s/gzip", d2);
+    TEST_ASSERT_EQUAL_STRING(expect, got);
+    free(got);
+    TEST_ASSERT_NULL(cmd_index_path(&x, "gi"));
+    TEST_ASSERT_NULL(cmd_index_path(&x, "notes.txt"));
+
+    // Directories that did not change are not read again. Back date them
+    // so they are not too fresh to trust.
+    struct timespec old[2] = { { .tv_sec = 1000000000 }, { .tv_sec = 1000000000 } };
+    TEST_ASSERT_EQUAL_INT(0, utimensat(AT_FDCWD, d1, old, 0));
+    TEST_ASSERT_EQUAL_INT(0, utimensat(AT_FDCWD, d2, old, 0));
+    TEST_ASSERT_EQUAL_INT(0, cmd_index_refresh(&x, path_env));
+    unsigned long rescans = x.rescans;
+    TEST_ASSERT_EQUAL_INT(0, cmd_index_refresh(&x, path_env));
+    TEST_ASSERT_EQUAL_INT(rescans, x.rescans);
+
+    // Only the changed directory is read and only its changes apply
+    make_file(d2, "gawk", 0755);
+    snprintf(expect, sizeof(expect), "%s/gitk", d1);
+    unlink(expect);
+    old[1].tv_sec += 100;
+    TEST_ASSERT_EQUAL_INT(0, utimensat(AT_FDCWD, d1, old, 0));
+    TEST_ASSERT_EQUAL_INT(0, utimensat(AT_FDCWD, d2, old, 0));
+    TEST_ASSERT_EQUAL_INT(0, cmd_index_refresh(&x, path_env));
+    TEST_ASSERT_EQUAL_INT(rescans + 2, x.rescans);
+    buf[0] = '\0';
+    cmd_index_complete(&x, "g", join_name, buf);
+    TEST_ASSERT_EQUAL_STRING("g gawk gcc git gzip ", buf);
+
+    // git is still in d2 after leaving d1
+    snprintf(expect, sizeof(expect), "%s/git", d1);
+    unlink(expect);
+    TEST_ASSERT_EQUAL_INT(0, cmd_index_refresh(&x, path_env));
+    got = cmd_index_path(&x, "git");
+    snprintf(expect, sizeof(expect), "%s/git", d2);
+    TEST_ASSERT_EQUAL_STRING(expect, got);
+    free(got);
+
+    // A new PATH starts over
+    TEST_ASSERT_EQUAL_INT(0, cmd_index_refresh(&x, d1));
+    buf[0] = '\0';
+    TEST_ASSERT_EQUAL_INT(1, cmd_index_complete(&x, "", join_name, buf));
+    TEST_ASSERT_EQUAL_STRING("gcc ", buf);
+    cmd_index_destroy(&x);
+
+    // The command hash resolves misses from the index once it exists
+    char *saved = getenv("PATH") ? strdup(getenv("PATH")) : NULL;
+    setenv("PATH", path_env, 1);
+    struct cmd_hash h = {0};
+    TEST_ASSERT_NOT_NULL(cmd_hash_index(&h));
+    snprintf(expect, sizeof(expect), "%s/gawk", d2);
+    TEST_ASSERT_EQUAL_STRING(expect, cmd_hash_lookup(&h, "gawk"));
+    TEST_ASSERT_NULL(cmd_hash_lookup(&h, "notes.txt"));
+    cmd_hash_destroy(&h);
+    if (saved) setenv("PATH", saved, 1);
+    free(saved);
+
+    const char *names[] = { "gcc", "notes.txt" };
+    for (size_t i = 0; i < 2; i++) {
+        snprintf(expect, sizeof(expect), "%s/%s", d1, names[i]);
+        unlink(expect);
+    }
+    const char *names2[] = { "git", "gzip", "g", "gawk" };
+    for (size_t i = 0; i < 4; i++) {
+        snprintf(expect, sizeof(expect), "%s/%s", d2, names2[i]);
+        unlink(expect);
+    }
+    rmdir(sub);
+    rmdir(d1);
+    rmdir(d2);
+}
+
+// Every thread but the main one has sig blocked
+static bool other_threads_block(int sig)
+{
+    DIR *d = opendir("/proc/self/task");
+    TEST_ASSERT_NOT_NULL(d);
+    bool blocked = true;
+    for (struct dirent *e; (e = readdir(d));) {
+        if (e->d_name[0] == '.' || atoi(e->d_name) == getpid()) continue;
+        char path[300], line[128];
+        snprintf(path, sizeof(path), "/proc/self/task/%s/status", e->d_name);
+        FILE *f = fopen(path, "r");
+        if (!f) continue;
+        unsigned long long mask;
+        while (fgets(line, sizeof(line), f)) {
+            if (sscanf(line, "SigBlk: %llx", &mask) == 1 && !(mask & (1ULL << (sig - 1)))) blocked = false;
+        }
+        fclose(f);
+    }
+    closedir(d);
+    return blocked;
+}
+
+void test_prompt_template(void)
+{
+    struct shell sh = {0};
+    sh.last_status = 3;
+    char *saved_home = getenv("HOME") ? strdup(getenv("HOME")) : NULL;
+    char *cwd = getcwd(NULL, 0);
+    char tmpl[] = "/tmp/test-lab-prompt-XXXXXX";
+    TEST_ASSERT_NOT_NULL(mkdtemp(tmpl));
+    char *dir = realpath(tmpl, NULL);
+    char sub[PATH_MAX];
+    snprintf(sub, sizeof(sub), "%s/work", dir);
+    TEST_ASSERT_EQUAL_INT(0, mkdir(sub, 0755));
+    TEST_ASSERT_EQUAL_INT(0, chdir(sub));
+    setenv("HOME", dir, 1);
+
+    const struct {
+        const char *tmpl;
+        const char *out;
+    } cases[] = {
+        { "shell>", "shell>" },
+        { "[\\?] \\j\\$ ", geteuid() == 0 ? "[3] 0# " : "[3] 0$ " },
+        { "\\w \\W>", "~/work work>" },
+        { "a\\\\b\\nc\\q", "a\\b\nc\\q" },
+        { "\\[\\e[1m\\]x\\[\\e[0m\\]", "\001\033[1m\002x\001\033[0m\002" },
+        { "trailing\\", "trailing\\" },
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        struct prompt p;
+        TEST_ASSERT_EQUAL_INT(0, prompt_compile(&p, cases[i].tmpl));
+        TEST_ASSERT_FALSE(p.async);
+        char *out = prompt_render(&p, &sh);
+        TEST_ASSERT_EQUAL_STRING_MESSAGE(cases[i].out, out, cases[i].tmpl);
+        free(out);
+        prompt_destroy(&p);
+    }
+
+    // The git branch shows up once the background thread found it
+    char git[PATH_MAX + 16];
+    snprintf(git, sizeof(git), "%s/.git", dir);
+    TEST_ASSERT_EQUAL_INT(0, mkdir(git, 0755));
+    snprintf(git, sizeof(git), "%s/.git/HEAD", dir);
+    FILE *head = fopen(git, "w");
+    fputs("ref: refs/heads/topic\n", head);
+    fclose(head);
+
+    struct prompt p;
+    TEST_ASSERT_EQUAL_INT(0, prompt_compile(&p, "(\\g)"));
+    TEST_ASSERT_TRUE(p.async);
+    TEST_ASSERT_NULL(p.worker);
+    char *out = prompt_render(&p, &sh);
+    // Nothing is cached for this directory yet, rendering does not wait
+    TEST_ASSERT_EQUAL_STRING("()", out);
+    free(out);
+    struct pollfd pfd = { .fd = p.notify_fd, .events = POLLIN };
+    TEST_ASSERT_EQUAL_INT(1, poll(&pfd, 1, 5000));
+    TEST_ASSERT_TRUE(prompt_collect(&p));
+    out = prompt_render(&p, &sh);
+    TEST_ASSERT_EQUAL_STRING("(topic)", out);
+    free(out);
+    // The worker never takes SIGINT or SIGCHLD from the main thread
+    TEST_ASSERT_TRUE(other_threads_block(SIGINT) && other_threads_block(SIGCHLD));
+
+    // A checkout is noticed by the renders that follow it
+    head = fopen(git, "w");
+    fputs("0123456789abcdef0123456789abcdef01234567\n", head);
+    fclose(head);
+    for (int tries = 0; tries < 50; tries++) {
+        out = prompt_render(&p, &sh);
+        if (strcmp(out, "(0123456)") == 0) break;
+        free(out);
+        out = NULL;
+        if (poll(&pfd, 1, 100) == 1) prompt_collect(&p);
+    }
+    TEST_ASSERT_EQUAL_STRING("(0123456)", out);
+    free(out);
+    prompt_destroy(&p);
+    sh_destroy(&sh);
+
+    unlink(git);
+    snprintf(git, sizeof(git), "%s/.git", dir);
+    rmdir(git);
+    TEST_ASSERT_EQUAL_INT(0, chdir(cwd));
+    rmdir(sub);
+    rmdir(dir);
+    free(dir);
+    free(cwd);
+    if (saved_home) setenv("HOME", saved_home, 1);
+    free(saved_home);
+}
+
+// Runs line in sh and returns how long it took in seconds
+static double timed_line(struct shell *sh, const char *text, int *status)
+{
+    struct timespec a, b;
+    char *line = strdup(text);
+    clock_gettime(CLOCK_MONOTONIC, &a);
+    *status = sh_exec_line(sh, line);
+    clock_gettime(CLOCK_MONOTONIC, &b);
+    free(line);
+    return (b.tv_sec - a.tv_sec) + (b.tv_nsec - a.tv_nsec) / 1e9;
+}
+
+void test_parallel_builtin(void)
+{
+    char dir[] = "/tmp/test-lab-parallel-XXXXXX";
+    TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+    char *cwd = getcwd(NULL, 0);
+    TEST_ASSERT_EQUAL_INT(0, chdir(dir));
+
+    FILE *f = fopen("mixed", "w");
+    fputs("sh -c 'sleep 0.3; echo slow; echo slow2'\n"
+          "\n# comments and blank lines are skipped\n"
+          "  sh -c 'echo fast; echo oops >&2'\n"
+          "cat\n"
+          "ls /nonexistent-lab-dir\n"
+          "echo a | tr a-z A-Z", f);
+    fclose(f);
+    f = fopen("sleepy", "w");
+    for (int i = 0; i < 4; i++) fputs("sleep 0.4\n", f);
+    fclose(f);
+    f = fopen("failing", "w");
+    fputs("sleep 0.1\nfalse\nsleep 10\nsleep 10\nsleep 10\n", f);
+    fclose(f);
+
+    const enum launch_mode modes[] = { LAUNCH_FORK, LAUNCH_SPAWN };
+    for (size_t m = 0; m < 2; m++) {
+        struct shell sh = {0};
+        sh.launch_mode = modes[m];
+        char buf[512];
+        int status;
+
+        // -k prints in input order, each job's lines together
+        timed_line(&sh, "parallel -k -j 3 mixed > out 2> err", &status);
+        TEST_ASSERT_EQUAL_INT(1, status);
+        TEST_ASSERT_EQUAL_STRING("slow\nslow2\nfast\nA\n", read_file("out", buf, sizeof(buf)));
+        read_file("err", buf, sizeof(buf));
+        TEST_ASSERT_TRUE(strstr(buf, "oops\n") != NULL);
+        TEST_ASSERT_TRUE(strstr(buf, "nonexistent-lab-dir") != NULL);
+
+        // Otherwise whatever finishes first comes first
+        timed_line(&sh, "parallel -j3 mixed > out 2>/dev/null", &status);
+        TEST_ASSERT_EQUAL_INT(1, status);
+        read_file("out", buf, sizeof(buf));
+        TEST_ASSERT_TRUE(strstr(buf, "slow\nslow2\n") != NULL);
+        TEST_ASSERT_TRUE(strstr(buf, "fast\n") < strstr(buf, "slow\n"));
+
+        // Four jobs at once take as long as one, one at a time as all four
+        TEST_ASSERT_TRUE(timed_line(&sh, "parallel -j 4 sleepy", &status) < 1.2);
+        TEST_ASSERT_EQUAL_INT(0, status);
+        TEST_ASSERT_TRUE(timed_line(&sh, "parallel -j 1 sleepy", &status) >= 1.6);
+
+        // The first failure stops the rest instead of waiting 10s for them
+        TEST_ASSERT_TRUE(timed_line(&sh, "parallel -j 3 --halt-on-error failing", &status) < 5);
+        TEST_ASSERT_EQUAL_INT(1, status);
+        // Without it every job runs and each failure counts
+        timed_line(&sh, "parallel -j 2 -k mixed > /dev/null 2>&1", &status);
+        TEST_ASSERT_EQUAL_INT(1, status);
+
+        timed_line(&sh, "parallel -j 0 mixed 2>/dev/null", &status);
+        TEST_ASSERT_EQUAL_INT(2, status);
+        timed_line(&sh, "parallel missing-file 2>/dev/null", &status);
+        TEST_ASSERT_EQUAL_INT(1, status);
+        // Every job was taken out of the table
+        TEST_ASSERT_EQUAL_size_t(0, sh.jobs.count);
+
+        job_table_destroy(&sh.jobs);
+        cmd_hash_destroy(&sh.hash);
+    }
+
+    const char *files[] = { "mixed", "sleepy", "failing", "out", "err" };
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) unlink(files[i]);
+    TEST_ASSERT_EQUAL_INT(0, chdir(cwd));
+    rmdir(dir);
+    free(cwd);
+}
+
+void test_env_table(void)
+{
+    // The table and environ agree both ways
+    TEST_ASSERT_EQUAL_INT(0, env_set("LAB_A", "1"));
+    TEST_ASSERT_EQUAL_STRING("1", env_get("LAB_A"));
+    TEST_ASSERT_EQUAL_STRING("1", getenv("LAB_A"));
+    TEST_ASSERT_EQUAL_INT(0, env_set("LAB_A", "two"));
+    TEST_ASSERT_EQUAL_STRING("two", getenv("LAB_A"));
+    TEST_ASSERT_EQUAL_INT(-1, env_set("LAB=A", "x"));
+    TEST_ASSERT_EQUAL_INT(-1, env_set("", "x"));
+
+    // Changes made through libc behind the table's back are seen
+    setenv("LAB_B", "new", 1);
+    TEST_ASSERT_EQUAL_STRING("new", env_get("LAB_B"));
+    setenv("LAB_A", "three", 1);
+    TEST_ASSERT_EQUAL_STRING("three", env_get("LAB_A"));
+    unsetenv("LAB_A");
+    TEST_ASSERT_NULL(env_get("LAB_A"));
+    TEST_ASSERT_EQUAL_STRING("new", env_get("LAB_B"));
+
+    // Lookups and envp cost nothing once the table is built
+    size_t allocs = alloc_count;
+    for (int i = 0; i < 100; i++) {
+        TEST_ASSERT_NOT_NULL(env_envp());
+        TEST_ASSERT_EQUAL_STRING("new", env_get("LAB_B"));
+    }
+    TEST_ASSERT_EQUAL_size_t(allocs, alloc_count);
+
+    // Thousands of variables, half of them removed again
+    char name[32], value[32];
+    size_t before = 0;
+    for (char **e = env_envp(); *e; e++) before++;
+    for (int i = 0; i < 3000; i++) {
+        snprintf(name, sizeof(name), "LAB_V%d", i);
+        snprintf(value, sizeof(value), "%d", i * 7);
+        TEST_ASSERT_EQUAL_INT(0, env_set(name, value));
+    }
+    for (int i = 0; i < 3000; i += 2) {
+        snprintf(name, sizeof(name), "LAB_V%d", i);
+        TEST_ASSERT_EQUAL_INT(0, env_unset(name));
+    }
+    TEST_ASSERT_EQUAL_INT(0, env_unset("LAB_NEVER_SET"));
+    size_t after = 0;
+    for (char **e = env_envp(); *e; e++) after++;
+    TEST_ASSERT_EQUAL_size_t(before + 1500, after);
+    for (int i = 0; i < 3000; i++) {
+        snprintf(name, sizeof(name), "LAB_V%d", i);
+        snprintf(value, sizeof(value), "%d", i * 7);
+        if (i % 2) {
+            TEST_ASSERT_EQUAL_STRING(value, env_get(name));
+            TEST_ASSERT_EQUAL_STRING(value, getenv(name));
+        } else {
+            TEST_ASSERT_NULL(env_get(name));
+            TEST_ASSERT_NULL(getenv(name));
+        }
+    }
+    for (int i = 1; i < 3000; i += 2) {
+        snprintf(name, sizeof(name), "LAB_V%d", i);
+        env_unset(name);
+    }
+    env_unset("LAB_B");
+}
+
+void test_env_builtins(void)
+{
+    char dir[] = "/tmp/test-lab-env-XXXXXX";
+    TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+    char *cwd = getcwd(NULL, 0);
+    TEST_ASSERT_EQUAL_INT(0, chdir(dir));
+
+    const enum launch_mode modes[] = { LAUNCH_FORK, LAUNCH_SPAWN };
+    for (size_t m = 0; m < 2; m++) {
+        struct shell sh = {0};
+        sh.launch_mode = modes[m];
+        char buf[256];
+        const struct {
+            const char *line;
+            const char *out;
+            int status;
+        } cases[] = {
+            { "export LAB_X='a b' LAB_Y=2", NULL, 0 },
+            // Commands started afterwards inherit them
+            { "sh -c 'echo $LAB_X-$LAB_Y' > out", "a b-2\n", 0 },
+            { "export LAB_X=c > out", "", 0 },
+            { "sh -c 'echo $LAB_X-$LAB_Y' > out", "c-2\n", 0 },
+            { "unset LAB_Y LAB_Z", NULL, 0 },
+            { "sh -c 'echo $LAB_X-$LAB_Y' > out", "c-\n", 0 },
+            { "export 1x LAB_OK=1 a-b > out 2>&1",
+              "export: `1x': not a valid identifier\nexport: `a-b': not a valid identifier\n", 1 },
+            { "unset = > out 2>&1", "unset: `=': not a valid identifier\n", 1 },
+            // With arguments env is the external command
+            { "env LAB_E=1 sh -c 'echo $LAB_E-$LAB_X' > out", "1-c\n", 0 },
+            { "env -u LAB_X sh -c 'echo $LAB_X' > out", "\n", 0 },
+        };
+        for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+            char *line = strdup(cases[i].line);
+            TEST_ASSERT_EQUAL_INT_MESSAGE(cases[i].status, sh_exec_line(&sh, line), cases[i].line);
+            free(line);
+            if (cases[i].out) {
+                TEST_ASSERT_EQUAL_STRING_MESSAGE(cases[i].out, read_file("out", buf, sizeof(buf)), cases[i].line);
+            }
+        }
+        TEST_ASSERT_EQUAL_STRING("1", env_get("LAB_OK"));
+        TEST_ASSERT_NULL(env_get("LAB_E"));
+
+        // env and export list the same variables
+        char line[] = "env > out";
+        TEST_ASSERT_EQUAL_INT(0, sh_exec_line(&sh, line));
+        char *all = malloc(1 << 20);
+        read_file("out", all, 1 << 20);
+        TEST_ASSERT_TRUE(strstr(all, "\nLAB_X=c\n") != NULL || strncmp(all, "LAB_X=c\n", 8) == 0);
+        TEST_ASSERT_NULL(strstr(all, "LAB_Y="));
+        char line2[] = "export > out";
+        TEST_ASSERT_EQUAL_INT(0, sh_exec_line(&sh, line2));
+        read_file("out", all, 1 << 20);
+        TEST_ASSERT_TRUE(strstr(all, "export LAB_X=c\n") != NULL);
+        free(all);
+
+        env_unset("LAB_X");
+        env_unset("LAB_OK");
+        job_table_destroy(&sh.jobs);
+        cmd_hash_destroy(&sh.hash);
+    }
+
+    unlink("out");
+    TEST_ASSERT_EQUAL_INT(0, chdir(cwd));
+    rmdir(dir);
+    free(cwd);
+}
+
+void test_dir_stack(void)
+{
+    char tmpl[] = "/tmp/test-lab-dirs-XXXXXX";
+    TEST_ASSERT_NOT_NULL(mkdtemp(tmpl));
+    char *dir = realpath(tmpl, NULL);
+    char *cwd = getcwd(NULL, 0);
+    char *saved_home = getenv("HOME") ? strdup(getenv("HOME")) : NULL;
+    char path[PATH_MAX + 16], out[PATH_MAX + 16], buf[PATH_MAX * 4];
+    snprintf(path, sizeof(path), "%s/a", dir);
+    TEST_ASSERT_EQUAL_INT(0, mkdir(path, 0755));
+    snprintf(path, sizeof(path), "%s/b", dir);
+    TEST_ASSERT_EQUAL_INT(0, mkdir(path, 0755));
+    snprintf(out, sizeof(out), "%s/out", dir);
+    TEST_ASSERT_EQUAL_INT(0, chdir(dir));
+    setenv("HOME", dir, 1);
+
+    struct shell sh = {0};
+    char line[PATH_MAX * 2];
+    snprintf(line, sizeof(line), "cd a");
+    TEST_ASSERT_EQUAL_INT(0, sh_exec_line(&sh, line));
+    snprintf(path, sizeof(path), "%s/a", dir);
+    TEST_ASSERT_EQUAL_STRING(path, sh_cwd(&sh));
+    TEST_ASSERT_EQUAL_STRING(path, env_get("PWD"));
+    TEST_ASSERT_EQUAL_STRING(dir, env_get("OLDPWD"));
+
+    // pwd answers from the cache: it does not see a chdir the shell never made
+    TEST_ASSERT_EQUAL_INT(0, chdir("/"));
+    snprintf(line, sizeof(line), "pwd > %s", out);
+    TEST_ASSERT_EQUAL_INT(0, sh_exec_line(&sh, line));
+    snprintf(path, sizeof(path), "%s/a\n", dir);
+    TEST_ASSERT_EQUAL_STRING(path, read_file(out, buf, sizeof(buf)));
+    snprintf(path, sizeof(path), "%s/a", dir);
+    TEST_ASSERT_EQUAL_INT(0, chdir(path));
+
+    // cd - goes back and says where
+    snprintf(line, sizeof(line), "cd - > %s", out);
+    TEST_ASSERT_EQUAL_INT(0, sh_exec_line(&sh, line));
+    snprintf(path, sizeof(path), "%s\n", dir);
+    TEST_ASSERT_EQUAL_STRING(path, read_file(out, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_STRING(dir, sh_cwd(&sh));
+    snprintf(line, sizeof(line), "cd - > %s", out);
+    TEST_ASSERT_EQUAL_INT(0, sh_exec_line(&sh, line));
+    snprintf(path, sizeof(path), "%s/a", dir);
+    TEST_ASSERT_EQUAL_STRING(path, sh_cwd(&sh));
+
+    const struct {
+        const char *cmd;
+        const char *out;
+        int status;
+        const char *cwd;
+    } steps[] = {
+        { "cd ..", "", 0, "" },
+        { "pushd a", "~/a ~\n", 0, "/a" },
+        { "pushd ../b", "~/b ~/a ~\n", 0, "/b" },
+        { "dirs", "~/b ~/a ~\n", 0, "/b" },
+        // With no directory the top two trade places
+        { "pushd", "~/a ~/b ~\n", 0, "/a" },
+        { "pushd /nonexistent-lab-dir 2>/dev/null", "", 1, "/a" },
+        { "popd", "~/b ~\n", 0, "/b" },
+        { "popd", "~\n", 0, "" },
+        { "popd 2>/dev/null", "", 1, "" },
+        { "pushd a", "~/a ~\n", 0, "/a" },
+        { "dirs -c", "", 0, "/a" },
+        { "dirs", "~/a\n", 0, "/a" },
+        { "cd /nonexistent-lab-dir 2>/dev/null", "", 1, "/a" },
+    };
+    for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+        snprintf(line, sizeof(line), "%s > %s", steps[i].cmd, out);
+        TEST_ASSERT_EQUAL_INT_MESSAGE(steps[i].status, sh_exec_line(&sh, line), steps[i].cmd);
+        TEST_ASSERT_EQUAL_STRING_MESSAGE(steps[i].out, read_file(out, buf, sizeof(buf)), steps[i].cmd);
+        snprintf(path, sizeof(path), "%s%s", dir, steps[i].cwd);
+        TEST_ASSERT_EQUAL_STRING_MESSAGE(path, sh_cwd(&sh), steps[i].cmd);
+        char *real = getcwd(NULL, 0);
+        TEST_ASSERT_EQUAL_STRING_MESSAGE(path, real, steps[i].cmd);
+        free(real);
+    }
+
+    sh_destroy(&sh);
+    TEST_ASSERT_EQUAL_INT(0, chdir(cwd));
+    unlink(out);
+    snprintf(path, sizeof(path), "%s/a", dir);
+    rmdir(path);
+    snprintf(path, sizeof(path), "%s/b", dir);
+    rmdir(path);
+    rmdir(dir);
+    free(dir);
+    free(cwd);
+    if (saved_home) setenv("HOME", saved_home, 1);
+    free(saved_home);
+}
+
+void test_jump_index(void)
+{
+    char dir[] = "/tmp/test-lab-jump-XXXXXX";
+    TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+    char file[PATH_MAX];
+    snprintf(file, sizeof(file), "%s/jump", dir);
+    time_t now = 1700000000;
+    const time_t month = 30 * 86400;
+
+    struct jump_db db;
+    TEST_ASSERT_EQUAL_INT(0, jump_open(&db, file));
+    struct jump_match m[8];
+    char *none[] = { NULL };
+    TEST_ASSERT_EQUAL_size_t(0, jump_query(&db, none, NULL, now, m, 8));
+
+    // alpha is visited most but long ago, alphabet once just now
+    for (int i = 0; i < 3; i++) TEST_ASSERT_EQUAL_INT(0, jump_visit(&db, "/src/proj/alpha", now - month));
+    TEST_ASSERT_EQUAL_INT(0, jump_visit(&db, "/src/proj/beta", now - 7200));
+    TEST_ASSERT_EQUAL_INT(0, jump_visit(&db, "/src/other/Alphabet", now));
+    TEST_ASSERT_EQUAL_INT(0, jump_visit(&db, "/src/proj/beta/deep", now - 86400 * 2));
+
+    const struct {
+        char *words[3];
+        const char *best;
+        size_t count;
+    } cases[] = {
+        { { "alph" }, "/src/other/Alphabet", 2 },
+        { { "ALPHA" }, "/src/other/Alphabet", 2 },
+        { { "proj", "alph" }, "/src/proj/alpha", 1 },
+        { { "proj", "a" }, "/src/proj/beta", 2 },
+        { { "beta" }, "/src/proj/beta", 1 },
+        { { "beta", "p" }, "/src/proj/beta/deep", 1 },
+        // The last word has to be in the last component
+        { { "proj" }, NULL, 0 },
+        { { "zzz" }, NULL, 0 },
+        { { "bet", "proj" }, NULL, 0 },
+    };
+    for (int round = 0; round < 3; round++) {
+        for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+            size_t n = jump_query(&db, (char **)cases[i].words, NULL, now, m, 8);
+            TEST_ASSERT_EQUAL_size_t_MESSAGE(cases[i].count, n, cases[i].words[0]);
+            if (cases[i].best) TEST_ASSERT_EQUAL_STRING_MESSAGE(cases[i].best, m[0].path, cases[i].words[0]);
+        }
+        // Pending, then flushed, then read back by a fresh open
+        if (round == 0) {
+            TEST_ASSERT_EQUAL_INT(0, jump_flush(&db));
+        } else if (round == 1) {
+            jump_close(&db);
+            TEST_ASSERT_EQUAL_INT(0, jump_open(&db, file));
+        }
+    }
+
+    // Scores are rank times the weight of the last visit
+    TEST_ASSERT_EQUAL_size_t(4, jump_query(&db, none, NULL, now, m, 8));
+    TEST_ASSERT_EQUAL_STRING("/src/other/Alphabet", m[0].path);
+    TEST_ASSERT_TRUE(m[0].score == 4.0);
+    TEST_ASSERT_EQUAL_STRING("/src/proj/beta", m[1].path);
+    TEST_ASSERT_EQUAL_STRING("/src/proj/alpha", m[2].path);
+    TEST_ASSERT_TRUE(m[2].score == 0.75);
+    TEST_ASSERT_EQUAL_size_t(2, jump_query(&db, none, NULL, now, m, 2));
+    TEST_ASSERT_EQUAL_STRING("/src/proj/beta", m[1].path);
+
+    // The directory we are in is left out
+    char *alph[] = { "alph", NULL };
+    TEST_ASSERT_EQUAL_size_t(1, jump_query(&db, alph, "/src/other/Alphabet", now, m, 8));
+    TEST_ASSERT_EQUAL_STRING("/src/proj/alpha", m[0].path);
+
+    // Visits on top of the file add up, and a flush replaces the file
+    struct stat before, after;
+    TEST_ASSERT_EQUAL_INT(0, stat(file, &before));
+    for (int i = 0; i < 2; i++) TEST_ASSERT_EQUAL_INT(0, jump_visit(&db, "/src/proj/alpha", now));
+    TEST_ASSERT_EQUAL_size_t(2, jump_query(&db, alph, NULL, now, m, 8));
+    TEST_ASSERT_EQUAL_STRING("/src/proj/alpha", m[0].path);
+    TEST_ASSERT_TRUE(m[0].score == 20.0);
+    db.flush_every = 1;
+    TEST_ASSERT_EQUAL_INT(0, jump_visit(&db, "/src/new", now));
+    TEST_ASSERT_EQUAL_INT(0, stat(file, &after));
+    TEST_ASSERT_TRUE(before.st_ino != after.st_ino);
+    TEST_ASSERT_EQUAL_size_t(2, jump_query(&db, alph, NULL, now, m, 8));
+    TEST_ASSERT_TRUE(m[0].score == 20.0);
+    TEST_ASSERT_EQUAL_size_t(5, jump_query(&db, none, NULL, now, m, 8));
+    jump_close(&db);
+
+    // Anything that is not an index is left alone
+    char other[PATH_MAX];
+    snprintf(other, sizeof(other), "%s/other", dir);
+    FILE *f = fopen(other, "w");
+    TEST_ASSERT_NOT_NULL(f);
+    fputs("/home/user/src\n", f);
+    fclose(f);
+    errno = 0;
+    TEST_ASSERT_EQUAL_INT(-1, jump_open(&db, other));
+    TEST_ASSERT_EQUAL_INT(EINVAL, errno);
+
+    unlink(other);
+    unlink(file);
+    rmdir(dir);
+}
+
+void test_jump_builtin(void)
+{
+    char tmpl[] = "/tmp/test-lab-j-XXXXXX";
+    TEST_ASSERT_NOT_NULL(mkdtemp(tmpl));
+    char *dir = realpath(tmpl, NULL);
+    char *cwd = getcwd(NULL, 0);
+    char path[PATH_MAX + 16], out[PATH_MAX + 16], file[PATH_MAX + 16], buf[PATH_MAX * 4];
+    const char *sub[] = { "/work", "/work/lab", "/work/lab/src", "/notes" };
+    for (size_t i = 0; i < sizeof(sub) / sizeof(sub[0]); i++) {
+        snprintf(path, sizeof(path), "%s%s", dir, sub[i]);
+        TEST_ASSERT_EQUAL_INT(0, mkdir(path, 0755));
+    }
+    snprintf(out, sizeof(out), "%s/out", dir);
+    snprintf(file, sizeof(file), "%s/jump", dir);
+
+    struct shell sh = {0};
+    char line[PATH_MAX * 2];
+    snprintf(line, sizeof(line), "j lab 2> %s", out);
+    TEST_ASSERT_EQUAL_INT(1, sh_exec_line(&sh, line));
+    TEST_ASSERT_EQUAL_INT(0, jump_open(&sh.jumps, file));
+
+    // Every cd is recorded
+    const char *visits[] = { "/work/lab", "/work/lab/src", "/notes", "/notes", "/work/lab",
+                             "/notes", "/work/lab/src", "/work/lab", "/work/lab" };
+    for (size_t i = 0; i < sizeof(visits) / sizeof(visits[0]); i++) {
+        snprintf(line, sizeof(line), "cd %s%s", dir, visits[i]);
+        TEST_ASSERT_EQUAL_INT(0, sh_exec_line(&sh, line));
+    }
+    snprintf(line, sizeof(line), "j -l > %s", out);
+    TEST_ASSERT_EQUAL_INT(0, sh_exec_line(&sh, line));
+    snprintf(path, sizeof(path), "%10.1f  %s/work/lab/src\n%10.1f  %s/notes\n%10.1f  %s/work/lab\n",
+             8.0, dir, 12.0, dir, 16.0, dir);
+    TEST_ASSERT_EQUAL_STRING(path, read_file(out, buf, sizeof(buf)));
+
+    const struct {
+        const char *cmd;
+        int status;
+        const char *cwd;
+    } steps[] = {
+        { "j no", 0, "/notes" },
+        { "j lab", 0, "/work/lab" },
+        // Not to where we already are
+        { "j lab 2>/dev/null", 1, "/work/lab" },
+        { "j work s", 0, "/work/lab/src" },
+        { "j work 2>/dev/null", 1, "/work/lab/src" },
+        { "j -l nothing", 1, "/work/lab/src" },
+    };
+    for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+        snprintf(line, sizeof(line), "%s", steps[i].cmd);
+        TEST_ASSERT_EQUAL_INT_MESSAGE(steps[i].status, sh_exec_line(&sh, line), steps[i].cmd);
+        snprintf(path, sizeof(path), "%s%s", dir, steps[i].cwd);
+        TEST_ASSERT_EQUAL_STRING_MESSAGE(path, sh_cwd(&sh), steps[i].cmd);
+    }
+
+    // A directory that is gone is skipped
+    snprintf(path, sizeof(path), "%s/notes", dir);
+    TEST_ASSERT_EQUAL_INT(0, rmdir(path));
+    snprintf(line, sizeof(line), "cd %s", dir);
+    TEST_ASSERT_EQUAL_INT(0, sh_exec_line(&sh, line));
+    snprintf(line, sizeof(line), "j s");
+    TEST_ASSERT_EQUAL_INT(0, sh_exec_line(&sh, line));
+    snprintf(path, sizeof(path), "%s/work/lab/src", dir);
+    TEST_ASSERT_EQUAL_STRING(path, sh_cwd(&sh));
+
+    // sh_destroy writes the visits out
+    sh_destroy(&sh);
+    struct jump_db db;
+    TEST_ASSERT_EQUAL_INT(0, jump_open(&db, file));
+    struct jump_match m[8];
+    char *none[] = { NULL };
+    TEST_ASSERT_EQUAL_size_t(4, jump_query(&db, none, NULL, time(NULL), m, 8));
+    jump_close(&db);
+
+    TEST_ASSERT_EQUAL_INT(0, chdir(cwd));
+    unlink(out);
+    unlink(file);
+    for (size_t i = sizeof(sub) / sizeof(sub[0]); i-- > 0;) {
+        snprintf(path, sizeof(path), "%s%s", dir, sub[i]);
+        rmdir(path);
+    }
+    rmdir(dir);
+    free(dir);
+    free(cwd);
+}
+
+// Run the script at path with stderr thrown away, compiled unless
+// interpret is set
+static int run_quiet(struct shell *sh, const char *path, bool interpret)
+{
+    fflush(stderr);
+    int saved = dup(STDERR_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDERR_FILENO);
+    close(null);
+    int rval;
+    if (interpret) {
+        int fd = open(path, O_RDONLY);
+        rval = script_run_fd(sh, fd);
+        close(fd);
+    } else {
+        rval = script_run_file(sh, path);
+    }
+    dup2(saved, STDERR_FILENO);
+    close(saved);
+    return rval;
+}
+
+void test_script_compiled(void)
+{
+    char dir[] = "/tmp/test-lab-code-XXXXXX";
+    TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+    char script[PATH_MAX], out[PATH_MAX], buf[4096], expect[4096];
+    snprintf(script, sizeof(script), "%s/run.sh", dir);
+    snprintf(out, sizeof(out), "%s/out", dir);
+    char *cache = script_cache_path(script);
+    char want[sizeof(expect) + 16];
+    snprintf(want, sizeof(want), "%s/.run.sh.labc", dir);
+    TEST_ASSERT_EQUAL_STRING(want, cache);
+    TEST_ASSERT_NULL(script_cache_path("/tmp/"));
+
+    FILE *f = fopen(script, "w");
+    TEST_ASSERT_NOT_NULL(f);
+    fprintf(f, "# a comment\n"
+               "\n"
+               "echo one > %s\n"
+               "  printf '%%s|%%s\\n' \"two words\" x >> %s\n"
+               "/bin/echo three | tr a-z A-Z >> %s\n"
+               "echo unclosed 'quote >> %s\n"
+               "cat < %s | wc -l >> %s\n"
+               "tr a-z A-Z <<< four 2>&1 >> %s\n"
+               "time true 2> /dev/null\n"
+               "missing-lab-command\n"
+               "echo status $? | >> %s\n"
+               "false",
+            out, out, out, out, out, out, out, out);
+    fclose(f);
+
+    // Interpreted line by line, then compiled, then from the cache
+    struct shell sh = {0};
+    TEST_ASSERT_EQUAL_INT(1, run_quiet(&sh, script, true));
+    read_file(out, expect, sizeof(expect));
+    TEST_ASSERT_EQUAL_STRING("one\ntwo words|x\nTHREE\n3\nFOUR\n", expect);
+    struct stat st, cst, cst2;
+    TEST_ASSERT_EQUAL_INT(-1, stat(cache, &cst));
+    for (int run = 0; run < 2; run++) {
+        unlink(out);
+        TEST_ASSERT_EQUAL_INT(1, run_quiet(&sh, script, false));
+        TEST_ASSERT_EQUAL_STRING(expect, read_file(out, buf, sizeof(buf)));
+        TEST_ASSERT_EQUAL_INT(0, stat(cache, run ? &cst2 : &cst));
+    }
+    // The second run used the cache rather than writing a new one
+    TEST_ASSERT_TRUE(cst.st_ino == cst2.st_ino);
+
+    // The code survives a round trip through the file
+    struct script_code code;
+    int fd = open(script, O_RDONLY);
+    TEST_ASSERT_EQUAL_INT(0, fstat(fd, &st));
+    TEST_ASSERT_EQUAL_INT(0, script_code_load(script, fd, &code));
+    TEST_ASSERT_TRUE(code.mapped);
+    char *text = malloc(st.st_size);
+    TEST_ASSERT_EQUAL_INT(st.st_size, pread(fd, text, st.st_size, 0));
+    struct script_code fresh;
+    TEST_ASSERT_EQUAL_INT(0, script_compile(text, st.st_size, &st, &fresh));
+    TEST_ASSERT_FALSE(fresh.mapped);
+    TEST_ASSERT_EQUAL_size_t(fresh.len, code.len);
+    TEST_ASSERT_EQUAL_MEMORY(fresh.image, code.image, code.len);
+    script_code_free(&fresh);
+    script_code_free(&code);
+
+    // A touch moves the mtime but the text still matches. The cache is
+    // written back with the new mtime, so later runs do not hash again.
+    struct timespec times[2] = { { 0, UTIME_OMIT }, { st.st_mtim.tv_sec + 10, 0 } };
+    TEST_ASSERT_EQUAL_INT(0, utimensat(AT_FDCWD, script, times, 0));
+    unlink(out);
+    TEST_ASSERT_EQUAL_INT(1, run_quiet(&sh, script, false));
+    TEST_ASSERT_EQUAL_STRING(expect, read_file(out, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_INT(0, stat(cache, &cst2));
+    TEST_ASSERT_TRUE(cst.st_ino != cst2.st_ino);
+    TEST_ASSERT_EQUAL_INT(0, fstat(fd, &st));
+    TEST_ASSERT_EQUAL_INT(0, script_compile(text, st.st_size, &st, &fresh));
+    TEST_ASSERT_EQUAL_INT(0, script_code_load(script, fd, &code));
+    TEST_ASSERT_EQUAL_size_t(fresh.len, code.len);
+    TEST_ASSERT_EQUAL_MEMORY(fresh.image, code.image, code.len);
+    TEST_ASSERT_EQUAL_INT(0, stat(cache, &cst));
+    TEST_ASSERT_TRUE(cst.st_ino == cst2.st_ino);
+    script_code_free(&fresh);
+    script_code_free(&code);
+    free(text);
+    close(fd);
+
+    // An edited script is compiled again
+    f = fopen(script, "a");
+    fprintf(f, "\necho five >> %s\n", out);
+    fclose(f);
+    unlink(out);
+    TEST_ASSERT_EQUAL_INT(0, run_quiet(&sh, script, false));
+    snprintf(want, sizeof(want), "%sfive\n", expect);
+    TEST_ASSERT_EQUAL_STRING(want, read_file(out, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_INT(0, stat(cache, &cst2));
+    TEST_ASSERT_TRUE(cst.st_ino != cst2.st_ino);
+
+    // So is one whose cache was damaged
+    fd = open(cache, O_WRONLY | O_TRUNC);
+    TEST_ASSERT_EQUAL_INT(12, write(fd, "not bytecode", 12));
+    close(fd);
+    unlink(out);
+    TEST_ASSERT_EQUAL_INT(0, run_quiet(&sh, script, false));
+    TEST_ASSERT_EQUAL_STRING(want, read_file(out, buf, sizeof(buf)));
+
+    sh_destroy(&sh);
+    unlink(cache);
+    unlink(script);
+    unlink(out);
+    rmdir(dir);
+    free(cache);
+}
 
 int main(void) {
   UNITY_BEGIN();
@@ -273,6 +2323,53 @@ int main(void) {
   RUN_TEST(test_signal_ctrl_c);
   RUN_TEST(test_signal_ctrl_z);
   RUN_TEST(test_cmd_parse_extra_spaces);
+  RUN_TEST(test_cmd_parse_single_allocation);
+  RUN_TEST(test_cmd_parse_inplace);
+  RUN_TEST(test_cmd_hash_lookup);
+  RUN_TEST(test_cmd_hash_path_change);
+  RUN_TEST(test_cmd_parse_pipe_token);
+  RUN_TEST(test_pipeline_parse);
+  RUN_TEST(test_pipeline_parse_empty_stage);
+  RUN_TEST(test_pipeline_run_status);
+  RUN_TEST(test_job_ids_and_specs);
+  RUN_TEST(test_pipeline_parse_background);
+  RUN_TEST(test_background_jobs_reaped);
+  RUN_TEST(test_batch_reaps_background_jobs);
+  RUN_TEST(test_script_run_buffer);
+  RUN_TEST(test_script_run_file_page_aligned);
+  RUN_TEST(test_builtin_find);
+  RUN_TEST(test_do_builtin_status);
+  RUN_TEST(test_job_usage_accounting);
+  RUN_TEST(test_pipeline_parse_time_keyword);
+  RUN_TEST(test_trim_white_all_blanks);
+  RUN_TEST(test_cmd_parse_tabs_and_newlines);
+  RUN_TEST(test_scan_kernels_agree);
+  RUN_TEST(test_cmd_parse_50k_tokens);
+  RUN_TEST(test_cmd_parse_arg_max);
+  RUN_TEST(test_cmd_parse_quotes_and_escapes);
+  RUN_TEST(test_lex_token_metadata);
+  RUN_TEST(test_pipeline_parse_quoted_operators);
+  RUN_TEST(test_lex_adversarial_linear);
+  RUN_TEST(test_lex_redirection_operators);
+  RUN_TEST(test_pipeline_parse_redirections);
+  RUN_TEST(test_redirections_run);
+  RUN_TEST(test_exec_failure_status);
+  RUN_TEST(test_script_stdin_shared);
+  RUN_TEST(test_builtins_echo_printf);
+  RUN_TEST(test_builtin_test);
+  RUN_TEST(test_hist_roundtrip);
+  RUN_TEST(test_hist_concurrent_appends);
+  RUN_TEST(test_hist_skips_torn_records);
+  RUN_TEST(test_hist_search);
+  RUN_TEST(test_cmd_index);
+  RUN_TEST(test_prompt_template);
+  RUN_TEST(test_parallel_builtin);
+  RUN_TEST(test_env_table);
+  RUN_TEST(test_env_builtins);
+  RUN_TEST(test_dir_stack);
+  RUN_TEST(test_jump_index);
+  RUN_TEST(test_jump_builtin);
+  RUN_TEST(test_script_compiled);
 
   return UNITY_END();
 }